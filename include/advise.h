@@ -0,0 +1,155 @@
+#ifndef ADVISE_H
+#define ADVISE_H
+
+#include "cgroups.h"
+#include <stddef.h>
+
+#ifndef ADVISE_WINDOW_MS
+#define ADVISE_WINDOW_MS 3600000
+#endif
+
+#ifndef ADVISE_INTERVAL_MS
+#define ADVISE_INTERVAL_MS 10000
+#endif
+
+// room kept above the observed demand
+#ifndef ADVISE_HEADROOM_PCT
+#define ADVISE_HEADROOM_PCT 20
+#endif
+
+// fewer samples only give a low confidence
+#ifndef ADVISE_MIN_SAMPLES
+#define ADVISE_MIN_SAMPLES 30
+#endif
+
+// above these the current limits hid part of the demand
+#ifndef ADVISE_THROTTLED_PCT
+#define ADVISE_THROTTLED_PCT 5
+#endif
+
+#ifndef ADVISE_PSI_PCT
+#define ADVISE_PSI_PCT 1.0
+#endif
+
+#ifndef ADVISE_MAX_DEVICES
+#define ADVISE_MAX_DEVICES 16
+#endif
+
+/**
+ * @struct advise_opts_t
+ * @brief Options of a right-sizing run.
+ * @var cgname      Cgroup to observe.
+ * @var window_ms   Observation time.
+ * @var interval_ms Time between two samples.
+ * @var headroom    Percent added to the observed demand.
+ * @var opts        Runtime options (verbose).
+ */
+typedef struct {
+  const char *cgname;
+  long long window_ms;
+  long long interval_ms;
+  int headroom;
+  run_opts_t opts;
+} advise_opts_t;
+
+/**
+ * @enum advise_confidence_t
+ * @brief How far a recommendation can be trusted.
+ * @var ADVISE_LOW    Too few samples, or a limit or pressure hid part of the
+ * demand: the value is a lower bound.
+ * @var ADVISE_MEDIUM Spiky demand, the maximum is more than twice the p99.
+ * @var ADVISE_HIGH   Enough samples of steady, unconstrained demand.
+ */
+typedef enum {
+  ADVISE_LOW = 0,
+  ADVISE_MEDIUM,
+  ADVISE_HIGH,
+} advise_confidence_t;
+
+/**
+ * @struct advise_rec_t
+ * @brief Observed distribution and recommendation for one limit.
+ * @var p50        Median of the samples.
+ * @var p95        95th percentile.
+ * @var p99        99th percentile.
+ * @var max        Largest sample.
+ * @var value      Recommended limit, p99 plus headroom.
+ * @var low        Lower end of the band, p95 plus headroom.
+ * @var high       Upper end of the band, the maximum plus headroom.
+ * @var confidence Confidence of the recommendation.
+ * @var limited    A limit or pressure capped the demand.
+ */
+typedef struct {
+  double p50;
+  double p95;
+  double p99;
+  double max;
+  double value;
+  double low;
+  double high;
+  advise_confidence_t confidence;
+  bool limited;
+} advise_rec_t;
+
+/**
+ * @struct advise_io_t
+ * @brief Recommendation for one block device of io.stat.
+ * @var dev  Device as "MAJ:MIN".
+ * @var rbps Read bytes per second.
+ * @var wbps Written bytes per second.
+ */
+typedef struct {
+  char dev[32];
+  advise_rec_t rbps;
+  advise_rec_t wbps;
+} advise_io_t;
+
+/**
+ * @struct advise_report_t
+ * @brief Result of a right-sizing run.
+ * @var samples     Intervals observed.
+ * @var elapsed_ms  Time observed.
+ * @var cpu         CPU usage in cores.
+ * @var throttled   Percent of the periods throttled by cpu.max.
+ * @var cpu_quota   Recommended cpu.max quota in microseconds.
+ * @var cpu_period  Recommended cpu.max period in microseconds.
+ * @var has_memory  The memory controller is enabled for the cgroup.
+ * @var mem_high    Working set in bytes (memory.current without the
+ * inactive LRUs), for memory.high.
+ * @var mem_max     memory.current in bytes, for memory.max. Its maximum
+ * includes memory.peak when available.
+ * @var io          Devices with traffic in the window.
+ * @var io_count    Number of entries in io.
+ */
+typedef struct {
+  size_t samples;
+  long long elapsed_ms;
+  advise_rec_t cpu;
+  double throttled;
+  long long cpu_quota;
+  long long cpu_period;
+  bool has_memory;
+  advise_rec_t mem_high;
+  advise_rec_t mem_max;
+  advise_io_t io[ADVISE_MAX_DEVICES];
+  size_t io_count;
+} advise_report_t;
+
+/**
+ * @brief Observe a cgroup and recommend cpu.max, memory.high, memory.max
+ * and io.max.
+ *
+ * cpu.stat, memory.current, memory.stat, io.stat and the pressure files
+ * are sampled every interval_ms for window_ms. SIGINT and SIGTERM end the
+ * window early and recommend from the samples taken so far.
+ *
+ * Byte values are rounded up to whole MiB.
+ *
+ * @param ao Options.
+ * @param r  Report, filled on success.
+ * @return PLIMIT_OK on success, error code on failure or without a single
+ * complete interval.
+ */
+int advise_run(const advise_opts_t *ao, advise_report_t *r);
+
+#endif
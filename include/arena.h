@@ -0,0 +1,102 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE 16384
+#endif
+
+/**
+ * @struct arena_block_t
+ * @brief Heap block chained to an arena once its initial buffer is full.
+ */
+typedef struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  _Alignas(16) char data[];
+} arena_block_t;
+
+/**
+ * @struct arena_t
+ * @brief Bump allocator for the allocations of one operation.
+ *
+ * Allocations are carved from a caller supplied buffer (usually on the
+ * stack) and then from heap blocks of at least ARENA_BLOCK_SIZE bytes.
+ * Nothing is freed individually: arena_release() drops everything at once.
+ *
+ * @var buf    Initial buffer, may be NULL.
+ * @var size   Size of the initial buffer.
+ * @var used   Bytes used in the initial buffer.
+ * @var blocks Heap blocks, most recent first.
+ * @var last   Start of the most recent allocation, for arena_realloc().
+ */
+typedef struct {
+  char *buf;
+  size_t size;
+  size_t used;
+  arena_block_t *blocks;
+  char *last;
+} arena_t;
+
+/**
+ * @brief Initialize an arena.
+ * @param a    Arena.
+ * @param buf  Initial buffer used before any heap block, may be NULL.
+ * @param size Size of the initial buffer.
+ */
+void arena_init(arena_t *a, void *buf, size_t size);
+
+/**
+ * @brief Allocate zero-initialized memory aligned to 16 bytes.
+ * @param a    Arena.
+ * @param size Number of bytes.
+ * @return Pointer to the memory, or NULL if out of memory.
+ */
+void *arena_alloc(arena_t *a, size_t size);
+
+/**
+ * @brief Grow an allocation, in place if it is the most recent one.
+ * @param a        Arena.
+ * @param ptr      Allocation to grow, may be NULL.
+ * @param old_size Current size of the allocation.
+ * @param new_size Requested size.
+ * @return Pointer to the grown allocation, or NULL if out of memory.
+ */
+void *arena_realloc(arena_t *a, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Duplicate a string into the arena.
+ * @param a Arena.
+ * @param s String to copy.
+ * @return The copy, or NULL if out of memory.
+ */
+char *arena_strdup(arena_t *a, const char *s);
+
+/**
+ * @brief Duplicate at most n bytes of a string into the arena.
+ * @param a Arena.
+ * @param s String to copy.
+ * @param n Maximum number of bytes to copy.
+ * @return The copy, or NULL if out of memory.
+ */
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+
+/**
+ * @brief Format a string into the arena.
+ * @param a   Arena.
+ * @param fmt Format string.
+ * @param ... Arguments for the format string.
+ * @return The formatted string, or NULL if out of memory.
+ */
+char *arena_sprintf(arena_t *a, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Free all heap blocks and forget every allocation.
+ * @param a Arena.
+ */
+void arena_release(arena_t *a);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef BATCH_URING_ENV
+#define BATCH_URING_ENV "PLIMIT_IO_URING"
+#endif
+
+#ifndef BATCH_URING_MIN
+#define BATCH_URING_MIN 4
+#endif
+
+#ifndef BATCH_URING_SIZE
+#define BATCH_URING_SIZE 256
+#endif
+
+/**
+ * @struct file_write_t
+ * @brief One entry of a batch of file writes.
+ * @var args File, data and mode, as for write_file().
+ * @var rc   Filled by write_files(): PLIMIT_OK or an error code.
+ * @var err  errno of the failed open or write, 0 on success.
+ */
+typedef struct {
+  file_write_args_t args;
+  int rc;
+  int err;
+} file_write_t;
+
+/**
+ * @brief Write a batch of independent files.
+ *
+ * Batches of at least BATCH_URING_MIN entries are submitted through
+ * io_uring: every entry becomes a linked openat -> write -> close chain on
+ * a direct descriptor, so up to BATCH_URING_SIZE files cost one
+ * io_uring_enter(2) instead of three syscalls each. Completions are mapped
+ * back to their entry. When io_uring is not available (old kernel, seccomp,
+ * BATCH_URING_ENV set to "0") or a chain is rejected as unsupported, the
+ * entries are written one by one with write_file().
+ *
+ * The entries must not depend on each other: they complete in any order.
+ * Unlike write_file(), files are not created, they must already exist (as
+ * cgroup interface files do) and args.mode is ignored.
+ *
+ * @param dry_run Only log the writes.
+ * @param writes  Entries to write, rc and err are set for each.
+ * @param count   Number of entries.
+ * @param verbose Log each write.
+ * @return PLIMIT_OK if every entry was written, else the first error code.
+ */
+int write_files(bool dry_run, file_write_t *writes, size_t count,
+                bool verbose);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef CGEMU_H
+#define CGEMU_H
+
+#include "utils.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Emulated cgroup v2 hierarchy.
+ *
+ * When cg_root() is not a cgroup2 filesystem, cgroups are plain directories
+ * and interface files are plain files. The helpers below reproduce the small
+ * part of the kernel semantics plimit relies on, so the tool can be run and
+ * benchmarked without privileges (see tests/cgroupfs for a bundled root):
+ *
+ *  - a new cgroup gets cgroup.* files plus the files of every controller
+ *    enabled in the parent's cgroup.subtree_control
+ *  - "+ctrl -ctrl" writes to cgroup.subtree_control are applied to the
+ *    current set and rejected for controllers missing in cgroup.controllers
+ *  - writes to cgroup.procs move the PID out of its previous cgroup and
+ *    append it (any number is accepted, the location of each PID is kept as
+ *    a symlink in CGEMU_PID_INDEX below the root)
+ *  - below the root, controllers cannot be enabled in a cgroup with member
+ *    PIDs and PIDs cannot join a cgroup with enabled subtree controllers
+ *    (EBUSY, the "no internal processes" rule)
+ *  - a cgroup can only be removed without child cgroups and member PIDs
+ *
+ * Values written to other files are stored as-is without validation.
+ */
+
+#ifndef CGEMU_PID_INDEX
+#define CGEMU_PID_INDEX ".cgemu-pids"
+#endif
+
+/**
+ * @brief Create the interface files of a new emulated cgroup.
+ *
+ * Does nothing if the cgroup is already populated.
+ *
+ * @param cgpath Full path of the cgroup directory.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cgemu_populate(const char *cgpath);
+
+/**
+ * @brief Emulate a write to cgroup.procs.
+ * @param args    Path of the cgroup.procs file and the PID to add.
+ * @param verbose Log the write.
+ * @return PLIMIT_OK on success, error code with errno set on failure.
+ */
+int cgemu_attach(const file_write_args_t *args, bool verbose);
+
+/**
+ * @brief Emulate a write to cgroup.subtree_control.
+ * @param args    Path of the cgroup.subtree_control file and the
+ * "+ctrl -ctrl" list.
+ * @param verbose Log the write.
+ * @return PLIMIT_OK on success, error code with errno set on failure.
+ */
+int cgemu_subtree_control(const file_write_args_t *args, bool verbose);
+
+/**
+ * @brief Emulate a write to cgroup.freeze.
+ *
+ * The "frozen" key of cgroup.events follows at once, as for a cgroup
+ * whose members all reached the freezer.
+ *
+ * @param args    Path of the cgroup.freeze file and "0" or "1".
+ * @param verbose Log the write.
+ * @return PLIMIT_OK on success, error code with errno set on failure.
+ */
+int cgemu_freeze(const file_write_args_t *args, bool verbose);
+
+/**
+ * @brief Look up the emulated cgroup of a PID, like /proc/<pid>/cgroup.
+ * @param pid  Process ID.
+ * @param buf  Set to the cgroup path relative to cg_root(), "" for the root.
+ * @param size Size of buf.
+ * @return PLIMIT_OK on success, error code with errno set on failure.
+ */
+int cgemu_proc_cgroup(pid_t pid, char *buf, size_t size);
+
+/**
+ * @brief Remove an emulated cgroup, like rmdir(2) on cgroupfs.
+ * @param cgpath Full path of the cgroup directory.
+ * @return 0 on success, -1 with errno set (EBUSY, ENOTEMPTY, ...) on failure.
+ */
+int cgemu_rmdir(const char *cgpath);
+
+#endif
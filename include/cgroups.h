@@ -1,27 +1,142 @@
 #ifndef CGROUPS_H
 #define CGROUPS_H
 
+#include "arena.h"
+#include "hugetlb.h"
 #include "utils.h"
 #include <stdbool.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+// fallback when no cgroup2 mount is found in MOUNTINFO_PATH
 #ifndef CGROUP_ROOT_PATH
 #define CGROUP_ROOT_PATH "/sys/fs/cgroup"
 #endif
 
+#ifndef CGROUP_ROOT_ENV
+#define CGROUP_ROOT_ENV "PLIMIT_CGROUP_ROOT"
+#endif
+
+#ifndef MOUNTINFO_PATH
+#define MOUNTINFO_PATH "/proc/self/mountinfo"
+#endif
+
 #ifndef CGROUPS_PLIMIT_DEFAULT_NAME
 #define CGROUPS_PLIMIT_DEFAULT_NAME "plimit"
 #endif
 
-#ifndef CGROUPS_PLIMIT_DEFAULT_PATH
-#define CGROUPS_PLIMIT_DEFAULT_PATH "/sys/fs/cgroup/plimit"
+#ifndef ARENA_STACK_SIZE
+#define ARENA_STACK_SIZE 1024
+#endif
+
+#ifndef PROCS_READ_SIZE
+#define PROCS_READ_SIZE 16384
+#endif
+
+#ifndef PROCS_INITIAL_CAP
+#define PROCS_INITIAL_CAP 64
+#endif
+
+// sibling that takes the remaining members of a cgroup --nest creates a
+// child in
+#ifndef CG_NEST_LEAF
+#define CG_NEST_LEAF "plimit-leaf"
+#endif
+
+// extended attribute of a cgroup listing "PID /ORIGIN" lines of the
+// processes plimit moved in, see destroy_cgroup()
+#ifndef CG_ORIGIN_XATTR
+#define CG_ORIGIN_XATTR "user.plimit.origin"
+#endif
+
+// time a cgroup gets to report a freeze or thaw in cgroup.events
+#ifndef CG_FREEZE_TIMEOUT_MS
+#define CG_FREEZE_TIMEOUT_MS 1000
+#endif
+
+#ifndef CG_ORIGIN_SIZE
+#define CG_ORIGIN_SIZE 4096
+#endif
+
+#ifndef CPU_PERIOD_DEFAULT_US
+#define CPU_PERIOD_DEFAULT_US 100000
+#endif
+
+#ifndef CPU_PERIOD_LOW_LATENCY_US
+#define CPU_PERIOD_LOW_LATENCY_US 10000
 #endif
 
-#ifndef CGROUPS_DEFAULT_CONTROLLERS_PATH
-#define CGROUPS_DEFAULT_CONTROLLERS_PATH "/sys/fs/cgroup/cgroup.controllers"
+#ifndef CPU_PERIOD_BATCH_US
+#define CPU_PERIOD_BATCH_US 500000
 #endif
 
+// bounds the kernel accepts in cpu.max
+#define CPU_QUOTA_MIN_US 1000LL
+#define CPU_PERIOD_MAX_US 1000000LL
+
+/**
+ * @enum cpu_latency_t
+ * @brief Latency hint used to pick the cpu.max period for --cpus and
+ * --cpu-percent.
+ *
+ * A short period spreads the quota over many small slices so a throttled
+ * group waits at most one short period, at the cost of more scheduler work.
+ * A long period lets batch work run in longer bursts.
+ */
+typedef enum {
+  CPU_LATENCY_NORMAL = 0, // CPU_PERIOD_DEFAULT_US
+  CPU_LATENCY_LOW,        // CPU_PERIOD_LOW_LATENCY_US
+  CPU_LATENCY_BATCH,      // CPU_PERIOD_BATCH_US
+} cpu_latency_t;
+
+/**
+ * @enum qos_field_t
+ * @brief Bits recording which fields of a qos_t were set.
+ */
+typedef enum {
+  QOS_CPU_WEIGHT = 1U << 0,
+  QOS_CPU_IDLE = 1U << 1,
+  QOS_IO_WEIGHT = 1U << 2,
+  QOS_MEM_LOW = 1U << 3,
+  QOS_MEM_HIGH = 1U << 4,
+  QOS_UCLAMP_MIN = 1U << 5,
+  QOS_UCLAMP_MAX = 1U << 6,
+  QOS_SCHED_POLICY = 1U << 7,
+  QOS_IOPRIO = 1U << 8,
+} qos_field_t;
+
+/**
+ * @struct qos_t
+ * @brief Scheduling and protection settings bundled by a QoS tier (see
+ * tier_resolve()).
+ *
+ * The cgroup files are written with the limits, the scheduling policy and
+ * I/O priority are set on every thread of the target PID.
+ *
+ * @var set          Bitmask of qos_field_t values present.
+ * @var cpu_weight   cpu.weight, 1-10000.
+ * @var cpu_idle     cpu.idle, 0 or 1. An idle cgroup keeps no cpu.weight.
+ * @var io_weight    Default io.weight, 1-10000.
+ * @var mem_low      memory.low in bytes, -1 for "max".
+ * @var mem_high     memory.high in bytes, -1 for "max".
+ * @var uclamp_min   cpu.uclamp.min in percent.
+ * @var uclamp_max   cpu.uclamp.max in percent, 100 for "max".
+ * @var sched_policy SCHED_OTHER, SCHED_BATCH or SCHED_IDLE.
+ * @var ioprio       I/O priority as built by IOPRIO_PRIO_VALUE().
+ */
+typedef struct {
+  unsigned set;
+  int cpu_weight;
+  int cpu_idle;
+  int io_weight;
+  long long mem_low;
+  long long mem_high;
+  double uclamp_min;
+  double uclamp_max;
+  int sched_policy;
+  int ioprio;
+} qos_t;
+
 /**
  * @struct run_opts_t
  * @brief Options controlling program execution and logging.
@@ -39,29 +154,46 @@ typedef struct {
  * @struct limits_t
  * @brief Describes resource limits and cgroup options for a process.
  * @var pid         Target process ID for cgroup operations.
- * @var cgname      Relative cgroup name (to /sys/fs/cgroup).
- * @var cpu_percent CPU usage limit as a percentage (1..100, 0=unset).
+ * @var cgname      Cgroup name, relative to cg_root() if it contains a '/'
+ * and to cg_plimit_root() otherwise.
+ * @var cpu_percent CPU usage limit as a percentage of one CPU (100 per core,
+ * 0=unset).
+ * @var cpus        CPU usage limit in cores, may be fractional (0=unset).
+ * @var cpu_latency Latency hint used to select the period for cpus and
+ * cpu_percent.
  * @var cpu_quota   CPU quota in microseconds (-1 if unset).
  * @var cpu_period  CPU period in microseconds (-1 if unset).
  * @var cpu_max_raw Raw string for CPU max value (if set, write directly).
  * @var mem_max     Memory limit in bytes (-1 if unset).
  * @var io_max      Array of strings for IO limits ("MAJ:MIN key=val ...",
  * NULL-terminated).
+ * @var hugetlb     Array of hugetlb limits, one per hugepage size.
+ * @var hugetlb_count Number of entries in hugetlb.
+ * @var qos         Settings of a QoS tier, applied after the limits.
  * @var attach_only If true, only attach to cgroup without setting limits.
  * @var delete_cg   If true, delete the specified cgroup.
+ * @var nest        If true, cgname is a child of the PID's own cgroup (see
+ * cg_nest_name()): its other members move to a CG_NEST_LEAF sibling and
+ * the available controllers are enabled there instead of with force.
  * @var opts        Additional runtime options (verbose, dry-run, force).
  */
 typedef struct {
   pid_t pid;
-  char *cgname;         // relative to /sys/fs/cgroup
-  int cpu_percent;      // 1..100, 0=unset
+  char *cgname;         // relative to cg_root() or cg_plimit_root()
+  int cpu_percent;      // 100 per core, 0=unset
+  double cpus;          // cores, 0=unset
+  cpu_latency_t cpu_latency;
   long long cpu_quota;  // us, -1 unset
   long long cpu_period; // us, -1 unset
   char *cpu_max_raw;    // if set, write directly
   long long mem_max;    // bytes, -1 unset
   char **io_max; // array of strings "MAJ:MIN key=val ...", NULL-terminated
+  hugetlb_limit_t *hugetlb; // per hugepage size limits
+  size_t hugetlb_count;
+  qos_t qos;
   bool attach_only;
   bool delete_cg;
+  bool nest;
   run_opts_t opts;
 } limits_t;
 
@@ -95,12 +227,21 @@ typedef struct {
  */
 int apply_limits(const limits_t *lim);
 
+/**
+ * @brief Enable controllers for the children of a cgroup.
+ * @param controllers Parent cgroup path and "+ctrl ..." list to write.
+ * @param opts        Runtime options (verbose, dry-run, etc.).
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int enable_controllers(controllers_t controllers, const run_opts_t *opts);
+
 /**
  * @brief Add a process into the specified cgroup.
  * @param cgpath Full path to the cgroup.
  * @param pid    Process ID to move.
  * @param opts   Runtime options (verbose, dry-run, etc.).
- * @return PLIMIT_OK on success, error code on failure.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_NOTFOUND if the process exited,
+ * error code on failure.
  */
 int add_proc_cgroup(const char *cgpath, pid_t pid, const run_opts_t *opts);
 
@@ -112,13 +253,41 @@ int add_proc_cgroup(const char *cgpath, pid_t pid, const run_opts_t *opts);
  */
 int remove_procs_cgroup(const char *cgname, const run_opts_t *opts);
 
+/**
+ * @brief Callback invoked by cg_for_each_proc() for every PID.
+ * @param pid PID read from cgroup.procs.
+ * @param ctx Caller context.
+ * @return PLIMIT_OK to continue, any other code stops the walk.
+ */
+typedef int (*cg_proc_fn_t)(pid_t pid, void *ctx);
+
+/**
+ * @brief Stream the PIDs of a cgroup without allocating.
+ *
+ * cgroup.procs is read with large read() calls into the caller's buffer
+ * and parsed in a single pass, so the buffer can be reused across calls.
+ *
+ * @param cgpath Full path of the cgroup.
+ * @param buf    Read buffer (PROCS_READ_SIZE is a good size).
+ * @param size   Size of the read buffer.
+ * @param fn     Callback invoked for each PID.
+ * @param ctx    Context passed to fn.
+ * @return PLIMIT_OK on success, the callback's code if it stopped the walk,
+ * error code on failure.
+ */
+int cg_for_each_proc(const char *cgpath, char *buf, size_t size,
+                     cg_proc_fn_t fn, void *ctx);
+
 /**
  * @brief Get all processes in a cgroup.
+ * @param a      Arena owning the returned array.
  * @param rc     Pointer to store the return code (PLIMIT_OK or error).
  * @param cgname Cgroup name.
- * @return NULL-terminated array of process IDs, or NULL on error.
+ * @param count  Number of PIDs in the returned array.
+ * @return Contiguous array of PIDs (NULL when empty or on error).
  */
-char **get_procs_cgroup(int *rc, const char *cgname);
+pid_t *get_procs_cgroup(arena_t *a, int *rc, const char *cgname,
+                        size_t *count);
 
 /**
  * @brief Delete a cgroup.
@@ -128,19 +297,200 @@ char **get_procs_cgroup(int *rc, const char *cgname);
  */
 int delete_cgroup(const char *cgname, const run_opts_t *opts);
 
+/**
+ * @brief Move all processes of a cgroup back where they came from and delete
+ * it.
+ *
+ * apply_limits() records the cgroup a PID was moved out of in the
+ * CG_ORIGIN_XATTR attribute of the target. Each member returns to its
+ * recorded origin, members without a record (e.g. forked after the move)
+ * follow the first recorded PID. When the origin is gone or cannot hold
+ * processes any more, the closest ancestor of the cgroup that can is used,
+ * up to the root cgroup.
+ *
+ * @param cgname Cgroup name.
+ * @param opts   Runtime options (verbose, dry-run, etc.).
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int destroy_cgroup(const char *cgname, const run_opts_t *opts);
+
+/**
+ * @brief Select the cgroup hierarchy plimit operates on.
+ *
+ * With a NULL path the root is taken from the CGROUP_ROOT_ENV environment
+ * variable, then from the first cgroup2 mount in MOUNTINFO_PATH, and finally
+ * falls back to CGROUP_ROOT_PATH. A root that is not a cgroup2 filesystem is
+ * treated as an emulated hierarchy (see cgemu.h).
+ *
+ * @param path Root of the hierarchy, or NULL to discover it.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cg_set_root(const char *path);
+
+/**
+ * @brief Get the root of the cgroup hierarchy, discovering it on first use.
+ * @return Absolute path without a trailing '/'.
+ */
+const char *cg_root(void);
+
+/**
+ * @brief Get the path of the plimit cgroup below cg_root().
+ * @return Absolute path of the CGROUPS_PLIMIT_DEFAULT_NAME cgroup.
+ */
+const char *cg_plimit_root(void);
+
+/**
+ * @brief Check if cg_root() is an emulated hierarchy rather than cgroupfs.
+ * @return true if the kernel semantics are emulated by plimit.
+ */
+bool cg_emulated(void);
+
+/**
+ * @brief Check that the caller may modify cg_root().
+ *
+ * Root privileges are only required for a real cgroup2 hierarchy.
+ *
+ * @return PLIMIT_OK if allowed, PLIMIT_ERR_PERM otherwise.
+ */
+int cg_check_access(void);
+
+/**
+ * @brief Find the mount point of the cgroup2 filesystem.
+ * @param mountinfo Path of a mountinfo file (usually MOUNTINFO_PATH).
+ * @param buf       Buffer receiving the mount point.
+ * @param len       Size of the buffer.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_NOTFOUND if cgroup2 is not mounted.
+ */
+int cg_find_mount(const char *mountinfo, char *buf, size_t len);
+
+/**
+ * @brief Create a cgroup directory.
+ *
+ * On an emulated hierarchy the interface files the kernel would provide are
+ * created as well.
+ *
+ * @param path Full path of the cgroup.
+ * @param opts Runtime options (verbose, dry-run, etc.).
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cg_mkdir(const char *path, const run_opts_t *opts);
+
+/**
+ * @brief Remove an empty cgroup directory, like rmdir(2).
+ * @param path Full path of the cgroup.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int cg_rmdir(const char *path);
+
 /**
  * @brief Get the full path to a cgroup given its relative name.
- * @param name Relative cgroup name.
- * @return Newly allocated string with full cgroup path (caller must free).
+ * @param a    Arena the path is allocated from.
+ * @param name Relative cgroup name: under cg_plimit_root() without a '/',
+ * else under cg_root() (a leading '/' selects a top-level cgroup).
+ * @return Full cgroup path, or NULL on allocation failure.
  */
-char *cg_full_path(const char *name);
+char *cg_full_path(arena_t *a, const char *name);
 
 /**
  * @brief Get the parent cgroup path for a given cgroup name.
+ * @param a    Arena the path is allocated from.
  * @param name Relative cgroup name.
- * @return Newly allocated string with parent cgroup path (caller must free).
+ * @return Parent cgroup path, or NULL on allocation failure.
+ */
+char *cg_parent(arena_t *a, const char *name);
+
+/**
+ * @brief Get the cgroup a process belongs to.
+ *
+ * Reads the cgroup v2 entry of /proc/<pid>/cgroup, or the PID index of an
+ * emulated root.
+ *
+ * @param pid  Process ID.
+ * @param buf  Set to the cgroup path relative to cg_root(), "" for the root.
+ * @param size Size of buf.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cg_proc_cgroup(pid_t pid, char *buf, size_t size);
+
+/**
+ * @brief Name a cgroup below the current cgroup of a process.
+ *
+ * The result is "/<current>/<name>" (see cg_full_path()). A process that
+ * already sits in a cgroup called name, or in the CG_NEST_LEAF of an
+ * earlier nest, is placed next to it instead of one level deeper, so
+ * repeated runs are idempotent.
+ *
+ * @param a    Arena the name is allocated from.
+ * @param pid  Process ID.
+ * @param name Child name, a single path component.
+ * @param out  Set to the nested cgroup name.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cg_nest_name(arena_t *a, pid_t pid, const char *name, char **out);
+
+/**
+ * @brief Compute the cpu.max quota and period for a number of cores.
+ *
+ * The period is taken from the latency hint, or from period_us if it is
+ * positive. It is then stretched if needed so the quota never drops below
+ * the kernel minimum of 1ms, which would otherwise be rejected.
+ *
+ * @param cpus      Number of cores (may be fractional).
+ * @param hint      Latency hint selecting the base period.
+ * @param period_us Explicit period in microseconds, or <= 0 to use the hint.
+ * @param quota     Computed quota in microseconds.
+ * @param period    Computed period in microseconds.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG if cpus is not a finite
+ * positive number, period_us is above CPU_PERIOD_MAX_US or the quota stays
+ * below the minimum.
+ */
+int cpu_max_for(double cpus, cpu_latency_t hint, long long period_us,
+                long long *quota, long long *period);
+
+/**
+ * @brief Parse a latency hint name ("low", "normal" or "batch").
+ * @param s    Hint name.
+ * @param hint Parsed hint.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_PARSE for unknown names.
+ */
+int parse_cpu_latency(const char *s, cpu_latency_t *hint);
+
+/**
+ * @brief Read a value from a flat keyed cgroup file such as cpu.stat.
+ * @param cgpath Full path to the cgroup.
+ * @param file   File name (e.g. "cpu.stat").
+ * @param key    Key to look up (e.g. "usage_usec").
+ * @param value  Parsed value.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_NOTFOUND if file or key is
+ * missing.
+ */
+int cg_read_keyed(const char *cgpath, const char *file, const char *key,
+                  long long *value);
+
+/**
+ * @brief Read a single value cgroup file such as memory.current.
+ * @param cgpath Full path to the cgroup.
+ * @param file   File name.
+ * @param value  Parsed value, -1 for "max".
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cg_read_value(const char *cgpath, const char *file, long long *value);
+
+/**
+ * @brief Freeze or thaw a cgroup and wait until the kernel confirms it.
+ *
+ * Writes cgroup.freeze and waits up to CG_FREEZE_TIMEOUT_MS for the
+ * "frozen" key of cgroup.events to follow. A freeze can take longer when
+ * members sleep uninterruptibly; the cgroup keeps freezing in the
+ * background then.
+ *
+ * @param cgpath Full path to the cgroup.
+ * @param frozen Freeze (true) or thaw (false).
+ * @param opts   Runtime options (verbose, dry-run).
+ * @return PLIMIT_OK on success, PLIMIT_ERR_CGROUP if the state was not
+ * confirmed in time, error code if the write failed.
  */
-char *cg_parent(const char *name);
+int cg_freeze(const char *cgpath, bool frozen, const run_opts_t *opts);
 
 /**
  * @brief Check if the system is using cgroup v2.
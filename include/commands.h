@@ -0,0 +1,134 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "utils.h"
+
+struct arg_str;
+
+/**
+ * @struct command_t
+ * @brief A plimit subcommand ("plimit <name> [options]").
+ * @var name Subcommand name.
+ * @var run  Entry point, called with argv[0] set to the subcommand name.
+ * @var help One line description shown in --help.
+ */
+typedef struct {
+  const char *name;
+  int (*run)(int argc, char **argv);
+  const char *help;
+} command_t;
+
+/**
+ * @enum cmd_setup_flag_t
+ * @brief Options of cmd_setup().
+ */
+typedef enum {
+  CMD_READ_ONLY = 1U << 0,  // select the cgroup root without access check
+  CMD_LOG_STDERR = 1U << 1, // log to stderr, stdout carries the output
+} cmd_setup_flag_t;
+
+/**
+ * @brief Apply the options every command front end shares.
+ *
+ * Sets the log format of --output, then selects the --cgroup-root and
+ * checks that it is writable. Failures are meant for log_result(), which
+ * stays silent while the format is text.
+ *
+ * @param output      --output option.
+ * @param cgroup_root --cgroup-root option, NULL for commands without cgroups.
+ * @param flags       cmd_setup_flag_t bits.
+ * @param fmt         Set to the log format, may be NULL.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_setup(struct arg_str *output, struct arg_str *cgroup_root,
+              unsigned flags, log_format_t *fmt);
+
+/**
+ * @brief Write a snapshot of the plimit hierarchy to stdout.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_snapshot(int argc, char **argv);
+
+/**
+ * @brief Recreate a hierarchy from a snapshot read from stdin or a file.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_restore(int argc, char **argv);
+
+/**
+ * @brief Divide a CPU and memory budget between weighted child cgroups.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_split(int argc, char **argv);
+
+/**
+ * @brief Keep the hierarchy in line with a watched state directory.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_reconcile(int argc, char **argv);
+
+/**
+ * @brief Trim a cgroup towards its working set through memory.reclaim.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_reclaim(int argc, char **argv);
+
+/**
+ * @brief Advise the cold mappings of a process out of memory.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_pageout(int argc, char **argv);
+
+/**
+ * @brief Pause a cgroup on a duty cycle or while the host is busy.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_freeze_schedule(int argc, char **argv);
+
+/**
+ * @brief Switch limits at the boundaries of daily time windows.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_schedule(int argc, char **argv);
+
+/**
+ * @brief Recommend limits from the observed usage of a cgroup.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_advise(int argc, char **argv);
+
+/**
+ * @brief Sample the statistics of matching cgroups into a ring file.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_record(int argc, char **argv);
+
+/**
+ * @brief Decode a ring file written by record.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int cmd_replay(int argc, char **argv);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef FREEZE_H
+#define FREEZE_H
+
+#include "cgroups.h"
+#include <stddef.h>
+
+#ifndef FREEZE_CHECK_MS
+#define FREEZE_CHECK_MS 1000
+#endif
+
+// longest freeze and shortest thaw between freezes with a pressure trigger
+#ifndef FREEZE_MAX_ON_MS
+#define FREEZE_MAX_ON_MS 10000
+#endif
+
+#ifndef FREEZE_MIN_OFF_MS
+#define FREEZE_MIN_OFF_MS 2000
+#endif
+
+// a pressure freeze ends once pressure fell below this share of the trigger
+#ifndef FREEZE_THAW_RATIO
+#define FREEZE_THAW_RATIO 0.5
+#endif
+
+/**
+ * @struct freeze_opts_t
+ * @brief Options of a freeze schedule.
+ * @var cgname   Cgroup to freeze.
+ * @var on_ms    Frozen time of a cycle, the longest freeze with psi.
+ * @var off_ms   Thawed time of a cycle, the shortest thaw with psi.
+ * @var psi      Host CPU "some" avg10 pressure, in percent, that triggers a
+ * freeze. 0 for a fixed duty cycle.
+ * @var check_ms Time between two pressure readings.
+ * @var opts     Runtime options (verbose, dry-run).
+ */
+typedef struct {
+  const char *cgname;
+  long long on_ms;
+  long long off_ms;
+  double psi;
+  long long check_ms;
+  run_opts_t opts;
+} freeze_opts_t;
+
+/**
+ * @struct freeze_stats_t
+ * @brief Counters of a freeze schedule.
+ * @var freezes   Times the cgroup was frozen.
+ * @var timeouts  Freezes or thaws not confirmed within CG_FREEZE_TIMEOUT_MS.
+ * @var frozen_ms Time spent frozen.
+ * @var total_ms  Time the schedule ran.
+ */
+typedef struct {
+  size_t freezes;
+  size_t timeouts;
+  long long frozen_ms;
+  long long total_ms;
+} freeze_stats_t;
+
+/**
+ * @brief Pause a cgroup on a schedule through cgroup.freeze.
+ *
+ * Without psi the cgroup is frozen for on_ms and thawed for off_ms in turn.
+ * With psi the host CPU pressure is read every check_ms from cpu.pressure of
+ * the root cgroup (/proc/pressure/cpu if missing). The cgroup is frozen when
+ * it reaches psi and has been thawed for off_ms, and thawed when it falls
+ * below FREEZE_THAW_RATIO of psi or after on_ms. Each transition is
+ * confirmed through cgroup.events (see cg_freeze()).
+ *
+ * SIGINT and SIGTERM stop the schedule. The cgroup is always left thawed.
+ *
+ * @param fo    Schedule options.
+ * @param stats Counters, filled on return.
+ * @return PLIMIT_OK on success, error code of the first failed write.
+ */
+int freeze_run(const freeze_opts_t *fo, freeze_stats_t *stats);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef HUGETLB_H
+#define HUGETLB_H
+
+#include "arena.h"
+#include "utils.h"
+#include <stddef.h>
+
+#ifndef HUGEPAGES_SYSFS_PATH
+#define HUGEPAGES_SYSFS_PATH "/sys/kernel/mm/hugepages"
+#endif
+
+#ifndef HUGETLB_MAX_SIZES
+#define HUGETLB_MAX_SIZES 8
+#endif
+
+/**
+ * @struct hugetlb_limit_t
+ * @brief Limit for a single hugepage size of the hugetlb controller.
+ * @var name      Size token used in controller file names (e.g. "2MB").
+ * @var page_size Hugepage size in bytes.
+ * @var max       Limit in bytes written to hugetlb.<name>.max and
+ * hugetlb.<name>.rsvd.max.
+ */
+typedef struct {
+  char name[16];
+  long long page_size;
+  long long max;
+} hugetlb_limit_t;
+
+/**
+ * @brief Discover the hugepage sizes supported by the kernel.
+ * @param sizes Array receiving page sizes in bytes, sorted ascending.
+ * @param max   Capacity of the sizes array.
+ * @param count Number of sizes found.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int hugetlb_page_sizes(long long *sizes, size_t max, size_t *count);
+
+/**
+ * @brief Format a page size as the token used by hugetlb controller files.
+ * @param page_size Page size in bytes.
+ * @param buf       Destination buffer.
+ * @param len       Size of the destination buffer.
+ */
+void hugetlb_size_name(long long page_size, char *buf, size_t len);
+
+/**
+ * @brief Parse a "SIZE=LIMIT[,SIZE=LIMIT...]" specification.
+ *
+ * Each SIZE must be one of the hugepage sizes discovered in
+ * HUGEPAGES_SYSFS_PATH. Parsed entries are appended to *limits.
+ *
+ * @param a      Arena the array is allocated from.
+ * @param spec   Specification string (e.g. "2MB=4G,1GB=8G").
+ * @param limits Pointer to the array to append to (grown in the arena).
+ * @param count  Pointer to the number of entries in the array.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int hugetlb_parse(arena_t *a, const char *spec, hugetlb_limit_t **limits,
+                  size_t *count);
+
+/**
+ * @brief Get the number of bytes still available in a hugepage pool.
+ * @param page_size  Page size in bytes.
+ * @param avail      Free and unreserved bytes in the pool.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int hugetlb_pool_available(long long page_size, long long *avail);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef INI_H
+#define INI_H
+
+#include "utils.h"
+#include <stdio.h>
+
+/**
+ * @brief Callback invoked for every key/value pair of an INI file.
+ * @param section Current section name ("" before the first section).
+ * @param key     Key with surrounding whitespace removed.
+ * @param value   Value with surrounding whitespace removed.
+ * @param lineno  Line number of the pair, for error reporting.
+ * @param ctx     Caller supplied context.
+ * @return PLIMIT_OK to continue, any other code aborts parsing.
+ */
+typedef int (*ini_handler_t)(const char *section, const char *key,
+                             const char *value, int lineno, void *ctx);
+
+/**
+ * @brief Parse an INI-style stream.
+ *
+ * Lines are "[section]", "key = value", blank, or comments starting with
+ * '#' or ';'. Keys may repeat; each occurrence is passed to the handler.
+ *
+ * @param fp      Stream to read.
+ * @param name    Name of the stream for error messages.
+ * @param handler Callback receiving every key/value pair.
+ * @param ctx     Context passed to the handler.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int ini_parse_stream(FILE *fp, const char *name, ini_handler_t handler,
+                     void *ctx);
+
+/**
+ * @brief Parse an INI-style file.
+ * @param path    File path.
+ * @param handler Callback receiving every key/value pair.
+ * @param ctx     Context passed to the handler.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int ini_parse_file(const char *path, ini_handler_t handler, void *ctx);
+
+#endif
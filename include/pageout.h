@@ -0,0 +1,144 @@
+#ifndef PAGEOUT_H
+#define PAGEOUT_H
+
+#include "arena.h"
+#include "cgroups.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+// time the referenced bits are left to collect accesses
+#ifndef PAGEOUT_WINDOW_MS
+#define PAGEOUT_WINDOW_MS 10000
+#endif
+
+// a mapping with more of its resident pages referenced is not cold
+#ifndef PAGEOUT_REFERENCED_PCT
+#define PAGEOUT_REFERENCED_PCT 10
+#endif
+
+#ifndef PAGEOUT_IOV_MAX
+#define PAGEOUT_IOV_MAX 512
+#endif
+
+/**
+ * @enum pageout_advice_t
+ * @brief Advice given to the cold mappings.
+ * @var PAGEOUT_COLD    MADV_COLD: move the pages to the inactive list.
+ * @var PAGEOUT_PAGEOUT MADV_PAGEOUT: reclaim the pages right away.
+ */
+typedef enum {
+  PAGEOUT_COLD = 0,
+  PAGEOUT_PAGEOUT,
+} pageout_advice_t;
+
+/**
+ * @struct pageout_vma_t
+ * @brief One mapping of the target process, from /proc/PID/smaps.
+ * @var start      First address.
+ * @var end        Address past the mapping.
+ * @var rss        Resident bytes.
+ * @var referenced Resident bytes referenced during the window.
+ * @var anon       Resident anonymous bytes.
+ * @var path       Backing file or pseudo path, "" for anonymous memory.
+ * @var selected   Chosen for the advice by pageout_select().
+ */
+typedef struct {
+  unsigned long start;
+  unsigned long end;
+  long long rss;
+  long long referenced;
+  long long anon;
+  const char *path;
+  bool selected;
+} pageout_vma_t;
+
+/**
+ * @struct pageout_opts_t
+ * @brief Options of a pageout run.
+ * @var pid        Target process.
+ * @var window_ms  Milliseconds between clearing and reading the referenced
+ * bits, 0 to read the bits as they are.
+ * @var referenced Percent of referenced resident bytes above which a mapping
+ * stays untouched.
+ * @var budget     Resident bytes advised at most, -1 for no limit.
+ * @var advice     Advice to give.
+ * @var file_only  Leave anonymous memory alone (hosts without swap).
+ * @var opts       Runtime options (verbose, dry-run).
+ */
+typedef struct {
+  pid_t pid;
+  long long window_ms;
+  int referenced;
+  long long budget;
+  pageout_advice_t advice;
+  bool file_only;
+  run_opts_t opts;
+} pageout_opts_t;
+
+/**
+ * @struct pageout_stats_t
+ * @brief Counters of a pageout run.
+ * @var vmas     Mappings scanned.
+ * @var selected Mappings advised.
+ * @var rss      Resident bytes of the process.
+ * @var cold     Resident bytes of the selected mappings.
+ * @var advised  Bytes the kernel accepted the advice for.
+ */
+typedef struct {
+  size_t vmas;
+  size_t selected;
+  long long rss;
+  long long cold;
+  long long advised;
+} pageout_stats_t;
+
+/**
+ * @brief Read the mappings of a process and how much of them is in use.
+ *
+ * With window_ms > 0 the referenced bits are cleared through
+ * /proc/PID/clear_refs first and /proc/PID/smaps is read window_ms later, so "Referenced" covers exactly the window. Locked, hugetlb, I/O and
+ * kernel provided mappings as well as mappings without resident pages are
+ * skipped.
+ *
+ * @param a     Arena the mappings are allocated from.
+ * @param po    Pageout options.
+ * @param vmas  Mappings, allocated from a.
+ * @param count Number of mappings.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int pageout_scan(arena_t *a, const pageout_opts_t *po, pageout_vma_t **vmas,
+                 size_t *count);
+
+/**
+ * @brief Choose the mappings to advise.
+ *
+ * Mappings referenced below the referenced threshold are taken coldest
+ * first (by unreferenced resident bytes) as long as their resident bytes
+ * fit in the budget. The mappings are sorted by address again afterwards.
+ *
+ * @param po    Pageout options.
+ * @param vmas  Mappings from pageout_scan(), selected is set.
+ * @param count Number of mappings.
+ * @param stats Counters, vmas, selected, rss and cold are filled.
+ */
+void pageout_select(const pageout_opts_t *po, pageout_vma_t *vmas,
+                    size_t count, pageout_stats_t *stats);
+
+/**
+ * @brief Give the selected mappings the advice with process_madvise(2).
+ *
+ * Requires Linux 5.10 and the rights to ptrace the target plus
+ * CAP_SYS_NICE. The mappings are passed in batches of PAGEOUT_IOV_MAX. A
+ * mapping that went away in the meantime ends its batch and the next batch
+ * continues after it.
+ *
+ * @param po    Pageout options.
+ * @param vmas  Mappings from pageout_select().
+ * @param count Number of mappings.
+ * @param stats Counters, advised is filled.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int pageout_apply(const pageout_opts_t *po, const pageout_vma_t *vmas,
+                  size_t count, pageout_stats_t *stats);
+
+#endif
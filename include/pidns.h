@@ -0,0 +1,50 @@
+#ifndef PIDNS_H
+#define PIDNS_H
+
+#include "cgroups.h"
+#include <sys/types.h>
+
+#ifndef PLIMIT_RUN_DIR
+#define PLIMIT_RUN_DIR "/run/plimit"
+#endif
+
+// one "NSPID PID" file per namespace, named after the namespace inode
+#ifndef PIDNS_CACHE_DIR
+#define PIDNS_CACHE_DIR PLIMIT_RUN_DIR "/pidns"
+#endif
+
+// the NSpid line sits in the first kilobyte of /proc/PID/status
+#ifndef PIDNS_STATUS_SIZE
+#define PIDNS_STATUS_SIZE 4096
+#endif
+
+#ifndef PIDNS_MAX_LEVELS
+#define PIDNS_MAX_LEVELS 33
+#endif
+
+/**
+ * @brief Map a PID of a PID namespace to the PID plimit sees.
+ *
+ * The namespace is the one of ns_pid, e.g. a process of a container. Every
+ * process lists its PID in each namespace from ours inwards on the NSpid
+ * line of /proc/PID/status, so the process whose entry at the level of that
+ * namespace is nspid is the one looked for. Processes of nested namespaces
+ * are checked through NS_GET_PARENT, a sibling namespace at the same level
+ * never matches.
+ *
+ * A scan reads the status of every process once and stores all PIDs of the
+ * namespace in PIDNS_CACHE_DIR. Later lookups in the same namespace check
+ * the cached PID against its NSpid line and only scan again when it went
+ * stale.
+ *
+ * @param ns_pid PID, in our namespace, of a process in the namespace.
+ * @param nspid  PID inside that namespace.
+ * @param opts   Runtime options (verbose).
+ * @param pid    Receives the PID in our namespace.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_NOTFOUND if no process has
+ * nspid in the namespace, error code on failure.
+ */
+int pidns_resolve(pid_t ns_pid, pid_t nspid, const run_opts_t *opts,
+                  pid_t *pid);
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef PLIMIT_H
+#define PLIMIT_H
+
+/**
+ * @file plimit.h
+ * @brief Public C API of libplimit.
+ *
+ * All calls go through a context handle. A context keeps its runtime
+ * options and the error of the last failed call, and never prints: messages
+ * are delivered to an optional callback instead. Contexts are independent,
+ * so different threads may use different contexts concurrently; a single
+ * context must not be used by two threads at once.
+ *
+ * Limits are built through an opaque handle and setters, so no internal
+ * structure crosses the ABI and new settings only add functions.
+ */
+
+#include "utils.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define PLIMIT_API __attribute__((visibility("default")))
+#else
+#define PLIMIT_API
+#endif
+
+#define PLIMIT_API_VERSION 2
+
+// flags of plimit_ctx_new()
+#define PLIMIT_DRY_RUN 0x1u // log the actions without making changes
+#define PLIMIT_VERBOSE 0x2u // log every action
+#define PLIMIT_FORCE 0x4u   // create missing parents, enable controllers
+
+/**
+ * @struct plimit_ctx_t
+ * @brief Opaque library context.
+ */
+typedef struct plimit_ctx plimit_ctx_t;
+
+/**
+ * @struct plimit_limits_t
+ * @brief Opaque set of limits for plimit_apply().
+ */
+typedef struct plimit_limits plimit_limits_t;
+
+/**
+ * @struct plimit_error_t
+ * @brief Details of the last failed call on a context.
+ * @var code      plimit_err_t value returned by the call.
+ * @var sys_errno errno observed when the first error was reported (0 if
+ * none).
+ * @var message   First error message reported during the call.
+ */
+typedef struct {
+  int code;
+  int sys_errno;
+  char message[512];
+} plimit_error_t;
+
+/**
+ * @struct plimit_stat_t
+ * @brief Usage counters of a cgroup (-1 when a value is unavailable).
+ * @var cpu_usage_usec     Total CPU time consumed (cpu.stat usage_usec).
+ * @var cpu_nr_throttled   Number of throttled periods (cpu.stat).
+ * @var cpu_throttled_usec Time spent throttled (cpu.stat).
+ * @var memory_current     Current memory usage in bytes.
+ * @var memory_max         Memory limit in bytes (-1 for "max").
+ * @var pids_current       Number of tasks.
+ * @var nr_procs           Number of processes in cgroup.procs.
+ */
+typedef struct {
+  long long cpu_usage_usec;
+  long long cpu_nr_throttled;
+  long long cpu_throttled_usec;
+  long long memory_current;
+  long long memory_max;
+  long long pids_current;
+  long long nr_procs;
+} plimit_stat_t;
+
+/**
+ * @brief Callback receiving the messages of calls made on a context.
+ * @param type Type of the message.
+ * @param msg  Message text.
+ * @param user User pointer passed to plimit_set_log().
+ */
+typedef void (*plimit_log_fn)(log_type_t type, const char *msg, void *user);
+
+/**
+ * @brief Get the API version implemented by the library.
+ * @return PLIMIT_API_VERSION the library was built with.
+ */
+PLIMIT_API int plimit_api_version(void);
+
+/**
+ * @brief Create a context.
+ * @param ctx   Receives the new context.
+ * @param flags PLIMIT_DRY_RUN, PLIMIT_VERBOSE and PLIMIT_FORCE, or 0.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_ctx_new(plimit_ctx_t **ctx, unsigned flags);
+
+/**
+ * @brief Release a context.
+ * @param ctx Context to release, may be NULL.
+ */
+PLIMIT_API void plimit_ctx_free(plimit_ctx_t *ctx);
+
+/**
+ * @brief Deliver messages of calls made on a context to a callback.
+ * @param ctx  Context.
+ * @param fn   Callback, or NULL to discard messages.
+ * @param user User pointer passed to the callback.
+ */
+PLIMIT_API void plimit_set_log(plimit_ctx_t *ctx, plimit_log_fn fn,
+                               void *user);
+
+/**
+ * @brief Get the error of the last failed call on a context.
+ * @param ctx Context.
+ * @return Error details; code is PLIMIT_OK if the last call succeeded.
+ */
+PLIMIT_API const plimit_error_t *plimit_last_error(const plimit_ctx_t *ctx);
+
+/**
+ * @brief Select the cgroup2 mount all contexts work on.
+ *
+ * The root is process-wide: call it before contexts are used by other
+ * threads. A directory that is not a cgroup2 mount is used as an emulated
+ * hierarchy.
+ *
+ * @param ctx  Context receiving the error.
+ * @param root Mount point, NULL for the default (PLIMIT_CGROUP_ROOT or
+ * /sys/fs/cgroup).
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_set_root(plimit_ctx_t *ctx, const char *root);
+
+/**
+ * @brief Create an empty set of limits for a cgroup.
+ * @param ctx    Context.
+ * @param lim    Receives the new set.
+ * @param cgname Cgroup name (see cg_full_path()).
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_limits_new(plimit_ctx_t *ctx, plimit_limits_t **lim,
+                                 const char *cgname);
+
+/**
+ * @brief Release a set of limits.
+ * @param lim Set to release, may be NULL.
+ */
+PLIMIT_API void plimit_limits_free(plimit_limits_t *lim);
+
+/**
+ * @brief Attach a process when the limits are applied.
+ * @param ctx Context.
+ * @param lim Limits.
+ * @param pid Process ID.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG for a PID below 1.
+ */
+PLIMIT_API int plimit_limits_set_pid(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                                     pid_t pid);
+
+/**
+ * @brief Limit the CPU time in cores, written to cpu.max.
+ * @param ctx  Context.
+ * @param lim  Limits.
+ * @param cpus Cores, may be fractional.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG unless cpus is positive.
+ */
+PLIMIT_API int plimit_limits_set_cpus(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                                      double cpus);
+
+/**
+ * @brief Set cpu.max from a quota and a period.
+ * @param ctx    Context.
+ * @param lim    Limits.
+ * @param quota  Quota in microseconds.
+ * @param period Period in microseconds.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG unless both are positive.
+ */
+PLIMIT_API int plimit_limits_set_cpu_max(plimit_ctx_t *ctx,
+                                         plimit_limits_t *lim,
+                                         long long quota, long long period);
+
+/**
+ * @brief Set memory.max.
+ * @param ctx   Context.
+ * @param lim   Limits.
+ * @param bytes Limit in bytes.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG unless bytes is positive.
+ */
+PLIMIT_API int plimit_limits_set_mem_max(plimit_ctx_t *ctx,
+                                         plimit_limits_t *lim,
+                                         long long bytes);
+
+/**
+ * @brief Set memory.high.
+ * @param ctx   Context.
+ * @param lim   Limits.
+ * @param bytes Threshold in bytes, -1 for "max".
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG for other values below 1.
+ */
+PLIMIT_API int plimit_limits_set_mem_high(plimit_ctx_t *ctx,
+                                          plimit_limits_t *lim,
+                                          long long bytes);
+
+/**
+ * @brief Add an io.max line.
+ * @param ctx  Context.
+ * @param lim  Limits.
+ * @param line "MAJ:MIN key=value ..." as written to io.max.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_limits_add_io_max(plimit_ctx_t *ctx,
+                                        plimit_limits_t *lim,
+                                        const char *line);
+
+/**
+ * @brief Add hugetlb limits.
+ * @param ctx  Context.
+ * @param lim  Limits.
+ * @param spec "SIZE=LIMIT[,SIZE=LIMIT...]", e.g. "2MB=4G,1GB=8G".
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_limits_add_hugetlb(plimit_ctx_t *ctx,
+                                         plimit_limits_t *lim,
+                                         const char *spec);
+
+/**
+ * @brief Apply the settings of a QoS tier after the limits.
+ * @param ctx    Context.
+ * @param lim    Limits.
+ * @param name   Tier name, built in or defined in config.
+ * @param config Config file with [tier NAME] sections, may be NULL.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_limits_set_tier(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                                      const char *name, const char *config);
+
+/**
+ * @brief Only attach the PID, leaving the limits of the cgroup as they are.
+ * @param ctx Context.
+ * @param lim Limits.
+ * @param on  Attach only.
+ * @return PLIMIT_OK.
+ */
+PLIMIT_API int plimit_limits_set_attach_only(plimit_ctx_t *ctx,
+                                             plimit_limits_t *lim, bool on);
+
+/**
+ * @brief Create the cgroup below the current cgroup of the PID.
+ * @param ctx Context.
+ * @param lim Limits, with a PID and a single component name.
+ * @param on  Nest.
+ * @return PLIMIT_OK.
+ */
+PLIMIT_API int plimit_limits_set_nest(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                                      bool on);
+
+/**
+ * @brief Create a cgroup, apply limits and attach the PID if set.
+ * @param ctx Context; its flags apply.
+ * @param lim Limits to apply.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_apply(plimit_ctx_t *ctx, const plimit_limits_t *lim);
+
+/**
+ * @brief Move a process into an existing cgroup.
+ * @param ctx    Context.
+ * @param cgname Cgroup name (see cg_full_path()).
+ * @param pid    Process to move.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_attach(plimit_ctx_t *ctx, const char *cgname,
+                             pid_t pid);
+
+/**
+ * @brief Move all members out of a cgroup and delete it.
+ * @param ctx    Context.
+ * @param cgname Cgroup name (see cg_full_path()).
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_delete(plimit_ctx_t *ctx, const char *cgname);
+
+/**
+ * @brief Read usage counters of a cgroup.
+ * @param ctx    Context.
+ * @param cgname Cgroup name (see cg_full_path()).
+ * @param st     Receives the counters.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+PLIMIT_API int plimit_stat(plimit_ctx_t *ctx, const char *cgname,
+                           plimit_stat_t *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#ifndef POOL_MAX_JOBS
+#define POOL_MAX_JOBS 256
+#endif
+
+/*
+ * Work-stealing thread pool for tree shaped work.
+ *
+ * Every worker owns a deque. A task queues its follow-up tasks (e.g. the
+ * children of a cgroup once the cgroup exists) on the deque of the worker
+ * running it and that worker continues with the newest one, which keeps a
+ * subtree on one thread. Idle workers steal the oldest task of another
+ * worker, i.e. the biggest remaining piece of work. pool_run() returns once
+ * no task is queued or running.
+ */
+
+typedef struct pool pool_t;
+
+/**
+ * @brief Runs one task.
+ * @param pool Pool the task runs in, for pool_push().
+ * @param task Task pointer as passed to pool_run() or pool_push().
+ * @param ctx  Context passed to pool_run().
+ */
+typedef void (*pool_task_fn)(pool_t *pool, void *task, void *ctx);
+
+/**
+ * @brief Run tasks and all tasks they push on up to jobs threads.
+ *
+ * The calling thread is one of the workers. With jobs <= 1 the tasks run
+ * on the calling thread only, depth first.
+ *
+ * @param jobs  Number of worker threads, capped at POOL_MAX_JOBS.
+ * @param tasks Initial tasks, spread over the workers.
+ * @param count Number of initial tasks.
+ * @param fn    Function running a task.
+ * @param ctx   Context passed to fn.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_MEM if a deque could not grow
+ * (tasks queued after that are run on the pushing thread instead).
+ */
+int pool_run(size_t jobs, void *const *tasks, size_t count, pool_task_fn fn,
+             void *ctx);
+
+/**
+ * @brief Queue a task from within a running task.
+ * @param pool Pool passed to the running task.
+ * @param task Task to queue.
+ */
+void pool_push(pool_t *pool, void *task);
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "cgroups.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef PLIMIT_CONFIG_PATH
+#define PLIMIT_CONFIG_PATH "/etc/plimit.conf"
+#endif
+
+#ifndef PLIMIT_RUN_DIR
+#define PLIMIT_RUN_DIR "/run/plimit"
+#endif
+
+#ifndef PROFILE_CACHE_PATH
+#define PROFILE_CACHE_PATH PLIMIT_RUN_DIR "/profiles.cache"
+#endif
+
+#ifndef PROFILE_MAX_IO
+#define PROFILE_MAX_IO 16
+#endif
+
+#ifndef PROFILE_MAX_DEPTH
+#define PROFILE_MAX_DEPTH 16
+#endif
+
+/**
+ * @enum profile_field_t
+ * @brief Bits recording which fields of a profile_t were set.
+ */
+typedef enum {
+  PROFILE_CPU_PERCENT = 1U << 0,
+  PROFILE_CPUS = 1U << 1,
+  PROFILE_CPU_LATENCY = 1U << 2,
+  PROFILE_CPU_QUOTA = 1U << 3,
+  PROFILE_CPU_PERIOD = 1U << 4,
+  PROFILE_CPU_MAX = 1U << 5,
+  PROFILE_MEM_MAX = 1U << 6,
+  PROFILE_IO_MAX = 1U << 7,
+  PROFILE_HUGETLB = 1U << 8,
+} profile_field_t;
+
+// fields that each set cpu.max on their own, setting one clears the others
+#define PROFILE_CPU_LIMIT                                                     \
+  (PROFILE_CPU_PERCENT | PROFILE_CPUS | PROFILE_CPU_QUOTA | PROFILE_CPU_MAX)
+
+/**
+ * @struct profile_t
+ * @brief Compiled form of one "[profile NAME]" or "[profile NAME@HOST]"
+ * section.
+ *
+ * The record is fixed-size and position independent: strings are stored as
+ * offsets into the string pool of the owning profile_set_t (0 = unset), so
+ * a compiled set can be written to disk and mmap'd back without fixups.
+ *
+ * @var name        Profile name.
+ * @var host        Host the section applies to (0 = any host).
+ * @var inherit     Name of the parent profile (0 = none).
+ * @var set         Bitmask of profile_field_t values present.
+ * @var io_max      io.max entries, io_max_count of them.
+ */
+typedef struct {
+  uint32_t name;
+  uint32_t host;
+  uint32_t inherit;
+  uint32_t set;
+  int32_t cpu_percent;
+  int32_t cpu_latency;
+  double cpus;
+  int64_t cpu_quota;
+  int64_t cpu_period;
+  int64_t mem_max;
+  uint32_t cpu_max;
+  uint32_t hugetlb;
+  uint32_t io_max[PROFILE_MAX_IO];
+  uint32_t io_max_count;
+  uint32_t reserved;
+} profile_t;
+
+/**
+ * @struct profile_set_t
+ * @brief All profiles of a configuration file in compiled form.
+ * @var profiles    Array of compiled profiles.
+ * @var count       Number of profiles.
+ * @var strings     String pool referenced by profile_t offsets.
+ * @var blob        Backing storage (heap buffer or mapping).
+ * @var blob_len    Size of the backing storage.
+ * @var mapped      True if blob is an mmap of the cache file.
+ */
+typedef struct {
+  const profile_t *profiles;
+  size_t count;
+  const char *strings;
+  void *blob;
+  size_t blob_len;
+  bool mapped;
+} profile_set_t;
+
+/**
+ * @brief Load all profiles from a configuration file.
+ *
+ * If cache is not NULL and holds a compiled copy of the file with matching
+ * inode, size and mtime, it is mmap'd instead of re-parsing the text.
+ * Otherwise the file is parsed and the cache is refreshed (best effort).
+ *
+ * @param path  Configuration file path.
+ * @param cache Compiled cache path, or NULL to disable caching.
+ * @param set   Loaded profile set (release with profiles_free()).
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int profiles_load(const char *path, const char *cache, profile_set_t *set);
+
+/**
+ * @brief Release a profile set.
+ * @param set Profile set to release.
+ */
+void profiles_free(profile_set_t *set);
+
+/**
+ * @brief Get a string from the pool of a profile set.
+ * @param set Profile set.
+ * @param off String offset.
+ * @return The string, or NULL for offset 0.
+ */
+const char *profile_str(const profile_set_t *set, uint32_t off);
+
+/**
+ * @brief Resolve a profile by name, following inheritance and applying the
+ * host specific overrides at every level.
+ * @param set  Profile set.
+ * @param name Profile name.
+ * @param host Host name used to select "[profile NAME@HOST]" sections.
+ * @param out  Flattened profile.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int profile_resolve(const profile_set_t *set, const char *name,
+                    const char *host, profile_t *out);
+
+/**
+ * @brief Fill limits from a resolved profile.
+ *
+ * Strings are copied into the arena so the limits outlive the profile set.
+ *
+ * @param a   Arena owning the strings stored in lim.
+ * @param set Profile set the profile was resolved from.
+ * @param p   Resolved profile.
+ * @param lim Limits to fill.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int profile_apply(arena_t *a, const profile_set_t *set, const profile_t *p,
+                  limits_t *lim);
+
+#endif
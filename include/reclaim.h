@@ -0,0 +1,143 @@
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include "cgroups.h"
+#include <stddef.h>
+
+#ifndef RECLAIM_INTERVAL_MS
+#define RECLAIM_INTERVAL_MS 5000
+#endif
+
+// memory "some" pressure (avg10, percent) above which no reclaim is done
+#ifndef RECLAIM_PSI_THRESHOLD
+#define RECLAIM_PSI_THRESHOLD 0.1
+#endif
+
+#ifndef RECLAIM_RATE_DEFAULT
+#define RECLAIM_RATE_DEFAULT (32LL << 20)
+#endif
+
+#ifndef RECLAIM_HEADROOM_PCT
+#define RECLAIM_HEADROOM_PCT 10
+#endif
+
+// refaults of more than this share of the last step count as overreach
+#ifndef RECLAIM_REFAULT_PCT
+#define RECLAIM_REFAULT_PCT 10
+#endif
+
+#ifndef RECLAIM_BACKOFF_MAX
+#define RECLAIM_BACKOFF_MAX 32
+#endif
+
+#ifndef RECLAIM_STAT_SIZE
+#define RECLAIM_STAT_SIZE 8192
+#endif
+
+/**
+ * @struct reclaim_opts_t
+ * @brief Options of a reclaim loop.
+ * @var cgname      Cgroup to trim.
+ * @var interval_ms Time between two passes.
+ * @var psi         Memory "some" avg10 pressure, in percent, at which
+ * reclaim stops.
+ * @var max_rate    Bytes reclaimed per second at most.
+ * @var min_bytes   memory.current is never trimmed below this.
+ * @var headroom    Percent kept above the working set.
+ * @var once        Run a single pass.
+ * @var opts        Runtime options (verbose, dry-run).
+ */
+typedef struct {
+  const char *cgname;
+  long long interval_ms;
+  double psi;
+  long long max_rate;
+  long long min_bytes;
+  int headroom;
+  bool once;
+  run_opts_t opts;
+} reclaim_opts_t;
+
+/**
+ * @struct reclaim_sample_t
+ * @brief Memory state of a cgroup at one pass.
+ * @var current       memory.current in bytes.
+ * @var active_anon   Active anonymous memory (memory.stat).
+ * @var inactive_anon Inactive anonymous memory.
+ * @var active_file   Active page cache.
+ * @var inactive_file Inactive page cache.
+ * @var refaults      Refaulted pages since the cgroup was created.
+ * @var psi_some      Memory "some" pressure over the last 10s, percent.
+ */
+typedef struct {
+  long long current;
+  long long active_anon;
+  long long inactive_anon;
+  long long active_file;
+  long long inactive_file;
+  long long refaults;
+  double psi_some;
+} reclaim_sample_t;
+
+/**
+ * @struct reclaim_stats_t
+ * @brief Counters of a reclaim loop.
+ * @var passes    Passes run.
+ * @var writes    memory.reclaim writes.
+ * @var held      Passes skipped because of pressure or refaults.
+ * @var requested Bytes asked for.
+ * @var reclaimed Drop of memory.current across the writes.
+ */
+typedef struct {
+  size_t passes;
+  size_t writes;
+  size_t held;
+  long long requested;
+  long long reclaimed;
+} reclaim_stats_t;
+
+/**
+ * @brief Read memory.current, memory.stat and memory.pressure of a cgroup.
+ *
+ * Missing memory.stat keys count as 0, a missing memory.pressure (PSI
+ * disabled) as no pressure.
+ *
+ * @param cgpath Full path to the cgroup.
+ * @param s      Sample to fill.
+ * @return PLIMIT_OK on success, error code if memory.current or
+ * memory.stat cannot be read.
+ */
+int reclaim_sample(const char *cgpath, reclaim_sample_t *s);
+
+/**
+ * @brief Compute the memory.current a cgroup may be trimmed to.
+ *
+ * The working set is memory.current without the inactive anon and file
+ * LRUs. The target keeps headroom percent above it and never drops below
+ * min_bytes.
+ *
+ * @param s     Sample of the cgroup.
+ * @param ropts Reclaim options.
+ * @return Target size in bytes.
+ */
+long long reclaim_target(const reclaim_sample_t *s,
+                         const reclaim_opts_t *ropts);
+
+/**
+ * @brief Trim a cgroup towards its working set through memory.reclaim.
+ *
+ * Every interval_ms the cgroup is sampled and the distance to
+ * reclaim_target() is reclaimed, at most max_rate bytes per second and
+ * scaled down as memory pressure approaches psi. A pass is held back when
+ * pressure reaches psi or when the refaults since the last write exceed
+ * RECLAIM_REFAULT_PCT of what it reclaimed. Each hold doubles the number of
+ * passes skipped, up to RECLAIM_BACKOFF_MAX, and each clean pass halves it.
+ * SIGINT and SIGTERM stop the loop.
+ *
+ * @param ropts Reclaim options.
+ * @param stats Counters, filled on return.
+ * @return PLIMIT_OK on success, error code of the first failed pass.
+ */
+int reclaim_run(const reclaim_opts_t *ropts, reclaim_stats_t *stats);
+
+#endif
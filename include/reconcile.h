@@ -0,0 +1,54 @@
+#ifndef RECONCILE_H
+#define RECONCILE_H
+
+#include "cgroups.h"
+#include <stddef.h>
+
+#ifndef RECONCILE_SUFFIX
+#define RECONCILE_SUFFIX ".conf"
+#endif
+
+#ifndef RECONCILE_DEBOUNCE_MS
+#define RECONCILE_DEBOUNCE_MS 200
+#endif
+
+/**
+ * @struct reconcile_opts_t
+ * @brief Options of a reconciler.
+ * @var dir  State directory holding the desired state.
+ * @var jobs Worker threads used to apply a pass (see snapshot_restore()).
+ * @var once Apply the state once and return instead of watching dir.
+ * @var opts Runtime options (verbose, dry-run, force).
+ */
+typedef struct {
+  const char *dir;
+  size_t jobs;
+  bool once;
+  run_opts_t opts;
+} reconcile_opts_t;
+
+/**
+ * @brief Keep the live hierarchy in line with a state directory.
+ *
+ * Every RECONCILE_SUFFIX file of the directory holds "[cgroup PATH]"
+ * sections in the snapshot format (see snapshot_write()), PATH relative to
+ * cg_root(). A cgroup may be declared in one file only. The merged state is
+ * kept in memory, sorted parents first, and applied like a snapshot restore:
+ * missing cgroups are created, files that differ are written and listed
+ * processes are migrated. Cgroups dropped from the state since the previous
+ * pass are deleted, children first.
+ *
+ * Unless once is set, the directory is then watched with inotify. Changes
+ * are coalesced for RECONCILE_DEBOUNCE_MS and trigger a pass only if the
+ * merged state differs from the last applied one, so an idle reconciler
+ * performs no cgroup reads or writes. A state that fails to load is logged
+ * and the previous one is kept. SIGHUP forces a pass against the live
+ * hierarchy, SIGINT and SIGTERM stop the reconciler.
+ *
+ * @param ropts Reconciler options.
+ * @return PLIMIT_OK on success, error code of the first failed pass with
+ * once, or of the watch setup.
+ */
+int reconcile_run(const reconcile_opts_t *ropts);
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "cgroups.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef RECORD_INTERVAL_MS
+#define RECORD_INTERVAL_MS 1000
+#endif
+
+// default file size, a week of 1s samples of about 100 busy cgroups (idle
+// cgroups take a few bytes per sample)
+#ifndef RECORD_FILE_SIZE
+#define RECORD_FILE_SIZE (1LL << 30)
+#endif
+
+// unit of the ring, the oldest block is dropped when the file is full. Each
+// block decodes on its own, a larger block stores fewer absolute values.
+#ifndef RECORD_BLOCK_SIZE
+#define RECORD_BLOCK_SIZE (1 << 20)
+#endif
+
+// time between two lookups of the cgroups matching the pattern
+#ifndef RECORD_RESCAN_MS
+#define RECORD_RESCAN_MS 10000
+#endif
+
+/**
+ * @enum record_field_t
+ * @brief Values of a sample, in file order.
+ */
+typedef enum {
+  RECORD_CPU_USAGE,        // cpu.stat usage_usec
+  RECORD_CPU_THROTTLED,    // cpu.stat nr_throttled
+  RECORD_CPU_THROTTLED_US, // cpu.stat throttled_usec
+  RECORD_MEM_CURRENT,      // memory.current
+  RECORD_MEM_ANON,         // memory.stat anon
+  RECORD_MEM_FILE,         // memory.stat file
+  RECORD_IO_RBYTES,        // io.stat rbytes of all devices
+  RECORD_IO_WBYTES,        // io.stat wbytes of all devices
+  RECORD_CPU_PRESSURE,     // cpu.pressure some total
+  RECORD_MEM_PRESSURE,     // memory.pressure some total
+  RECORD_IO_PRESSURE,      // io.pressure some total
+  RECORD_PIDS,             // pids.current
+  RECORD_FIELDS
+} record_field_t;
+
+/**
+ * @struct record_opts_t
+ * @brief Options of a metric recording.
+ * @var pattern     Shell pattern of the cgroups to sample, matched like
+ * cg_full_path() resolves a name, one path component per '*'.
+ * @var file        Ring file, created if missing, continued if it exists.
+ * @var size        Size of a new ring file in bytes, rounded down to whole
+ * blocks. The header page comes on top.
+ * @var interval_ms Time between two samples.
+ * @var opts        Runtime options (verbose).
+ */
+typedef struct {
+  const char *pattern;
+  const char *file;
+  long long size;
+  long long interval_ms;
+  run_opts_t opts;
+} record_opts_t;
+
+/**
+ * @struct record_stats_t
+ * @brief Counters of a recording.
+ * @var rounds  Sampling rounds.
+ * @var samples Cgroup samples written.
+ * @var bytes   Bytes written to the ring.
+ * @var wraps   Blocks reused after the ring was full.
+ */
+typedef struct {
+  size_t rounds;
+  size_t samples;
+  long long bytes;
+  size_t wraps;
+} record_stats_t;
+
+/**
+ * @struct record_sample_t
+ * @brief One decoded sample.
+ * @var time_ms Wall clock time of the round, in ms since the epoch.
+ * @var cgname  Cgroup path relative to cg_root() at recording time.
+ * @var values  Values, indexed by record_field_t. Absent files read as 0.
+ */
+typedef struct {
+  long long time_ms;
+  const char *cgname;
+  long long values[RECORD_FIELDS];
+} record_sample_t;
+
+/**
+ * @brief Receives the samples of record_replay().
+ * @param s   Decoded sample, valid during the call only.
+ * @param ctx Context passed to record_replay().
+ * @return PLIMIT_OK to go on, any other value stops the replay.
+ */
+typedef int (*record_sample_fn)(const record_sample_t *s, void *ctx);
+
+/**
+ * @brief Get the name of a field, as used in CSV headers.
+ * @param field Field index.
+ * @return Field name, e.g. "cpu_usage_usec".
+ */
+const char *record_field_name(record_field_t field);
+
+/**
+ * @brief Sample the controller statistics of matching cgroups into a ring
+ * file until SIGINT or SIGTERM.
+ *
+ * The file is a header page followed by fixed-size blocks of
+ * RECORD_BLOCK_SIZE, mapped into memory. Each round appends a time entry
+ * and one entry per cgroup to the current block. Values are zigzag varints
+ * of the difference to the previous sample of the same cgroup in the block,
+ * behind a bit mask that leaves out the unchanged ones. The first sample of
+ * a cgroup in a block holds absolute values after an entry with its name.
+ * Blocks thus decode on their own and the ring simply reuses the oldest
+ * block when the file is full. The used length of a block is updated after
+ * each round, so a crashed recording loses one round at most.
+ *
+ * The cgroups matching the pattern are looked up again every
+ * RECORD_RESCAN_MS. Each file is read once per round.
+ *
+ * @param ro    Recording options.
+ * @param stats Counters, filled on return.
+ * @return PLIMIT_OK on success, error code of the setup.
+ */
+int record_run(const record_opts_t *ro, record_stats_t *stats);
+
+/**
+ * @brief Decode a ring file written by record_run(), oldest block first.
+ *
+ * The file may be read while it is being recorded, the block being written
+ * is decoded up to its last complete round. A damaged block, or one the
+ * writer reuses during the replay, is skipped with a warning.
+ *
+ * @param file Ring file.
+ * @param fn   Called for each sample in time order.
+ * @param ctx  Passed to fn.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_PARSE if the file header is not
+ * a ring file, or the return value of fn that stopped the replay.
+ */
+int record_replay(const char *file, record_sample_fn fn, void *ctx);
+
+#endif
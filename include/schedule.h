@@ -0,0 +1,67 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "cgroups.h"
+#include <stddef.h>
+
+// boundaries are looked up this many days ahead, a week covers every
+// day-of-week pattern
+#ifndef SCHEDULE_HORIZON_DAYS
+#define SCHEDULE_HORIZON_DAYS 8
+#endif
+
+// a failed pass is retried after this delay, doubled on every further
+// failure up to the maximum, or at the next boundary if that comes first
+#ifndef SCHEDULE_RETRY_MS
+#define SCHEDULE_RETRY_MS 5000
+#endif
+
+#ifndef SCHEDULE_RETRY_MAX_MS
+#define SCHEDULE_RETRY_MAX_MS 300000
+#endif
+
+/**
+ * @struct schedule_opts_t
+ * @brief Options of a limit schedule.
+ * @var file Schedule file.
+ * @var once Apply the limits of the current time and return.
+ * @var opts Runtime options (verbose, dry-run, force).
+ */
+typedef struct {
+  const char *file;
+  bool once;
+  run_opts_t opts;
+} schedule_opts_t;
+
+/**
+ * @brief Apply time-windowed limits at every window boundary.
+ *
+ * The file holds "[cgroup PATH]" sections in the snapshot format (see
+ * snapshot_write()) with the limits that apply outside of any window, and
+ * "[window NAME]" sections:
+ *
+ *   cgroup = PATH         cgroup the window applies to
+ *   days   = mon-fri,sun  days the window starts on (default every day)
+ *   hours  = 22:00-06:00  local time, may wrap past midnight
+ *
+ * plus the limit files that differ while the window is open. Each of them
+ * must also be set in the [cgroup PATH] section, so leaving the window
+ * restores a known value. When windows overlap, the one later in the file
+ * wins.
+ *
+ * The limits of the current time are applied like a snapshot restore, so
+ * only files that differ are written and all files of a cgroup change in
+ * one pass. The process then sleeps on a timerfd until the next window
+ * boundary (or a change of the wall clock) and applies the limits again.
+ * A failed pass is retried after SCHEDULE_RETRY_MS, backing off up to
+ * SCHEDULE_RETRY_MAX_MS.
+ * SIGHUP reloads the file, keeping the previous schedule if it fails to
+ * load. SIGINT and SIGTERM stop the schedule.
+ *
+ * @param so Schedule options.
+ * @return PLIMIT_OK on success, error code of the first failed step with
+ * once, or of the setup.
+ */
+int schedule_run(const schedule_opts_t *so);
+
+#endif
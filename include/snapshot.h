@@ -0,0 +1,77 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "cgroups.h"
+#include <stdio.h>
+
+/**
+ * @struct snapshot_opts_t
+ * @brief Options controlling what a snapshot captures.
+ * @var procs    Record member PIDs.
+ * @var cmdlines Record the command line of every member PID.
+ */
+typedef struct {
+  bool procs;
+  bool cmdlines;
+} snapshot_opts_t;
+
+/**
+ * @struct restore_stats_t
+ * @brief Counters collected while restoring a snapshot.
+ * @var cgroups  Cgroup sections processed.
+ * @var created  Cgroup directories created.
+ * @var writes   Controller files written.
+ * @var skipped  Controller files already holding the desired value.
+ * @var moved    Processes migrated.
+ * @var missing  Recorded processes that no longer exist or changed.
+ */
+typedef struct {
+  size_t cgroups;
+  size_t created;
+  size_t writes;
+  size_t skipped;
+  size_t moved;
+  size_t missing;
+} restore_stats_t;
+
+/**
+ * @brief Write a snapshot of a cgroup subtree.
+ *
+ * The snapshot is an INI stream with one "[cgroup PATH]" section per cgroup
+ * in pre-order, PATH relative to cg_root(). Each section lists the
+ * enabled subtree controllers, every writable limit file that exists and,
+ * optionally, the member processes.
+ *
+ * @param out    Output stream.
+ * @param cgname Cgroup name of the subtree root (see cg_full_path()), or
+ * NULL for the whole plimit hierarchy.
+ * @param sopts  Snapshot options.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int snapshot_write(FILE *out, const char *cgname,
+                   const snapshot_opts_t *sopts);
+
+/**
+ * @brief Recreate the cgroups described by a snapshot stream.
+ *
+ * The stream is applied in a single pass. Missing cgroups are created and
+ * only files whose live value differs from the snapshot are written.
+ * Recorded processes are migrated if they still exist and, when a command
+ * line was recorded, it still matches.
+ *
+ * With jobs > 1 the stream is loaded first and sibling subtrees are
+ * restored concurrently on a work-stealing pool (see pool.h). A failing
+ * cgroup then only stops its own subtree; counters and the result are
+ * aggregated in stream order, so they do not depend on scheduling.
+ *
+ * @param in    Input stream.
+ * @param name  Name of the stream for error messages.
+ * @param opts  Runtime options (verbose, dry-run, force).
+ * @param jobs  Number of worker threads, 1 to apply while reading.
+ * @param stats Counters filled while restoring, may be NULL.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int snapshot_restore(FILE *in, const char *name, const run_opts_t *opts,
+                     size_t jobs, restore_stats_t *stats);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include "arena.h"
+#include "cgroups.h"
+
+#ifndef SPLIT_WEIGHT_MAX
+#define SPLIT_WEIGHT_MAX 10000
+#endif
+
+#ifndef SPLIT_MEM_ALIGN
+#define SPLIT_MEM_ALIGN 4096
+#endif
+
+/**
+ * @struct split_child_t
+ * @brief One child of a split budget.
+ * @var name   Child cgroup name, created below the parent.
+ * @var weight Share of the parent budget, 1 to SPLIT_WEIGHT_MAX.
+ * @var quota  Computed cpu.max quota in microseconds (0 if cpu is not split).
+ * @var mem    Computed memory.max in bytes (0 if memory is not split).
+ */
+typedef struct {
+  const char *name;
+  unsigned weight;
+  long long quota;
+  long long mem;
+} split_child_t;
+
+/**
+ * @struct split_t
+ * @brief A parent budget and the children it is divided between.
+ * @var parent      Parent cgroup name (see cg_full_path()).
+ * @var cpus        Parent CPU budget in cores (0 to leave cpu.max alone).
+ * @var cpu_latency Latency hint used to pick the period.
+ * @var cpu_period  Period in microseconds (-1 to use the hint).
+ * @var mem_max     Parent memory budget in bytes (-1 to leave memory.max
+ * alone).
+ * @var quota       Computed parent quota in microseconds.
+ * @var period      Computed period shared by the parent and its children.
+ * @var children    Children in command line order.
+ * @var count       Number of children.
+ * @var opts        Runtime options (verbose, dry-run, force).
+ */
+typedef struct {
+  const char *parent;
+  double cpus;
+  cpu_latency_t cpu_latency;
+  long long cpu_period;
+  long long mem_max;
+  long long quota;
+  long long period;
+  split_child_t *children;
+  size_t count;
+  run_opts_t opts;
+} split_t;
+
+/**
+ * @struct split_stats_t
+ * @brief Counters collected while applying a split.
+ * @var created   Cgroup directories created.
+ * @var writes    Controller files written.
+ * @var unchanged Controller files already holding their share.
+ * @var children  Children that had at least one file written.
+ */
+typedef struct {
+  size_t created;
+  size_t writes;
+  size_t unchanged;
+  size_t children;
+} split_stats_t;
+
+/**
+ * @brief Parse a "NAME:WEIGHT,..." list of children.
+ *
+ * A missing weight defaults to 1. Names must be unique single path
+ * components.
+ *
+ * @param a        Arena the children are allocated from.
+ * @param spec     Comma separated list.
+ * @param children Set to the parsed array.
+ * @param count    Set to the number of children.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG on a malformed list.
+ */
+int split_parse_children(arena_t *a, const char *spec,
+                         split_child_t **children, size_t *count);
+
+/**
+ * @brief Compute the parent and child limits of a split.
+ *
+ * The parent quota and memory budget are divided in proportion to the
+ * weights with the largest remainder method: every child gets the floor of
+ * its exact share and the units left over go to the largest fractions, so
+ * the children add up to the parent exactly and a given set of weights
+ * always yields the same limits. Memory is divided in SPLIT_MEM_ALIGN units,
+ * the parent budget is rounded down to a multiple of it. All cgroups share
+ * one period, stretched (as for --cpus) until the smallest share reaches the
+ * kernel minimum quota.
+ *
+ * @param s Split to compute, quota, period and the child limits are set.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG if a share is too small.
+ */
+int split_compute(split_t *s);
+
+/**
+ * @brief Write a computed split as one transaction.
+ *
+ * Creates the parent and missing children, enables the split controllers
+ * in the parent (and, with force, in its parent) and writes cpu.max and
+ * memory.max. Files that already hold their share are left alone, so after
+ * a weight change only the children whose limits moved are written. If any
+ * step fails, every change made so far is undone in reverse order: files
+ * get their previous value back, controllers enabled by the split are
+ * disabled again and created cgroups are removed.
+ *
+ * Children that exist below the parent but are not part of the split are
+ * not touched.
+ *
+ * @param s     Split computed by split_compute().
+ * @param stats Counters filled while applying, may be NULL.
+ * @return PLIMIT_OK on success, error code on failure (after rollback).
+ */
+int split_apply(const split_t *s, split_stats_t *stats);
+
+#endif
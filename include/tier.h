@@ -0,0 +1,36 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include "cgroups.h"
+
+/**
+ * @brief Resolve a QoS tier into the settings it bundles.
+ *
+ * The built-in tiers set every cpu, io and memory knob but the memory.low
+ * of latency-critical, so moving a cgroup to another tier leaves nothing of
+ * the previous one behind:
+ *
+ *   tier              cpu.weight io.weight memory.low policy ioprio
+ *   latency-critical  1000       1000      -          other  be/0
+ *   standard          100        100       0          other  none
+ *   batch             25         25        0          batch  be/7
+ *   best-effort       (cpu.idle) 1         0          idle   idle
+ *
+ * memory.high is "max" and cpu.idle 0 except for best-effort. Real-time and
+ * deadline threads keep their policy. A "[tier NAME]" section of the config
+ * file overrides single keys of a built-in tier or defines a new one, and a
+ * "[tier NAME@HOST]" section overrides those on one host. Keys are
+ * cpu-weight, cpu-idle, io-weight, mem-low, mem-high, uclamp-min,
+ * uclamp-max, sched-policy (other, batch or idle) and ioprio (none, idle,
+ * be/N or rt/N).
+ *
+ * @param config Config file, NULL for the built-in tiers only.
+ * @param name   Tier name.
+ * @param host   Host name used to select "[tier NAME@HOST]" sections.
+ * @param out    Settings of the tier.
+ * @return PLIMIT_OK on success, error code on failure.
+ */
+int tier_resolve(const char *config, const char *name, const char *host,
+                 qos_t *out);
+
+#endif
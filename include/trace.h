@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef TRACE_DETAIL_SIZE
+#define TRACE_DETAIL_SIZE 128
+#endif
+
+/*
+ * Latency tracing of cgroup operations.
+ *
+ * Every phase and syscall plimit performs on the hierarchy is wrapped in a
+ * span:
+ *
+ *   uint64_t t = trace_begin();
+ *   int rc = write(...);
+ *   trace_end(t, "write", path, rc);
+ *
+ * Spans are timed with CLOCK_MONOTONIC and nest per thread, so the cost of
+ * a single write(2) to cgroup.procs (which can wait on the kernel's
+ * threadgroup rwsem) shows up below the phase that issued it. When tracing
+ * is disabled trace_begin() returns 0 and trace_end() returns immediately.
+ */
+
+/**
+ * @enum trace_format_t
+ * @brief Output format of trace_write().
+ * @var TRACE_OFF    Tracing disabled
+ * @var TRACE_TEXT   One indented line per span
+ * @var TRACE_CHROME Chrome trace-event JSON (chrome://tracing, Perfetto)
+ */
+typedef enum {
+  TRACE_OFF = 0,
+  TRACE_TEXT,
+  TRACE_CHROME,
+} trace_format_t;
+
+/**
+ * @brief Parse a trace format name ("text" or "chrome"/"json").
+ * @param s   Format name.
+ * @param fmt Receives the format.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG for an unknown name.
+ */
+int trace_parse_format(const char *s, trace_format_t *fmt);
+
+/**
+ * @brief Start recording spans of all threads.
+ */
+void trace_enable(void);
+
+/**
+ * @brief Open a span on the calling thread.
+ * @return Start timestamp to pass to trace_end(), 0 when tracing is off.
+ */
+uint64_t trace_begin(void);
+
+/**
+ * @brief Close a span opened with trace_begin() and record it.
+ * @param start  Value returned by trace_begin().
+ * @param name   Static name of the phase or syscall.
+ * @param detail Path or value the operation worked on, may be NULL.
+ * @param rc     Result of the operation (plimit_err_t or syscall return).
+ */
+void trace_end(uint64_t start, const char *name, const char *detail, int rc);
+
+/**
+ * @brief Write the recorded spans ordered by start time.
+ * @param out Destination stream.
+ * @param fmt TRACE_TEXT or TRACE_CHROME.
+ * @return PLIMIT_OK on success, PLIMIT_ERR_IO on write failure.
+ */
+int trace_write(FILE *out, trace_format_t fmt);
+
+/**
+ * @brief Drop the recorded spans and stop tracing.
+ */
+void trace_reset(void);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -10,6 +11,13 @@
 #define PLIMIT_VERSION "0.0.0"
 #endif
 
+#ifndef LOG_INLINE_SIZE
+#define LOG_INLINE_SIZE 256
+#endif
+
+#define MSEC_PER_SEC 1000LL
+#define NSEC_PER_MSEC 1000000LL
+
 /**
  * @enum plimit_err_t
  * @brief Error codes for plimit utilities.
@@ -28,6 +36,13 @@ typedef enum {
   PLIMIT_ERR_SYS,      // System call failure
 } plimit_err_t;
 
+/**
+ * @brief Get a short description of a plimit error code.
+ * @param code plimit_err_t value
+ * @return Static string describing the error
+ */
+const char *plimit_strerror(int code);
+
 /**
  * @enum log_type_t
  * @brief Specifies the type of log message.
@@ -46,6 +61,110 @@ typedef enum {
   LOG_ERROR,         // Error message
 } log_type_t;
 
+/**
+ * @brief Receives log messages instead of stdout/stderr.
+ * @param type Type of the log message
+ * @param msg Formatted message without prefix or newline
+ * @param ctx Context passed to log_set_handler()
+ */
+typedef void (*log_handler_t)(log_type_t type, const char *msg, void *ctx);
+
+/**
+ * @brief Route log messages of the calling thread to a handler.
+ * @param handler Handler to call, or NULL to print to stdout/stderr again
+ * @param ctx Context passed to the handler
+ */
+void log_set_handler(log_handler_t handler, void *ctx);
+
+/**
+ * @brief Get the log handler of the calling thread.
+ * @param ctx Receives the handler context, may be NULL
+ * @return Current handler, or NULL when printing to stdout/stderr
+ */
+log_handler_t log_get_handler(void **ctx);
+
+/**
+ * @enum log_format_t
+ * @brief Output format of log messages written to a stream.
+ * @var LOG_FORMAT_TEXT Prefixed lines for humans
+ * @var LOG_FORMAT_JSON One JSON object per line
+ */
+typedef enum {
+  LOG_FORMAT_TEXT = 0,
+  LOG_FORMAT_JSON,
+} log_format_t;
+
+/**
+ * @enum log_action_t
+ * @brief A change plimit makes (or would make) to the cgroup hierarchy.
+ */
+typedef enum {
+  LOG_ACTION_WRITE,    // value written to a file
+  LOG_ACTION_TRUNCATE, // file truncated
+  LOG_ACTION_MKDIR,    // directory created
+  LOG_ACTION_RMDIR,    // directory removed
+} log_action_t;
+
+/**
+ * @brief Parse an output format name ("text" or "json").
+ * @param s Format name
+ * @param fmt Receives the format
+ * @return PLIMIT_OK on success, PLIMIT_ERR_ARG for an unknown name
+ */
+int log_parse_format(const char *s, log_format_t *fmt);
+
+/**
+ * @brief Select the output format of all threads.
+ *
+ * With LOG_FORMAT_JSON every message, action and result is written as one
+ * JSON object per line to a single stream, so a consumer does not have to
+ * merge stdout and stderr.
+ *
+ * @param fmt Output format
+ * @param stream Stream for JSON records, NULL for stdout
+ */
+void log_set_format(log_format_t fmt, FILE *stream);
+
+/**
+ * @brief Get the output format selected with log_set_format().
+ * @return Current output format
+ */
+log_format_t log_get_format(void);
+
+/**
+ * @brief Write a JSON string literal, escaping quotes and control characters.
+ * @param out Destination stream
+ * @param s String to write
+ */
+void json_write_string(FILE *out, const char *s);
+
+/**
+ * @brief Log a change to the hierarchy.
+ *
+ * Text output only shows the action with dry_run or verbose set, JSON
+ * output always records it.
+ *
+ * @param action Kind of change
+ * @param path Affected file or directory
+ * @param value Value written, NULL for actions without one
+ * @param dry_run The action was only planned
+ * @param verbose Show the action in text output
+ */
+void log_action(log_action_t action, const char *path, const char *value,
+                bool dry_run, bool verbose);
+
+/**
+ * @brief Record the outcome of a command as a JSON record.
+ *
+ * Does nothing with text output, where commands print their own summary.
+ *
+ * @param command Command name (e.g. "apply", "delete", "restore")
+ * @param cgname Cgroup the command worked on, may be NULL
+ * @param pid Target PID, ignored when <= 0
+ * @param rc plimit_err_t result, reported with plimit_strerror()
+ */
+void log_result(const char *command, const char *cgname, pid_t pid, int rc);
+
 /**
  * @brief Log a formatted message to stdout or stderr.
  * @param type Type of the log message
@@ -72,10 +191,45 @@ typedef struct {
  * @param dry_run Only log the action without executing it
  * @param args File write arguments
  * @param verbose Log the action
- * @return PLIMIT_OK on success, error code on failure
+ * @return PLIMIT_OK on success, PLIMIT_ERR_NOTFOUND without logging when
+ * the kernel rejects a PID that no longer exists (ESRCH), error code on
+ * other failures with errno preserved
  */
 int write_file(bool dry_run, const file_write_args_t *args, bool verbose);
 
+/**
+ * @brief Check whether a file holds a line equal to the given string.
+ * @param path File path
+ * @param line Line to look for, without newline
+ * @return true if found, false if not found or unreadable
+ */
+bool file_has_line(const char *path, const char *line);
+
+/**
+ * @brief Write data to a file only if it differs from the current content.
+ *
+ * Cgroup interface files may hold one entry per line (e.g. io.max), so the
+ * data is considered unchanged when it equals any line of the file.
+ *
+ * @param dry_run Only log the action without executing it
+ * @param args File write arguments
+ * @param verbose Log the action
+ * @param changed Set to true if the file was (or would be) written, may be
+ * NULL
+ * @return PLIMIT_OK on success, error code on failure
+ */
+int write_file_if_changed(bool dry_run, const file_write_args_t *args,
+                          bool verbose, bool *changed);
+
+/**
+ * @brief Read a small file into a buffer, stripping the trailing newline.
+ * @param path File path
+ * @param buf Destination buffer
+ * @param size Size of the destination buffer
+ * @return PLIMIT_OK on success, error code on failure
+ */
+int read_file(const char *path, char *buf, size_t size);
+
 /**
  * @brief Creates a directory if not exists or set mode.
  * @param dry_run Only log the action without executing it
@@ -93,6 +247,51 @@ int create_directory(bool dry_run, const char *path, mode_t mode, bool verbose);
  */
 long long parse_bytes(const char *s);
 
+/**
+ * @brief Parse a limit size, "max" or a number with an optional K/M/G/T/P/E
+ * suffix. Unlike parse_bytes(), errors cannot be mistaken for a size.
+ * @param s Input string
+ * @param out Receives the size in bytes, -1 for "max"
+ * @return PLIMIT_OK on success, PLIMIT_ERR_PARSE for anything else
+ */
+int parse_size(const char *s, long long *out);
+
+/**
+ * @brief Parse a duration such as "500ms", "2s", "5m" or "1h".
+ * @param s Input string, a plain number is in seconds
+ * @return Duration in milliseconds, -1 if s is not a duration
+ */
+long long parse_duration(const char *s);
+
+/**
+ * @brief Let SIGINT and SIGTERM request a stop instead of terminating.
+ *
+ * The handler is installed without SA_RESTART, so sleep_ms() and poll()
+ * return early. An earlier stop request is cleared.
+ *
+ * @param on_hup Handler for SIGHUP, NULL to leave SIGHUP alone
+ */
+void stop_on_signal(void (*on_hup)(int));
+
+/**
+ * @brief Check for SIGINT or SIGTERM since stop_on_signal().
+ * @return true once a stop was requested
+ */
+bool stop_requested(void);
+
+/**
+ * @brief Read a clock in milliseconds.
+ * @param clock CLOCK_MONOTONIC for intervals, CLOCK_REALTIME for timestamps
+ * @return Clock value in milliseconds
+ */
+long long clock_ms(clockid_t clock);
+
+/**
+ * @brief Sleep, returning early once a stop was requested.
+ * @param ms Time to sleep in milliseconds, nothing happens for 0 or less
+ */
+void sleep_ms(long long ms);
+
 /**
  * @brief Parse a string as a long long integer.
  * @param s Input string
@@ -107,4 +306,12 @@ long long parse_ll(const char *s, const char *name);
  */
 int run_as_root(void);
 
+/**
+ * @brief Check whether a host name selects the local host.
+ * @param want Host name of a config section
+ * @param host Local host name, may be NULL
+ * @return true if want is the host name or its short form
+ */
+bool host_matches(const char *want, const char *host);
+
 #endif
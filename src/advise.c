@@ -0,0 +1,320 @@
+#include "advise.h"
+#include "reclaim.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const double USEC_PER_MSEC = 1000;
+static const double MIB = 1048576;
+static const double MIN_CORES = 0.01;
+static const double SPIKE_RATIO = 2;
+
+typedef struct {
+  long long t_ms;
+  long long usage_usec;
+  long long nr_periods;
+  long long nr_throttled;
+  reclaim_sample_t mem;
+  double io_psi;
+  bool present[ADVISE_MAX_DEVICES];
+  long long rbytes[ADVISE_MAX_DEVICES];
+  long long wbytes[ADVISE_MAX_DEVICES];
+} snap_t;
+
+// samples of every series, cap entries each
+typedef struct {
+  size_t cap;
+  double *cpu;
+  double *ws;
+  double *cur;
+  double *rbps[ADVISE_MAX_DEVICES];
+  double *wbps[ADVISE_MAX_DEVICES];
+} series_t;
+
+static double read_psi(const char *cgpath, const char *file) {
+  char path[PATH_MAX];
+  char buf[256];
+  double psi = 0;
+  snprintf(path, sizeof(path), "%s/%s", cgpath, file);
+  if (read_file(path, buf, sizeof(buf)) != PLIMIT_OK ||
+      sscanf(buf, "some avg10=%lf", &psi) != 1) {
+    return 0;
+  }
+  return psi;
+}
+
+static int device_index(advise_report_t *r, const char *dev, size_t len) {
+  for (size_t i = 0; i < r->io_count; i++) {
+    if (strlen(r->io[i].dev) == len && strncmp(r->io[i].dev, dev, len) == 0) {
+      return (int)i;
+    }
+  }
+  if (r->io_count == ADVISE_MAX_DEVICES || len >= sizeof(r->io[0].dev)) {
+    return -1;
+  }
+  snprintf(r->io[r->io_count].dev, sizeof(r->io[0].dev), "%.*s", (int)len,
+           dev);
+  return (int)r->io_count++;
+}
+
+static long long io_key(const char *line, size_t len, const char *key) {
+  size_t klen = strlen(key);
+  for (const char *c = line; c < line + len; c++) {
+    if (c[-1] == ' ' && strncmp(c, key, klen) == 0 && c[klen] == '=') {
+      return strtoll(c + klen + 1, NULL, 10);
+    }
+  }
+  return 0;
+}
+
+// "MAJ:MIN rbytes=N wbytes=N rios=N ..." per device, missing without io
+static void read_io(const char *cgpath, advise_report_t *r, snap_t *s) {
+  char path[PATH_MAX];
+  char buf[RECLAIM_STAT_SIZE];
+  snprintf(path, sizeof(path), "%s/io.stat", cgpath);
+  if (read_file(path, buf, sizeof(buf)) != PLIMIT_OK) {
+    return;
+  }
+  for (const char *line = buf; *line;) {
+    size_t len = strcspn(line, "\n");
+    size_t dlen = strcspn(line, " \n");
+    int d = dlen > 0 ? device_index(r, line, dlen) : -1;
+    if (d >= 0) {
+      s->present[d] = true;
+      s->rbytes[d] = io_key(line + 1, len - 1, "rbytes");
+      s->wbytes[d] = io_key(line + 1, len - 1, "wbytes");
+    }
+    line += len + (line[len] == '\n');
+  }
+  s->io_psi = read_psi(cgpath, "io.pressure");
+}
+
+static int take(const char *cgpath, advise_report_t *r, snap_t *s) {
+  memset(s, 0, sizeof(*s));
+  int rc = cg_read_keyed(cgpath, "cpu.stat", "usage_usec", &s->usage_usec);
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to read usage_usec from %s/cpu.stat", cgpath);
+    return rc;
+  }
+  // only with the cpu controller enabled
+  cg_read_keyed(cgpath, "cpu.stat", "nr_periods", &s->nr_periods);
+  cg_read_keyed(cgpath, "cpu.stat", "nr_throttled", &s->nr_throttled);
+  if (r->has_memory) {
+    rc = reclaim_sample(cgpath, &s->mem);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+  }
+  read_io(cgpath, r, s);
+  s->t_ms = clock_ms(CLOCK_MONOTONIC);
+  return PLIMIT_OK;
+}
+
+static double rate(long long from, long long to, long long dt_ms) {
+  return to > from ? (double)(to - from) * MSEC_PER_SEC / (double)dt_ms : 0;
+}
+
+static void record(const snap_t *prev, const snap_t *cur, size_t k,
+                   const advise_report_t *r, series_t *s) {
+  long long dt = cur->t_ms - prev->t_ms;
+  s->cpu[k] = (double)(cur->usage_usec - prev->usage_usec) /
+              ((double)dt * USEC_PER_MSEC);
+  if (r->has_memory) {
+    long long ws =
+        cur->mem.current - cur->mem.inactive_anon - cur->mem.inactive_file;
+    s->ws[k] = ws > 0 ? (double)ws : 0;
+    s->cur[k] = (double)cur->mem.current;
+  }
+  for (size_t d = 0; d < r->io_count; d++) {
+    // a device that just appeared has no previous counters
+    bool both = prev->present[d] && cur->present[d];
+    s->rbps[d][k] = both ? rate(prev->rbytes[d], cur->rbytes[d], dt) : 0;
+    s->wbps[d][k] = both ? rate(prev->wbytes[d], cur->wbytes[d], dt) : 0;
+  }
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// nearest rank of sorted samples
+static double percentile(const double *v, size_t n, double p) {
+  size_t rank = (size_t)(p * (double)n);
+  rank += (double)rank < p * (double)n;
+  return v[rank > 0 ? rank - 1 : 0];
+}
+
+static void summarize(double *v, size_t n, int headroom, bool limited,
+                      advise_rec_t *rec) {
+  qsort(v, n, sizeof(*v), cmp_double);
+  double h = 1 + headroom / 100.0;
+  rec->p50 = percentile(v, n, 0.50);
+  rec->p95 = percentile(v, n, 0.95);
+  rec->p99 = percentile(v, n, 0.99);
+  rec->max = v[n - 1];
+  rec->value = rec->p99 * h;
+  rec->low = rec->p95 * h;
+  rec->high = rec->max * h;
+  rec->limited = limited;
+  if (n < ADVISE_MIN_SAMPLES || limited) {
+    rec->confidence = ADVISE_LOW;
+  } else if (rec->max > rec->p99 * SPIKE_RATIO) {
+    rec->confidence = ADVISE_MEDIUM;
+  } else {
+    rec->confidence = ADVISE_HIGH;
+  }
+}
+
+static double round_mib(double bytes) {
+  long long mib = (long long)(bytes / MIB);
+  mib += (double)mib * MIB < bytes;
+  return (double)(mib > 1 ? mib : 1) * MIB;
+}
+
+static void round_rec(advise_rec_t *rec) {
+  rec->value = round_mib(rec->value);
+  rec->low = round_mib(rec->low);
+  rec->high = round_mib(rec->high);
+}
+
+static int recommend(const advise_opts_t *ao, const char *cgpath,
+                     series_t *s, double mem_psi, double io_psi,
+                     advise_report_t *r) {
+  size_t n = r->samples;
+  summarize(s->cpu, n, ao->headroom, r->throttled > ADVISE_THROTTLED_PCT,
+            &r->cpu);
+  double cores = r->cpu.value > MIN_CORES ? r->cpu.value : MIN_CORES;
+  int rc = cpu_max_for(cores, CPU_LATENCY_NORMAL, -1, &r->cpu_quota,
+                       &r->cpu_period);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+
+  if (r->has_memory) {
+    bool squeezed = mem_psi > ADVISE_PSI_PCT;
+    summarize(s->ws, n, ao->headroom, squeezed, &r->mem_high);
+    summarize(s->cur, n, ao->headroom, squeezed, &r->mem_max);
+    // memory.max has to hold every peak, memory.peak also saw the ones
+    // between samples and before the window
+    long long peak = 0;
+    if (cg_read_value(cgpath, "memory.peak", &peak) == PLIMIT_OK &&
+        (double)peak > r->mem_max.max) {
+      r->mem_max.max = (double)peak;
+    }
+    r->mem_max.low = r->mem_max.value;
+    r->mem_max.value = r->mem_max.max * (1 + ao->headroom / 100.0);
+    r->mem_max.high = r->mem_max.value;
+    round_rec(&r->mem_high);
+    round_rec(&r->mem_max);
+  }
+
+  // keep the devices that saw traffic
+  size_t kept = 0;
+  for (size_t d = 0; d < r->io_count; d++) {
+    advise_io_t io = r->io[d];
+    summarize(s->rbps[d], n, ao->headroom, io_psi > ADVISE_PSI_PCT, &io.rbps);
+    summarize(s->wbps[d], n, ao->headroom, io_psi > ADVISE_PSI_PCT, &io.wbps);
+    if (io.rbps.max <= 0 && io.wbps.max <= 0) {
+      continue;
+    }
+    round_rec(&io.rbps);
+    round_rec(&io.wbps);
+    r->io[kept++] = io;
+  }
+  r->io_count = kept;
+  return PLIMIT_OK;
+}
+
+static int alloc_series(arena_t *a, size_t cap, series_t *s) {
+  s->cap = cap;
+  s->cpu = arena_alloc(a, cap * sizeof(double));
+  s->ws = arena_alloc(a, cap * sizeof(double));
+  s->cur = arena_alloc(a, cap * sizeof(double));
+  bool ok = s->cpu && s->ws && s->cur;
+  for (size_t d = 0; ok && d < ADVISE_MAX_DEVICES; d++) {
+    s->rbps[d] = arena_alloc(a, cap * sizeof(double));
+    s->wbps[d] = arena_alloc(a, cap * sizeof(double));
+    ok = s->rbps[d] && s->wbps[d];
+  }
+  if (!ok) {
+    log_msg(LOG_ERROR, "failed to allocate memory for %zu samples", cap);
+    return PLIMIT_ERR_MEM;
+  }
+  return PLIMIT_OK;
+}
+
+int advise_run(const advise_opts_t *ao, advise_report_t *r) {
+  memset(r, 0, sizeof(*r));
+  arena_t a;
+  arena_init(&a, NULL, 0);
+  series_t s;
+  int rc = PLIMIT_OK;
+  const char *cgpath = cg_full_path(&a, ao->cgname);
+  if (!cgpath) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  rc = alloc_series(&a, (size_t)(ao->window_ms / ao->interval_ms) + 1, &s);
+  if (rc != PLIMIT_OK) {
+    goto exit;
+  }
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/memory.current", cgpath);
+  r->has_memory = access(path, R_OK) == 0;
+
+  stop_on_signal(NULL);
+
+  snap_t prev;
+  snap_t cur;
+  rc = take(cgpath, r, &prev);
+  long long start = prev.t_ms;
+  long long nr_periods = prev.nr_periods;
+  long long nr_throttled = prev.nr_throttled;
+  double mem_psi = 0;
+  double io_psi = 0;
+  while (rc == PLIMIT_OK && !stop_requested() && r->samples < s.cap &&
+         prev.t_ms - start < ao->window_ms) {
+    sleep_ms(ao->interval_ms);
+    if (stop_requested()) {
+      break;
+    }
+    rc = take(cgpath, r, &cur);
+    if (rc != PLIMIT_OK || cur.t_ms <= prev.t_ms) {
+      continue;
+    }
+    record(&prev, &cur, r->samples, r, &s);
+    mem_psi = cur.mem.psi_some > mem_psi ? cur.mem.psi_some : mem_psi;
+    io_psi = cur.io_psi > io_psi ? cur.io_psi : io_psi;
+    if (ao->opts.verbose) {
+      log_msg(LOG_INFO, "sample %zu: %.2f cores, %lld bytes", r->samples + 1,
+              s.cpu[r->samples], cur.mem.current);
+    }
+    r->samples++;
+    prev = cur;
+  }
+  if (rc != PLIMIT_OK) {
+    goto exit;
+  }
+  r->elapsed_ms = prev.t_ms - start;
+  if (r->samples == 0) {
+    log_msg(LOG_ERROR, "stopped before the first sample of '%s'",
+            ao->cgname);
+    rc = PLIMIT_ERR_NOTFOUND;
+    goto exit;
+  }
+  if (prev.nr_periods > nr_periods) {
+    r->throttled = (double)(prev.nr_throttled - nr_throttled) * 100 /
+                   (double)(prev.nr_periods - nr_periods);
+  }
+  rc = recommend(ao, cgpath, &s, mem_psi, io_psi, r);
+
+exit:
+  arena_release(&a);
+  return rc;
+}
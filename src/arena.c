@@ -0,0 +1,142 @@
+#include "arena.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t ARENA_ALIGN = 16;
+
+static size_t align_up(size_t n) {
+  return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+void arena_init(arena_t *a, void *buf, size_t size) {
+  memset(a, 0, sizeof(*a));
+  if (buf) {
+    // the initial buffer must honour the same alignment as heap blocks
+    size_t skip = (ARENA_ALIGN - ((uintptr_t)buf & (ARENA_ALIGN - 1))) &
+                  (ARENA_ALIGN - 1);
+    if (size > skip) {
+      a->buf = (char *)buf + skip;
+      a->size = size - skip;
+    }
+  }
+}
+
+static void *bump(char *base, size_t *used, size_t cap, size_t size) {
+  size_t off = align_up(*used);
+  if (off > cap || cap - off < size) {
+    return NULL;
+  }
+  *used = off + size;
+  return base + off;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+  void *p = NULL;
+  if (a->buf) {
+    p = bump(a->buf, &a->used, a->size, size);
+  }
+  if (!p && a->blocks) {
+    p = bump(a->blocks->data, &a->blocks->used, a->blocks->size, size);
+  }
+  if (!p) {
+    // doubling past SIZE_MAX / 2 would wrap to 0 and never end
+    if (size > (SIZE_MAX - sizeof(arena_block_t)) / 2) {
+      return NULL;
+    }
+    size_t bsize = ARENA_BLOCK_SIZE;
+    while (bsize < size) {
+      bsize *= 2;
+    }
+    arena_block_t *b = (arena_block_t *)malloc(sizeof(*b) + bsize);
+    if (!b) {
+      return NULL;
+    }
+    b->next = a->blocks;
+    b->size = bsize;
+    b->used = 0;
+    a->blocks = b;
+    p = bump(b->data, &b->used, b->size, size);
+  }
+  memset(p, 0, size);
+  a->last = (char *)p;
+  return p;
+}
+
+void *arena_realloc(arena_t *a, void *ptr, size_t old_size, size_t new_size) {
+  if (!ptr) {
+    return arena_alloc(a, new_size);
+  }
+  if (new_size <= old_size) {
+    return ptr;
+  }
+  // the most recent allocation can simply be extended if room is left
+  if ((char *)ptr == a->last) {
+    char *base = a->buf;
+    size_t *used = &a->used;
+    size_t cap = a->size;
+    if (a->blocks && (char *)ptr >= a->blocks->data &&
+        (char *)ptr < a->blocks->data + a->blocks->size) {
+      base = a->blocks->data;
+      used = &a->blocks->used;
+      cap = a->blocks->size;
+    }
+    size_t off = (size_t)((char *)ptr - base);
+    if (base && off <= cap && cap - off >= new_size) {
+      memset((char *)ptr + old_size, 0, new_size - old_size);
+      *used = off + new_size;
+      return ptr;
+    }
+  }
+  void *p = arena_alloc(a, new_size);
+  if (p) {
+    memcpy(p, ptr, old_size);
+  }
+  return p;
+}
+
+static char *copy_string(arena_t *a, const char *s, size_t len) {
+  char *p = (char *)arena_alloc(a, len + 1);
+  if (p) {
+    memcpy(p, s, len);
+  }
+  return p;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n) {
+  return copy_string(a, s, strnlen(s, n));
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+  return copy_string(a, s, strlen(s));
+}
+
+char *arena_sprintf(arena_t *a, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (len < 0) {
+    return NULL;
+  }
+  char *p = (char *)arena_alloc(a, (size_t)len + 1);
+  if (!p) {
+    return NULL;
+  }
+  va_start(ap, fmt);
+  vsnprintf(p, (size_t)len + 1, fmt, ap);
+  va_end(ap);
+  return p;
+}
+
+void arena_release(arena_t *a) {
+  while (a->blocks) {
+    arena_block_t *next = a->blocks->next;
+    free(a->blocks);
+    a->blocks = next;
+  }
+  a->used = 0;
+  a->last = NULL;
+}
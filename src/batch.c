@@ -0,0 +1,311 @@
+#include "batch.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// user_data of a CQE: entry index * 3 + step of the chain
+enum { STEP_OPEN, STEP_WRITE, STEP_CLOSE, STEPS };
+
+typedef struct {
+  int fd;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_len;
+  size_t cq_ring_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+} uring_t;
+
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t uring_key;
+static atomic_bool uring_disabled;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(SYS_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+  return (int)syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned op, void *arg,
+                                 unsigned nr) {
+  return (int)syscall(SYS_io_uring_register, fd, op, arg, nr);
+}
+
+static void uring_free(void *p) {
+  uring_t *r = (uring_t *)p;
+  if (!r) {
+    return;
+  }
+  if (r->sqes && r->sqes != MAP_FAILED) {
+    munmap(r->sqes, r->sqes_len);
+  }
+  if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) {
+    munmap(r->cq_ring, r->cq_ring_len);
+  }
+  if (r->sq_ring && r->sq_ring != MAP_FAILED) {
+    munmap(r->sq_ring, r->sq_ring_len);
+  }
+  if (r->fd >= 0) {
+    close(r->fd);
+  }
+  free(r);
+}
+
+static void uring_key_init(void) {
+  pthread_key_create(&uring_key, uring_free);
+  const char *env = getenv(BATCH_URING_ENV);
+  if (env && strcmp(env, "0") == 0) {
+    atomic_store(&uring_disabled, true);
+  }
+}
+
+static bool uring_ops_supported(int fd) {
+  size_t len = sizeof(struct io_uring_probe) +
+               IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, len);
+  if (!probe) {
+    return false;
+  }
+  bool ok = sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe,
+                                  IORING_OP_LAST) == 0;
+  const int ops[] = {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE};
+  for (size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i++) {
+    ok = ops[i] <= probe->last_op &&
+         (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+  }
+  free(probe);
+  return ok;
+}
+
+static uring_t *uring_create(void) {
+  uring_t *r = calloc(1, sizeof(*r));
+  if (!r) {
+    return NULL;
+  }
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  r->fd = sys_io_uring_setup(BATCH_URING_SIZE * STEPS, &p);
+  if (r->fd < 0 || !(p.features & IORING_FEAT_NODROP) ||
+      !uring_ops_supported(r->fd)) {
+    goto fail;
+  }
+
+  r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_ring_len > r->sq_ring_len) {
+      r->sq_ring_len = r->cq_ring_len;
+    }
+    r->cq_ring_len = r->sq_ring_len;
+  }
+  r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ring == MAP_FAILED) {
+    goto fail;
+  }
+  r->cq_ring = r->sq_ring;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ring == MAP_FAILED) {
+      goto fail;
+    }
+  }
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    goto fail;
+  }
+
+  char *sq = (char *)r->sq_ring;
+  char *cq = (char *)r->cq_ring;
+  r->sq_head = (unsigned *)(sq + p.sq_off.head);
+  r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + p.sq_off.array);
+  r->cq_head = (unsigned *)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  // one empty direct descriptor slot per entry of a chunk
+  int slots[BATCH_URING_SIZE];
+  for (size_t i = 0; i < BATCH_URING_SIZE; i++) {
+    slots[i] = -1;
+  }
+  if (sys_io_uring_register(r->fd, IORING_REGISTER_FILES, slots,
+                            BATCH_URING_SIZE) != 0) {
+    goto fail;
+  }
+  return r;
+
+fail:
+  uring_free(r);
+  return NULL;
+}
+
+// the ring of the calling thread, created on first use
+static uring_t *uring_get(void) {
+  pthread_once(&uring_once, uring_key_init);
+  if (atomic_load(&uring_disabled)) {
+    return NULL;
+  }
+  uring_t *r = (uring_t *)pthread_getspecific(uring_key);
+  if (!r) {
+    r = uring_create();
+    if (!r) {
+      // no point in trying again for every batch
+      atomic_store(&uring_disabled, true);
+      return NULL;
+    }
+    pthread_setspecific(uring_key, r);
+  }
+  return r;
+}
+
+// queue the openat -> write -> close chain of one entry at SQ position tail
+static void prep_chain(uring_t *r, unsigned tail, const file_write_t *w,
+                       unsigned slot, size_t index) {
+  struct io_uring_sqe *sqe[STEPS];
+  for (unsigned s = 0; s < STEPS; s++) {
+    unsigned idx = (tail + s) & *r->sq_mask;
+    r->sq_array[idx] = idx;
+    sqe[s] = &r->sqes[idx];
+    memset(sqe[s], 0, sizeof(*sqe[s]));
+    sqe[s]->user_data = index * STEPS + s;
+  }
+
+  // O_CLOEXEC is rejected for direct descriptors, which never reach the
+  // file table anyway; O_CREAT would force every open onto an io-wq worker
+  sqe[STEP_OPEN]->opcode = IORING_OP_OPENAT;
+  sqe[STEP_OPEN]->fd = AT_FDCWD;
+  sqe[STEP_OPEN]->addr = (uint64_t)(uintptr_t)w->args.path;
+  sqe[STEP_OPEN]->open_flags = O_WRONLY | O_TRUNC;
+  sqe[STEP_OPEN]->file_index = slot + 1;
+  sqe[STEP_OPEN]->flags = IOSQE_IO_LINK;
+
+  // a hard link so that the slot is closed even if the write fails
+  sqe[STEP_WRITE]->opcode = IORING_OP_WRITE;
+  sqe[STEP_WRITE]->fd = (int)slot;
+  sqe[STEP_WRITE]->addr = (uint64_t)(uintptr_t)w->args.data;
+  sqe[STEP_WRITE]->len = (unsigned)strlen(w->args.data);
+  sqe[STEP_WRITE]->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+  sqe[STEP_CLOSE]->opcode = IORING_OP_CLOSE;
+  sqe[STEP_CLOSE]->file_index = slot + 1;
+}
+
+// submit one chunk and wait for all of its completions; entries the kernel
+// could not run as a chain are flagged with err == EOPNOTSUPP
+static int uring_write_chunk(uring_t *r, file_write_t *writes, size_t count) {
+  unsigned tail = *r->sq_tail;
+  for (size_t i = 0; i < count; i++) {
+    writes[i].rc = PLIMIT_OK;
+    writes[i].err = 0;
+    prep_chain(r, tail + (unsigned)i * STEPS, &writes[i], (unsigned)i, i);
+  }
+  unsigned total = (unsigned)count * STEPS;
+  atomic_store_explicit((_Atomic unsigned *)r->sq_tail, tail + total,
+                        memory_order_release);
+
+  uint64_t t = trace_begin();
+  unsigned pending = total;
+  unsigned seen = 0;
+  int ret = 0;
+  while (seen < total) {
+    ret = sys_io_uring_enter(r->fd, pending, total - seen,
+                             IORING_ENTER_GETEVENTS);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < 0) {
+      break;
+    }
+    pending -= (unsigned)ret < pending ? (unsigned)ret : pending;
+    unsigned head = *r->cq_head;
+    unsigned ctail = atomic_load_explicit((_Atomic unsigned *)r->cq_tail,
+                                          memory_order_acquire);
+    for (; head != ctail; head++, seen++) {
+      const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      file_write_t *w = &writes[cqe->user_data / STEPS];
+      unsigned step = (unsigned)(cqe->user_data % STEPS);
+      if (step == STEP_OPEN && cqe->res < 0) {
+        // EINVAL/EBADF: no direct descriptors (Linux < 5.15)
+        bool unsupported = cqe->res == -EINVAL || cqe->res == -EBADF;
+        w->rc = unsupported ? PLIMIT_ERR_SYS : PLIMIT_ERR_IO;
+        w->err = unsupported ? EOPNOTSUPP : -cqe->res;
+      } else if (step == STEP_WRITE && w->rc == PLIMIT_OK &&
+                 (cqe->res < 0 ||
+                  (size_t)cqe->res != strlen(w->args.data))) {
+        w->rc = PLIMIT_ERR_IO;
+        w->err = cqe->res < 0 ? -cqe->res : EIO;
+      }
+    }
+    atomic_store_explicit((_Atomic unsigned *)r->cq_head, head,
+                          memory_order_release);
+  }
+  trace_end(t, "io_uring_enter", NULL, ret < 0 ? -errno : 0);
+  return ret < 0 ? PLIMIT_ERR_SYS : PLIMIT_OK;
+}
+
+int write_files(bool dry_run, file_write_t *writes, size_t count,
+                bool verbose) {
+  uring_t *r = NULL;
+  if (!dry_run && count >= BATCH_URING_MIN) {
+    r = uring_get();
+  }
+  // entries before done went through the ring
+  size_t done = 0;
+  while (r && done < count) {
+    size_t n = count - done;
+    if (n > BATCH_URING_SIZE) {
+      n = BATCH_URING_SIZE;
+    }
+    if (uring_write_chunk(r, writes + done, n) != PLIMIT_OK) {
+      // the ring is in an unknown state, finish synchronously
+      pthread_setspecific(uring_key, NULL);
+      uring_free(r);
+      atomic_store(&uring_disabled, true);
+      r = NULL;
+      break;
+    }
+    done += n;
+  }
+
+  int rc = PLIMIT_OK;
+  for (size_t i = 0; i < count; i++) {
+    file_write_t *w = &writes[i];
+    if (i >= done || (w->rc == PLIMIT_ERR_SYS && w->err == EOPNOTSUPP)) {
+      w->rc = write_file(dry_run, &w->args, verbose);
+      w->err = w->rc == PLIMIT_OK ? 0 : errno;
+    } else if (w->rc == PLIMIT_OK) {
+      log_action(LOG_ACTION_WRITE, w->args.path, w->args.data, false,
+                 verbose);
+    }
+    if (w->rc != PLIMIT_OK && rc == PLIMIT_OK) {
+      rc = w->rc;
+    }
+  }
+  return rc;
+}
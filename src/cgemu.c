@@ -0,0 +1,474 @@
+#include "cgemu.h"
+#include "cgroups.h"
+#include "hugetlb.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const mode_t EMU_FILE_PERM = 0644;
+
+typedef struct {
+  const char *controller; // NULL for files present in every cgroup
+  const char *file;
+  const char *value;
+} emu_file_t;
+
+static const emu_file_t EMU_FILES[] = {
+    {NULL, "cgroup.threads", ""},
+    {NULL, "cgroup.subtree_control", ""},
+    {NULL, "cgroup.events", "populated 0\nfrozen 0\n"},
+    {NULL, "cgroup.freeze", "0\n"},
+    {NULL, "cgroup.type", "domain\n"},
+    {NULL, "cpu.stat", "usage_usec 0\nuser_usec 0\nsystem_usec 0\n"},
+    {"cpu", "cpu.max", "max 100000\n"},
+    {"cpu", "cpu.weight", "100\n"},
+    {"cpu", "cpu.idle", "0\n"},
+    {"cpu", "cpu.uclamp.min", "0.00\n"},
+    {"cpu", "cpu.uclamp.max", "max\n"},
+    {"memory", "memory.max", "max\n"},
+    {"memory", "memory.high", "max\n"},
+    {"memory", "memory.low", "0\n"},
+    {"memory", "memory.min", "0\n"},
+    {"memory", "memory.current", "0\n"},
+    {"memory", "memory.stat", "anon 0\nfile 0\n"},
+    {"memory", "memory.reclaim", ""},
+    {"memory", "memory.pressure",
+     "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+     "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"},
+    {"io", "io.max", ""},
+    {"io", "io.weight", "default 100\n"},
+    {"io", "io.stat", ""},
+    {"pids", "pids.max", "max\n"},
+    {"pids", "pids.current", "0\n"},
+};
+
+static int put_file(const char *cgpath, const char *file, const char *value,
+                    int flags) {
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/%s", cgpath, file) >=
+      (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return PLIMIT_ERR_IO;
+  }
+  int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | flags, EMU_FILE_PERM);
+  if (fd < 0) {
+    return PLIMIT_ERR_IO;
+  }
+  size_t len = strlen(value);
+  ssize_t n = write(fd, value, len);
+  close(fd);
+  return n == (ssize_t)len ? PLIMIT_OK : PLIMIT_ERR_IO;
+}
+
+// true if the space separated list contains name
+static bool has_word(const char *list, const char *name, size_t len) {
+  for (const char *c = list; *c;) {
+    c += strspn(c, " \n");
+    size_t wlen = strcspn(c, " \n");
+    if (wlen == len && strncmp(c, name, len) == 0) {
+      return true;
+    }
+    c += wlen;
+  }
+  return false;
+}
+
+static int populate_hugetlb(const char *cgpath) {
+  long long sizes[HUGETLB_MAX_SIZES];
+  size_t count = 0;
+  // hosts without hugepages simply get no hugetlb files
+  if (hugetlb_page_sizes(sizes, HUGETLB_MAX_SIZES, &count) != PLIMIT_OK) {
+    return PLIMIT_OK;
+  }
+  static const char *const suffixes[] = {"max", "rsvd.max", "current"};
+  for (size_t i = 0; i < count; i++) {
+    char name[16];
+    char file[64];
+    hugetlb_size_name(sizes[i], name, sizeof(name));
+    for (size_t j = 0; j < sizeof(suffixes) / sizeof(suffixes[0]); j++) {
+      snprintf(file, sizeof(file), "hugetlb.%s.%s", name, suffixes[j]);
+      int rc = put_file(cgpath, file, j == 2 ? "0\n" : "max\n", O_EXCL);
+      if (rc != PLIMIT_OK && errno != EEXIST) {
+        return rc;
+      }
+    }
+  }
+  return PLIMIT_OK;
+}
+
+int cgemu_populate(const char *cgpath) {
+  char path[PATH_MAX];
+  char enabled[1024] = "";
+  if (snprintf(path, sizeof(path), "%s/cgroup.procs", cgpath) >=
+      (int)sizeof(path)) {
+    return PLIMIT_ERR_ARG;
+  }
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    return PLIMIT_OK;
+  }
+
+  // the controllers available here are the ones the parent enabled
+  snprintf(path, sizeof(path), "%s", cgpath);
+  char *slash = strrchr(path, '/');
+  if (slash && slash != path &&
+      strlen(path) + strlen("/cgroup.subtree_control") < sizeof(path)) {
+    strcpy(slash, "/cgroup.subtree_control");
+    if (read_file(path, enabled, sizeof(enabled)) != PLIMIT_OK) {
+      *enabled = '\0';
+    }
+  }
+
+  char line[1024 + 1];
+  snprintf(line, sizeof(line), "%s\n", enabled);
+  int rc = put_file(cgpath, "cgroup.controllers", *enabled ? line : "", 0);
+  size_t nfiles = sizeof(EMU_FILES) / sizeof(EMU_FILES[0]);
+  for (size_t i = 0; rc == PLIMIT_OK && i < nfiles; i++) {
+    const emu_file_t *f = &EMU_FILES[i];
+    if (!f->controller ||
+        has_word(enabled, f->controller, strlen(f->controller))) {
+      rc = put_file(cgpath, f->file, f->value, O_TRUNC);
+    }
+  }
+  if (rc == PLIMIT_OK && has_word(enabled, "hugetlb", strlen("hugetlb"))) {
+    rc = populate_hugetlb(cgpath);
+  }
+  // cgroup.procs goes last, it marks the cgroup as populated
+  if (rc == PLIMIT_OK) {
+    rc = put_file(cgpath, "cgroup.procs", "", O_TRUNC);
+  }
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to populate emulated cgroup '%s': %s", cgpath,
+            strerror(errno));
+  }
+  return rc;
+}
+
+static int pid_index_path(const char *pid, char *buf, size_t len) {
+  if (snprintf(buf, len, "%s/%s/%s", cg_root(), CGEMU_PID_INDEX, pid) >=
+      (int)len) {
+    errno = ENAMETOOLONG;
+    return PLIMIT_ERR_IO;
+  }
+  return PLIMIT_OK;
+}
+
+// rewrite a cgroup.procs file without the given PID
+static void drop_pid(const char *cgpath, const char *pid) {
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/cgroup.procs", cgpath) >=
+      (int)sizeof(path)) {
+    return;
+  }
+  FILE *fp = fopen(path, "r+e");
+  if (!fp) {
+    return;
+  }
+  char *data = NULL;
+  size_t cap = 0;
+  size_t used = 0;
+  char *line = NULL;
+  size_t lcap = 0;
+  ssize_t n;
+  size_t plen = strlen(pid);
+  while ((n = getline(&line, &lcap, fp)) > 0) {
+    if ((size_t)n >= plen && strncmp(line, pid, plen) == 0 &&
+        (line[plen] == '\n' || line[plen] == '\0')) {
+      continue;
+    }
+    if (used + (size_t)n > cap) {
+      cap = (used + (size_t)n) * 2;
+      char *tmp = (char *)realloc(data, cap);
+      if (!tmp) {
+        goto exit;
+      }
+      data = tmp;
+    }
+    memcpy(data + used, line, (size_t)n);
+    used += (size_t)n;
+  }
+  rewind(fp);
+  if (ftruncate(fileno(fp), 0) == 0 && used > 0) {
+    fwrite(data, 1, used, fp);
+  }
+
+exit:
+  free(line);
+  free(data);
+  fclose(fp);
+}
+
+static bool has_procs(const char *cgpath) {
+  char path[PATH_MAX];
+  struct stat st;
+  return snprintf(path, sizeof(path), "%s/cgroup.procs", cgpath) <
+             (int)sizeof(path) &&
+         stat(path, &st) == 0 && st.st_size > 0;
+}
+
+// no internal processes: below the root a cgroup either has member PIDs or
+// controllers enabled for its children, never both
+static bool has_subtree_controllers(const char *cgpath) {
+  char path[PATH_MAX];
+  char cur[1024];
+  return strcmp(cgpath, cg_root()) != 0 &&
+         snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgpath) <
+             (int)sizeof(path) &&
+         read_file(path, cur, sizeof(cur)) == PLIMIT_OK && *cur;
+}
+
+// moving a PID rewrites the procs files of two cgroups, serialize the
+// migrations of concurrent threads like the kernel does
+static pthread_mutex_t attach_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int attach_locked(const file_write_args_t *args, bool verbose) {
+  if (access(args->path, W_OK) != 0) {
+    log_msg(LOG_ERROR, "cannot write to file '%s': %s", args->path,
+            strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  char cgpath[PATH_MAX];
+  char index[PATH_MAX];
+  char prev[PATH_MAX];
+  snprintf(cgpath, sizeof(cgpath), "%s", args->path);
+  *strrchr(cgpath, '/') = '\0';
+  if (has_subtree_controllers(cgpath)) {
+    errno = EBUSY;
+    return PLIMIT_ERR_IO;
+  }
+  if (pid_index_path(args->data, index, sizeof(index)) != PLIMIT_OK) {
+    return PLIMIT_ERR_IO;
+  }
+
+  // the index remembers where each PID lives so it is in one cgroup only
+  ssize_t plen = readlink(index, prev, sizeof(prev) - 1);
+  if (plen > 0) {
+    prev[plen] = '\0';
+    if (strcmp(prev, cgpath) == 0) {
+      return PLIMIT_OK;
+    }
+    drop_pid(prev, args->data);
+  }
+
+  char line[32];
+  snprintf(line, sizeof(line), "%s\n", args->data);
+  int rc = put_file(cgpath, "cgroup.procs", line, O_APPEND);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  unlink(index);
+  if (symlink(cgpath, index) != 0 && errno == ENOENT) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%s", cg_root(), CGEMU_PID_INDEX);
+    mkdir(dir, 0755);
+    if (symlink(cgpath, index) != 0) {
+      return PLIMIT_ERR_IO;
+    }
+  }
+  log_action(LOG_ACTION_WRITE, args->path, args->data, false, verbose);
+  return PLIMIT_OK;
+}
+
+int cgemu_attach(const file_write_args_t *args, bool verbose) {
+  pthread_mutex_lock(&attach_lock);
+  int rc = attach_locked(args, verbose);
+  pthread_mutex_unlock(&attach_lock);
+  return rc;
+}
+
+int cgemu_subtree_control(const file_write_args_t *args, bool verbose) {
+  char path[PATH_MAX];
+  char avail[1024];
+  char cur[1024];
+  snprintf(path, sizeof(path), "%s", args->path);
+  char *slash = strrchr(path, '/');
+  if (!slash || (size_t)(slash - path) + strlen("/cgroup.controllers") >=
+                    sizeof(path)) {
+    errno = EINVAL;
+    return PLIMIT_ERR_ARG;
+  }
+  strcpy(slash, "/cgroup.controllers");
+  if (read_file(path, avail, sizeof(avail)) != PLIMIT_OK ||
+      read_file(args->path, cur, sizeof(cur)) != PLIMIT_OK) {
+    errno = ENOENT;
+    return PLIMIT_ERR_IO;
+  }
+
+  // validate the whole request first, the kernel applies all or nothing
+  bool enable = false;
+  for (const char *c = args->data; *c;) {
+    c += strspn(c, " ");
+    size_t len = strcspn(c, " ");
+    if (len == 0) {
+      break;
+    }
+    if ((*c != '+' && *c != '-') || !has_word(avail, c + 1, len - 1)) {
+      errno = *c == '+' || *c == '-' ? ENOENT : EINVAL;
+      return PLIMIT_ERR_IO;
+    }
+    enable = enable || *c == '+';
+    c += len;
+  }
+  *slash = '\0';
+  if (enable && strcmp(path, cg_root()) != 0 && has_procs(path)) {
+    errno = EBUSY;
+    return PLIMIT_ERR_IO;
+  }
+
+  // rebuild the set in the order of cgroup.controllers
+  char out[1024] = "";
+  size_t used = 0;
+  for (const char *a = avail; *a;) {
+    a += strspn(a, " ");
+    size_t alen = strcspn(a, " ");
+    if (alen == 0) {
+      break;
+    }
+    bool on = has_word(cur, a, alen);
+    for (const char *c = args->data; *c;) {
+      c += strspn(c, " ");
+      size_t len = strcspn(c, " ");
+      if (len == alen + 1 && strncmp(c + 1, a, alen) == 0) {
+        on = *c == '+';
+      }
+      c += len;
+    }
+    if (on && used + alen + 2 < sizeof(out)) {
+      used += (size_t)snprintf(out + used, sizeof(out) - used, "%s%.*s",
+                               used ? " " : "", (int)alen, a);
+    }
+    a += alen;
+  }
+  if (used + 1 < sizeof(out)) {
+    out[used++] = '\n';
+    out[used] = '\0';
+  }
+
+  snprintf(path, sizeof(path), "%s", args->path);
+  *strrchr(path, '/') = '\0';
+  int rc = put_file(path, "cgroup.subtree_control", used > 1 ? out : "",
+                    O_TRUNC);
+  if (rc == PLIMIT_OK) {
+    log_action(LOG_ACTION_WRITE, args->path, args->data, false, verbose);
+  }
+  return rc;
+}
+
+int cgemu_freeze(const file_write_args_t *args, bool verbose) {
+  if (strcmp(args->data, "0") != 0 && strcmp(args->data, "1") != 0) {
+    errno = EINVAL;
+    return PLIMIT_ERR_ARG;
+  }
+  char cgpath[PATH_MAX];
+  char path[PATH_MAX];
+  char events[256];
+  snprintf(cgpath, sizeof(cgpath), "%s", args->path);
+  char *slash = strrchr(cgpath, '/');
+  if (!slash) {
+    errno = EINVAL;
+    return PLIMIT_ERR_ARG;
+  }
+  *slash = '\0';
+  if (snprintf(path, sizeof(path), "%s/cgroup.events", cgpath) >=
+      (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return PLIMIT_ERR_IO;
+  }
+  if (read_file(path, events, sizeof(events)) != PLIMIT_OK) {
+    errno = ENOENT;
+    return PLIMIT_ERR_IO;
+  }
+  // keep the other keys, e.g. "populated"
+  char out[300];
+  size_t used = 0;
+  for (char *l = events; *l;) {
+    size_t len = strcspn(l, "\n");
+    if (strncmp(l, "frozen ", 7) != 0) {
+      used += (size_t)snprintf(out + used, sizeof(out) - used, "%.*s\n",
+                               (int)len, l);
+    }
+    l += len + (l[len] == '\n');
+  }
+  snprintf(out + used, sizeof(out) - used, "frozen %s\n", args->data);
+  int rc = put_file(cgpath, "cgroup.freeze", args->data, O_TRUNC);
+  if (rc == PLIMIT_OK) {
+    rc = put_file(cgpath, "cgroup.events", out, O_TRUNC);
+  }
+  if (rc == PLIMIT_OK) {
+    log_action(LOG_ACTION_WRITE, args->path, args->data, false, verbose);
+  }
+  return rc;
+}
+
+int cgemu_proc_cgroup(pid_t pid, char *buf, size_t size) {
+  char name[32];
+  char index[PATH_MAX];
+  char target[PATH_MAX];
+  snprintf(name, sizeof(name), "%d", pid);
+  if (pid_index_path(name, index, sizeof(index)) != PLIMIT_OK) {
+    return PLIMIT_ERR_IO;
+  }
+  ssize_t n = readlink(index, target, sizeof(target) - 1);
+  size_t rlen = strlen(cg_root());
+  // a PID that was never attached lives in the root cgroup
+  const char *rel = "";
+  if (n > 0) {
+    target[n] = '\0';
+    if (strncmp(target, cg_root(), rlen) == 0 && target[rlen] == '/') {
+      rel = target + rlen + 1;
+    }
+  }
+  if (snprintf(buf, size, "%s", rel) >= (int)size) {
+    errno = ENAMETOOLONG;
+    return PLIMIT_ERR_IO;
+  }
+  return PLIMIT_OK;
+}
+
+int cgemu_rmdir(const char *cgpath) {
+  char path[PATH_MAX];
+  struct stat st;
+  if (snprintf(path, sizeof(path), "%s/cgroup.procs", cgpath) >=
+      (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if (stat(path, &st) == 0 && st.st_size > 0) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  DIR *dir = opendir(cgpath);
+  if (!dir) {
+    return -1;
+  }
+  int dfd = dirfd(dir);
+  struct dirent *de;
+  // child cgroups keep the directory busy, interface files go away with it
+  while ((de = readdir(dir)) != NULL) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+        S_ISDIR(st.st_mode)) {
+      closedir(dir);
+      errno = ENOTEMPTY;
+      return -1;
+    }
+  }
+  rewinddir(dir);
+  while ((de = readdir(dir)) != NULL) {
+    if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+      unlinkat(dfd, de->d_name, 0);
+    }
+  }
+  closedir(dir);
+  return rmdir(cgpath);
+}
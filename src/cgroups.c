@@ -1,65 +1,202 @@
 #include "cgroups.h"
+#include "cgemu.h"
+#include "trace.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/magic.h>
+#include <math.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <sys/xattr.h>
+#include <time.h>
 #include <unistd.h>
 
 static const int CGFILE_PERM = 0644;
+static const mode_t CGDIR_PERM = 0755;
+static const int IOPRIO_WHO_PROCESS = 1;
+static const double UCLAMP_MAX_PERCENT = 100;
 
-char *cg_full_path(const char *name) {
-  char *p = NULL;
+static struct {
+  char root[PATH_MAX];
+  char plimit[PATH_MAX];
+  bool emulated;
+} hierarchy;
+
+static pthread_once_t hierarchy_once = PTHREAD_ONCE_INIT;
+
+// mountinfo escapes blanks and backslashes in paths as \ooo
+static void unescape_octal(char *s) {
+  char *out = s;
+  for (char *in = s; *in; ++out) {
+    if (in[0] == '\\' && in[1] >= '0' && in[1] <= '7' && in[2] >= '0' &&
+        in[2] <= '7' && in[3] >= '0' && in[3] <= '7') {
+      *out = (char)(((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0'));
+      in += 4;
+    } else {
+      *out = *in++;
+    }
+  }
+  *out = '\0';
+}
+
+int cg_find_mount(const char *mountinfo, char *buf, size_t len) {
+  FILE *fp = fopen(mountinfo, "re");
+  if (!fp) {
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  int rc = PLIMIT_ERR_NOTFOUND;
+  char *line = NULL;
+  size_t cap = 0;
+  while (rc != PLIMIT_OK && getline(&line, &cap, fp) > 0) {
+    // ID PARENT MAJ:MIN ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - FSTYPE ...
+    char *sep = strstr(line, " - ");
+    if (!sep || strncmp(sep + 3, "cgroup2 ", 8) != 0) {
+      continue;
+    }
+    *sep = '\0';
+    char *save = NULL;
+    char *field = strtok_r(line, " ", &save);
+    for (int i = 0; field && i < 4; i++) {
+      field = strtok_r(NULL, " ", &save);
+    }
+    if (field) {
+      unescape_octal(field);
+      if (snprintf(buf, len, "%s", field) < (int)len) {
+        rc = PLIMIT_OK;
+      }
+    }
+  }
+  free(line);
+  fclose(fp);
+  return rc;
+}
+
+int cg_set_root(const char *path) {
+  char found[PATH_MAX];
+  if (!path) {
+    path = getenv(CGROUP_ROOT_ENV);
+  }
+  if (!path || !*path) {
+    path = cg_find_mount(MOUNTINFO_PATH, found, sizeof(found)) == PLIMIT_OK
+               ? found
+               : CGROUP_ROOT_PATH;
+  }
+  size_t len = strlen(path);
+  while (len > 0 && path[len - 1] == '/') {
+    len--;
+  }
+  if (*path != '/' || len == 0 || len >= sizeof(hierarchy.root) ||
+      len + 1 + strlen(CGROUPS_PLIMIT_DEFAULT_NAME) >=
+          sizeof(hierarchy.plimit)) {
+    log_msg(LOG_ERROR, "invalid cgroup root '%s' (expected an absolute path "
+                       "below /)",
+            path);
+    return PLIMIT_ERR_ARG;
+  }
+  memcpy(hierarchy.root, path, len);
+  hierarchy.root[len] = '\0';
+  memcpy(hierarchy.plimit, path, len);
+  hierarchy.plimit[len] = '/';
+  strcpy(hierarchy.plimit + len + 1, CGROUPS_PLIMIT_DEFAULT_NAME);
+
+  struct statfs sfs;
+  hierarchy.emulated =
+      statfs(hierarchy.root, &sfs) == 0 && sfs.f_type != CGROUP2_SUPER_MAGIC;
+  return PLIMIT_OK;
+}
+
+static void discover_root(void) {
+  if (!*hierarchy.root && cg_set_root(NULL) != PLIMIT_OK) {
+    cg_set_root(CGROUP_ROOT_PATH);
+  }
+}
+
+const char *cg_root(void) {
+  if (!*hierarchy.root) {
+    pthread_once(&hierarchy_once, discover_root);
+  }
+  return hierarchy.root;
+}
+
+const char *cg_plimit_root(void) {
+  cg_root();
+  return hierarchy.plimit;
+}
+
+bool cg_emulated(void) {
+  cg_root();
+  return hierarchy.emulated;
+}
+
+int cg_check_access(void) {
+  // an emulated hierarchy is plain files owned by the caller
+  if (!cg_emulated() && !run_as_root()) {
+    log_msg(LOG_ERROR, "must be run as root or with CAP_SYS_ADMIN: %s",
+            strerror(EPERM));
+    return PLIMIT_ERR_PERM;
+  }
+  return PLIMIT_OK;
+}
+
+int cg_mkdir(const char *path, const run_opts_t *opts) {
+  uint64_t t = trace_begin();
+  int rc = create_directory(opts->dry_run, path, CGDIR_PERM, opts->verbose);
+  if (rc == PLIMIT_OK && !opts->dry_run && cg_emulated()) {
+    rc = cgemu_populate(path);
+  }
+  trace_end(t, "cg_mkdir", path, rc);
+  return rc;
+}
+
+int cg_rmdir(const char *path) {
+  uint64_t t = trace_begin();
+  int ret = cg_emulated() ? cgemu_rmdir(path) : rmdir(path);
+  trace_end(t, "rmdir", path, ret < 0 ? -errno : 0);
+  return ret;
+}
+
+char *cg_full_path(arena_t *a, const char *name) {
   if (!name) {
     log_msg(LOG_ERROR, "cg_full_path: name is NULL");
     return NULL;
   }
-  if (!strchr(name, '/')) {
-    // name does not contain '/', use CGROUPS_PLIMIT_DEFAULT_PATH as parent
-    if (asprintf(&p, "%s/%s", CGROUPS_PLIMIT_DEFAULT_PATH, name) < 0) {
-      log_msg(LOG_ERROR, "failed to allocate memory for cgroup path (name=%s)",
-              name);
-      free(p);
-      return NULL;
-    }
-  } else {
-    // name contains '/', use its path as parent
-    if (asprintf(&p, "%s/%s", CGROUP_ROOT_PATH, name) < 0) {
-      log_msg(LOG_ERROR, "failed to allocate memory for cgroup path (name=%s)",
-              name);
-      free(p);
-      return NULL;
-    }
+  // names without '/' live under cg_plimit_root(), others are relative to
+  // cg_root()
+  char *p = arena_sprintf(a, "%s%s%s",
+                          strchr(name, '/') ? cg_root() : cg_plimit_root(),
+                          *name == '/' ? "" : "/", name);
+  if (!p) {
+    log_msg(LOG_ERROR, "failed to allocate memory for cgroup path (name=%s)",
+            name);
   }
   return p;
 }
 
-char *cg_parent(const char *name) {
-  char *p = NULL;
+char *cg_parent(arena_t *a, const char *name) {
   if (!name || !*name) {
     log_msg(LOG_ERROR, "cgroup name is empty");
-    free(p);
     return NULL;
   }
-  const char *slash = strrchr(name, '/');
-  size_t len = slash - name;
-  char *rel = strndup(name, len);
-  if (!rel) {
-    log_msg(LOG_ERROR,
-            "failed to allocate memory for parent substring (name=%s)", name);
-    free(p);
-    free(rel);
-    return NULL;
+  // same rules as cg_full_path(), "/NAME" is a child of cg_root()
+  const char *rel = *name == '/' ? name + 1 : name;
+  const char *slash = strrchr(rel, '/');
+  char *p = slash     ? arena_sprintf(a, "%s/%.*s", cg_root(),
+                                      (int)(slash - rel), rel)
+            : rel != name ? arena_strdup(a, cg_root())
+                          : arena_strdup(a, cg_plimit_root());
+  if (!p) {
+    log_msg(LOG_ERROR, "failed to allocate memory for parent path (name=%s)",
+            name);
   }
-  if (asprintf(&p, "%s/%s", CGROUP_ROOT_PATH, rel) < 0) {
-    log_msg(LOG_ERROR, "failed to allocate memory for parent path (rel=%s)",
-            rel);
-    free(p);
-    free(rel);
-    return NULL;
-  }
-  free(rel);
   return p;
 }
 
@@ -68,7 +205,11 @@ int enable_controllers(controllers_t controllers, const run_opts_t *opts) {
   snprintf(path, sizeof(path), "%s/cgroup.subtree_control", controllers.parent);
   file_write_args_t file_args = {
       .path = path, .data = controllers.list, .mode = CGFILE_PERM};
-  int rc = write_file(opts->dry_run, &file_args, opts->verbose);
+  uint64_t t = trace_begin();
+  int rc = !opts->dry_run && cg_emulated()
+               ? cgemu_subtree_control(&file_args, opts->verbose)
+               : write_file(opts->dry_run, &file_args, opts->verbose);
+  trace_end(t, "subtree_control", path, rc);
   if (rc != PLIMIT_OK) {
     log_msg(LOG_ERROR, "failed to enable controllers '%s' in file %s: %s",
             controllers.list, path, strerror(errno));
@@ -84,7 +225,9 @@ static int write_controller(const char *cgpath, controller_opts_t ctrl_opts,
   snprintf(path, sizeof(path), "%s/%s", cgpath, ctrl_opts.file);
   file_write_args_t file_args = {
       .path = path, .data = ctrl_opts.value, .mode = CGFILE_PERM};
+  uint64_t t = trace_begin();
   rc = write_file(opts->dry_run, &file_args, opts->verbose);
+  trace_end(t, ctrl_opts.file, path, rc);
   if (rc != PLIMIT_OK) {
     return rc;
   }
@@ -95,113 +238,521 @@ int add_proc_cgroup(const char *cgpath, pid_t pid, const run_opts_t *opts) {
   char buf[64];
   snprintf(buf, sizeof(buf), "%d", pid);
   controller_opts_t ctrl_opts = {.file = "cgroup.procs", .value = buf};
-  return write_controller(cgpath, ctrl_opts, opts);
+  uint64_t t = trace_begin();
+  int rc;
+  if (!opts->dry_run && cg_emulated()) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", cgpath, ctrl_opts.file);
+    file_write_args_t file_args = {
+        .path = path, .data = buf, .mode = CGFILE_PERM};
+    rc = cgemu_attach(&file_args, opts->verbose);
+  } else {
+    rc = write_controller(cgpath, ctrl_opts, opts);
+  }
+  trace_end(t, "migrate", buf, rc);
+  return rc;
 }
 
 int remove_procs_cgroup(const char *cgname, const run_opts_t *opts) {
-  char *cgpath = cg_full_path(cgname);
-  char *procsfilepath = NULL;
-  if (asprintf(&procsfilepath, "%s/cgroup.procs", cgpath) < 0) {
-    log_msg(LOG_ERROR, "failed to allocate memory for cgroup procs file (cgname=%s)",
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  const char *cgpath = cg_full_path(&a, cgname);
+  char *procsfilepath = cgpath ? arena_sprintf(&a, "%s/cgroup.procs", cgpath)
+                               : NULL;
+  if (!procsfilepath) {
+    log_msg(LOG_ERROR,
+            "failed to allocate memory for cgroup procs file (cgname=%s)",
             cgname);
+    arena_release(&a);
     return PLIMIT_ERR_MEM;
   }
 
   file_write_args_t file_args = {
-    .path = procsfilepath,
-    .data = "",
-    .mode = CGFILE_PERM
-  };
-  return write_file(opts->dry_run, &file_args, opts->verbose);
+      .path = procsfilepath, .data = "", .mode = CGFILE_PERM};
+  int rc = write_file(opts->dry_run, &file_args, opts->verbose);
+  arena_release(&a);
+  return rc;
+}
+
+int cg_for_each_proc(const char *cgpath, char *buf, size_t size,
+                     cg_proc_fn_t fn, void *ctx) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/cgroup.procs", cgpath);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    int err = errno;
+    log_msg(LOG_ERROR, "failed to open file '%s': %s", path, strerror(err));
+    return err == ENOENT ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+
+  // a pid may straddle two reads, so the partial number is carried over
+  int rc = PLIMIT_OK;
+  long long pid = 0;
+  bool in_pid = false;
+  ssize_t n;
+  while (rc == PLIMIT_OK && (n = read(fd, buf, size)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      log_msg(LOG_ERROR, "failed to read file '%s': %s", path,
+              strerror(errno));
+      rc = PLIMIT_ERR_IO;
+      break;
+    }
+    for (ssize_t i = 0; i < n && rc == PLIMIT_OK; i++) {
+      char c = buf[i];
+      if (c >= '0' && c <= '9') {
+        pid = pid * 10 + (c - '0');
+        in_pid = pid <= INT_MAX;
+        if (!in_pid) {
+          rc = PLIMIT_ERR_PARSE;
+        }
+      } else if (c == '\n' && in_pid) {
+        rc = fn((pid_t)pid, ctx);
+        pid = 0;
+        in_pid = false;
+      } else if (c != '\n') {
+        rc = PLIMIT_ERR_PARSE;
+      }
+    }
+  }
+  if (rc == PLIMIT_OK && in_pid) {
+    rc = fn((pid_t)pid, ctx);
+  }
+  if (rc == PLIMIT_ERR_PARSE) {
+    log_msg(LOG_ERROR, "invalid PID in file '%s'", path);
+  }
+  close(fd);
+  return rc;
+}
+
+typedef struct {
+  arena_t *arena;
+  pid_t *pids;
+  size_t count;
+  size_t cap;
+} pid_array_t;
+
+static int collect_pid(pid_t pid, void *ctx) {
+  pid_array_t *arr = (pid_array_t *)ctx;
+  if (arr->count == arr->cap) {
+    size_t cap = arr->cap ? arr->cap * 2 : PROCS_INITIAL_CAP;
+    pid_t *tmp = (pid_t *)arena_realloc(arr->arena, arr->pids,
+                                        arr->cap * sizeof(pid_t),
+                                        cap * sizeof(pid_t));
+    if (!tmp) {
+      log_msg(LOG_ERROR, "failed to allocate memory for %zu PIDs", cap);
+      return PLIMIT_ERR_MEM;
+    }
+    arr->pids = tmp;
+    arr->cap = cap;
+  }
+  arr->pids[arr->count++] = pid;
+  return PLIMIT_OK;
 }
 
-char **get_procs_cgroup(int *rc, const char *cgname) {
-  *rc = PLIMIT_OK;
-  char *cgpath = cg_full_path(cgname);
+pid_t *get_procs_cgroup(arena_t *a, int *rc, const char *cgname,
+                        size_t *count) {
+  *count = 0;
+  const char *cgpath = cg_full_path(a, cgname);
   if (!cgpath) {
-    log_msg(LOG_ERROR, "cgpath is NULL");
     *rc = PLIMIT_ERR_MEM;
     return NULL;
   }
-
-  char *procsfilepath = NULL;
-  if (asprintf(&procsfilepath, "%s/cgroup.procs", cgpath) < 0) {
-    log_msg(LOG_ERROR, "failed to allocate memory for cgroup procs file (cgname=%s)",
-            cgname);
-    *rc = PLIMIT_ERR_MEM;
+  // the read buffer stays on the stack so the array can grow in place
+  char buf[PROCS_READ_SIZE];
+  pid_array_t arr = {.arena = a};
+  *rc = cg_for_each_proc(cgpath, buf, sizeof(buf), collect_pid, &arr);
+  if (*rc != PLIMIT_OK) {
     return NULL;
   }
+  *count = arr.count;
+  return arr.pids;
+}
 
-  FILE *fp = fopen(procsfilepath, "r");
+int cg_proc_cgroup(pid_t pid, char *buf, size_t size) {
+  if (cg_emulated()) {
+    return cgemu_proc_cgroup(pid, buf, size);
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+  FILE *fp = fopen(path, "re");
   if (!fp) {
-    log_msg(LOG_ERROR, "failed to open file '%s': %s", procsfilepath, strerror(errno));
-    *rc = PLIMIT_ERR_IO;
+    int err = errno;
+    log_msg(LOG_ERROR, "failed to read cgroup of PID %d: %s", pid,
+            strerror(err));
+    return err == ENOENT ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+  int rc = PLIMIT_ERR_NOTFOUND;
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  // hybrid hosts list the v1 hierarchies too, the v2 entry has id 0
+  while ((n = getline(&line, &cap, fp)) > 0) {
+    if (strncmp(line, "0::/", 4) != 0) {
+      continue;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    rc = snprintf(buf, size, "%s", line + 4) < (int)size ? PLIMIT_OK
+                                                          : PLIMIT_ERR_ARG;
+    break;
+  }
+  free(line);
+  fclose(fp);
+  if (rc == PLIMIT_OK && strncmp(buf, "..", 2) == 0) {
+    // outside of our cgroup namespace
+    rc = PLIMIT_ERR_NOTFOUND;
+  }
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "PID %d has no cgroup v2 path below %s", pid,
+            cg_root());
+  }
+  return rc;
+}
+
+int cg_nest_name(arena_t *a, pid_t pid, const char *name, char **out) {
+  char cur[PATH_MAX];
+  int rc = cg_proc_cgroup(pid, cur, sizeof(cur));
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  char *slash = strrchr(cur, '/');
+  const char *base = slash ? slash + 1 : cur;
+  if (*cur && (strcmp(base, name) == 0 || strcmp(base, CG_NEST_LEAF) == 0)) {
+    // nested before: stay next to the earlier child
+    if (strcmp(base, name) == 0) {
+      *out = arena_sprintf(a, "/%s", cur);
+    } else {
+      *out = arena_sprintf(a, "/%.*s%s", (int)(base - cur), cur, name);
+    }
+  } else {
+    *out = arena_sprintf(a, "/%s%s%s", cur, *cur ? "/" : "", name);
+  }
+  if (!*out) {
+    log_msg(LOG_ERROR, "failed to allocate memory for cgroup name (pid=%d)",
+            pid);
+    return PLIMIT_ERR_MEM;
+  }
+  return PLIMIT_OK;
+}
+
+int delete_cgroup(const char *cgname, const run_opts_t *opts) {
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  int rc = PLIMIT_OK;
+  const char *cgpath = cg_full_path(&a, cgname);
+  if (!cgpath) {
+    rc = PLIMIT_ERR_MEM;
+  } else if (opts->dry_run) {
+    log_action(LOG_ACTION_RMDIR, cgpath, NULL, true, false);
+  } else if (cg_rmdir(cgpath) != 0) {
+    log_msg(LOG_ERROR, "failed to delete cgroup %s: %s", cgpath,
+            strerror(errno));
+    rc = PLIMIT_ERR_IO;
+  } else {
+    log_action(LOG_ACTION_RMDIR, cgpath, NULL, false, true);
+  }
+  arena_release(&a);
+  return rc;
+}
+
+int parse_cpu_latency(const char *s, cpu_latency_t *hint) {
+  if (strcmp(s, "low") == 0) {
+    *hint = CPU_LATENCY_LOW;
+  } else if (strcmp(s, "normal") == 0) {
+    *hint = CPU_LATENCY_NORMAL;
+  } else if (strcmp(s, "batch") == 0) {
+    *hint = CPU_LATENCY_BATCH;
+  } else {
+    log_msg(LOG_ERROR, "invalid cpu latency hint '%s' (low, normal, batch)",
+            s);
+    return PLIMIT_ERR_PARSE;
+  }
+  return PLIMIT_OK;
+}
+
+int cpu_max_for(double cpus, cpu_latency_t hint, long long period_us,
+                long long *quota, long long *period) {
+  if (!isfinite(cpus) || cpus <= 0) {
+    return PLIMIT_ERR_ARG;
+  }
+  if (period_us > CPU_PERIOD_MAX_US) {
+    log_msg(LOG_ERROR, "cpu period of %lldus is above the maximum of %lldus",
+            period_us, CPU_PERIOD_MAX_US);
+    return PLIMIT_ERR_ARG;
+  }
+  long long p = period_us;
+  if (p <= 0) {
+    switch (hint) {
+    case CPU_LATENCY_LOW:
+      p = CPU_PERIOD_LOW_LATENCY_US;
+      break;
+    case CPU_LATENCY_BATCH:
+      p = CPU_PERIOD_BATCH_US;
+      break;
+    default:
+      p = CPU_PERIOD_DEFAULT_US;
+      break;
+    }
+    // a quota below the kernel minimum is rejected, so trade latency for
+    // a longer period instead of failing small fractional limits
+    if ((double)p * cpus < (double)CPU_QUOTA_MIN_US) {
+      p = (long long)((double)CPU_QUOTA_MIN_US / cpus + 0.5);
+    }
+    if (p > CPU_PERIOD_MAX_US) {
+      p = CPU_PERIOD_MAX_US;
+    }
+  }
+  long long q = (long long)((double)p * cpus + 0.5);
+  if (q < CPU_QUOTA_MIN_US) {
+    log_msg(LOG_ERROR, "cpu limit of %.3f cores is below the minimum quota "
+                       "of %lldus per %lldus period",
+            cpus, CPU_QUOTA_MIN_US, p);
+    return PLIMIT_ERR_ARG;
+  }
+  *quota = q;
+  *period = p;
+  return PLIMIT_OK;
+}
+
+// remember the cgroup a PID was moved out of, the attribute goes away with
+// the cgroup so nothing is left behind on delete
+static void record_origin(const char *cgpath, pid_t pid, const char *origin,
+                          const run_opts_t *opts) {
+  if (opts->dry_run) {
+    return;
+  }
+  char list[CG_ORIGIN_SIZE];
+  ssize_t n = getxattr(cgpath, CG_ORIGIN_XATTR, list, sizeof(list) - 1);
+  size_t used = n > 0 ? (size_t)n : 0;
+  list[used] = '\0';
+  // an entry of the same PID is stale, the number was reused
+  char key[32];
+  size_t klen = (size_t)snprintf(key, sizeof(key), "%d ", pid);
+  for (char *l = list; *l;) {
+    size_t len = strcspn(l, "\n");
+    len += l[len] == '\n';
+    if (strncmp(l, key, klen) == 0) {
+      memmove(l, l + len, used - (size_t)(l - list) - len + 1);
+      used -= len;
+    } else {
+      l += len;
+    }
+  }
+  int w = snprintf(list + used, sizeof(list) - used, "%s/%s\n", key, origin);
+  if (w < 0 || (size_t)w >= sizeof(list) - used) {
+    log_msg(LOG_WARN, "no room to record the origin of PID %d in %s", pid,
+            cgpath);
+    return;
+  }
+  if (setxattr(cgpath, CG_ORIGIN_XATTR, list, used + (size_t)w, 0) != 0 &&
+      opts->verbose) {
+    log_msg(LOG_WARN, "failed to record the origin of PID %d: %s", pid,
+            strerror(errno));
+  }
+}
+
+// origin recorded for pid, or for the first PID when pid has none
+static const char *origin_of(const char *list, pid_t pid, char *buf,
+                             size_t size) {
+  char key[32];
+  size_t klen = (size_t)snprintf(key, sizeof(key), "%d /", pid);
+  const char *first = NULL;
+  size_t flen = 0;
+  for (const char *l = list; *l;) {
+    size_t len = strcspn(l, "\n");
+    const char *path = memchr(l, '/', len);
+    if (path) {
+      size_t plen = len - (size_t)(path + 1 - l);
+      if (strncmp(l, key, klen) == 0) {
+        snprintf(buf, size, "%.*s", (int)plen, path + 1);
+        return buf;
+      }
+      if (!first) {
+        first = path + 1;
+        flen = plen;
+      }
+    }
+    l += len + (l[len] == '\n');
+  }
+  if (!first) {
     return NULL;
   }
+  snprintf(buf, size, "%.*s", (int)flen, first);
+  return buf;
+}
 
-  size_t procs_alloc = 8;
-  size_t procs_count = 0;
-  char **procs = (char **)malloc(procs_alloc * sizeof(char *));
-  if (!procs) {
-    log_msg(LOG_ERROR, "memory allocation failed");
-    fclose(fp);
-    *rc = PLIMIT_ERR_MEM;
+// a cgroup other than the root holds processes only without controllers
+// enabled for its children
+static bool can_hold_procs(const char *path) {
+  if (strcmp(path, cg_root()) == 0) {
+    return true;
+  }
+  char file[PATH_MAX];
+  char cur[1024];
+  snprintf(file, sizeof(file), "%s/cgroup.subtree_control", path);
+  return access(file, F_OK) == 0 &&
+         read_file(file, cur, sizeof(cur)) == PLIMIT_OK &&
+         cur[strspn(cur, " \n")] == '\0';
+}
+
+// the recorded origin of pid if it can still take the PID, else the
+// CG_NEST_LEAF its other members moved to when it was nested into, else the
+// closest ancestor of cgpath that can
+static const char *home_of(arena_t *a, const char *cgpath, const char *list,
+                           pid_t pid) {
+  char rel[PATH_MAX];
+  if (origin_of(list, pid, rel, sizeof(rel))) {
+    size_t len = strlen(cgpath);
+    char *path =
+        *rel ? arena_sprintf(a, "%s/%s", cg_root(), rel) : (char *)cg_root();
+    bool inside = path && strncmp(path, cgpath, len) == 0 &&
+                  (path[len] == '\0' || path[len] == '/');
+    if (path && !inside && can_hold_procs(path)) {
+      return path;
+    }
+    char *leaf =
+        path && !inside ? arena_sprintf(a, "%s/%s", path, CG_NEST_LEAF) : NULL;
+    if (leaf && strcmp(leaf, cgpath) != 0 && can_hold_procs(leaf)) {
+      return leaf;
+    }
+  }
+  size_t rlen = strlen(cg_root());
+  char *dir = arena_strdup(a, cgpath);
+  if (!dir) {
     return NULL;
   }
+  for (char *slash = strrchr(dir, '/'); slash && slash > dir + rlen;
+       slash = strrchr(dir, '/')) {
+    *slash = '\0';
+    if (can_hold_procs(dir)) {
+      return dir;
+    }
+  }
+  return cg_root();
+}
 
-  char buf[256];
-  while (fgets(buf, sizeof(buf), fp)) {
-    size_t len = strlen(buf);
-    if (len > 0 && buf[len - 1] == '\n') buf[len - 1] = '\0';
-    if (procs_count == procs_alloc) {
-      procs_alloc *= 2;
-      char **tmp = (char **)realloc((void *)procs, procs_alloc * sizeof(char *));
-      if (!tmp) {
-        log_msg(LOG_ERROR, "memory allocation failed");
-        for (size_t i = 0; i < procs_count; ++i) free(procs[i]);
-        free((void *)procs);
-        fclose(fp);
-        *rc = PLIMIT_ERR_MEM;
-        return NULL;
-      }
-      procs = tmp;
+int destroy_cgroup(const char *cgname, const run_opts_t *opts) {
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  int rc = PLIMIT_OK;
+  // move pids back to their origin before deleting target cgroup
+  size_t count = 0;
+  pid_t *procs = get_procs_cgroup(&a, &rc, cgname, &count);
+  const char *cgpath = procs ? cg_full_path(&a, cgname) : NULL;
+  if (rc != PLIMIT_OK) {
+    arena_release(&a);
+    return rc;
+  }
+  char list[CG_ORIGIN_SIZE] = "";
+  if (count > 0 && cgpath) {
+    ssize_t n = getxattr(cgpath, CG_ORIGIN_XATTR, list, sizeof(list) - 1);
+    list[n > 0 ? n : 0] = '\0';
+  }
+  for (size_t i = 0; i < count; i++) {
+    const char *home = cgpath ? home_of(&a, cgpath, list, procs[i]) : NULL;
+    if (!home) {
+      log_msg(LOG_ERROR, "failed to allocate memory for cgroup path");
+      rc = PLIMIT_ERR_MEM;
+      break;
     }
-    procs[procs_count] = strdup(buf);
-    if (!procs[procs_count]) {
-      log_msg(LOG_ERROR, "memory allocation failed");
-      for (size_t i = 0; i < procs_count; ++i) free(procs[i]);
-      free((void *)procs);
-      fclose(fp);
-      *rc = PLIMIT_ERR_MEM;
-      return NULL;
+    rc = add_proc_cgroup(home, procs[i], opts);
+    if (rc == PLIMIT_ERR_NOTFOUND) {
+      // exited meanwhile
+      rc = PLIMIT_OK;
+    }
+    if (rc != PLIMIT_OK) {
+      break;
     }
-    procs_count++;
   }
-  fclose(fp);
+  arena_release(&a);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
 
-  if (procs_count == procs_alloc) {
-    char **tmp = (char **)realloc((void *)procs, (procs_alloc + 1) * sizeof(char *));
-    if (tmp) procs = tmp;
+  rc = remove_procs_cgroup(cgname, opts);
+  if (rc != PLIMIT_OK) {
+    return rc;
   }
-  procs[procs_count] = NULL;
+  return delete_cgroup(cgname, opts);
+}
 
-  *rc = PLIMIT_OK;
-  return procs;
+static bool list_has(const char *list, const char *word, size_t len) {
+  for (const char *c = list; *c;) {
+    c += strspn(c, " ");
+    size_t wlen = strcspn(c, " ");
+    if (wlen == len && strncmp(c, word, len) == 0) {
+      return true;
+    }
+    c += wlen;
+  }
+  return false;
 }
 
-int delete_cgroup(const char *cgname, const run_opts_t *opts) {
-  char *cgpath = cg_full_path(cgname);
-  if (opts->dry_run) {
-    log_msg(LOG_DRY_RUN, "delete cgroup directory %s", cgpath);
-    return PLIMIT_OK;
+// below the root a cgroup cannot hold processes and hand controllers to its
+// children at once: move the members to a leaf sibling first
+static int nest_parent(arena_t *a, const char *parent, const limits_t *lim) {
+  int rc = PLIMIT_OK;
+  if (strcmp(parent, cg_root()) != 0) {
+    char buf[PROCS_READ_SIZE];
+    pid_array_t arr = {.arena = a};
+    rc = cg_for_each_proc(parent, buf, sizeof(buf), collect_pid, &arr);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    char *leaf = arr.count > 0
+                     ? arena_sprintf(a, "%s/%s", parent, CG_NEST_LEAF)
+                     : NULL;
+    if (arr.count > 0 && !leaf) {
+      log_msg(LOG_ERROR, "failed to allocate memory for leaf path");
+      return PLIMIT_ERR_MEM;
+    }
+    if (leaf && cg_mkdir(leaf, &lim->opts) != PLIMIT_OK) {
+      log_msg(LOG_ERROR, "failed to create leaf cgroup '%s': %s", leaf,
+              strerror(errno));
+      return PLIMIT_ERR_IO;
+    }
+    for (size_t i = 0; i < arr.count; i++) {
+      // a PID that exited meanwhile has nothing left to move
+      rc = add_proc_cgroup(leaf, arr.pids[i], &lim->opts);
+      if (rc != PLIMIT_OK && rc != PLIMIT_ERR_NOTFOUND) {
+        log_msg(LOG_ERROR, "failed to move PID %d to leaf cgroup",
+                arr.pids[i]);
+        return PLIMIT_ERR_IO;
+      }
+    }
   }
-  if (rmdir(cgpath) != 0) {
-    log_msg(LOG_ERROR, "failed to delete cgroup %s: %s", cgpath,
-            strerror(errno));
-    return PLIMIT_ERR_IO;
+
+  // only what the parent may hand down, a missing controller makes the
+  // matching limit write fail with a clear error instead
+  char path[PATH_MAX];
+  char avail[1024] = "";
+  char cur[1024] = "";
+  snprintf(path, sizeof(path), "%s/cgroup.controllers", parent);
+  read_file(path, avail, sizeof(avail));
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", parent);
+  read_file(path, cur, sizeof(cur));
+  const char *want = lim->hugetlb_count > 0 ? "cpu memory io pids hugetlb"
+                                            : "cpu memory io pids";
+  char list[256] = "";
+  size_t used = 0;
+  for (const char *c = want; *c;) {
+    size_t len = strcspn(c, " ");
+    if (list_has(avail, c, len) && !list_has(cur, c, len)) {
+      used += (size_t)snprintf(list + used, sizeof(list) - used, "%s+%.*s",
+                               used ? " " : "", (int)len, c);
+    }
+    c += len + (c[len] == ' ');
   }
-  log_msg(LOG_INFO, "deleted cgroup directory %s", cgpath);
-  return PLIMIT_OK;
+  if (used == 0) {
+    return PLIMIT_OK;
+  }
+  controllers_t controllers = {.parent = parent, .list = list};
+  return enable_controllers(controllers, &lim->opts);
 }
 
 static int apply_cpu(const char *cgpath, const limits_t *lim) {
@@ -210,9 +761,18 @@ static int apply_cpu(const char *cgpath, const limits_t *lim) {
                                    .value = lim->cpu_max_raw};
     return write_controller(cgpath, ctrl_opts, &lim->opts);
   }
-  if (lim->cpu_percent > 0) {
-    long long period = 100000;
-    long long quota = (period * lim->cpu_percent) / 100;
+  double cpus = lim->cpus;
+  if (cpus <= 0 && lim->cpu_percent > 0) {
+    cpus = lim->cpu_percent / 100.0;
+  }
+  if (cpus > 0) {
+    long long quota = 0;
+    long long period = 0;
+    int rc = cpu_max_for(cpus, lim->cpu_latency, lim->cpu_period, &quota,
+                         &period);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
     char buf[64];
     snprintf(buf, sizeof(buf), "%lld %lld", quota, period);
     controller_opts_t ctrl_opts = {.file = "cpu.max", .value = buf};
@@ -250,86 +810,442 @@ static int apply_io(const char *cgpath, const limits_t *lim) {
   return PLIMIT_OK;
 }
 
+// runs before the cgroup is created or the PID moved, so an oversized
+// request leaves nothing half-configured behind
+static int check_hugetlb(const char *cgpath, const limits_t *lim) {
+  for (size_t i = 0; i < lim->hugetlb_count; i++) {
+    const hugetlb_limit_t *l = &lim->hugetlb[i];
+
+    // pages already charged to this cgroup count towards what it may use
+    long long avail = 0;
+    int rc = hugetlb_pool_available(l->page_size, &avail);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    char path[PATH_MAX];
+    char buf[64];
+    snprintf(path, sizeof(path), "%s/hugetlb.%s.current", cgpath, l->name);
+    if (read_file(path, buf, sizeof(buf)) == PLIMIT_OK) {
+      avail += strtoll(buf, NULL, 10);
+    }
+    if (l->max > avail) {
+      log_msg(LOG_ERROR,
+              "hugetlb limit %lld for %s exceeds the available pool of %lld "
+              "bytes",
+              l->max, l->name, avail);
+      return PLIMIT_ERR_ARG;
+    }
+  }
+  return PLIMIT_OK;
+}
+
+static int apply_hugetlb(const char *cgpath, const limits_t *lim) {
+  for (size_t i = 0; i < lim->hugetlb_count; i++) {
+    const hugetlb_limit_t *l = &lim->hugetlb[i];
+    char path[PATH_MAX];
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%lld", l->max);
+    char file[64];
+    snprintf(file, sizeof(file), "hugetlb.%s.max", l->name);
+    controller_opts_t ctrl_opts = {.file = file, .value = buf};
+    int rc = write_controller(cgpath, ctrl_opts, &lim->opts);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+
+    // reservation accounting appeared in Linux 5.7
+    snprintf(file, sizeof(file), "hugetlb.%s.rsvd.max", l->name);
+    snprintf(path, sizeof(path), "%s/%s", cgpath, file);
+    if (!lim->opts.dry_run && access(path, F_OK) != 0) {
+      log_msg(LOG_WARN, "%s not available, skipping reservation limit", path);
+      continue;
+    }
+    ctrl_opts.file = file;
+    rc = write_controller(cgpath, ctrl_opts, &lim->opts);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+  }
+  return PLIMIT_OK;
+}
+
+static int write_qos_value(const char *cgpath, const char *file,
+                           const char *value, const run_opts_t *opts) {
+  controller_opts_t ctrl_opts = {.file = file, .value = value};
+  return write_controller(cgpath, ctrl_opts, opts);
+}
+
+static void format_size(char *buf, size_t size, long long bytes) {
+  if (bytes < 0) {
+    snprintf(buf, size, "max");
+  } else {
+    snprintf(buf, size, "%lld", bytes);
+  }
+}
+
+static int apply_qos(const char *cgpath, const limits_t *lim) {
+  const qos_t *q = &lim->qos;
+  char buf[64];
+  int rc = PLIMIT_OK;
+  // an idle cgroup rejects cpu.weight, leaving idle has to come first
+  if (q->set & QOS_CPU_IDLE) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cpu.idle", cgpath);
+    // cpu.idle appeared in Linux 5.15, a cgroup without it is never idle
+    bool missing = !lim->opts.dry_run && access(path, F_OK) != 0;
+    if (q->cpu_idle || !missing) {
+      rc = write_qos_value(cgpath, "cpu.idle", q->cpu_idle ? "1" : "0",
+                           &lim->opts);
+    }
+  }
+  if (rc == PLIMIT_OK && (q->set & QOS_CPU_WEIGHT) &&
+      !((q->set & QOS_CPU_IDLE) && q->cpu_idle)) {
+    snprintf(buf, sizeof(buf), "%d", q->cpu_weight);
+    rc = write_qos_value(cgpath, "cpu.weight", buf, &lim->opts);
+  }
+  if (rc == PLIMIT_OK && (q->set & QOS_UCLAMP_MIN)) {
+    snprintf(buf, sizeof(buf), "%.2f", q->uclamp_min);
+    rc = write_qos_value(cgpath, "cpu.uclamp.min", buf, &lim->opts);
+  }
+  if (rc == PLIMIT_OK && (q->set & QOS_UCLAMP_MAX)) {
+    if (q->uclamp_max >= UCLAMP_MAX_PERCENT) {
+      snprintf(buf, sizeof(buf), "max");
+    } else {
+      snprintf(buf, sizeof(buf), "%.2f", q->uclamp_max);
+    }
+    rc = write_qos_value(cgpath, "cpu.uclamp.max", buf, &lim->opts);
+  }
+  if (rc == PLIMIT_OK && (q->set & QOS_IO_WEIGHT)) {
+    snprintf(buf, sizeof(buf), "default %d", q->io_weight);
+    rc = write_qos_value(cgpath, "io.weight", buf, &lim->opts);
+  }
+  if (rc == PLIMIT_OK && (q->set & QOS_MEM_LOW)) {
+    format_size(buf, sizeof(buf), q->mem_low);
+    rc = write_qos_value(cgpath, "memory.low", buf, &lim->opts);
+  }
+  if (rc == PLIMIT_OK && (q->set & QOS_MEM_HIGH)) {
+    format_size(buf, sizeof(buf), q->mem_high);
+    rc = write_qos_value(cgpath, "memory.high", buf, &lim->opts);
+  }
+  return rc;
+}
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
+// real-time and deadline threads keep their policy, a tier must not demote
+// the threads of e.g. an audio or control loop to SCHED_OTHER
+static bool is_realtime(pid_t tid) {
+  int policy = sched_getscheduler(tid);
+  if (policy < 0) {
+    return false;
+  }
+  policy &= ~SCHED_RESET_ON_FORK;
+  return policy == SCHED_FIFO || policy == SCHED_RR ||
+         policy == SCHED_DEADLINE;
+}
+
+// policy and I/O priority are per thread, threads created later inherit
+// them from their creator
+static int apply_qos_tasks(pid_t pid, const qos_t *q, const run_opts_t *opts) {
+  if (!(q->set & (QOS_SCHED_POLICY | QOS_IOPRIO))) {
+    return PLIMIT_OK;
+  }
+  // an emulated hierarchy is not the one the PID runs in, leave the real
+  // process alone
+  if (cg_emulated()) {
+    if (opts->verbose) {
+      log_msg(LOG_INFO, "emulated cgroupfs, scheduling policy and I/O "
+                        "priority of PID %d unchanged",
+              pid);
+    }
+    return PLIMIT_OK;
+  }
+  if (opts->dry_run) {
+    log_msg(LOG_DRY_RUN, "set scheduling policy and I/O priority of PID %d",
+            pid);
+    return PLIMIT_OK;
+  }
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  DIR *dir = opendir(path);
+  if (!dir) {
+    log_msg(LOG_ERROR, "failed to list threads of PID %d: %s", pid,
+            strerror(errno));
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  int rc = PLIMIT_OK;
+  size_t threads = 0;
+  size_t realtime = 0;
+  struct dirent *d;
+  while (rc == PLIMIT_OK && (d = readdir(dir))) {
+    if (d->d_name[0] == '.') {
+      continue;
+    }
+    pid_t tid = (pid_t)strtol(d->d_name, NULL, 10);
+    struct sched_param param = {.sched_priority = 0};
+    bool keep = (q->set & QOS_SCHED_POLICY) && is_realtime(tid);
+    realtime += keep;
+    if ((q->set & QOS_SCHED_POLICY) && !keep &&
+        sched_setscheduler(tid, q->sched_policy, &param) != 0 &&
+        errno != ESRCH) {
+      log_msg(LOG_ERROR, "failed to set the scheduling policy of thread %d: "
+                         "%s",
+              tid, strerror(errno));
+      rc = PLIMIT_ERR_IO;
+    }
+    if (rc == PLIMIT_OK && (q->set & QOS_IOPRIO) &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, q->ioprio) != 0 &&
+        errno != ESRCH) {
+      log_msg(LOG_ERROR, "failed to set the I/O priority of thread %d: %s",
+              tid, strerror(errno));
+      rc = PLIMIT_ERR_IO;
+    }
+    threads++;
+  }
+  closedir(dir);
+  if (rc == PLIMIT_OK && opts->verbose) {
+    log_msg(LOG_INFO, "set scheduling policy and I/O priority of %zu "
+                      "threads of PID %d",
+            threads, pid);
+  }
+  if (rc == PLIMIT_OK && realtime) {
+    log_msg(LOG_WARN, "%zu real-time threads of PID %d keep their "
+                      "scheduling policy",
+            realtime, pid);
+  }
+  return rc;
+}
+
 int apply_limits(const limits_t *lim) {
   if (!have_cgroupv2()) {
-    log_msg(LOG_ERROR, "cgroup v2 not detected at /sys/fs/cgroup: %s",
+    log_msg(LOG_ERROR, "cgroup v2 not detected at %s: %s", cg_root(),
             strerror(errno));
     return PLIMIT_ERR_NOTFOUND;
   }
 
-  char *cgpath = cg_full_path(lim->cgname);
-  char *parent = cg_parent(lim->cgname);
+  uint64_t t_apply = trace_begin();
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  int rc = PLIMIT_OK;
+  char *cgpath = cg_full_path(&a, lim->cgname);
+  char *parent = cg_parent(&a, lim->cgname);
+  if (!cgpath || !parent) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  if (!lim->attach_only) {
+    rc = check_hugetlb(cgpath, lim);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
 
-  if (lim->opts.force) {
-    if (create_directory(lim->opts.dry_run, parent, 0755, lim->opts.verbose) !=
-        PLIMIT_OK) {
+  if (lim->nest) {
+    rc = nest_parent(&a, parent, lim);
+    if (rc != PLIMIT_OK) {
+      log_msg(LOG_ERROR, "failed to prepare '%s' for nesting", parent);
+      goto exit;
+    }
+  } else if (lim->opts.force) {
+    if (cg_mkdir(parent, &lim->opts) != PLIMIT_OK) {
       log_msg(LOG_ERROR, "failed to create parent directory '%s': %s", parent,
               strerror(errno));
-      free(cgpath);
-      free(parent);
-      return PLIMIT_ERR_IO;
+      rc = PLIMIT_ERR_IO;
+      goto exit;
     }
-    controllers_t controllers = {.parent = parent,
-                                 .list = "+cpu +memory +io +pids"};
-    int rc = enable_controllers(controllers, &lim->opts);
+    controllers_t controllers = {
+        .parent = parent,
+        .list = lim->hugetlb_count > 0 ? "+cpu +memory +io +pids +hugetlb"
+                                       : "+cpu +memory +io +pids"};
+    rc = enable_controllers(controllers, &lim->opts);
     if (rc != PLIMIT_OK) {
       log_msg(LOG_ERROR, "failed to enable controllers for parent '%s': %s",
               parent, strerror(errno));
-      free(cgpath);
-      free(parent);
-      return rc;
+      goto exit;
     }
   }
 
-  if (create_directory(lim->opts.dry_run, cgpath, 0755, lim->opts.verbose) !=
-      PLIMIT_OK) {
+  if (cg_mkdir(cgpath, &lim->opts) != PLIMIT_OK) {
     log_msg(LOG_ERROR, "failed to create cgroup directory '%s': %s", cgpath,
             strerror(errno));
-    free(cgpath);
-    free(parent);
-    return PLIMIT_ERR_IO;
+    rc = PLIMIT_ERR_IO;
+    goto exit;
   }
 
   if (lim->pid > 0) {
+    // best effort, a PID outside our cgroup namespace can still be moved
+    char origin[PATH_MAX];
+    bool known = cg_proc_cgroup(lim->pid, origin, sizeof(origin)) == PLIMIT_OK;
+    if (!known) {
+      log_msg(LOG_WARN, "origin of PID %d not recorded, --delete moves it to "
+                        "an ancestor",
+              lim->pid);
+    }
     if (add_proc_cgroup(cgpath, lim->pid, &lim->opts) != PLIMIT_OK) {
       log_msg(LOG_ERROR, "failed to add pid to cgroup: %s", strerror(errno));
-      free(cgpath);
-      free(parent);
-      return PLIMIT_ERR_IO;
+      rc = PLIMIT_ERR_IO;
+      goto exit;
+    }
+    // a re-run finds the PID in place and keeps the first record
+    size_t rlen = strlen(cg_root());
+    if (known && strcmp(cgpath + rlen + (cgpath[rlen] == '/'), origin) != 0) {
+      record_origin(cgpath, lim->pid, origin, &lim->opts);
     }
   }
 
   if (!lim->attach_only) {
-    int rc;
+    uint64_t t = trace_begin();
     rc = apply_cpu(cgpath, lim);
+    trace_end(t, "apply_cpu", NULL, rc);
     if (rc != PLIMIT_OK) {
       log_msg(LOG_ERROR, "failed to apply cpu limits");
-      free(cgpath);
-      free(parent);
-      return PLIMIT_ERR_CGROUP;
+      rc = PLIMIT_ERR_CGROUP;
+      goto exit;
     }
+    t = trace_begin();
     rc = apply_mem(cgpath, lim);
+    trace_end(t, "apply_mem", NULL, rc);
     if (rc != PLIMIT_OK) {
       log_msg(LOG_ERROR, "failed to apply memory limits");
-      free(cgpath);
-      free(parent);
-      return PLIMIT_ERR_CGROUP;
+      rc = PLIMIT_ERR_CGROUP;
+      goto exit;
     }
+    t = trace_begin();
     rc = apply_io(cgpath, lim);
+    trace_end(t, "apply_io", NULL, rc);
     if (rc != PLIMIT_OK) {
       log_msg(LOG_ERROR, "failed to apply io limits");
-      free(cgpath);
-      free(parent);
-      return rc;
+      goto exit;
+    }
+    t = trace_begin();
+    rc = apply_hugetlb(cgpath, lim);
+    trace_end(t, "apply_hugetlb", NULL, rc);
+    if (rc != PLIMIT_OK) {
+      log_msg(LOG_ERROR, "failed to apply hugetlb limits");
+      goto exit;
+    }
+    t = trace_begin();
+    rc = apply_qos(cgpath, lim);
+    if (rc == PLIMIT_OK && lim->pid > 0) {
+      rc = apply_qos_tasks(lim->pid, &lim->qos, &lim->opts);
+    }
+    trace_end(t, "apply_qos", NULL, rc);
+    if (rc != PLIMIT_OK) {
+      log_msg(LOG_ERROR, "failed to apply tier settings");
+      goto exit;
     }
   }
 
-  free(cgpath);
-  free(parent);
+exit:
+  trace_end(t_apply, "apply_limits", lim->cgname, rc);
+  arena_release(&a);
+  return rc;
+}
+
+int cg_read_keyed(const char *cgpath, const char *file, const char *key,
+                  long long *value) {
+  char path[PATH_MAX];
+  char buf[4096];
+  snprintf(path, sizeof(path), "%s/%s", cgpath, file);
+  int rc = read_file(path, buf, sizeof(buf));
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  size_t klen = strlen(key);
+  for (char *line = buf; line && *line;) {
+    char *next = strchr(line, '\n');
+    if (strncmp(line, key, klen) == 0 && line[klen] == ' ') {
+      *value = strtoll(line + klen + 1, NULL, 10);
+      return PLIMIT_OK;
+    }
+    line = next ? next + 1 : NULL;
+  }
+  return PLIMIT_ERR_NOTFOUND;
+}
+
+int cg_read_value(const char *cgpath, const char *file, long long *value) {
+  char path[PATH_MAX];
+  char buf[64];
+  snprintf(path, sizeof(path), "%s/%s", cgpath, file);
+  int rc = read_file(path, buf, sizeof(buf));
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  *value = strcmp(buf, "max") == 0 ? -1 : strtoll(buf, NULL, 10);
   return PLIMIT_OK;
 }
 
+static int wait_frozen(const char *cgpath, bool frozen) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/cgroup.events", cgpath);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    log_msg(LOG_ERROR, "failed to open '%s': %s", path, strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  const char *want = frozen ? "frozen 1" : "frozen 0";
+  long long start = clock_ms(CLOCK_MONOTONIC);
+  int rc = PLIMIT_ERR_CGROUP;
+  for (;;) {
+    char buf[256];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n < 0) {
+      rc = PLIMIT_ERR_IO;
+      break;
+    }
+    buf[n] = '\0';
+    if (strstr(buf, want)) {
+      rc = PLIMIT_OK;
+      break;
+    }
+    long long waited = clock_ms(CLOCK_MONOTONIC) - start;
+    if (waited >= CG_FREEZE_TIMEOUT_MS) {
+      break;
+    }
+    // the kernel signals changes of cgroup.events as POLLPRI
+    struct pollfd pfd = {.fd = fd, .events = POLLPRI};
+    if (poll(&pfd, 1, (int)(CG_FREEZE_TIMEOUT_MS - waited)) < 0 &&
+        errno != EINTR) {
+      rc = PLIMIT_ERR_IO;
+      break;
+    }
+  }
+  close(fd);
+  if (rc == PLIMIT_ERR_CGROUP) {
+    log_msg(LOG_WARN, "%s did not report '%s' within %dms", cgpath, want,
+            CG_FREEZE_TIMEOUT_MS);
+  }
+  return rc;
+}
+
+int cg_freeze(const char *cgpath, bool frozen, const run_opts_t *opts) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/cgroup.freeze", cgpath);
+  file_write_args_t args = {
+      .path = path, .data = frozen ? "1" : "0", .mode = CGFILE_PERM};
+  uint64_t t = trace_begin();
+  int rc = !opts->dry_run && cg_emulated()
+               ? cgemu_freeze(&args, opts->verbose)
+               : write_file(opts->dry_run, &args, opts->verbose);
+  if (rc == PLIMIT_OK && !opts->dry_run) {
+    rc = wait_frozen(cgpath, frozen);
+  }
+  trace_end(t, frozen ? "freeze" : "thaw", cgpath, rc);
+  return rc;
+}
+
 int have_cgroupv2(void) {
   struct stat st;
-  return stat(CGROUPS_DEFAULT_CONTROLLERS_PATH, &st) == 0;
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/cgroup.controllers", cg_root()) >=
+      (int)sizeof(path)) {
+    return 0;
+  }
+  return stat(path, &st) == 0;
 }
@@ -0,0 +1,240 @@
+#include <argtable3.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "advise.h"
+#include "commands.h"
+
+static const double MIB = 1048576;
+static const char *const CONFIDENCE[] = {"low", "medium", "high"};
+
+static const char SHELL_SAFE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnop"
+                                 "qrstuvwxyz0123456789_./:@%+=,-";
+
+// single quotes unless the name is plain, a quote becomes '\''
+static void shell_quote(char *buf, size_t size, const char *s) {
+  if (*s && s[strspn(s, SHELL_SAFE)] == '\0') {
+    snprintf(buf, size, "%s", s);
+    return;
+  }
+  size_t used = 0;
+  buf[used++] = '\'';
+  for (const char *c = s; *c && used + 6 < size; c++) {
+    if (*c == '\'') {
+      memcpy(buf + used, "'\\''", 4);
+      used += 4;
+    } else {
+      buf[used++] = *c;
+    }
+  }
+  buf[used++] = '\'';
+  buf[used] = '\0';
+}
+
+static void print_row(const char *name, const advise_rec_t *rec,
+                      double scale, const char *fmt) {
+  char cells[7][32];
+  const double values[] = {rec->p50,   rec->p95,   rec->p99, rec->max,
+                           rec->value, rec->low, rec->high};
+  for (size_t i = 0; i < 7; i++) {
+    snprintf(cells[i], sizeof(cells[i]), fmt, values[i] / scale);
+  }
+  char band[72];
+  snprintf(band, sizeof(band), "%s-%s", cells[5], cells[6]);
+  log_msg(LOG_NO_PREFIX, "%-16s %9s %9s %9s %9s %11s %19s  %s%s", name,
+          cells[0], cells[1], cells[2], cells[3], cells[4], band,
+          CONFIDENCE[rec->confidence], rec->limited ? " (limited)" : "");
+}
+
+// one record per limit, values in cores, bytes or bytes per second
+static void json_row(const char *limit, const char *dev, const char *key,
+                     const advise_rec_t *rec, const char *fmt) {
+  const char *names[] = {"p50", "p95",  "p99", "max",
+                         "recommended", "low", "high"};
+  const double values[] = {rec->p50,   rec->p95,   rec->p99, rec->max,
+                           rec->value, rec->low, rec->high};
+  flockfile(stdout);
+  fputs("{\"type\":\"advice\",\"limit\":", stdout);
+  json_write_string(stdout, limit);
+  if (dev) {
+    fputs(",\"device\":", stdout);
+    json_write_string(stdout, dev);
+    fputs(",\"key\":", stdout);
+    json_write_string(stdout, key);
+  }
+  for (size_t i = 0; i < 7; i++) {
+    printf(",\"%s\":", names[i]);
+    printf(fmt, values[i]);
+  }
+  printf(",\"confidence\":\"%s\",\"limited\":%s}\n",
+         CONFIDENCE[rec->confidence], rec->limited ? "true" : "false");
+  fflush(stdout);
+  funlockfile(stdout);
+}
+
+static void format_command(const char *cgname, const advise_report_t *r,
+                           char *cmd, size_t size) {
+  char name[1024];
+  shell_quote(name, sizeof(name), cgname);
+  int used = snprintf(cmd, size, "plimit --cgname %s --cpu-max \"%lld %lld\"",
+                      name, r->cpu_quota, r->cpu_period);
+  if (r->has_memory && used < (int)size) {
+    used += snprintf(cmd + used, size - (size_t)used,
+                     " --mem-high %.0fM --mem-max %.0fM",
+                     r->mem_high.value / MIB, r->mem_max.value / MIB);
+  }
+  for (size_t i = 0; i < r->io_count && used < (int)size; i++) {
+    const advise_io_t *io = &r->io[i];
+    used += snprintf(cmd + used, size - (size_t)used, " --io-max \"%s",
+                     io->dev);
+    if (io->rbps.max > 0 && used < (int)size) {
+      used += snprintf(cmd + used, size - (size_t)used, " rbps=%.0f",
+                       io->rbps.value);
+    }
+    if (io->wbps.max > 0 && used < (int)size) {
+      used += snprintf(cmd + used, size - (size_t)used, " wbps=%.0f",
+                       io->wbps.value);
+    }
+    if (used < (int)size) {
+      used += snprintf(cmd + used, size - (size_t)used, "\"");
+    }
+  }
+}
+
+static void print_json(const char *cmd, const advise_report_t *r) {
+  json_row("cpu.max", NULL, NULL, &r->cpu, "%.3f");
+  if (r->has_memory) {
+    json_row("memory.high", NULL, NULL, &r->mem_high, "%.0f");
+    json_row("memory.max", NULL, NULL, &r->mem_max, "%.0f");
+  }
+  for (size_t i = 0; i < r->io_count; i++) {
+    if (r->io[i].rbps.max > 0) {
+      json_row("io.max", r->io[i].dev, "rbps", &r->io[i].rbps, "%.0f");
+    }
+    if (r->io[i].wbps.max > 0) {
+      json_row("io.max", r->io[i].dev, "wbps", &r->io[i].wbps, "%.0f");
+    }
+  }
+  flockfile(stdout);
+  fputs("{\"type\":\"advice_command\",\"command\":", stdout);
+  json_write_string(stdout, cmd);
+  fputs("}\n", stdout);
+  fflush(stdout);
+  funlockfile(stdout);
+}
+
+static void print_report(const char *cgname, const advise_report_t *r,
+                         log_format_t fmt) {
+  char cmd[2048];
+  format_command(cgname, r, cmd, sizeof(cmd));
+  if (fmt == LOG_FORMAT_JSON) {
+    print_json(cmd, r);
+  } else {
+    log_msg(LOG_NO_PREFIX, "%-16s %9s %9s %9s %9s %11s %19s  %s", "limit",
+            "p50", "p95", "p99", "max", "recommended", "band", "confidence");
+    print_row("cpu.max (cores)", &r->cpu, 1, "%.2f");
+    if (r->has_memory) {
+      print_row("memory.high", &r->mem_high, MIB, "%.0fM");
+      print_row("memory.max", &r->mem_max, MIB, "%.0fM");
+    }
+    for (size_t i = 0; i < r->io_count; i++) {
+      char name[48];
+      if (r->io[i].rbps.max > 0) {
+        snprintf(name, sizeof(name), "io %s rbps", r->io[i].dev);
+        print_row(name, &r->io[i].rbps, MIB, "%.0fM");
+      }
+      if (r->io[i].wbps.max > 0) {
+        snprintf(name, sizeof(name), "io %s wbps", r->io[i].dev);
+        print_row(name, &r->io[i].wbps, MIB, "%.0fM");
+      }
+    }
+  }
+  if (r->cpu.limited) {
+    log_msg(LOG_WARN, "throttled in %.1f%% of the periods, the CPU demand "
+                      "may be higher",
+            r->throttled);
+  }
+  if (r->has_memory && r->mem_high.limited) {
+    log_msg(LOG_WARN, "memory pressure above %.1f%%, the working set may be "
+                      "larger",
+            ADVISE_PSI_PCT);
+  }
+  if (fmt != LOG_FORMAT_JSON) {
+    log_msg(LOG_NO_PREFIX, "\n%s", cmd);
+  }
+}
+
+int cmd_advise(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *cgname =
+      arg_str1(NULL, "cgname", "NAME", "cgroup to observe");
+  struct arg_str *window =
+      arg_str0(NULL, "window", "DUR", "observation time (default 1h)");
+  struct arg_str *interval =
+      arg_str0(NULL, "interval", "DUR", "time between samples (default 10s)");
+  struct arg_int *headroom = arg_int0(
+      NULL, "headroom", "PCT", "percent added to the observed demand (20)");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,    cgname,      window, interval, headroom,
+                      verbose, cgroup_root, output, end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit advise --cgname NAME [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit advise");
+    log_msg(LOG_NO_PREFIX, "Try 'plimit advise --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  advise_opts_t ao = {
+      .cgname = cgname->sval[0],
+      .window_ms = ADVISE_WINDOW_MS,
+      .interval_ms = ADVISE_INTERVAL_MS,
+      .headroom = headroom->count ? headroom->ival[0] : ADVISE_HEADROOM_PCT,
+      .opts = {.verbose = verbose->count > 0}};
+  if (window->count) {
+    ao.window_ms = parse_duration(window->sval[0]);
+  }
+  if (interval->count) {
+    ao.interval_ms = parse_duration(interval->sval[0]);
+  }
+  if (ao.window_ms <= 0 || ao.interval_ms <= 0 ||
+      ao.interval_ms > ao.window_ms) {
+    log_msg(LOG_PREFIX, "--window and --interval must be durations, with "
+                        "--interval at most --window");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (ao.headroom < 0) {
+    log_msg(LOG_PREFIX, "--headroom must not be negative");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  log_format_t fmt = LOG_FORMAT_TEXT;
+  rc = cmd_setup(output, cgroup_root, 0, &fmt);
+  if (rc == PLIMIT_OK) {
+    advise_report_t r;
+    rc = advise_run(&ao, &r);
+    if (rc == PLIMIT_OK) {
+      print_report(ao.cgname, &r, fmt);
+      log_msg(LOG_INFO, "advise complete: %zu samples over %llds",
+              r.samples, r.elapsed_ms / 1000);
+    }
+  }
+  log_result("advise", cgname->sval[0], 0, rc);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
@@ -0,0 +1,106 @@
+#include <argtable3.h>
+#include <stdio.h>
+
+#include "commands.h"
+#include "freeze.h"
+
+static int parse_opt_duration(struct arg_str *opt, long long def,
+                              long long *ms) {
+  *ms = def;
+  if (!opt->count) {
+    return PLIMIT_OK;
+  }
+  *ms = parse_duration(opt->sval[0]);
+  if (*ms <= 0) {
+    log_msg(LOG_PREFIX, "invalid duration '%s' for --%s", opt->sval[0],
+            opt->hdr.longopts);
+    return PLIMIT_ERR_ARG;
+  }
+  return PLIMIT_OK;
+}
+
+int cmd_freeze_schedule(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *cgname =
+      arg_str1(NULL, "cgname", "NAME", "cgroup to pause");
+  struct arg_str *on = arg_str0(NULL, "on", "DUR",
+                                "frozen time of a cycle, longest with --psi");
+  struct arg_str *off = arg_str0(
+      NULL, "off", "DUR", "thawed time of a cycle, shortest with --psi");
+  struct arg_dbl *psi = arg_dbl0(
+      NULL, "psi", "PCT", "freeze while host CPU pressure exceeds PCT");
+  struct arg_str *check = arg_str0(NULL, "check", "DUR",
+                                   "time between pressure reads (1s)");
+  struct arg_lit *dry_run =
+      arg_lit0(NULL, "dry-run", "print actions without making changes");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,    cgname,  on,          off,    psi, check,
+                      dry_run, verbose, cgroup_root, output, end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX,
+            "Usage: plimit freeze-schedule --cgname NAME (--on DUR --off DUR "
+            "| --psi PCT) [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit freeze-schedule");
+    log_msg(LOG_NO_PREFIX,
+            "Try 'plimit freeze-schedule --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  freeze_opts_t fo = {
+      .cgname = cgname->sval[0],
+      .psi = psi->count ? psi->dval[0] : 0,
+      .opts = {.verbose = verbose->count > 0, .dry_run = dry_run->count > 0}};
+  if (fo.opts.verbose && fo.opts.dry_run) {
+    log_msg(LOG_PREFIX, "--verbose and --dry-run cannot be used together");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (!psi->count && (!on->count || !off->count)) {
+    log_msg(LOG_PREFIX, "--on and --off are required without --psi");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (psi->count && (fo.psi <= 0 || fo.psi > 100)) {
+    log_msg(LOG_PREFIX, "--psi must be greater than 0 and at most 100");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  rc = parse_opt_duration(on, FREEZE_MAX_ON_MS, &fo.on_ms);
+  if (rc == PLIMIT_OK) {
+    rc = parse_opt_duration(off, FREEZE_MIN_OFF_MS, &fo.off_ms);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = parse_opt_duration(check, FREEZE_CHECK_MS, &fo.check_ms);
+  }
+  if (rc != PLIMIT_OK) {
+    goto exit;
+  }
+  rc = cmd_setup(output, cgroup_root, 0, NULL);
+  if (rc == PLIMIT_OK) {
+    freeze_stats_t stats;
+    rc = freeze_run(&fo, &stats);
+    log_msg(rc == PLIMIT_OK ? LOG_INFO : LOG_ERROR,
+            "freeze-schedule %s: %zu freezes, frozen %lldms of %lldms, %zu "
+            "unconfirmed",
+            rc == PLIMIT_OK ? "stopped" : "failed", stats.freezes,
+            stats.frozen_ms, stats.total_ms, stats.timeouts);
+  }
+  log_result("freeze-schedule", cgname->sval[0], 0, rc);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
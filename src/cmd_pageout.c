@@ -0,0 +1,139 @@
+#include <argtable3.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+#include "pageout.h"
+
+static void print_pageout(const pageout_vma_t *vmas, size_t count,
+                          bool all) {
+  log_msg(LOG_NO_PREFIX, "%-33s %12s %12s  %s", "mapping", "rss", "referenced",
+          "path");
+  for (size_t i = 0; i < count; i++) {
+    const pageout_vma_t *v = &vmas[i];
+    if (!all && !v->selected) {
+      continue;
+    }
+    char range[40];
+    snprintf(range, sizeof(range), "%lx-%lx", v->start, v->end);
+    log_msg(LOG_NO_PREFIX, "%c %-31s %12lld %12lld  %s",
+            v->selected ? '*' : ' ', range, v->rss, v->referenced,
+            *v->path ? v->path : "[anon]");
+  }
+}
+
+int cmd_pageout(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_int *pid = arg_int1(NULL, "pid", "PID", "process to trim");
+  struct arg_str *window = arg_str0(
+      NULL, "window", "DUR", "time to sample references (default 10s, 0 off)");
+  struct arg_int *referenced =
+      arg_int0(NULL, "referenced", "PCT",
+               "skip mappings with more referenced pages (default 10)");
+  struct arg_str *budget =
+      arg_str0(NULL, "budget", "SIZE", "resident bytes to advise at most");
+  struct arg_str *advice = arg_str0(NULL, "advice", "ADVICE",
+                                    "pageout (default) or cold");
+  struct arg_lit *file_only =
+      arg_lit0(NULL, "file-only", "leave anonymous memory alone");
+  struct arg_lit *dry_run =
+      arg_lit0(NULL, "dry-run", "report the cold mappings without advice");
+  struct arg_lit *verbose =
+      arg_lit0(NULL, "verbose", "extra logging, list all mappings");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,      pid,     window,  referenced, budget, advice,
+                      file_only, dry_run, verbose, output,     end};
+
+  int rc = PLIMIT_OK;
+  arena_t a;
+  arena_init(&a, NULL, 0);
+  log_format_t fmt = LOG_FORMAT_TEXT;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit pageout --pid PID [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit pageout");
+    log_msg(LOG_NO_PREFIX, "Try 'plimit pageout --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  pageout_opts_t po = {
+      .pid = pid->ival[0],
+      .window_ms = PAGEOUT_WINDOW_MS,
+      .referenced =
+          referenced->count ? referenced->ival[0] : PAGEOUT_REFERENCED_PCT,
+      .budget = -1,
+      .advice = PAGEOUT_PAGEOUT,
+      .file_only = file_only->count > 0,
+      .opts = {.verbose = verbose->count > 0, .dry_run = dry_run->count > 0}};
+  if (po.pid <= 0) {
+    log_msg(LOG_PREFIX, "--pid must be greater than 0");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (window->count) {
+    po.window_ms = parse_duration(window->sval[0]);
+    if (po.window_ms < 0) {
+      log_msg(LOG_PREFIX, "invalid duration '%s' for --window",
+              window->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  if (po.referenced < 0 || po.referenced > 100) {
+    log_msg(LOG_PREFIX, "--referenced must be between 0 and 100");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (budget->count) {
+    po.budget = parse_bytes(budget->sval[0]);
+    if (po.budget <= 0) {
+      log_msg(LOG_PREFIX, "invalid --budget '%s'", budget->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  if (advice->count) {
+    if (strcmp(advice->sval[0], "cold") == 0) {
+      po.advice = PAGEOUT_COLD;
+    } else if (strcmp(advice->sval[0], "pageout") != 0) {
+      log_msg(LOG_PREFIX, "--advice must be pageout or cold");
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  // works on /proc/PID, no cgroup root
+  rc = cmd_setup(output, NULL, 0, &fmt);
+  if (rc != PLIMIT_OK) {
+    goto exit;
+  }
+
+  pageout_vma_t *vmas = NULL;
+  size_t count = 0;
+  pageout_stats_t stats = {0};
+  rc = pageout_scan(&a, &po, &vmas, &count);
+  if (rc == PLIMIT_OK) {
+    pageout_select(&po, vmas, count, &stats);
+    if (fmt == LOG_FORMAT_TEXT) {
+      print_pageout(vmas, count, po.opts.verbose);
+    }
+    rc = pageout_apply(&po, vmas, count, &stats);
+    log_msg(rc == PLIMIT_OK ? LOG_INFO : LOG_ERROR,
+            "pageout %s: %zu of %zu mappings cold, %lld of %lld resident "
+            "bytes, %lld advised",
+            rc == PLIMIT_OK ? "complete" : "failed", stats.selected,
+            stats.vmas, stats.cold, stats.rss, stats.advised);
+  }
+  log_result("pageout", NULL, po.pid, rc);
+
+exit:
+  arena_release(&a);
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
@@ -0,0 +1,116 @@
+#include <argtable3.h>
+#include <stdio.h>
+
+#include "commands.h"
+#include "reclaim.h"
+
+int cmd_reclaim(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *cgname =
+      arg_str1(NULL, "cgname", "NAME", "cgroup to trim");
+  struct arg_str *interval =
+      arg_str0(NULL, "interval", "DUR", "time between passes (default 5s)");
+  struct arg_dbl *psi = arg_dbl0(
+      NULL, "psi", "PCT", "memory pressure (some avg10) to stop at (0.1)");
+  struct arg_str *max_rate = arg_str0(NULL, "max-rate", "SIZE",
+                                      "bytes reclaimed per second (32M)");
+  struct arg_int *headroom = arg_int0(
+      NULL, "headroom", "PCT", "percent kept above the working set (10)");
+  struct arg_str *min =
+      arg_str0(NULL, "min", "SIZE", "never trim memory.current below SIZE");
+  struct arg_lit *once = arg_lit0(NULL, "once", "run a single pass");
+  struct arg_lit *dry_run =
+      arg_lit0(NULL, "dry-run", "print actions without making changes");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,     cgname, interval, psi,     max_rate,
+                      headroom, min,    once,     dry_run, verbose,
+                      cgroup_root,      output,   end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit reclaim --cgname NAME [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit reclaim");
+    log_msg(LOG_NO_PREFIX, "Try 'plimit reclaim --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  reclaim_opts_t ropts = {
+      .cgname = cgname->sval[0],
+      .interval_ms = RECLAIM_INTERVAL_MS,
+      .psi = psi->count ? psi->dval[0] : RECLAIM_PSI_THRESHOLD,
+      .max_rate = RECLAIM_RATE_DEFAULT,
+      .headroom = headroom->count ? headroom->ival[0] : RECLAIM_HEADROOM_PCT,
+      .once = once->count > 0,
+      .opts = {.verbose = verbose->count > 0, .dry_run = dry_run->count > 0}};
+  if (ropts.opts.verbose && ropts.opts.dry_run) {
+    log_msg(LOG_PREFIX, "--verbose and --dry-run cannot be used together");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (interval->count) {
+    ropts.interval_ms = parse_duration(interval->sval[0]);
+    if (ropts.interval_ms < 0) {
+      log_msg(LOG_PREFIX, "invalid duration '%s' for --interval",
+              interval->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  if (ropts.interval_ms < 100) {
+    log_msg(LOG_PREFIX, "--interval must be at least 100ms");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (ropts.psi <= 0 || ropts.psi > 100) {
+    log_msg(LOG_PREFIX, "--psi must be greater than 0 and at most 100");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (ropts.headroom < 0) {
+    log_msg(LOG_PREFIX, "--headroom must not be negative");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (max_rate->count) {
+    ropts.max_rate = parse_bytes(max_rate->sval[0]);
+    if (ropts.max_rate <= 0) {
+      log_msg(LOG_PREFIX, "invalid --max-rate '%s'", max_rate->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  if (min->count) {
+    ropts.min_bytes = parse_bytes(min->sval[0]);
+    if (ropts.min_bytes < 0) {
+      log_msg(LOG_PREFIX, "invalid --min '%s'", min->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  rc = cmd_setup(output, cgroup_root, 0, NULL);
+  if (rc == PLIMIT_OK) {
+    reclaim_stats_t stats;
+    rc = reclaim_run(&ropts, &stats);
+    log_msg(rc == PLIMIT_OK ? LOG_INFO : LOG_ERROR,
+            "reclaim %s: %zu passes, %zu writes, %zu held back, %lld bytes "
+            "requested, %lld reclaimed",
+            rc == PLIMIT_OK ? "stopped" : "failed", stats.passes, stats.writes,
+            stats.held, stats.requested, stats.reclaimed);
+  }
+  log_result("reclaim", cgname->sval[0], 0, rc);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
@@ -0,0 +1,69 @@
+#include <argtable3.h>
+#include <stdio.h>
+
+#include "commands.h"
+#include "pool.h"
+#include "reconcile.h"
+
+int cmd_reconcile(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *state =
+      arg_str1(NULL, "state", "DIR", "directory holding the desired state");
+  struct arg_lit *once =
+      arg_lit0(NULL, "once", "apply the state once instead of watching DIR");
+  struct arg_int *jobs =
+      arg_int0("j", "jobs", "N", "apply on N threads (default 1)");
+  struct arg_lit *dry_run =
+      arg_lit0(NULL, "dry-run", "print actions without making changes");
+  struct arg_lit *force =
+      arg_lit0(NULL, "force", "enable controllers above the declared tree");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,    state,   once,        jobs,   dry_run,
+                      force,   verbose, cgroup_root, output, end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit reconcile --state DIR [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit reconcile");
+    log_msg(LOG_NO_PREFIX,
+            "Try 'plimit reconcile --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  reconcile_opts_t ropts = {.dir = state->sval[0],
+                            .jobs = jobs->count ? (size_t)jobs->ival[0] : 1,
+                            .once = once->count > 0,
+                            .opts = {.verbose = verbose->count > 0,
+                                     .dry_run = dry_run->count > 0,
+                                     .force = force->count > 0}};
+  if (ropts.opts.verbose && ropts.opts.dry_run) {
+    log_msg(LOG_PREFIX, "--verbose and --dry-run cannot be used together");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (jobs->count && (jobs->ival[0] < 1 || jobs->ival[0] > POOL_MAX_JOBS)) {
+    log_msg(LOG_PREFIX, "--jobs must be between 1 and %d", POOL_MAX_JOBS);
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  rc = cmd_setup(output, cgroup_root, 0, NULL);
+  if (rc == PLIMIT_OK) {
+    rc = reconcile_run(&ropts);
+  }
+  log_result("reconcile", NULL, 0, rc);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
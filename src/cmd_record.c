@@ -0,0 +1,176 @@
+#include <argtable3.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "commands.h"
+#include "record.h"
+
+int cmd_record(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *cgname = arg_str1(NULL, "cgname", "PATTERN",
+                                    "cgroups to sample, e.g. 'jobs/*'");
+  struct arg_file *out =
+      arg_file1("o", "out", "FILE", "ring file, continued if it exists");
+  struct arg_str *size = arg_str0(NULL, "size", "SIZE",
+                                  "size of a new ring file (default 1G)");
+  struct arg_str *interval =
+      arg_str0(NULL, "interval", "DUR", "time between samples (default 1s)");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,    cgname,      out,    size, interval,
+                      verbose, cgroup_root, output, end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX,
+            "Usage: plimit record --cgname PATTERN --out FILE [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit record");
+    log_msg(LOG_NO_PREFIX, "Try 'plimit record --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  record_opts_t ro = {.pattern = cgname->sval[0],
+                      .file = out->filename[0],
+                      .size = RECORD_FILE_SIZE,
+                      .interval_ms = RECORD_INTERVAL_MS,
+                      .opts = {.verbose = verbose->count > 0}};
+  if (size->count) {
+    ro.size = parse_bytes(size->sval[0]);
+    // parse_bytes() errors are small positive codes, far below two blocks
+    if (ro.size < 2LL * RECORD_BLOCK_SIZE) {
+      log_msg(LOG_PREFIX, "invalid size '%s' for --size, %dM at least",
+              size->sval[0], 2 * RECORD_BLOCK_SIZE >> 20);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  if (interval->count) {
+    ro.interval_ms = parse_duration(interval->sval[0]);
+    if (ro.interval_ms <= 0) {
+      log_msg(LOG_PREFIX, "invalid duration '%s' for --interval",
+              interval->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  // only reads, no access check
+  rc = cmd_setup(output, cgroup_root, CMD_READ_ONLY, NULL);
+  if (rc == PLIMIT_OK) {
+    record_stats_t stats;
+    rc = record_run(&ro, &stats);
+    if (rc == PLIMIT_OK) {
+      log_msg(LOG_INFO,
+              "record stopped: %zu rounds, %zu samples, %lld bytes, %zu "
+              "blocks reused",
+              stats.rounds, stats.samples, stats.bytes, stats.wraps);
+    }
+  }
+  log_result("record", cgname->sval[0], 0, rc);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
+
+typedef struct {
+  const char *pattern;
+  bool csv;
+  size_t rows;
+} replay_ctx_t;
+
+// RFC 4180 quoting, cgroup names may hold commas
+static void print_csv_name(const char *name) {
+  if (!strpbrk(name, ",\"\n")) {
+    fputs(name, stdout);
+    return;
+  }
+  putchar('"');
+  for (const char *c = name; *c; c++) {
+    if (*c == '"') {
+      putchar('"');
+    }
+    putchar(*c);
+  }
+  putchar('"');
+}
+
+static int print_sample(const record_sample_t *s, void *ctx) {
+  replay_ctx_t *rc = ctx;
+  if (rc->pattern && fnmatch(rc->pattern, s->cgname, FNM_PATHNAME) != 0) {
+    return PLIMIT_OK;
+  }
+  if (rc->csv && rc->rows == 0) {
+    fputs("time_ms,cgroup", stdout);
+    for (size_t f = 0; f < RECORD_FIELDS; f++) {
+      printf(",%s", record_field_name((record_field_t)f));
+    }
+    putchar('\n');
+  }
+  rc->rows++;
+  if (rc->csv) {
+    printf("%lld,", s->time_ms);
+    print_csv_name(s->cgname);
+    for (size_t f = 0; f < RECORD_FIELDS; f++) {
+      printf(",%lld", s->values[f]);
+    }
+    putchar('\n');
+    return PLIMIT_OK;
+  }
+  char when[32];
+  time_t t = (time_t)(s->time_ms / 1000);
+  struct tm tm;
+  strftime(when, sizeof(when), "%F %T", localtime_r(&t, &tm));
+  printf("%s.%03lld %s\n", when, s->time_ms % 1000,
+         *s->cgname ? s->cgname : "/");
+  for (size_t f = 0; f < RECORD_FIELDS; f++) {
+    printf("  %-22s %lld\n", record_field_name((record_field_t)f),
+           s->values[f]);
+  }
+  return PLIMIT_OK;
+}
+
+int cmd_replay(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_file *file = arg_file1(NULL, NULL, "FILE", "ring file to decode");
+  struct arg_lit *csv =
+      arg_lit0(NULL, "csv", "one CSV row per sample with a header");
+  struct arg_str *cgname = arg_str0(NULL, "cgname", "PATTERN",
+                                    "only cgroups matching PATTERN");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help, file, csv, cgname, end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit replay FILE [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit replay");
+    log_msg(LOG_NO_PREFIX, "Try 'plimit replay --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  replay_ctx_t ctx = {.pattern = cgname->count ? cgname->sval[0] : NULL,
+                      .csv = csv->count > 0};
+  rc = record_replay(file->filename[0], print_sample, &ctx);
+  fflush(stdout);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
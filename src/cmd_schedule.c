@@ -0,0 +1,60 @@
+#include <argtable3.h>
+#include <stdio.h>
+
+#include "commands.h"
+#include "schedule.h"
+
+int cmd_schedule(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *file =
+      arg_str1(NULL, "file", "FILE", "schedule of baseline and window limits");
+  struct arg_lit *once = arg_lit0(
+      NULL, "once", "apply the limits of the current time and exit");
+  struct arg_lit *dry_run =
+      arg_lit0(NULL, "dry-run", "print actions without making changes");
+  struct arg_lit *force =
+      arg_lit0(NULL, "force", "enable controllers above the scheduled tree");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,    file,        once,   dry_run, force,
+                      verbose, cgroup_root, output, end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit schedule --file FILE [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit schedule");
+    log_msg(LOG_NO_PREFIX,
+            "Try 'plimit schedule --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  schedule_opts_t so = {.file = file->sval[0],
+                        .once = once->count > 0,
+                        .opts = {.verbose = verbose->count > 0,
+                                 .dry_run = dry_run->count > 0,
+                                 .force = force->count > 0}};
+  if (so.opts.verbose && so.opts.dry_run) {
+    log_msg(LOG_PREFIX, "--verbose and --dry-run cannot be used together");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  rc = cmd_setup(output, cgroup_root, 0, NULL);
+  if (rc == PLIMIT_OK) {
+    rc = schedule_run(&so);
+  }
+  log_result("schedule", NULL, 0, rc);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
@@ -0,0 +1,147 @@
+#include <argtable3.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "commands.h"
+#include "pool.h"
+#include "snapshot.h"
+
+int cmd_snapshot(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *cgname =
+      arg_str0(NULL, "cgname", "NAME",
+               "subtree to capture (default: whole plimit hierarchy)");
+  struct arg_lit *procs = arg_lit0(NULL, "pids", "record member PIDs");
+  struct arg_lit *cmdlines =
+      arg_lit0(NULL, "cmdlines", "record member PIDs and their command lines");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output = arg_str0(NULL, "output", "FMT",
+                                    "log format: text or json (on stderr)");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,        cgname, procs, cmdlines,
+                      cgroup_root, output, end};
+
+  int rc = PLIMIT_OK;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit snapshot [options] > FILE\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit snapshot");
+    log_msg(LOG_NO_PREFIX,
+            "Try 'plimit snapshot --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  // stdout carries the snapshot itself
+  rc = cmd_setup(output, cgroup_root, CMD_LOG_STDERR, NULL);
+  if (rc != PLIMIT_OK) {
+    goto result;
+  }
+  snapshot_opts_t sopts = {.procs = procs->count > 0 || cmdlines->count > 0,
+                           .cmdlines = cmdlines->count > 0};
+  rc = snapshot_write(stdout, cgname->count ? cgname->sval[0] : NULL, &sopts);
+
+result:
+  log_result("snapshot", cgname->count ? cgname->sval[0] : NULL, 0, rc);
+
+exit:
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
+
+int cmd_restore(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_file *file = arg_file0(
+      "f", "file", "FILE", "read the snapshot from FILE (default stdin)");
+  struct arg_lit *dry_run =
+      arg_lit0(NULL, "dry-run", "print actions without making changes");
+  struct arg_lit *force =
+      arg_lit0(NULL, "force", "enable controllers above the restored tree");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_int *jobs = arg_int0(
+      "j", "jobs", "N", "restore sibling subtrees on N threads (default 1)");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,        file,   dry_run, force, verbose,
+                      cgroup_root, output, jobs,    end};
+
+  int rc = PLIMIT_OK;
+  FILE *in = stdin;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX, "Usage: plimit restore [options] < FILE\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit restore");
+    log_msg(LOG_NO_PREFIX,
+            "Try 'plimit restore --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  run_opts_t opts = {.verbose = verbose->count > 0,
+                     .dry_run = dry_run->count > 0,
+                     .force = force->count > 0};
+  if (opts.verbose && opts.dry_run) {
+    log_msg(LOG_PREFIX, "--verbose and --dry-run cannot be used together");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (jobs->count && (jobs->ival[0] < 1 || jobs->ival[0] > POOL_MAX_JOBS)) {
+    log_msg(LOG_PREFIX, "--jobs must be between 1 and %d", POOL_MAX_JOBS);
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  rc = cmd_setup(output, cgroup_root, 0, NULL);
+  if (rc != PLIMIT_OK) {
+    goto result;
+  }
+  if (file->count) {
+    in = fopen(file->filename[0], "re");
+    if (!in) {
+      log_msg(LOG_ERROR, "failed to open file '%s': %s", file->filename[0],
+              strerror(errno));
+      rc = PLIMIT_ERR_IO;
+      goto result;
+    }
+  }
+
+  struct timespec start;
+  struct timespec stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  restore_stats_t stats;
+  rc = snapshot_restore(in, file->count ? file->filename[0] : "<stdin>", &opts,
+                        jobs->count ? (size_t)jobs->ival[0] : 1, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double ms = (double)(stop.tv_sec - start.tv_sec) * 1e3 +
+              (double)(stop.tv_nsec - start.tv_nsec) / NSEC_PER_MSEC;
+
+  log_msg(rc == PLIMIT_OK ? LOG_INFO : LOG_ERROR,
+          "restore %s: %zu cgroups (%zu created), %zu writes, %zu unchanged, "
+          "%zu processes moved, %zu missing in %.1fms",
+          rc == PLIMIT_OK ? "complete" : "aborted", stats.cgroups,
+          stats.created, stats.writes, stats.skipped, stats.moved,
+          stats.missing, ms);
+
+result:
+  log_result("restore", NULL, 0, rc);
+
+exit:
+  if (in && in != stdin) {
+    fclose(in);
+  }
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
@@ -0,0 +1,159 @@
+#include <argtable3.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+#include "split.h"
+
+static void print_split(const split_t *s) {
+  char cpu[64] = "-";
+  char mem[64] = "-";
+  if (s->cpus > 0) {
+    snprintf(cpu, sizeof(cpu), "%lld %lld", s->quota, s->period);
+  }
+  if (s->mem_max >= 0) {
+    snprintf(mem, sizeof(mem), "%lld", s->mem_max);
+  }
+  log_msg(LOG_NO_PREFIX, "%-20s %8s  %-20s %s", "cgroup", "weight", "cpu.max",
+          "memory.max");
+  log_msg(LOG_NO_PREFIX, "%-20s %8s  %-20s %s", s->parent, "-", cpu, mem);
+  for (size_t i = 0; i < s->count; i++) {
+    const split_child_t *c = &s->children[i];
+    if (s->cpus > 0) {
+      snprintf(cpu, sizeof(cpu), "%lld %lld", c->quota, s->period);
+    }
+    if (s->mem_max >= 0) {
+      snprintf(mem, sizeof(mem), "%lld", c->mem);
+    }
+    log_msg(LOG_NO_PREFIX, "  %-18s %8u  %-20s %s", c->name, c->weight, cpu,
+            mem);
+  }
+}
+
+int cmd_split(int argc, char **argv) {
+  struct arg_lit *help = arg_lit0("h", "help", "show this help");
+  struct arg_str *parent =
+      arg_str1(NULL, "parent", "NAME", "cgroup holding the budget");
+  struct arg_str *children = arg_str1(
+      NULL, "children", "NAME:W,...", "children and their weights (default 1)");
+  struct arg_dbl *cpus =
+      arg_dbl0(NULL, "cpus", "N", "CPU budget in cores, may be fractional");
+  struct arg_str *cpu_latency = arg_str0(NULL, "cpu-latency", "HINT",
+                                         "period hint: low, normal or batch");
+  struct arg_int *cpu_period =
+      arg_int0(NULL, "cpu-period", "US", "period shared by all cgroups");
+  struct arg_str *mem =
+      arg_str0(NULL, "mem", "SIZE", "memory budget, accepts K, M, G, T suffixes");
+  struct arg_lit *dry_run =
+      arg_lit0(NULL, "dry-run", "print actions without making changes");
+  struct arg_lit *force = arg_lit0(
+      NULL, "force", "create the parent's parent and enable controllers");
+  struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR", "cgroup2 mount to use");
+  struct arg_str *output =
+      arg_str0(NULL, "output", "FMT", "text (default) or json");
+  struct arg_end *end = arg_end(20);
+  void *argtable[] = {help,    parent, children,    cpus,
+                      cpu_latency,     cpu_period,  mem,
+                      dry_run, force,  verbose,     cgroup_root,
+                      output,  end};
+
+  int rc = PLIMIT_OK;
+  char buf[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, buf, sizeof(buf));
+  log_format_t fmt = LOG_FORMAT_TEXT;
+  int nerrors = arg_parse(argc, argv, argtable);
+  if (help->count) {
+    log_msg(LOG_NO_PREFIX,
+            "Usage: plimit split --parent NAME --children NAME:W,... "
+            "[--cpus N] [--mem SIZE] [options]\n\n");
+    arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    goto exit;
+  }
+  if (nerrors > 0) {
+    arg_print_errors(stdout, end, "plimit split");
+    log_msg(LOG_NO_PREFIX, "Try 'plimit split --help' for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  split_t s = {.parent = parent->sval[0],
+               .cpu_period = -1,
+               .mem_max = -1,
+               .opts = {.verbose = verbose->count > 0,
+                        .dry_run = dry_run->count > 0,
+                        .force = force->count > 0}};
+  if (s.opts.verbose && s.opts.dry_run) {
+    log_msg(LOG_PREFIX, "--verbose and --dry-run cannot be used together");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (!cpus->count && !mem->count) {
+    log_msg(LOG_PREFIX, "at least one of --cpus and --mem is required");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+  if (cpus->count) {
+    s.cpus = cpus->dval[0];
+    if (!isfinite(s.cpus) || s.cpus <= 0) {
+      log_msg(LOG_PREFIX, "--cpus must be a number greater than 0");
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  if (cpu_latency->count) {
+    rc = parse_cpu_latency(cpu_latency->sval[0], &s.cpu_latency);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
+  if (cpu_period->count) {
+    s.cpu_period = cpu_period->ival[0];
+    if (s.cpu_period <= 0 || s.cpu_period > CPU_PERIOD_MAX_US) {
+      log_msg(LOG_PREFIX, "--cpu-period must be between 1 and %lld",
+              CPU_PERIOD_MAX_US);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  if (mem->count) {
+    s.mem_max = parse_bytes(mem->sval[0]);
+    if (s.mem_max <= 0) {
+      log_msg(LOG_PREFIX, "invalid --mem '%s'", mem->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+  }
+  rc = cmd_setup(output, cgroup_root, 0, &fmt);
+  if (rc == PLIMIT_OK) {
+    rc = split_parse_children(&a, children->sval[0], &s.children, &s.count);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = split_compute(&s);
+  }
+  if (rc != PLIMIT_OK) {
+    goto result;
+  }
+
+  if (fmt == LOG_FORMAT_TEXT) {
+    print_split(&s);
+  }
+  split_stats_t stats;
+  rc = split_apply(&s, &stats);
+  log_msg(rc == PLIMIT_OK ? LOG_INFO : LOG_ERROR,
+          "split %s: %zu of %zu children changed, %zu cgroups created, %zu "
+          "writes, %zu unchanged",
+          rc == PLIMIT_OK ? "complete" : "rolled back", stats.children,
+          s.count, stats.created, stats.writes, stats.unchanged);
+
+result:
+  log_result("split", parent->count ? parent->sval[0] : NULL, 0, rc);
+
+exit:
+  arena_release(&a);
+  arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
+  return rc;
+}
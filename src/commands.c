@@ -0,0 +1,28 @@
+#include <argtable3.h>
+#include <stdio.h>
+
+#include "cgroups.h"
+#include "commands.h"
+
+int cmd_setup(struct arg_str *output, struct arg_str *cgroup_root,
+              unsigned flags, log_format_t *fmt) {
+  log_format_t f = LOG_FORMAT_TEXT;
+  if (output->count) {
+    int rc = log_parse_format(output->sval[0], &f);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    log_set_format(f, flags & CMD_LOG_STDERR ? stderr : NULL);
+  }
+  if (fmt) {
+    *fmt = f;
+  }
+  if (!cgroup_root) {
+    return PLIMIT_OK;
+  }
+  int rc = cg_set_root(cgroup_root->count ? cgroup_root->sval[0] : NULL);
+  if (rc == PLIMIT_OK && !(flags & CMD_READ_ONLY)) {
+    rc = cg_check_access();
+  }
+  return rc;
+}
@@ -0,0 +1,149 @@
+#include "freeze.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char HOST_PRESSURE[] = "/proc/pressure/cpu";
+
+static int host_pressure(double *psi) {
+  char path[PATH_MAX];
+  char buf[256];
+  snprintf(path, sizeof(path), "%s/cpu.pressure", cg_root());
+  if (read_file(path, buf, sizeof(buf)) != PLIMIT_OK &&
+      read_file(HOST_PRESSURE, buf, sizeof(buf)) != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to read CPU pressure from %s or %s", path,
+            HOST_PRESSURE);
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  if (sscanf(buf, "some avg10=%lf", psi) != 1) {
+    log_msg(LOG_ERROR, "unexpected CPU pressure format '%s'", buf);
+    return PLIMIT_ERR_PARSE;
+  }
+  return PLIMIT_OK;
+}
+
+typedef struct {
+  const char *cgpath;
+  bool frozen;
+  long long since; // time of the last freeze or thaw
+} freeze_state_t;
+
+static int set_frozen(const freeze_opts_t *fo, freeze_state_t *st,
+                      bool frozen, freeze_stats_t *stats) {
+  int rc = cg_freeze(st->cgpath, frozen, &fo->opts);
+  if (rc == PLIMIT_ERR_CGROUP) {
+    // still freezing in the background, the schedule goes on
+    stats->timeouts++;
+    rc = PLIMIT_OK;
+  }
+  if (rc != PLIMIT_OK) {
+    // the write may have gone through before the wait failed, let the exit
+    // path thaw to be sure
+    st->frozen = st->frozen || frozen;
+    return rc;
+  }
+  long long t = clock_ms(CLOCK_MONOTONIC);
+  if (frozen) {
+    stats->freezes++;
+  } else {
+    stats->frozen_ms += t - st->since;
+  }
+  if (fo->opts.verbose) {
+    log_msg(LOG_INFO, "%s %s after %lldms", frozen ? "froze" : "thawed",
+            fo->cgname, t - st->since);
+  }
+  st->frozen = frozen;
+  st->since = t;
+  return PLIMIT_OK;
+}
+
+static int run_duty(const freeze_opts_t *fo, freeze_state_t *st,
+                    freeze_stats_t *stats) {
+  while (!stop_requested()) {
+    int rc = set_frozen(fo, st, true, stats);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    sleep_ms(fo->on_ms);
+    rc = set_frozen(fo, st, false, stats);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    sleep_ms(fo->off_ms);
+  }
+  return PLIMIT_OK;
+}
+
+static int run_pressure(const freeze_opts_t *fo, freeze_state_t *st,
+                        freeze_stats_t *stats) {
+  // the first freeze does not wait for a thaw period
+  st->since -= fo->off_ms;
+  while (!stop_requested()) {
+    double psi = 0;
+    int rc = host_pressure(&psi);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    long long held = clock_ms(CLOCK_MONOTONIC) - st->since;
+    if (!st->frozen && psi >= fo->psi && held >= fo->off_ms) {
+      if (fo->opts.verbose) {
+        log_msg(LOG_INFO, "host CPU pressure %.2f", psi);
+      }
+      rc = set_frozen(fo, st, true, stats);
+    } else if (st->frozen &&
+               (psi < fo->psi * FREEZE_THAW_RATIO || held >= fo->on_ms)) {
+      rc = set_frozen(fo, st, false, stats);
+    }
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    long long wait = fo->check_ms;
+    long long left = fo->on_ms - (clock_ms(CLOCK_MONOTONIC) - st->since);
+    if (st->frozen && left < wait) {
+      wait = left;
+    }
+    sleep_ms(wait);
+  }
+  return PLIMIT_OK;
+}
+
+int freeze_run(const freeze_opts_t *fo, freeze_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  int rc = PLIMIT_OK;
+  const char *cgpath = cg_full_path(&a, fo->cgname);
+  char path[PATH_MAX];
+  if (!cgpath) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  snprintf(path, sizeof(path), "%s/cgroup.freeze", cgpath);
+  if (access(path, W_OK) != 0) {
+    log_msg(LOG_ERROR, "cannot use '%s': %s (not the root cgroup, Linux "
+                       "5.2 or later?)",
+            path, strerror(errno));
+    rc = PLIMIT_ERR_NOTFOUND;
+    goto exit;
+  }
+
+  stop_on_signal(NULL);
+
+  long long start = clock_ms(CLOCK_MONOTONIC);
+  freeze_state_t st = {.cgpath = cgpath, .since = start};
+  rc = fo->psi > 0 ? run_pressure(fo, &st, stats) : run_duty(fo, &st, stats);
+  // never leave the workload paused behind
+  if (st.frozen) {
+    int thaw = set_frozen(fo, &st, false, stats);
+    rc = rc != PLIMIT_OK ? rc : thaw;
+  }
+  stats->total_ms = clock_ms(CLOCK_MONOTONIC) - start;
+
+exit:
+  arena_release(&a);
+  return rc;
+}
@@ -0,0 +1,161 @@
+#include "hugetlb.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const long long KIB = 1024LL;
+
+static int cmp_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+int hugetlb_page_sizes(long long *sizes, size_t max, size_t *count) {
+  *count = 0;
+  DIR *dir = opendir(HUGEPAGES_SYSFS_PATH);
+  if (!dir) {
+    log_msg(LOG_ERROR, "cannot open %s: %s", HUGEPAGES_SYSFS_PATH,
+            strerror(errno));
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  struct dirent *de;
+  while ((de = readdir(dir)) != NULL && *count < max) {
+    unsigned long long kb = 0;
+    // entries are named "hugepages-<N>kB"
+    if (sscanf(de->d_name, "hugepages-%llukB", &kb) == 1 && kb > 0) {
+      sizes[(*count)++] = (long long)kb * KIB;
+    }
+  }
+  closedir(dir);
+  qsort(sizes, *count, sizeof(*sizes), cmp_ll);
+  return PLIMIT_OK;
+}
+
+void hugetlb_size_name(long long page_size, char *buf, size_t len) {
+  long long kb = page_size / KIB;
+  if (kb % (KIB * KIB) == 0) {
+    snprintf(buf, len, "%lldGB", kb / (KIB * KIB));
+  } else if (kb % KIB == 0) {
+    snprintf(buf, len, "%lldMB", kb / KIB);
+  } else {
+    snprintf(buf, len, "%lldKB", kb);
+  }
+}
+
+// parse a page size such as "2MB", "2M", "1GB" or "2048kB" into bytes
+static long long parse_page_size(const char *s) {
+  char tmp[32];
+  size_t len = strlen(s);
+  if (len == 0 || len >= sizeof(tmp)) {
+    return PLIMIT_ERR_PARSE;
+  }
+  memcpy(tmp, s, len + 1);
+  if (len > 1 && (tmp[len - 1] == 'B' || tmp[len - 1] == 'b') &&
+      (tmp[len - 2] < '0' || tmp[len - 2] > '9')) {
+    tmp[len - 1] = '\0';
+  }
+  return parse_bytes(tmp);
+}
+
+int hugetlb_parse(arena_t *a, const char *spec, hugetlb_limit_t **limits,
+                  size_t *count) {
+  long long sizes[HUGETLB_MAX_SIZES];
+  size_t nsizes = 0;
+  int rc = hugetlb_page_sizes(sizes, HUGETLB_MAX_SIZES, &nsizes);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+
+  char *copy = arena_strdup(a, spec);
+  if (!copy) {
+    log_msg(LOG_ERROR, "failed to allocate memory for hugetlb spec");
+    return PLIMIT_ERR_MEM;
+  }
+
+  rc = PLIMIT_OK;
+  char *save = NULL;
+  for (char *tok = strtok_r(copy, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    char *eq = strchr(tok, '=');
+    if (!eq) {
+      log_msg(LOG_ERROR, "invalid hugetlb entry '%s' (expected SIZE=LIMIT)",
+              tok);
+      rc = PLIMIT_ERR_PARSE;
+      break;
+    }
+    *eq = '\0';
+    long long page_size = parse_page_size(tok);
+    long long max = parse_bytes(eq + 1);
+    if (page_size <= 0 || max < 0) {
+      log_msg(LOG_ERROR, "invalid hugetlb entry '%s=%s'", tok, eq + 1);
+      rc = PLIMIT_ERR_PARSE;
+      break;
+    }
+    bool supported = false;
+    for (size_t i = 0; i < nsizes; i++) {
+      supported = supported || sizes[i] == page_size;
+    }
+    if (!supported) {
+      log_msg(LOG_ERROR, "hugepage size '%s' is not supported by the kernel "
+                         "(see %s)",
+              tok, HUGEPAGES_SYSFS_PATH);
+      rc = PLIMIT_ERR_ARG;
+      break;
+    }
+    if (max % page_size != 0) {
+      log_msg(LOG_WARN, "hugetlb limit %lld for %s is not a multiple of the "
+                        "page size, the kernel will round it down",
+              max, tok);
+    }
+
+    hugetlb_limit_t *tmp = (hugetlb_limit_t *)arena_realloc(
+        a, *limits, *count * sizeof(hugetlb_limit_t),
+        (*count + 1) * sizeof(hugetlb_limit_t));
+    if (!tmp) {
+      log_msg(LOG_ERROR, "failed to allocate memory for hugetlb limits");
+      rc = PLIMIT_ERR_MEM;
+      break;
+    }
+    *limits = tmp;
+    hugetlb_limit_t *l = &(*limits)[(*count)++];
+    hugetlb_size_name(page_size, l->name, sizeof(l->name));
+    l->page_size = page_size;
+    l->max = max;
+  }
+  return rc;
+}
+
+static int read_pool_counter(long long page_size, const char *counter,
+                             long long *value) {
+  char path[PATH_MAX];
+  char buf[64];
+  snprintf(path, sizeof(path), "%s/hugepages-%lldkB/%s", HUGEPAGES_SYSFS_PATH,
+           page_size / KIB, counter);
+  int rc = read_file(path, buf, sizeof(buf));
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "cannot read hugepage counter '%s'", path);
+    return rc;
+  }
+  *value = strtoll(buf, NULL, 10);
+  return PLIMIT_OK;
+}
+
+int hugetlb_pool_available(long long page_size, long long *avail) {
+  long long free_pages = 0;
+  long long resv_pages = 0;
+  int rc = read_pool_counter(page_size, "free_hugepages", &free_pages);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  rc = read_pool_counter(page_size, "resv_hugepages", &resv_pages);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  long long pages = free_pages - resv_pages;
+  *avail = pages > 0 ? pages * page_size : 0;
+  return PLIMIT_OK;
+}
@@ -0,0 +1,70 @@
+#include "ini.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *trim(char *s) {
+  while (isspace((unsigned char)*s)) {
+    s++;
+  }
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return s;
+}
+
+int ini_parse_stream(FILE *fp, const char *name, ini_handler_t handler,
+                     void *ctx) {
+  char section[256] = "";
+  char *line = NULL;
+  size_t cap = 0;
+  int lineno = 0;
+  int rc = PLIMIT_OK;
+
+  while (getline(&line, &cap, fp) >= 0) {
+    lineno++;
+    char *s = trim(line);
+    if (*s == '\0' || *s == '#' || *s == ';') {
+      continue;
+    }
+    if (*s == '[') {
+      char *close = strchr(s, ']');
+      if (!close) {
+        log_msg(LOG_ERROR, "%s:%d: missing ']' in section header", name,
+                lineno);
+        rc = PLIMIT_ERR_PARSE;
+        break;
+      }
+      *close = '\0';
+      snprintf(section, sizeof(section), "%s", trim(s + 1));
+      continue;
+    }
+    char *eq = strchr(s, '=');
+    if (!eq) {
+      log_msg(LOG_ERROR, "%s:%d: expected 'key = value'", name, lineno);
+      rc = PLIMIT_ERR_PARSE;
+      break;
+    }
+    *eq = '\0';
+    rc = handler(section, trim(s), trim(eq + 1), lineno, ctx);
+    if (rc != PLIMIT_OK) {
+      break;
+    }
+  }
+  free(line);
+  return rc;
+}
+
+int ini_parse_file(const char *path, ini_handler_t handler, void *ctx) {
+  FILE *fp = fopen(path, "re");
+  if (!fp) {
+    int err = errno; // log_msg() may clobber errno
+    log_msg(LOG_ERROR, "failed to open file '%s': %s", path, strerror(err));
+    return err == ENOENT ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+  int rc = ini_parse_stream(fp, path, handler, ctx);
+  fclose(fp);
+  return rc;
+}
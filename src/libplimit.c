@@ -0,0 +1,345 @@
+#include "plimit.h"
+#include "cgroups.h"
+#include "hugetlb.h"
+#include "tier.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+struct plimit_ctx {
+  run_opts_t opts;
+  plimit_error_t err;
+  plimit_log_fn log_fn;
+  void *log_user;
+  log_handler_t prev;
+  void *prev_ctx;
+};
+
+struct plimit_limits {
+  arena_t arena;
+  limits_t lim;
+  size_t io_count;
+};
+
+static void ctx_log(log_type_t type, const char *msg, void *arg) {
+  plimit_ctx_t *ctx = (plimit_ctx_t *)arg;
+  if (type == LOG_ERROR && !ctx->err.message[0]) {
+    // the first error is the root cause, later ones only add context
+    ctx->err.sys_errno = errno;
+    snprintf(ctx->err.message, sizeof(ctx->err.message), "%s", msg);
+  }
+  if (ctx->log_fn) {
+    ctx->log_fn(type, msg, ctx->log_user);
+  }
+}
+
+static void ctx_enter(plimit_ctx_t *ctx) {
+  memset(&ctx->err, 0, sizeof(ctx->err));
+  ctx->prev = log_get_handler(&ctx->prev_ctx);
+  log_set_handler(ctx_log, ctx);
+}
+
+static int ctx_leave(plimit_ctx_t *ctx, int rc) {
+  log_set_handler(ctx->prev, ctx->prev_ctx);
+  ctx->err.code = rc;
+  if (rc == PLIMIT_OK) {
+    ctx->err.message[0] = '\0';
+    ctx->err.sys_errno = 0;
+  } else if (!ctx->err.message[0]) {
+    snprintf(ctx->err.message, sizeof(ctx->err.message), "%s",
+             plimit_strerror(rc));
+  }
+  return rc;
+}
+
+int plimit_api_version(void) { return PLIMIT_API_VERSION; }
+
+int plimit_ctx_new(plimit_ctx_t **ctx, unsigned flags) {
+  if (!ctx) {
+    return PLIMIT_ERR_ARG;
+  }
+  *ctx = (plimit_ctx_t *)calloc(1, sizeof(**ctx));
+  if (!*ctx) {
+    return PLIMIT_ERR_MEM;
+  }
+  (*ctx)->opts.dry_run = (flags & PLIMIT_DRY_RUN) != 0;
+  (*ctx)->opts.verbose = (flags & PLIMIT_VERBOSE) != 0;
+  (*ctx)->opts.force = (flags & PLIMIT_FORCE) != 0;
+  return PLIMIT_OK;
+}
+
+void plimit_ctx_free(plimit_ctx_t *ctx) { free(ctx); }
+
+void plimit_set_log(plimit_ctx_t *ctx, plimit_log_fn fn, void *user) {
+  ctx->log_fn = fn;
+  ctx->log_user = user;
+}
+
+const plimit_error_t *plimit_last_error(const plimit_ctx_t *ctx) {
+  return &ctx->err;
+}
+
+int plimit_set_root(plimit_ctx_t *ctx, const char *root) {
+  ctx_enter(ctx);
+  return ctx_leave(ctx, cg_set_root(root));
+}
+
+int plimit_limits_new(plimit_ctx_t *ctx, plimit_limits_t **lim,
+                      const char *cgname) {
+  ctx_enter(ctx);
+  if (!lim || !cgname || !*cgname) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  plimit_limits_t *l = (plimit_limits_t *)calloc(1, sizeof(*l));
+  if (!l) {
+    return ctx_leave(ctx, PLIMIT_ERR_MEM);
+  }
+  arena_init(&l->arena, NULL, 0);
+  l->lim.cgname = arena_strdup(&l->arena, cgname);
+  if (!l->lim.cgname) {
+    plimit_limits_free(l);
+    return ctx_leave(ctx, PLIMIT_ERR_MEM);
+  }
+  l->lim.cpu_percent = -1;
+  l->lim.cpu_quota = -1;
+  l->lim.cpu_period = -1;
+  l->lim.mem_max = -1;
+  *lim = l;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+void plimit_limits_free(plimit_limits_t *lim) {
+  if (lim) {
+    arena_release(&lim->arena);
+    free(lim);
+  }
+}
+
+int plimit_limits_set_pid(plimit_ctx_t *ctx, plimit_limits_t *lim, pid_t pid) {
+  ctx_enter(ctx);
+  if (!lim || pid <= 0) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  lim->lim.pid = pid;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_limits_set_cpus(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                           double cpus) {
+  ctx_enter(ctx);
+  if (!lim || !(cpus > 0)) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  lim->lim.cpus = cpus;
+  lim->lim.cpu_percent = -1;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_limits_set_cpu_max(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                              long long quota, long long period) {
+  ctx_enter(ctx);
+  if (!lim || quota <= 0 || period <= 0) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  lim->lim.cpu_quota = quota;
+  lim->lim.cpu_period = period;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_limits_set_mem_max(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                              long long bytes) {
+  ctx_enter(ctx);
+  if (!lim || bytes <= 0) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  lim->lim.mem_max = bytes;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_limits_set_mem_high(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                               long long bytes) {
+  ctx_enter(ctx);
+  if (!lim || (bytes != -1 && bytes < 1)) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  lim->lim.qos.mem_high = bytes;
+  lim->lim.qos.set |= QOS_MEM_HIGH;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_limits_add_io_max(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                             const char *line) {
+  ctx_enter(ctx);
+  if (!lim || !line || !*line) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  size_t n = lim->io_count;
+  char **io_max = (char **)arena_realloc(&lim->arena, lim->lim.io_max,
+                                         n ? (n + 1) * sizeof(char *) : 0,
+                                         (n + 2) * sizeof(char *));
+  char *copy = io_max ? arena_strdup(&lim->arena, line) : NULL;
+  if (!copy) {
+    return ctx_leave(ctx, PLIMIT_ERR_MEM);
+  }
+  io_max[n] = copy;
+  io_max[n + 1] = NULL;
+  lim->lim.io_max = io_max;
+  lim->io_count++;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_limits_add_hugetlb(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                              const char *spec) {
+  ctx_enter(ctx);
+  if (!lim || !spec) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  return ctx_leave(ctx, hugetlb_parse(&lim->arena, spec, &lim->lim.hugetlb,
+                                      &lim->lim.hugetlb_count));
+}
+
+int plimit_limits_set_tier(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                           const char *name, const char *config) {
+  ctx_enter(ctx);
+  if (!lim || !name) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  // --mem-high set earlier wins over the tier, as on the command line
+  qos_t q;
+  int rc = tier_resolve(config, name, host, &q);
+  if (rc == PLIMIT_OK) {
+    if (lim->lim.qos.set & QOS_MEM_HIGH) {
+      q.mem_high = lim->lim.qos.mem_high;
+      q.set |= QOS_MEM_HIGH;
+    }
+    lim->lim.qos = q;
+  }
+  return ctx_leave(ctx, rc);
+}
+
+int plimit_limits_set_attach_only(plimit_ctx_t *ctx, plimit_limits_t *lim,
+                                  bool on) {
+  ctx_enter(ctx);
+  if (!lim) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  lim->lim.attach_only = on;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_limits_set_nest(plimit_ctx_t *ctx, plimit_limits_t *lim, bool on) {
+  ctx_enter(ctx);
+  if (!lim) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  lim->lim.nest = on;
+  return ctx_leave(ctx, PLIMIT_OK);
+}
+
+int plimit_apply(plimit_ctx_t *ctx, const plimit_limits_t *lim) {
+  ctx_enter(ctx);
+  if (!lim) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  int rc = PLIMIT_OK;
+  limits_t l = lim->lim;
+  l.opts = ctx->opts;
+  if (l.nest) {
+    if (l.pid <= 0 || strchr(l.cgname, '/')) {
+      log_msg(LOG_ERROR, "nesting needs a PID and a single cgroup name");
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+    rc = cg_nest_name(&a, l.pid, lim->lim.cgname, &l.cgname);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = apply_limits(&l);
+  }
+
+exit:
+  arena_release(&a);
+  return ctx_leave(ctx, rc);
+}
+
+int plimit_attach(plimit_ctx_t *ctx, const char *cgname, pid_t pid) {
+  ctx_enter(ctx);
+  if (!cgname || pid <= 0) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  const char *cgpath = cg_full_path(&a, cgname);
+  int rc = cgpath ? add_proc_cgroup(cgpath, pid, &ctx->opts) : PLIMIT_ERR_MEM;
+  arena_release(&a);
+  return ctx_leave(ctx, rc);
+}
+
+int plimit_delete(plimit_ctx_t *ctx, const char *cgname) {
+  ctx_enter(ctx);
+  if (!cgname) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  return ctx_leave(ctx, destroy_cgroup(cgname, &ctx->opts));
+}
+
+static int count_proc(pid_t pid, void *ctx) {
+  (void)pid;
+  ++*(long long *)ctx;
+  return PLIMIT_OK;
+}
+
+int plimit_stat(plimit_ctx_t *ctx, const char *cgname, plimit_stat_t *st) {
+  ctx_enter(ctx);
+  if (!cgname || !st) {
+    return ctx_leave(ctx, PLIMIT_ERR_ARG);
+  }
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  int rc = PLIMIT_OK;
+  const char *cgpath = cg_full_path(&a, cgname);
+  struct stat sb;
+  if (!cgpath) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  if (stat(cgpath, &sb) != 0) {
+    log_msg(LOG_ERROR, "cgroup '%s' not found", cgpath);
+    rc = PLIMIT_ERR_NOTFOUND;
+    goto exit;
+  }
+
+  st->cpu_usage_usec = -1;
+  st->cpu_nr_throttled = -1;
+  st->cpu_throttled_usec = -1;
+  st->memory_current = -1;
+  st->memory_max = -1;
+  st->pids_current = -1;
+  st->nr_procs = -1;
+  cg_read_keyed(cgpath, "cpu.stat", "usage_usec", &st->cpu_usage_usec);
+  cg_read_keyed(cgpath, "cpu.stat", "nr_throttled", &st->cpu_nr_throttled);
+  cg_read_keyed(cgpath, "cpu.stat", "throttled_usec", &st->cpu_throttled_usec);
+  cg_read_value(cgpath, "memory.current", &st->memory_current);
+  cg_read_value(cgpath, "memory.max", &st->memory_max);
+  cg_read_value(cgpath, "pids.current", &st->pids_current);
+
+  // counting needs no PID array, stream the file instead
+  char buf[PROCS_READ_SIZE];
+  long long nr_procs = 0;
+  rc = cg_for_each_proc(cgpath, buf, sizeof(buf), count_proc, &nr_procs);
+  if (rc == PLIMIT_OK) {
+    st->nr_procs = nr_procs;
+  }
+
+exit:
+  arena_release(&a);
+  return ctx_leave(ctx, rc);
+}
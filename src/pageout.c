@@ -0,0 +1,276 @@
+#include "pageout.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// older libc headers lack the numbers, both are the same on all
+// architectures using the generic syscall table
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef SYS_process_madvise
+#define SYS_process_madvise 440
+#endif
+
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+static const size_t VMAS_INITIAL_CAP = 256;
+static const long long KIB = 1024;
+
+// VmFlags of mappings the advice does not apply to or must not touch:
+// mlocked, hugetlb, I/O and raw PFN mappings
+static const char *const SKIP_FLAGS[] = {"lo", "ht", "io", "pf"};
+
+static bool has_flag(const char *flags, const char *flag) {
+  for (const char *f = flags + strspn(flags, " "); *f && *f != '\n';) {
+    size_t len = strcspn(f, " \n");
+    if (len == strlen(flag) && strncmp(f, flag, len) == 0) {
+      return true;
+    }
+    f += len;
+    f += strspn(f, " ");
+  }
+  return false;
+}
+
+static bool skip_vma(const pageout_vma_t *v, const char *flags) {
+  if (v->rss == 0 || (v->path[0] == '[' && strcmp(v->path, "[heap]") != 0 &&
+                      strncmp(v->path, "[anon", 5) != 0 &&
+                      strncmp(v->path, "[stack", 6) != 0)) {
+    // [vdso], [vvar] and friends belong to the kernel
+    return true;
+  }
+  for (size_t i = 0; i < sizeof(SKIP_FLAGS) / sizeof(SKIP_FLAGS[0]); i++) {
+    if (has_flag(flags, SKIP_FLAGS[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int clear_refs(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/clear_refs", pid);
+  file_write_args_t args = {.path = path, .data = "1", .mode = 0200};
+  return write_file(false, &args, false);
+}
+
+int pageout_scan(arena_t *a, const pageout_opts_t *po, pageout_vma_t **vmas,
+                 size_t *count) {
+  *vmas = NULL;
+  *count = 0;
+  if (po->window_ms > 0) {
+    int rc = clear_refs(po->pid);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+    if (po->opts.verbose) {
+      log_msg(LOG_INFO, "sampling references of PID %d for %lldms", po->pid,
+              po->window_ms);
+    }
+    sleep_ms(po->window_ms);
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/smaps", po->pid);
+  FILE *fp = fopen(path, "re");
+  if (!fp) {
+    int err = errno;
+    log_msg(LOG_ERROR, "failed to open '%s': %s", path, strerror(err));
+    return err == ENOENT ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+  int rc = PLIMIT_OK;
+  size_t cap = 0;
+  pageout_vma_t *cur = NULL;
+  char *line = NULL;
+  size_t len = 0;
+  uint64_t t = trace_begin();
+  while (getline(&line, &len, fp) > 0) {
+    unsigned long start, end;
+    int off = 0;
+    // "start-end perms offset dev inode path" opens a mapping
+    if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &start, &end, &off) == 2 &&
+        off > 0) {
+      if (*count == cap) {
+        size_t ncap = cap ? cap * 2 : VMAS_INITIAL_CAP;
+        pageout_vma_t *tmp = (pageout_vma_t *)arena_realloc(
+            a, *vmas, cap * sizeof(**vmas), ncap * sizeof(**vmas));
+        if (!tmp) {
+          log_msg(LOG_ERROR, "failed to allocate memory for %zu mappings",
+                  ncap);
+          rc = PLIMIT_ERR_MEM;
+          break;
+        }
+        *vmas = tmp;
+        cap = ncap;
+      }
+      line[strcspn(line, "\n")] = '\0';
+      cur = &(*vmas)[(*count)++];
+      memset(cur, 0, sizeof(*cur));
+      cur->start = start;
+      cur->end = end;
+      cur->path = arena_strdup(a, line + off);
+      if (!cur->path) {
+        rc = PLIMIT_ERR_MEM;
+        break;
+      }
+      continue;
+    }
+    if (!cur) {
+      continue;
+    }
+    long long kb = 0;
+    if (sscanf(line, "Rss: %lld kB", &kb) == 1) {
+      cur->rss = kb * KIB;
+    } else if (sscanf(line, "Referenced: %lld kB", &kb) == 1) {
+      cur->referenced = kb * KIB;
+    } else if (sscanf(line, "Anonymous: %lld kB", &kb) == 1) {
+      cur->anon = kb * KIB;
+    } else if (strncmp(line, "VmFlags:", 8) == 0) {
+      // the last key of a mapping
+      if (skip_vma(cur, line + 8)) {
+        (*count)--;
+      }
+      cur = NULL;
+    }
+  }
+  trace_end(t, "smaps", path, rc);
+  free(line);
+  fclose(fp);
+  return rc;
+}
+
+static int cmp_cold(const void *x, const void *y) {
+  const pageout_vma_t *a = (const pageout_vma_t *)x;
+  const pageout_vma_t *b = (const pageout_vma_t *)y;
+  long long ca = a->rss - a->referenced;
+  long long cb = b->rss - b->referenced;
+  return (cb > ca) - (cb < ca);
+}
+
+static int cmp_start(const void *x, const void *y) {
+  const pageout_vma_t *a = (const pageout_vma_t *)x;
+  const pageout_vma_t *b = (const pageout_vma_t *)y;
+  return (a->start > b->start) - (a->start < b->start);
+}
+
+void pageout_select(const pageout_opts_t *po, pageout_vma_t *vmas,
+                    size_t count, pageout_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->vmas = count;
+  if (count == 0) {
+    return;
+  }
+  qsort(vmas, count, sizeof(*vmas), cmp_cold);
+  long long left = po->budget;
+  for (size_t i = 0; i < count; i++) {
+    pageout_vma_t *v = &vmas[i];
+    stats->rss += v->rss;
+    bool cold = v->referenced * 100 <= v->rss * po->referenced;
+    // without swap MADV_PAGEOUT cannot drop anonymous pages
+    bool kind = !po->file_only || v->anon == 0;
+    // the budget is spent coldest first, smaller mappings may still fit
+    bool fits = left < 0 || v->rss <= left;
+    if (cold && kind && fits) {
+      v->selected = true;
+      stats->selected++;
+      stats->cold += v->rss;
+      if (left >= 0) {
+        left -= v->rss;
+      }
+    }
+  }
+  qsort(vmas, count, sizeof(*vmas), cmp_start);
+}
+
+int pageout_apply(const pageout_opts_t *po, const pageout_vma_t *vmas,
+                  size_t count, pageout_stats_t *stats) {
+  stats->advised = 0;
+  const char *name = po->advice == PAGEOUT_COLD ? "cold" : "pageout";
+  if (po->opts.dry_run) {
+    for (size_t i = 0; i < count; i++) {
+      if (vmas[i].selected) {
+        log_msg(LOG_DRY_RUN, "advise %s %lx-%lx of PID %d", name,
+                vmas[i].start, vmas[i].end, po->pid);
+      }
+    }
+    return PLIMIT_OK;
+  }
+
+  int pidfd = (int)syscall(SYS_pidfd_open, po->pid, 0);
+  if (pidfd < 0) {
+    int err = errno;
+    log_msg(LOG_ERROR, "failed to open PID %d: %s", po->pid, strerror(err));
+    return err == ESRCH ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+  int advice = po->advice == PAGEOUT_COLD ? MADV_COLD : MADV_PAGEOUT;
+  struct iovec iov[PAGEOUT_IOV_MAX];
+  int rc = PLIMIT_OK;
+  size_t next = 0;
+  while (next < count) {
+    size_t n = 0;
+    size_t first = next;
+    size_t total = 0;
+    for (; next < count && n < PAGEOUT_IOV_MAX; next++) {
+      if (vmas[next].selected) {
+        iov[n].iov_base = (void *)vmas[next].start;
+        iov[n].iov_len = vmas[next].end - vmas[next].start;
+        total += iov[n].iov_len;
+        n++;
+      }
+    }
+    if (n == 0) {
+      break;
+    }
+    uint64_t t = trace_begin();
+    ssize_t done = syscall(SYS_process_madvise, pidfd, iov, n, advice, 0);
+    int err = done < 0 ? errno : 0;
+    trace_end(t, "process_madvise", name, -err);
+    if (done < 0 && err != ENOMEM && err != EINVAL) {
+      log_msg(LOG_ERROR, "failed to advise memory of PID %d: %s", po->pid,
+              strerror(err));
+      rc = err == EPERM ? PLIMIT_ERR_PERM : PLIMIT_ERR_IO;
+      break;
+    }
+    if (done >= 0 && (size_t)done == total) {
+      stats->advised += done;
+      continue;
+    }
+    // a mapping was unmapped or changed since the scan: count what was
+    // advised and restart behind the failed mapping
+    size_t ok = done > 0 ? (size_t)done : 0;
+    stats->advised += (long long)ok;
+    size_t skip = 0;
+    for (size_t i = 0; i < n && ok >= iov[i].iov_len; i++) {
+      ok -= iov[i].iov_len;
+      skip++;
+    }
+    next = first;
+    for (size_t seen = 0; next < count; next++) {
+      if (vmas[next].selected && seen++ == skip) {
+        next++;
+        break;
+      }
+    }
+    if (po->opts.verbose) {
+      log_msg(LOG_WARN, "skipped a mapping of PID %d that changed: %s",
+              po->pid, strerror(err ? err : ENOMEM));
+    }
+  }
+  close(pidfd);
+  return rc;
+}
@@ -0,0 +1,253 @@
+#include "pidns.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef NS_GET_PARENT
+#define NS_GET_PARENT _IO(0xb7, 0x2)
+#endif
+
+static const char NSPID_KEY[] = "\nNSpid:";
+
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+} ns_id_t;
+
+typedef struct {
+  pid_t ids[PIDNS_MAX_LEVELS]; // outermost (ours) first
+  size_t count;
+} nspid_t;
+
+// one read() of /proc/PID/status, only the NSpid line is parsed
+static int read_nspid(pid_t pid, nspid_t *out) {
+  char path[64];
+  char buf[PIDNS_STATUS_SIZE];
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) {
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  buf[n] = '\0';
+  const char *c = strstr(buf, NSPID_KEY);
+  if (!c) {
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  c += strlen(NSPID_KEY);
+  out->count = 0;
+  while (*c && *c != '\n' && out->count < PIDNS_MAX_LEVELS) {
+    char *end = NULL;
+    long v = strtol(c, &end, 10);
+    if (end == c) {
+      break;
+    }
+    out->ids[out->count++] = (pid_t)v;
+    c = end;
+  }
+  return out->count > 0 ? PLIMIT_OK : PLIMIT_ERR_PARSE;
+}
+
+static int ns_of(int fd, ns_id_t *ns) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return PLIMIT_ERR_IO;
+  }
+  ns->dev = st.st_dev;
+  ns->ino = st.st_ino;
+  return PLIMIT_OK;
+}
+
+static int open_ns(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/ns/pid", pid);
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// the namespace of pid is ns, or ns is found up levels above it
+static bool in_namespace(pid_t pid, const ns_id_t *ns, size_t up) {
+  int fd = open_ns(pid);
+  while (fd >= 0) {
+    ns_id_t cur;
+    if (ns_of(fd, &cur) == PLIMIT_OK && cur.dev == ns->dev &&
+        cur.ino == ns->ino) {
+      close(fd);
+      return true;
+    }
+    int parent = up-- > 0 ? ioctl(fd, NS_GET_PARENT) : -1;
+    close(fd);
+    fd = parent;
+  }
+  return false;
+}
+
+// PID nspid of level in ns, checked against the live process
+static bool matches(pid_t pid, pid_t nspid, size_t level, const ns_id_t *ns) {
+  nspid_t ids;
+  return read_nspid(pid, &ids) == PLIMIT_OK && ids.count > level &&
+         ids.ids[level] == nspid &&
+         in_namespace(pid, ns, ids.count - 1 - level);
+}
+
+static void cache_path(char *buf, size_t size, const ns_id_t *ns) {
+  snprintf(buf, size, "%s/%lu", PIDNS_CACHE_DIR, (unsigned long)ns->ino);
+}
+
+static pid_t cache_lookup(const ns_id_t *ns, pid_t nspid) {
+  char path[PATH_MAX];
+  cache_path(path, sizeof(path), ns);
+  FILE *fp = fopen(path, "re");
+  if (!fp) {
+    return 0;
+  }
+  int a = 0;
+  int b = 0;
+  pid_t pid = 0;
+  while (fscanf(fp, "%d %d", &a, &b) == 2) {
+    if (a == nspid) {
+      pid = (pid_t)b;
+      break;
+    }
+  }
+  fclose(fp);
+  return pid;
+}
+
+static void cache_store(const ns_id_t *ns, const char *text, size_t len) {
+  char path[PATH_MAX];
+  char tmp[PATH_MAX];
+  cache_path(path, sizeof(path), ns);
+  if (snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid()) >=
+      (int)sizeof(tmp)) {
+    return;
+  }
+  mkdir(PLIMIT_RUN_DIR, 0755);
+  mkdir(PIDNS_CACHE_DIR, 0755);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  ssize_t n = write(fd, text, len);
+  close(fd);
+  if (n < 0 || (size_t)n != len || rename(tmp, path) != 0) {
+    unlink(tmp);
+  }
+}
+
+// every process of the namespace, the match is returned in pid
+static int scan(const ns_id_t *ns, size_t level, pid_t nspid, pid_t *pid,
+                size_t *seen) {
+  DIR *dir = opendir("/proc");
+  if (!dir) {
+    log_msg(LOG_ERROR, "failed to list /proc: %s", strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  char *text = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&text, &len);
+  if (!out) {
+    closedir(dir);
+    log_msg(LOG_ERROR, "failed to allocate memory for the PID scan");
+    return PLIMIT_ERR_MEM;
+  }
+  *pid = 0;
+  *seen = 0;
+  struct dirent *d;
+  while ((d = readdir(dir))) {
+    if (!isdigit((unsigned char)d->d_name[0])) {
+      continue;
+    }
+    pid_t cur = (pid_t)strtol(d->d_name, NULL, 10);
+    nspid_t ids;
+    (*seen)++;
+    // processes of shallower namespaces have no PID at this level
+    if (read_nspid(cur, &ids) != PLIMIT_OK || ids.count <= level ||
+        !in_namespace(cur, ns, ids.count - 1 - level)) {
+      continue;
+    }
+    fprintf(out, "%d %d\n", ids.ids[level], cur);
+    if (ids.ids[level] == nspid) {
+      *pid = cur;
+    }
+  }
+  closedir(dir);
+  if (fclose(out) != 0) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the PID scan");
+    return PLIMIT_ERR_MEM;
+  }
+  cache_store(ns, text, len);
+  free(text);
+  return PLIMIT_OK;
+}
+
+int pidns_resolve(pid_t ns_pid, pid_t nspid, const run_opts_t *opts,
+                  pid_t *pid) {
+  nspid_t ids;
+  int fd = open_ns(ns_pid);
+  if (fd < 0 || read_nspid(ns_pid, &ids) != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "cannot read the PID namespace of PID %d: %s", ns_pid,
+            fd < 0 ? strerror(errno) : "no NSpid in its status (Linux 4.1?)");
+    if (fd >= 0) {
+      close(fd);
+    }
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  ns_id_t ns;
+  int rc = ns_of(fd, &ns);
+  close(fd);
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "cannot read the PID namespace of PID %d: %s", ns_pid,
+            strerror(errno));
+    return rc;
+  }
+  // our own namespace is level 0
+  size_t level = ids.count - 1;
+  if (level == 0) {
+    if (read_nspid(nspid, &ids) != PLIMIT_OK) {
+      log_msg(LOG_ERROR, "no PID %d in the PID namespace of PID %d", nspid,
+              ns_pid);
+      return PLIMIT_ERR_NOTFOUND;
+    }
+    *pid = nspid;
+    return PLIMIT_OK;
+  }
+
+  pid_t cached = cache_lookup(&ns, nspid);
+  if (cached > 0 && matches(cached, nspid, level, &ns)) {
+    *pid = cached;
+    if (opts->verbose) {
+      log_msg(LOG_INFO, "PID %d of the namespace of PID %d is PID %d (cached)",
+              nspid, ns_pid, cached);
+    }
+    return PLIMIT_OK;
+  }
+
+  size_t seen = 0;
+  rc = scan(&ns, level, nspid, pid, &seen);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  if (*pid <= 0) {
+    log_msg(LOG_ERROR, "no PID %d in the PID namespace of PID %d", nspid,
+            ns_pid);
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  if (opts->verbose) {
+    log_msg(LOG_INFO, "PID %d of the namespace of PID %d is PID %d (%zu "
+                      "processes scanned)",
+            nspid, ns_pid, *pid, seen);
+  }
+  return PLIMIT_OK;
+}
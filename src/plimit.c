@@ -1,67 +1,184 @@
 #include <argtable3.h>
 #include <errno.h>
 #include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "cgroups.h"
+#include "commands.h"
+#include "pidns.h"
+#include "profile.h"
+#include "tier.h"
+#include "trace.h"
 #include "utils.h"
 
 static void print_version(void) {
   log_msg(LOG_NO_PREFIX, "plimit %s", PLIMIT_VERSION);
 }
 
-int main(int argc, char **argv) {
-  if (!run_as_root()) {
-    log_msg(LOG_ERROR, "must be run as root or with CAP_SYS_ADMIN: %s",
-            strerror(errno));
-    return PLIMIT_ERR_PERM;
+static const command_t commands[] = {
+    {"snapshot", cmd_snapshot, "capture the plimit hierarchy to stdout"},
+    {"restore", cmd_restore, "recreate a hierarchy from a snapshot"},
+    {"split", cmd_split, "divide a budget between weighted children"},
+    {"reconcile", cmd_reconcile, "apply and watch a desired state directory"},
+    {"reclaim", cmd_reclaim, "trim a cgroup towards its working set"},
+    {"pageout", cmd_pageout, "evict the cold mappings of a process"},
+    {"freeze-schedule", cmd_freeze_schedule,
+     "pause a cgroup on a duty cycle or under pressure"},
+    {"schedule", cmd_schedule, "switch limits in daily time windows"},
+    {"advise", cmd_advise, "recommend limits from observed usage"},
+    {"record", cmd_record, "record cgroup statistics into a ring file"},
+    {"replay", cmd_replay, "decode a file written by record"},
+    {NULL, NULL, NULL},
+};
+
+static void print_commands(void) {
+  log_msg(LOG_NO_PREFIX, "\nCommands:");
+  for (const command_t *c = commands; c->name; ++c) {
+    log_msg(LOG_NO_PREFIX, "  %-25s %s", c->name, c->help);
   }
+}
 
+static int load_profile(arena_t *a, const char *config, const char *name,
+                        limits_t *lim) {
+  profile_set_t set;
+  int rc = profiles_load(config, PROFILE_CACHE_PATH, &set);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  profile_t prof;
+  rc = profile_resolve(&set, name, host, &prof);
+  if (rc == PLIMIT_OK) {
+    rc = profile_apply(a, &set, &prof, lim);
+  }
+  if (rc == PLIMIT_OK && lim->opts.verbose) {
+    log_msg(LOG_INFO, "loaded profile '%s' from %s%s", name, config,
+            set.mapped ? " (cached)" : "");
+  }
+  profiles_free(&set);
+  return rc;
+}
+
+static int load_tier(const char *config, const char *name, limits_t *lim) {
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  int rc = tier_resolve(config, name, host, &lim->qos);
+  if (rc == PLIMIT_OK && lim->opts.verbose) {
+    log_msg(LOG_INFO, "loaded tier '%s'%s%s", name, config ? " from " : "",
+            config ? config : "");
+  }
+  return rc;
+}
+
+int main(int argc, char **argv) {
   int rc;
 
+  if (argc > 1 && argv[1][0] != '-') {
+    for (const command_t *c = commands; c->name; ++c) {
+      if (strcmp(argv[1], c->name) == 0) {
+        return c->run(argc - 1, argv + 1);
+      }
+    }
+    log_msg(LOG_PREFIX, "unknown command '%s'", argv[1]);
+    log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+    return PLIMIT_ERR_ARG;
+  }
+
   struct arg_lit *help = arg_lit0("h", "help", "show this help");
   struct arg_lit *version = arg_lit0("v", "version", "show version");
   struct arg_int *pid = arg_int0(
       "p", "pid", "PID", "target PID (required unless --delete + --cgname)");
+  struct arg_int *container_pid =
+      arg_int0(NULL, "container-pid", "N",
+               "target PID as seen inside the namespace of --pidns-of");
+  struct arg_int *pidns_of = arg_int0(
+      NULL, "pidns-of", "PID", "process whose PID namespace --container-pid "
+                               "is in");
   struct arg_int *cpu_percent =
-      arg_int0(NULL, "cpu-percent", "N", "limit CPU to N%% of a single CPU");
+      arg_int0(NULL, "cpu-percent", "N", "limit CPU to N%% of one CPU (250=2.5)");
+  struct arg_dbl *cpus =
+      arg_dbl0(NULL, "cpus", "N", "limit CPU to N cores (fractional allowed)");
+  struct arg_str *cpu_latency =
+      arg_str0(NULL, "cpu-latency", "HINT",
+               "period for --cpus/--cpu-percent: low, normal or batch");
+  struct arg_lit *latency_sensitive =
+      arg_lit0(NULL, "latency-sensitive", "same as --cpu-latency low");
   struct arg_int *cpu_quota =
       arg_int0(NULL, "cpu-quota", "US", "quota in µs (requires --cpu-period)");
   struct arg_int *cpu_period =
-      arg_int0(NULL, "cpu-period", "US", "period in µs (requires --cpu-quota)");
+      arg_int0(NULL, "cpu-period", "US",
+               "period in µs (with --cpu-quota, --cpus or --cpu-percent)");
   struct arg_str *cpu_max =
       arg_str0(NULL, "cpu-max", "STR",
                "direct cpu.max string (e.g. \"max\" or \"50000 100000\")");
   struct arg_str *mem_max =
       arg_str0(NULL, "mem-max", "SIZE", "memory.max with K/M/G suffix");
+  struct arg_str *mem_high = arg_str0(NULL, "mem-high", "SIZE",
+                                      "memory.high with K/M/G suffix or max");
   struct arg_str *io_max = arg_strn(NULL, "io-max", "STR", 0, 16,
                                     "io.max entries (MAJ:MIN rbps=... etc.)");
+  struct arg_str *hugetlb =
+      arg_strn(NULL, "hugetlb", "SIZE=LIMIT", 0, 16,
+               "hugetlb limits per page size (e.g. 2MB=4G,1GB=8G)");
+  struct arg_str *profile =
+      arg_str0(NULL, "profile", "NAME", "apply limits of a named profile");
+  struct arg_str *tier = arg_str0(
+      NULL, "tier", "NAME",
+      "QoS tier: latency-critical, standard, batch or best-effort");
+  struct arg_str *config = arg_str0(
+      NULL, "config", "FILE",
+      "profile and tier config file (default " PLIMIT_CONFIG_PATH ")");
   struct arg_str *cgname =
       arg_str0(NULL, "cgname", "NAME", "cgroup name (default plimit/<pid>)");
+  struct arg_str *cgroup_root =
+      arg_str0(NULL, "cgroup-root", "DIR",
+               "cgroup2 mount to use (default: $" CGROUP_ROOT_ENV
+               " or autodetect)");
   struct arg_lit *attach_only =
       arg_lit0(NULL, "attach-only", "move PID only, don't change limits");
   struct arg_lit *delete_cg =
       arg_lit0(NULL, "delete", "delete the cgroup (requires --cgname)");
+  struct arg_lit *nest = arg_lit0(
+      NULL, "nest", "create the cgroup below the PID's current cgroup");
   struct arg_lit *dry_run =
       arg_lit0(NULL, "dry-run", "print actions without making changes");
   struct arg_lit *force =
       arg_lit0(NULL, "force", "create parents and enable controllers");
   struct arg_lit *verbose = arg_lit0(NULL, "verbose", "extra logging");
+  struct arg_str *output = arg_str0(
+      NULL, "output", "FMT", "text (default) or json, one record per line");
+  struct arg_str *trace =
+      arg_str0(NULL, "trace", "FMT",
+               "time each cgroup operation, print as text or chrome");
+  struct arg_str *trace_file = arg_str0(
+      NULL, "trace-file", "FILE", "write the trace to FILE (default stderr)");
 
   struct arg_end *end = arg_end(20);
-  void *argtable[] = {help,      version,    pid,         cpu_percent,
-                      cpu_quota, cpu_period, cpu_max,     mem_max,
-                      io_max,    cgname,     attach_only, delete_cg,
-                      dry_run,   force,      verbose,     end};
+  void *argtable[] = {help,        version,     pid,
+                      container_pid,            pidns_of,
+                      cpu_percent, cpus,        cpu_latency,
+                      latency_sensitive,        cpu_quota,
+                      cpu_period,  cpu_max,     mem_max,
+                      mem_high,
+                      io_max,      hugetlb,     profile,
+                      tier,        config,      cgname,
+                      cgroup_root, attach_only, delete_cg,
+                      nest,        dry_run,     force,
+                      verbose,     output,      trace,
+                      trace_file,  end};
 
   int nerrors = arg_parse(argc, argv, argtable);
   if (help->count) {
     print_version();
-    log_msg(LOG_NO_PREFIX, "Usage: plimit [options]\n\n");
+    log_msg(LOG_NO_PREFIX, "Usage: plimit [options]\n"
+                           "       plimit <command> [options]\n\n");
     arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+    print_commands();
     arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
     return PLIMIT_OK;
   }
@@ -77,6 +194,13 @@ int main(int argc, char **argv) {
     return PLIMIT_ERR_ARG;
   }
 
+  // every string and array hanging off lim lives in this arena
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  trace_format_t trace_fmt = TRACE_OFF;
+  log_format_t log_fmt = LOG_FORMAT_TEXT;
+
   limits_t lim;
   memset(&lim, 0, sizeof(lim));
   lim.cpu_percent = -1;
@@ -85,19 +209,94 @@ int main(int argc, char **argv) {
   lim.mem_max = -1;
   lim.attach_only = attach_only->count > 0;
   lim.delete_cg = delete_cg->count > 0;
+  lim.nest = nest->count > 0;
   lim.opts.verbose = verbose->count > 0;
   lim.opts.dry_run = dry_run->count > 0;
   lim.opts.force = force->count > 0;
 
+  rc = cmd_setup(output, cgroup_root, 0, &log_fmt);
+  if (rc != PLIMIT_OK) {
+    goto exit;
+  }
+
+  if (trace->count || trace_file->count) {
+    rc = trace_parse_format(trace->count ? trace->sval[0] : "text",
+                            &trace_fmt);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+    trace_enable();
+  }
+  if (lim.opts.verbose) {
+    log_msg(LOG_INFO, "using cgroup root %s%s", cg_root(),
+            cg_emulated() ? " (emulated)" : "");
+  }
+
+  // profile values come first so that explicit flags override them
+  if (profile->count) {
+    rc = load_profile(&a, config->count ? config->sval[0] : PLIMIT_CONFIG_PATH,
+                      profile->sval[0], &lim);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
+
+  if (tier->count) {
+    // the built-in tiers work without a config file
+    const char *path = config->count ? config->sval[0] : PLIMIT_CONFIG_PATH;
+    rc = load_tier(config->count || access(path, F_OK) == 0 ? path : NULL,
+                   tier->sval[0], &lim);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
+
   if (pid->count) {
     lim.pid = (pid_t)pid->ival[0];
   }
+  if (container_pid->count || pidns_of->count) {
+    if (!container_pid->count || !pidns_of->count || pid->count) {
+      log_msg(LOG_PREFIX, "--container-pid and --pidns-of are required "
+                          "together and replace --pid");
+      log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+    rc = pidns_resolve((pid_t)pidns_of->ival[0],
+                       (pid_t)container_pid->ival[0], &lim.opts, &lim.pid);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
   if (cgname->count) {
-    lim.cgname = strdup(cgname->sval[0]);
+    lim.cgname = arena_strdup(&a, cgname->sval[0]);
+  }
+  // an explicit cpu limit replaces whichever form the profile used
+  if (cpu_percent->count || cpus->count || cpu_quota->count ||
+      cpu_max->count) {
+    lim.cpu_percent = -1;
+    lim.cpus = 0;
+    lim.cpu_quota = -1;
+    lim.cpu_max_raw = NULL;
+  }
+  if (cpu_max->count) {
+    lim.cpu_period = -1;
   }
   if (cpu_percent->count) {
     lim.cpu_percent = cpu_percent->ival[0];
   }
+  if (cpus->count) {
+    lim.cpus = cpus->dval[0];
+  }
+  if (latency_sensitive->count) {
+    lim.cpu_latency = CPU_LATENCY_LOW;
+  }
+  if (cpu_latency->count) {
+    rc = parse_cpu_latency(cpu_latency->sval[0], &lim.cpu_latency);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
   if (cpu_quota->count) {
     lim.cpu_quota = cpu_quota->ival[0];
   }
@@ -105,19 +304,53 @@ int main(int argc, char **argv) {
     lim.cpu_period = cpu_period->ival[0];
   }
   if (cpu_max->count) {
-    lim.cpu_max_raw = strdup(cpu_max->sval[0]);
+    lim.cpu_max_raw = arena_strdup(&a, cpu_max->sval[0]);
+    if (!lim.cpu_max_raw) {
+      log_msg(LOG_ERROR, "failed to allocate memory for --cpu-max");
+      rc = PLIMIT_ERR_MEM;
+      goto exit;
+    }
   }
   if (mem_max->count) {
     lim.mem_max = parse_bytes(mem_max->sval[0]);
   }
+  if (mem_high->count) {
+    if (parse_size(mem_high->sval[0], &lim.qos.mem_high) != PLIMIT_OK ||
+        (lim.qos.mem_high != -1 && lim.qos.mem_high < 1)) {
+      log_msg(LOG_PREFIX, "invalid size '%s' for --mem-high",
+              mem_high->sval[0]);
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+    lim.qos.set |= QOS_MEM_HIGH;
+  }
   if (io_max->count) {
     size_t n = io_max->count;
-    lim.io_max = (char **)calloc(n + 1, sizeof(char *));
-    for (size_t i = 0; i < n; i++) {
-      lim.io_max[i] = strdup(io_max->sval[i]);
+    lim.io_max = (char **)arena_alloc(&a, (n + 1) * sizeof(char *));
+    for (size_t i = 0; lim.io_max && i < n; i++) {
+      lim.io_max[i] = arena_strdup(&a, io_max->sval[i]);
+      if (!lim.io_max[i]) {
+        lim.io_max = NULL;
+      }
+    }
+    if (!lim.io_max) {
+      log_msg(LOG_ERROR, "failed to allocate memory for --io-max");
+      rc = PLIMIT_ERR_MEM;
+      goto exit;
     }
     lim.io_max[n] = NULL;
   }
+  if (hugetlb->count) {
+    lim.hugetlb = NULL;
+    lim.hugetlb_count = 0;
+  }
+  for (int i = 0; i < hugetlb->count; i++) {
+    rc = hugetlb_parse(&a, hugetlb->sval[i], &lim.hugetlb,
+                       &lim.hugetlb_count);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
 
   if (lim.opts.verbose && lim.opts.dry_run) {
     log_msg(LOG_PREFIX, "--verbose and --dry-run cannot be used together");
@@ -141,48 +374,25 @@ int main(int argc, char **argv) {
     goto exit;
   }
 
-  if (lim.cgname && lim.delete_cg) {
-    // move pids to root cgroup before deleting target cgroup
-    char **procs = get_procs_cgroup(&rc, lim.cgname);
-    if (rc != PLIMIT_OK) {
-      goto exit;
-    }
-    for (char **p = procs; *p; ++p) {
-      lim.pid = atoi(*p);
-      if (lim.pid <= 0) {
-        log_msg(LOG_ERROR, "invalid PID '%s' in cgroup '%s'", *p, lim.cgname);
-        rc = PLIMIT_ERR_ARG;
-        goto exit;
-      }
-      rc = add_proc_cgroup(CGROUP_ROOT_PATH, lim.pid, &lim.opts);
-      if (rc != PLIMIT_OK) {
-        for (char **p = procs; *p; ++p) {
-          free(*p);
-        }
-        free((void *)procs);
-        goto exit;
-      }
-    }
-    for (char **p = procs; *p; ++p) {
-      free(*p);
-    }
-    free((void *)procs);
-
-    rc = remove_procs_cgroup(lim.cgname, &lim.opts);
-    if (rc != PLIMIT_OK) {
-      goto exit;
-    }
+  if (lim.nest && (lim.delete_cg || lim.pid <= 0)) {
+    log_msg(LOG_PREFIX, "--nest requires --pid and cannot be used with "
+                        "--delete");
+    log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
 
-    rc = delete_cgroup(lim.cgname, &lim.opts);
-    if (rc == PLIMIT_OK) {
-      log_msg(LOG_ERROR, "deleted cgroup '%s'", lim.cgname);
+  if (lim.cgname && lim.delete_cg) {
+    rc = destroy_cgroup(lim.cgname, &lim.opts);
+    if (rc == PLIMIT_OK && log_fmt == LOG_FORMAT_TEXT) {
+      log_msg(LOG_NO_PREFIX, "deleted cgroup '%s'", lim.cgname);
     }
-
     goto exit;
   }
 
   if (!lim.cgname && lim.pid > 0) {
-    if (asprintf(&lim.cgname, "%d", lim.pid) < 0) {
+    lim.cgname = arena_sprintf(&a, "%d", lim.pid);
+    if (!lim.cgname) {
       log_msg(LOG_ERROR, "failed to allocate memory for cgroup name (pid=%d)",
               lim.pid);
       rc = PLIMIT_ERR_MEM;
@@ -190,8 +400,17 @@ int main(int argc, char **argv) {
     }
   }
 
+  if ((cpus->count || cpu_percent->count) && cpu_quota->count) {
+    log_msg(LOG_PREFIX,
+            "--cpu-quota cannot be used with --cpus or --cpu-percent");
+    log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  bool cpu_cores = lim.cpus > 0 || lim.cpu_percent > 0;
   if ((lim.cpu_quota > 0 && lim.cpu_period <= 0) ||
-      (lim.cpu_period > 0 && lim.cpu_quota <= 0)) {
+      (lim.cpu_period > 0 && lim.cpu_quota <= 0 && !cpu_cores)) {
     log_msg(LOG_PREFIX,
             "both --cpu-quota and --cpu-period are required together");
     log_msg(LOG_NO_PREFIX, "Try --help for more information.");
@@ -199,10 +418,39 @@ int main(int argc, char **argv) {
     goto exit;
   }
 
+  if (cpus->count && cpu_percent->count) {
+    log_msg(LOG_PREFIX, "--cpus and --cpu-percent cannot be used together");
+    log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  if (lim.cpu_period > CPU_PERIOD_MAX_US) {
+    log_msg(LOG_PREFIX, "--cpu-period must not exceed %lld", CPU_PERIOD_MAX_US);
+    log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  if ((cpus->count && (!isfinite(lim.cpus) || lim.cpus <= 0)) ||
+      (cpu_percent->count && lim.cpu_percent <= 0)) {
+    log_msg(LOG_PREFIX, "--cpus and --cpu-percent must be greater than 0");
+    log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+    rc = PLIMIT_ERR_ARG;
+    goto exit;
+  }
+
+  if (cpu_cores) {
+    double want = lim.cpus > 0 ? lim.cpus : lim.cpu_percent / 100.0;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online > 0 && want > (double)online) {
+      log_msg(LOG_WARN, "cpu limit of %.2f cores exceeds the %ld online CPUs",
+              want, online);
+    }
+  }
+
   if (!lim.cgname) {
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%d", lim.pid);
-    lim.cgname = strdup(buf);
+    lim.cgname = arena_sprintf(&a, "%d", lim.pid);
     if (!lim.cgname) {
       log_msg(LOG_ERROR, "failed to allocate memory for cgroup name (pid=%d)",
               lim.pid);
@@ -215,34 +463,59 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (lim.nest) {
+    if (strchr(lim.cgname, '/')) {
+      log_msg(LOG_PREFIX, "--cgname must be a single name with --nest");
+      log_msg(LOG_NO_PREFIX, "Try --help for more information.");
+      rc = PLIMIT_ERR_ARG;
+      goto exit;
+    }
+    rc = cg_nest_name(&a, lim.pid, lim.cgname, &lim.cgname);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+    if (lim.opts.verbose) {
+      log_msg(LOG_INFO, "nesting cgroup as '%s'", lim.cgname);
+    }
+  }
+
   rc = apply_limits(&lim);
   if (rc != PLIMIT_OK) {
     goto exit;
   }
 
+  if (log_fmt == LOG_FORMAT_JSON) {
+    goto exit;
+  }
   if (lim.opts.dry_run) {
     log_msg(LOG_DRY_RUN, "applied cgroup %s for PID %d", lim.cgname, lim.pid);
-    rc = PLIMIT_OK;
     goto exit;
   }
 
   log_msg(LOG_NO_PREFIX, "applied cgroup %s for PID %d", lim.cgname, lim.pid);
-  rc = PLIMIT_OK;
   goto exit;
 
 exit:
-  if (lim.cgname) {
-    free(lim.cgname);
-  }
-  if (lim.cpu_max_raw) {
-    free(lim.cpu_max_raw);
-  }
-  if (lim.io_max) {
-    for (char **p = lim.io_max; *p; ++p) {
-      free(*p);
+  log_result(lim.delete_cg ? "delete" : "apply", lim.cgname, lim.pid, rc);
+  if (trace_fmt != TRACE_OFF) {
+    FILE *out = stderr;
+    if (trace_file->count) {
+      out = fopen(trace_file->sval[0], "we");
+      if (!out) {
+        log_msg(LOG_ERROR, "cannot open trace file '%s': %s",
+                trace_file->sval[0], strerror(errno));
+      }
+    }
+    int trc = out ? trace_write(out, trace_fmt) : PLIMIT_ERR_IO;
+    if (rc == PLIMIT_OK) {
+      rc = trc;
+    }
+    if (out && out != stderr) {
+      fclose(out);
     }
-    free((void *)lim.io_max);
+    trace_reset();
   }
+  arena_release(&a);
 
   arg_freetable((void **)argtable, sizeof(argtable) / sizeof(argtable[0]));
   return rc;
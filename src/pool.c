@@ -0,0 +1,203 @@
+#include "pool.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+static const size_t DEQUE_INITIAL_CAP = 64;
+
+// the owner pushes and pops at the tail, thieves take from the head
+typedef struct {
+  pthread_mutex_t lock;
+  void **items;
+  size_t head;
+  size_t tail;
+  size_t cap;
+} deque_t;
+
+struct pool {
+  deque_t *deques;
+  size_t nworkers;
+  pool_task_fn fn;
+  void *ctx;
+  atomic_size_t pending; // queued or running tasks
+  atomic_int rc;
+  pthread_mutex_t idle_lock;
+  pthread_cond_t idle_cond;
+  unsigned long generation; // bumped on every push, under idle_lock
+};
+
+typedef struct {
+  pool_t *pool;
+  size_t id;
+} worker_t;
+
+static _Thread_local size_t worker_id;
+
+static bool deque_push(deque_t *d, void *task) {
+  pthread_mutex_lock(&d->lock);
+  if (d->tail == d->cap) {
+    // compact first, grow only if the deque is really full
+    size_t used = d->tail - d->head;
+    if (d->head > 0 && used < d->cap / 2) {
+      for (size_t i = 0; i < used; i++) {
+        d->items[i] = d->items[d->head + i];
+      }
+    } else {
+      size_t ncap = d->cap ? d->cap * 2 : DEQUE_INITIAL_CAP;
+      void **tmp = realloc(d->items, ncap * sizeof(*tmp));
+      if (!tmp) {
+        pthread_mutex_unlock(&d->lock);
+        return false;
+      }
+      for (size_t i = 0; i < used; i++) {
+        tmp[i] = tmp[d->head + i];
+      }
+      d->items = tmp;
+      d->cap = ncap;
+    }
+    d->head = 0;
+    d->tail = used;
+  }
+  d->items[d->tail++] = task;
+  pthread_mutex_unlock(&d->lock);
+  return true;
+}
+
+static void *deque_pop(deque_t *d, bool steal) {
+  void *task = NULL;
+  pthread_mutex_lock(&d->lock);
+  if (d->head < d->tail) {
+    task = steal ? d->items[d->head++] : d->items[--d->tail];
+  }
+  if (d->head == d->tail) {
+    d->head = 0;
+    d->tail = 0;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return task;
+}
+
+static void *find_task(pool_t *p, size_t id) {
+  void *task = deque_pop(&p->deques[id], false);
+  for (size_t i = 1; !task && i < p->nworkers; i++) {
+    task = deque_pop(&p->deques[(id + i) % p->nworkers], true);
+  }
+  return task;
+}
+
+static void run_task(pool_t *p, void *task) {
+  p->fn(p, task, p->ctx);
+  if (atomic_fetch_sub(&p->pending, 1) == 1) {
+    pthread_mutex_lock(&p->idle_lock);
+    pthread_cond_broadcast(&p->idle_cond);
+    pthread_mutex_unlock(&p->idle_lock);
+  }
+}
+
+static void *worker_main(void *arg) {
+  worker_t *w = (worker_t *)arg;
+  pool_t *p = w->pool;
+  worker_id = w->id;
+  for (;;) {
+    pthread_mutex_lock(&p->idle_lock);
+    unsigned long seen = p->generation;
+    pthread_mutex_unlock(&p->idle_lock);
+
+    void *task = find_task(p, w->id);
+    if (task) {
+      run_task(p, task);
+      continue;
+    }
+    // nothing to take: sleep until a push or the last task finishing
+    pthread_mutex_lock(&p->idle_lock);
+    while (atomic_load(&p->pending) > 0 && p->generation == seen) {
+      pthread_cond_wait(&p->idle_cond, &p->idle_lock);
+    }
+    bool done = atomic_load(&p->pending) == 0;
+    pthread_mutex_unlock(&p->idle_lock);
+    if (done) {
+      return NULL;
+    }
+  }
+}
+
+void pool_push(pool_t *pool, void *task) {
+  atomic_fetch_add(&pool->pending, 1);
+  if (!deque_push(&pool->deques[worker_id], task)) {
+    atomic_store(&pool->rc, PLIMIT_ERR_MEM);
+    run_task(pool, task);
+    return;
+  }
+  pthread_mutex_lock(&pool->idle_lock);
+  pool->generation++;
+  pthread_cond_signal(&pool->idle_cond);
+  pthread_mutex_unlock(&pool->idle_lock);
+}
+
+int pool_run(size_t jobs, void *const *tasks, size_t count, pool_task_fn fn,
+             void *ctx) {
+  if (jobs < 1) {
+    jobs = 1;
+  }
+  if (jobs > POOL_MAX_JOBS) {
+    jobs = POOL_MAX_JOBS;
+  }
+  pool_t p = {.nworkers = jobs, .fn = fn, .ctx = ctx};
+  atomic_init(&p.pending, 0);
+  atomic_init(&p.rc, PLIMIT_OK);
+  p.deques = calloc(jobs, sizeof(*p.deques));
+  worker_t *workers = calloc(jobs, sizeof(*workers));
+  pthread_t *threads = calloc(jobs, sizeof(*threads));
+  if (!p.deques || !workers || !threads) {
+    free(p.deques);
+    free(workers);
+    free(threads);
+    log_msg(LOG_ERROR, "failed to allocate memory for %zu workers", jobs);
+    return PLIMIT_ERR_MEM;
+  }
+  pthread_mutex_init(&p.idle_lock, NULL);
+  pthread_cond_init(&p.idle_cond, NULL);
+  for (size_t i = 0; i < jobs; i++) {
+    pthread_mutex_init(&p.deques[i].lock, NULL);
+    workers[i].pool = &p;
+    workers[i].id = i;
+  }
+
+  // queue in reverse so that each worker starts with its first task
+  atomic_store(&p.pending, count);
+  for (size_t i = count; i-- > 0;) {
+    if (!deque_push(&p.deques[i % jobs], tasks[i])) {
+      atomic_store(&p.rc, PLIMIT_ERR_MEM);
+      worker_id = 0;
+      run_task(&p, tasks[i]);
+    }
+  }
+
+  size_t started = 1;
+  for (; started < jobs; started++) {
+    if (pthread_create(&threads[started], NULL, worker_main,
+                       &workers[started]) != 0) {
+      // fewer threads still drain every deque by stealing
+      break;
+    }
+  }
+  size_t saved_id = worker_id;
+  worker_main(&workers[0]);
+  worker_id = saved_id;
+  for (size_t i = 1; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (size_t i = 0; i < jobs; i++) {
+    pthread_mutex_destroy(&p.deques[i].lock);
+    free(p.deques[i].items);
+  }
+  pthread_mutex_destroy(&p.idle_lock);
+  pthread_cond_destroy(&p.idle_cond);
+  free(p.deques);
+  free(workers);
+  free(threads);
+  return atomic_load(&p.rc);
+}
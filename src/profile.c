@@ -0,0 +1,545 @@
+#include "profile.h"
+#include "ini.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char PROFILE_MAGIC[8] = "PLPROF2";
+static const char PROFILE_SECTION[] = "profile ";
+
+/**
+ * @struct profile_header_t
+ * @brief Header of a compiled profile set, followed by count profile_t
+ * records and strings_len bytes of string pool.
+ */
+typedef struct {
+  char magic[8];
+  uint64_t src_dev;
+  uint64_t src_ino;
+  uint64_t src_size;
+  int64_t src_mtime_sec;
+  int64_t src_mtime_nsec;
+  uint64_t count;
+  uint64_t strings_len;
+} profile_header_t;
+
+typedef struct {
+  const char *path;
+  profile_t *profiles;
+  size_t count;
+  size_t cap;
+  char *strings;
+  size_t strings_len;
+  size_t strings_cap;
+} builder_t;
+
+const char *profile_str(const profile_set_t *set, uint32_t off) {
+  return off ? set->strings + off : NULL;
+}
+
+static int pool_add(builder_t *b, const char *s, uint32_t *off) {
+  size_t len = strlen(s) + 1;
+  if (b->strings_len + len > b->strings_cap) {
+    size_t cap = b->strings_cap ? b->strings_cap * 2 : 256;
+    while (cap < b->strings_len + len) {
+      cap *= 2;
+    }
+    char *tmp = (char *)realloc(b->strings, cap);
+    if (!tmp) {
+      log_msg(LOG_ERROR, "failed to allocate memory for profile strings");
+      return PLIMIT_ERR_MEM;
+    }
+    b->strings = tmp;
+    b->strings_cap = cap;
+  }
+  if (b->strings_len == 0) {
+    // offset 0 is reserved for "unset"
+    b->strings[b->strings_len++] = '\0';
+    return pool_add(b, s, off);
+  }
+  memcpy(b->strings + b->strings_len, s, len);
+  *off = (uint32_t)b->strings_len;
+  b->strings_len += len;
+  return PLIMIT_OK;
+}
+
+static const char *pool_str(const builder_t *b, uint32_t off) {
+  return off ? b->strings + off : "";
+}
+
+static int builder_section(builder_t *b, const char *section,
+                           profile_t **out) {
+  char name[256];
+  snprintf(name, sizeof(name), "%s", section + strlen(PROFILE_SECTION));
+  char *host = strchr(name, '@');
+  if (host) {
+    *host++ = '\0';
+  }
+  if (!*name || (host && !*host)) {
+    log_msg(LOG_ERROR, "%s: invalid profile section '[%s]'", b->path,
+            section);
+    return PLIMIT_ERR_PARSE;
+  }
+  for (size_t i = 0; i < b->count; i++) {
+    profile_t *p = &b->profiles[i];
+    if (strcmp(pool_str(b, p->name), name) == 0 &&
+        strcmp(pool_str(b, p->host), host ? host : "") == 0) {
+      *out = p;
+      return PLIMIT_OK;
+    }
+  }
+  if (b->count == b->cap) {
+    size_t cap = b->cap ? b->cap * 2 : 8;
+    profile_t *tmp =
+        (profile_t *)realloc(b->profiles, cap * sizeof(profile_t));
+    if (!tmp) {
+      log_msg(LOG_ERROR, "failed to allocate memory for profiles");
+      return PLIMIT_ERR_MEM;
+    }
+    b->profiles = tmp;
+    b->cap = cap;
+  }
+  profile_t *p = &b->profiles[b->count];
+  memset(p, 0, sizeof(*p));
+  int rc = pool_add(b, name, &p->name);
+  if (rc == PLIMIT_OK && host) {
+    rc = pool_add(b, host, &p->host);
+  }
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  b->count++;
+  *out = p;
+  return PLIMIT_OK;
+}
+
+static int parse_positive(const char *value, long long *out) {
+  char *end = NULL;
+  errno = 0;
+  long long v = strtoll(value, &end, 10);
+  if (errno || *end || v <= 0) {
+    return PLIMIT_ERR_PARSE;
+  }
+  *out = v;
+  return PLIMIT_OK;
+}
+
+static int builder_key(profile_t *p, builder_t *b, const char *key,
+                       const char *value) {
+  long long v = 0;
+  if (strcmp(key, "inherit") == 0) {
+    return pool_add(b, value, &p->inherit);
+  }
+  if (strcmp(key, "cpu-percent") == 0) {
+    if (parse_positive(value, &v) != PLIMIT_OK || v > INT32_MAX) {
+      return PLIMIT_ERR_PARSE;
+    }
+    p->cpu_percent = (int32_t)v;
+    p->set |= PROFILE_CPU_PERCENT;
+    return PLIMIT_OK;
+  }
+  if (strcmp(key, "cpus") == 0) {
+    char *end = NULL;
+    double d = strtod(value, &end);
+    if (*end || !isfinite(d) || d <= 0) {
+      return PLIMIT_ERR_PARSE;
+    }
+    p->cpus = d;
+    p->set |= PROFILE_CPUS;
+    return PLIMIT_OK;
+  }
+  if (strcmp(key, "cpu-latency") == 0) {
+    cpu_latency_t hint = CPU_LATENCY_NORMAL;
+    if (parse_cpu_latency(value, &hint) != PLIMIT_OK) {
+      return PLIMIT_ERR_PARSE;
+    }
+    p->cpu_latency = (int32_t)hint;
+    p->set |= PROFILE_CPU_LATENCY;
+    return PLIMIT_OK;
+  }
+  if (strcmp(key, "cpu-quota") == 0 || strcmp(key, "cpu-period") == 0) {
+    if (parse_positive(value, &v) != PLIMIT_OK) {
+      return PLIMIT_ERR_PARSE;
+    }
+    if (key[4] == 'q') {
+      p->cpu_quota = v;
+      p->set |= PROFILE_CPU_QUOTA;
+    } else {
+      p->cpu_period = v;
+      p->set |= PROFILE_CPU_PERIOD;
+    }
+    return PLIMIT_OK;
+  }
+  if (strcmp(key, "cpu-max") == 0) {
+    p->set |= PROFILE_CPU_MAX;
+    return pool_add(b, value, &p->cpu_max);
+  }
+  if (strcmp(key, "mem-max") == 0) {
+    p->mem_max = parse_bytes(value);
+    p->set |= PROFILE_MEM_MAX;
+    return p->mem_max > 0 ? PLIMIT_OK : PLIMIT_ERR_PARSE;
+  }
+  if (strcmp(key, "io-max") == 0) {
+    if (p->io_max_count == PROFILE_MAX_IO) {
+      return PLIMIT_ERR_ARG;
+    }
+    p->set |= PROFILE_IO_MAX;
+    return pool_add(b, value, &p->io_max[p->io_max_count++]);
+  }
+  if (strcmp(key, "hugetlb") == 0) {
+    p->set |= PROFILE_HUGETLB;
+    return pool_add(b, value, &p->hugetlb);
+  }
+  log_msg(LOG_ERROR, "unknown profile key '%s'", key);
+  return PLIMIT_ERR_PARSE;
+}
+
+static int builder_handler(const char *section, const char *key,
+                           const char *value, int lineno, void *ctx) {
+  builder_t *b = (builder_t *)ctx;
+  if (strncmp(section, PROFILE_SECTION, strlen(PROFILE_SECTION)) != 0) {
+    // other sections belong to other features sharing the file
+    return PLIMIT_OK;
+  }
+  profile_t *p = NULL;
+  int rc = builder_section(b, section, &p);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  rc = builder_key(p, b, key, value);
+  if (rc != PLIMIT_OK && rc != PLIMIT_ERR_MEM) {
+    log_msg(LOG_ERROR, "%s:%d: invalid value '%s' for '%s'", b->path, lineno,
+            value, key);
+  }
+  return rc;
+}
+
+static void set_from_blob(profile_set_t *set, void *blob, size_t len,
+                          bool mapped) {
+  const profile_header_t *hdr = (const profile_header_t *)blob;
+  set->blob = blob;
+  set->blob_len = len;
+  set->mapped = mapped;
+  set->count = hdr->count;
+  set->profiles = (const profile_t *)((char *)blob + sizeof(*hdr));
+  set->strings = (const char *)(set->profiles + hdr->count);
+}
+
+// a stale or truncated cache must not send profile_str() out of the pool
+static bool profile_valid(const profile_t *p, uint64_t strings_len) {
+  if (p->name == 0 || p->io_max_count > PROFILE_MAX_IO) {
+    return false;
+  }
+  uint32_t offs[] = {p->name, p->host, p->inherit, p->cpu_max, p->hugetlb};
+  for (size_t i = 0; i < sizeof(offs) / sizeof(offs[0]); i++) {
+    if (offs[i] >= strings_len) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < PROFILE_MAX_IO; i++) {
+    if (p->io_max[i] >= strings_len || (i < p->io_max_count && !p->io_max[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool header_matches(const profile_header_t *hdr, size_t len,
+                           const struct stat *src) {
+  if (len < sizeof(*hdr) ||
+      memcmp(hdr->magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC)) != 0) {
+    return false;
+  }
+  if (hdr->src_dev != (uint64_t)src->st_dev ||
+      hdr->src_ino != (uint64_t)src->st_ino ||
+      hdr->src_size != (uint64_t)src->st_size ||
+      hdr->src_mtime_sec != (int64_t)src->st_mtim.tv_sec ||
+      hdr->src_mtime_nsec != (int64_t)src->st_mtim.tv_nsec) {
+    return false;
+  }
+  if (hdr->count > len / sizeof(profile_t)) {
+    return false;
+  }
+  size_t want =
+      sizeof(*hdr) + hdr->count * sizeof(profile_t) + hdr->strings_len;
+  if (want != len || hdr->strings_len == 0) {
+    return false;
+  }
+  const char *strings = (const char *)hdr + len - hdr->strings_len;
+  if (strings[0] != '\0' || strings[hdr->strings_len - 1] != '\0') {
+    return false;
+  }
+  const profile_t *profiles = (const profile_t *)(hdr + 1);
+  for (uint64_t i = 0; i < hdr->count; i++) {
+    if (!profile_valid(&profiles[i], hdr->strings_len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int load_cache(const char *cache, const struct stat *src,
+                      profile_set_t *set) {
+  int fd = open(cache, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(profile_header_t)) {
+    close(fd);
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  size_t len = (size_t)st.st_size;
+  void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return PLIMIT_ERR_IO;
+  }
+  if (!header_matches((const profile_header_t *)map, len, src)) {
+    munmap(map, len);
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  set_from_blob(set, map, len, true);
+  return PLIMIT_OK;
+}
+
+static void store_cache(const char *cache, const void *blob, size_t len) {
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.%d", cache, getpid());
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", cache);
+  char *slash = strrchr(dir, '/');
+  if (slash && slash != dir) {
+    *slash = '\0';
+    mkdir(dir, 0755);
+  }
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  ssize_t n = write(fd, blob, len);
+  close(fd);
+  if (n < 0 || (size_t)n != len || rename(tmp, cache) != 0) {
+    unlink(tmp);
+  }
+}
+
+int profiles_load(const char *path, const char *cache, profile_set_t *set) {
+  memset(set, 0, sizeof(*set));
+  struct stat src;
+  if (stat(path, &src) != 0) {
+    int err = errno;
+    log_msg(LOG_ERROR, "cannot access config file '%s': %s", path,
+            strerror(err));
+    return err == ENOENT ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+  if (cache && load_cache(cache, &src, set) == PLIMIT_OK) {
+    return PLIMIT_OK;
+  }
+
+  builder_t b = {.path = path};
+  uint32_t unused = 0;
+  int rc = pool_add(&b, "", &unused);
+  if (rc == PLIMIT_OK) {
+    rc = ini_parse_file(path, builder_handler, &b);
+  }
+  if (rc != PLIMIT_OK) {
+    free(b.profiles);
+    free(b.strings);
+    return rc;
+  }
+
+  size_t len = sizeof(profile_header_t) + b.count * sizeof(profile_t) +
+               b.strings_len;
+  char *blob = (char *)calloc(1, len);
+  if (!blob) {
+    log_msg(LOG_ERROR, "failed to allocate memory for profiles");
+    free(b.profiles);
+    free(b.strings);
+    return PLIMIT_ERR_MEM;
+  }
+  profile_header_t *hdr = (profile_header_t *)blob;
+  memcpy(hdr->magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC));
+  hdr->src_dev = (uint64_t)src.st_dev;
+  hdr->src_ino = (uint64_t)src.st_ino;
+  hdr->src_size = (uint64_t)src.st_size;
+  hdr->src_mtime_sec = (int64_t)src.st_mtim.tv_sec;
+  hdr->src_mtime_nsec = (int64_t)src.st_mtim.tv_nsec;
+  hdr->count = b.count;
+  hdr->strings_len = b.strings_len;
+  if (b.count) {
+    memcpy(blob + sizeof(*hdr), b.profiles, b.count * sizeof(profile_t));
+  }
+  memcpy(blob + len - b.strings_len, b.strings, b.strings_len);
+  free(b.profiles);
+  free(b.strings);
+
+  if (cache) {
+    store_cache(cache, blob, len);
+  }
+  set_from_blob(set, blob, len, false);
+  return PLIMIT_OK;
+}
+
+void profiles_free(profile_set_t *set) {
+  if (!set->blob) {
+    return;
+  }
+  if (set->mapped) {
+    munmap(set->blob, set->blob_len);
+  } else {
+    free(set->blob);
+  }
+  memset(set, 0, sizeof(*set));
+}
+
+static const profile_t *find_profile(const profile_set_t *set,
+                                     const char *name, const char *host) {
+  for (size_t i = 0; i < set->count; i++) {
+    const profile_t *p = &set->profiles[i];
+    if (strcmp(profile_str(set, p->name), name) != 0) {
+      continue;
+    }
+    if (!host && p->host == 0) {
+      return p;
+    }
+    if (host && p->host && host_matches(profile_str(set, p->host), host)) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static void merge_profile(profile_t *dst, const profile_t *src) {
+  uint32_t set = src->set;
+  if (src->inherit) {
+    dst->inherit = src->inherit;
+  }
+  // the cpu limit forms replace each other, an inherited cpu-max must not
+  // win over the cpus of a child
+  if (set & PROFILE_CPU_LIMIT) {
+    dst->set &= ~(uint32_t)PROFILE_CPU_LIMIT;
+  }
+  // cpu-max carries its own period
+  if (set & PROFILE_CPU_MAX) {
+    dst->set &= ~(uint32_t)PROFILE_CPU_PERIOD;
+  }
+  if (set & PROFILE_CPU_PERCENT) {
+    dst->cpu_percent = src->cpu_percent;
+  }
+  if (set & PROFILE_CPUS) {
+    dst->cpus = src->cpus;
+  }
+  if (set & PROFILE_CPU_LATENCY) {
+    dst->cpu_latency = src->cpu_latency;
+  }
+  if (set & PROFILE_CPU_QUOTA) {
+    dst->cpu_quota = src->cpu_quota;
+  }
+  if (set & PROFILE_CPU_PERIOD) {
+    dst->cpu_period = src->cpu_period;
+  }
+  if (set & PROFILE_CPU_MAX) {
+    dst->cpu_max = src->cpu_max;
+  }
+  if (set & PROFILE_MEM_MAX) {
+    dst->mem_max = src->mem_max;
+  }
+  if (set & PROFILE_IO_MAX) {
+    memcpy(dst->io_max, src->io_max, sizeof(dst->io_max));
+    dst->io_max_count = src->io_max_count;
+  }
+  if (set & PROFILE_HUGETLB) {
+    dst->hugetlb = src->hugetlb;
+  }
+  dst->set |= set;
+}
+
+int profile_resolve(const profile_set_t *set, const char *name,
+                    const char *host, profile_t *out) {
+  profile_t chain[PROFILE_MAX_DEPTH];
+  size_t depth = 0;
+  const char *cur = name;
+
+  while (cur) {
+    if (depth == PROFILE_MAX_DEPTH) {
+      log_msg(LOG_ERROR, "profile '%s' inherits too deeply (cycle?)", name);
+      return PLIMIT_ERR_PARSE;
+    }
+    const profile_t *base = find_profile(set, cur, NULL);
+    const profile_t *over = find_profile(set, cur, host);
+    if (!base && !over) {
+      log_msg(LOG_ERROR, "profile '%s' not found", cur);
+      return PLIMIT_ERR_NOTFOUND;
+    }
+    profile_t *level = &chain[depth++];
+    memset(level, 0, sizeof(*level));
+    if (base) {
+      merge_profile(level, base);
+    }
+    if (over) {
+      merge_profile(level, over);
+    }
+    cur = profile_str(set, level->inherit);
+  }
+
+  memset(out, 0, sizeof(*out));
+  while (depth > 0) {
+    merge_profile(out, &chain[--depth]);
+  }
+  out->inherit = 0;
+  return PLIMIT_OK;
+}
+
+int profile_apply(arena_t *a, const profile_set_t *set, const profile_t *p,
+                  limits_t *lim) {
+  if (p->set & PROFILE_CPU_PERCENT) {
+    lim->cpu_percent = p->cpu_percent;
+  }
+  if (p->set & PROFILE_CPUS) {
+    lim->cpus = p->cpus;
+  }
+  if (p->set & PROFILE_CPU_LATENCY) {
+    lim->cpu_latency = (cpu_latency_t)p->cpu_latency;
+  }
+  if (p->set & PROFILE_CPU_QUOTA) {
+    lim->cpu_quota = p->cpu_quota;
+  }
+  if (p->set & PROFILE_CPU_PERIOD) {
+    lim->cpu_period = p->cpu_period;
+  }
+  if (p->set & PROFILE_MEM_MAX) {
+    lim->mem_max = p->mem_max;
+  }
+  if (p->set & PROFILE_CPU_MAX) {
+    lim->cpu_max_raw = arena_strdup(a, profile_str(set, p->cpu_max));
+    if (!lim->cpu_max_raw) {
+      return PLIMIT_ERR_MEM;
+    }
+  }
+  if (p->set & PROFILE_IO_MAX) {
+    lim->io_max =
+        (char **)arena_alloc(a, (p->io_max_count + 1) * sizeof(char *));
+    if (!lim->io_max) {
+      return PLIMIT_ERR_MEM;
+    }
+    for (uint32_t i = 0; i < p->io_max_count; i++) {
+      lim->io_max[i] = arena_strdup(a, profile_str(set, p->io_max[i]));
+      if (!lim->io_max[i]) {
+        return PLIMIT_ERR_MEM;
+      }
+    }
+  }
+  if (p->set & PROFILE_HUGETLB) {
+    return hugetlb_parse(a, profile_str(set, p->hugetlb), &lim->hugetlb,
+                         &lim->hugetlb_count);
+  }
+  return PLIMIT_OK;
+}
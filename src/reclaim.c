@@ -0,0 +1,216 @@
+#include "reclaim.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static long long stat_key(const char *stat, const char *key) {
+  size_t klen = strlen(key);
+  for (const char *line = stat; *line;) {
+    if (strncmp(line, key, klen) == 0 && line[klen] == ' ') {
+      return strtoll(line + klen + 1, NULL, 10);
+    }
+    line += strcspn(line, "\n");
+    line += *line == '\n';
+  }
+  return 0;
+}
+
+int reclaim_sample(const char *cgpath, reclaim_sample_t *s) {
+  memset(s, 0, sizeof(*s));
+  int rc = cg_read_value(cgpath, "memory.current", &s->current);
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to read %s/memory.current", cgpath);
+    return rc;
+  }
+  char path[PATH_MAX];
+  char buf[RECLAIM_STAT_SIZE];
+  snprintf(path, sizeof(path), "%s/memory.stat", cgpath);
+  rc = read_file(path, buf, sizeof(buf));
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to read %s", path);
+    return rc;
+  }
+  s->active_anon = stat_key(buf, "active_anon");
+  s->inactive_anon = stat_key(buf, "inactive_anon");
+  s->active_file = stat_key(buf, "active_file");
+  s->inactive_file = stat_key(buf, "inactive_file");
+  // split by LRU type since 5.9, a single counter before
+  s->refaults = stat_key(buf, "workingset_refault_anon") +
+                stat_key(buf, "workingset_refault_file") +
+                stat_key(buf, "workingset_refault");
+
+  snprintf(path, sizeof(path), "%s/memory.pressure", cgpath);
+  if (read_file(path, buf, sizeof(buf)) == PLIMIT_OK &&
+      sscanf(buf, "some avg10=%lf", &s->psi_some) != 1) {
+    s->psi_some = 0;
+  }
+  return PLIMIT_OK;
+}
+
+long long reclaim_target(const reclaim_sample_t *s,
+                         const reclaim_opts_t *ropts) {
+  long long ws = s->current - s->inactive_anon - s->inactive_file;
+  if (ws < 0) {
+    ws = 0;
+  }
+  long long target = ws + ws / 100 * ropts->headroom;
+  return target > ropts->min_bytes ? target : ropts->min_bytes;
+}
+
+// the kernel reclaims in batches and fails with EAGAIN when it fell short of
+// the request, which is the normal outcome under a tight working set
+static int write_reclaim(const char *cgpath, long long bytes,
+                         const run_opts_t *opts) {
+  char path[PATH_MAX];
+  char value[32];
+  snprintf(path, sizeof(path), "%s/memory.reclaim", cgpath);
+  snprintf(value, sizeof(value), "%lld", bytes);
+  if (opts->dry_run) {
+    log_action(LOG_ACTION_WRITE, path, value, true, false);
+    return PLIMIT_OK;
+  }
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    int err = errno;
+    log_msg(LOG_ERROR, "failed to open file '%s': %s", path,
+            strerror(err));
+    return err == ENOENT ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+  uint64_t t = trace_begin();
+  ssize_t n = write(fd, value, strlen(value));
+  int err = n < 0 ? errno : 0;
+  trace_end(t, "write", value, -err);
+  close(fd);
+  if (n < 0 && err != EAGAIN) {
+    log_msg(LOG_ERROR, "failed to write to file '%s': %s", path,
+            strerror(err));
+    return PLIMIT_ERR_IO;
+  }
+  log_action(LOG_ACTION_WRITE, path, value, false, opts->verbose);
+  return PLIMIT_OK;
+}
+
+typedef struct {
+  long long last_step; // bytes reclaimed by the previous write
+  long long refaults;  // refault counter after the previous write
+  int backoff;         // passes to hold back on the next trip
+  int hold;            // passes still held back
+} reclaim_state_t;
+
+static int reclaim_pass(const char *cgpath, const reclaim_opts_t *ropts,
+                        reclaim_state_t *st, reclaim_stats_t *stats) {
+  reclaim_sample_t s;
+  int rc = reclaim_sample(cgpath, &s);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  stats->passes++;
+  long long page = sysconf(_SC_PAGESIZE);
+  long long refault = (s.refaults - st->refaults) * page;
+  st->refaults = s.refaults;
+  const char *why = NULL;
+  if (s.psi_some >= ropts->psi) {
+    why = "memory pressure";
+  } else if (st->last_step > 0 &&
+             refault > st->last_step / 100 * RECLAIM_REFAULT_PCT) {
+    why = "refaults";
+  }
+  st->last_step = 0;
+  if (why) {
+    st->hold = st->backoff;
+    st->backoff = st->backoff * 2 < RECLAIM_BACKOFF_MAX ? st->backoff * 2
+                                                        : RECLAIM_BACKOFF_MAX;
+    stats->held++;
+    if (ropts->opts.verbose) {
+      log_msg(LOG_INFO, "holding back for %d passes: %s (psi %.2f, %lld "
+                        "bytes refaulted)",
+              st->hold, why, s.psi_some, refault);
+    }
+    return PLIMIT_OK;
+  }
+  st->backoff = st->backoff > 1 ? st->backoff / 2 : 1;
+
+  long long target = reclaim_target(&s, ropts);
+  long long step = s.current - target;
+  long long cap = ropts->max_rate / MSEC_PER_SEC * ropts->interval_ms;
+  if (step > cap) {
+    step = cap;
+  }
+  // proportional to the pressure budget left, so the loop settles instead
+  // of oscillating around the threshold
+  step = (long long)((double)step * (1.0 - s.psi_some / ropts->psi));
+  step -= step % page;
+  if (ropts->opts.verbose) {
+    log_msg(LOG_INFO, "current %lld, target %lld, psi %.2f: reclaim %lld",
+            s.current, target, s.psi_some, step > 0 ? step : 0);
+  }
+  if (step <= 0) {
+    return PLIMIT_OK;
+  }
+  rc = write_reclaim(cgpath, step, &ropts->opts);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  stats->writes++;
+  stats->requested += step;
+  long long after = s.current;
+  if (!ropts->opts.dry_run &&
+      cg_read_value(cgpath, "memory.current", &after) == PLIMIT_OK &&
+      after < s.current) {
+    st->last_step = s.current - after;
+    stats->reclaimed += st->last_step;
+  }
+  return PLIMIT_OK;
+}
+
+int reclaim_run(const reclaim_opts_t *ropts, reclaim_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  int rc = PLIMIT_OK;
+  const char *cgpath = cg_full_path(&a, ropts->cgname);
+  char path[PATH_MAX];
+  if (!cgpath) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  snprintf(path, sizeof(path), "%s/memory.reclaim", cgpath);
+  if (access(path, W_OK) != 0) {
+    log_msg(LOG_ERROR, "cannot use '%s': %s (memory controller enabled, "
+                       "Linux 5.19 or later?)",
+            path, strerror(errno));
+    rc = PLIMIT_ERR_NOTFOUND;
+    goto exit;
+  }
+
+  stop_on_signal(NULL);
+
+  reclaim_state_t st = {.backoff = 1};
+  while (!stop_requested()) {
+    if (st.hold > 0) {
+      st.hold--;
+      stats->passes++;
+      stats->held++;
+    } else {
+      rc = reclaim_pass(cgpath, ropts, &st, stats);
+      if (rc != PLIMIT_OK) {
+        break;
+      }
+    }
+    if (ropts->once) {
+      break;
+    }
+    sleep_ms(ropts->interval_ms);
+  }
+
+exit:
+  arena_release(&a);
+  return rc;
+}
@@ -0,0 +1,436 @@
+#include "reconcile.h"
+#include "ini.h"
+#include "snapshot.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char CGROUP_SECTION[] = "cgroup ";
+static const size_t STATE_INITIAL_CAP = 64;
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO |
+                                   IN_MOVED_FROM | IN_DELETE |
+                                   IN_DELETE_SELF | IN_MOVE_SELF;
+
+typedef struct state_entry {
+  const char *key;
+  const char *value;
+  struct state_entry *next;
+} state_entry_t;
+
+typedef struct {
+  const char *name; // relative to cg_root()
+  const char *file; // declaring file, for error messages
+  int lineno;
+  state_entry_t *entries;
+  state_entry_t *last;
+} state_cgroup_t;
+
+// the desired state: cgroups sorted parents first and the merged stream
+// applied for them
+typedef struct {
+  arena_t arena;
+  state_cgroup_t **cgroups;
+  size_t count;
+  size_t cap;
+  char *text;
+  size_t len;
+} state_t;
+
+typedef struct {
+  state_t *state;
+  const char *file;
+  state_cgroup_t *cur;
+} load_ctx_t;
+
+typedef struct {
+  restore_stats_t restore;
+  size_t deleted;
+} pass_stats_t;
+
+static volatile sig_atomic_t resync;
+
+static void on_hup(int sig) {
+  (void)sig;
+  resync = 1;
+}
+
+static void state_free(state_t *s) {
+  arena_release(&s->arena);
+  free(s->text);
+  memset(s, 0, sizeof(*s));
+}
+
+static bool valid_name(const char *name) {
+  size_t len = strlen(name);
+  return len > 0 && *name != '/' && name[len - 1] != '/' &&
+         strcmp(name, "..") != 0 && strncmp(name, "../", 3) != 0 &&
+         !strstr(name, "/../") &&
+         !(len >= 3 && strcmp(name + len - 3, "/..") == 0);
+}
+
+static int load_handler(const char *section, const char *key,
+                        const char *value, int lineno, void *ctx_) {
+  load_ctx_t *ctx = (load_ctx_t *)ctx_;
+  state_t *s = ctx->state;
+  if (strncmp(section, CGROUP_SECTION, strlen(CGROUP_SECTION)) != 0) {
+    log_msg(LOG_ERROR, "%s:%d: key outside of a [cgroup NAME] section",
+            ctx->file, lineno);
+    return PLIMIT_ERR_PARSE;
+  }
+  const char *name = section + strlen(CGROUP_SECTION);
+  if (strcmp(key, "proc") != 0 &&
+      strcmp(key, "cgroup.subtree_control") != 0 &&
+      (strchr(key, '/') || strncmp(key, "cgroup.", strlen("cgroup.")) == 0)) {
+    log_msg(LOG_ERROR, "%s:%d: invalid controller file '%s'", ctx->file,
+            lineno, key);
+    return PLIMIT_ERR_PARSE;
+  }
+
+  if (!ctx->cur || strcmp(ctx->cur->name, name) != 0) {
+    if (!valid_name(name)) {
+      log_msg(LOG_ERROR, "%s:%d: invalid cgroup name '%s'", ctx->file, lineno,
+              name);
+      return PLIMIT_ERR_PARSE;
+    }
+    if (s->count == s->cap) {
+      size_t ncap = s->cap ? s->cap * 2 : STATE_INITIAL_CAP;
+      state_cgroup_t **tmp = arena_realloc(&s->arena, s->cgroups,
+                                           s->cap * sizeof(*tmp),
+                                           ncap * sizeof(*tmp));
+      if (!tmp) {
+        log_msg(LOG_ERROR, "failed to allocate memory for the state");
+        return PLIMIT_ERR_MEM;
+      }
+      s->cgroups = tmp;
+      s->cap = ncap;
+    }
+    state_cgroup_t *cg = arena_alloc(&s->arena, sizeof(*cg));
+    if (!cg || !(cg->name = arena_strdup(&s->arena, name))) {
+      log_msg(LOG_ERROR, "failed to allocate memory for the state");
+      return PLIMIT_ERR_MEM;
+    }
+    cg->file = ctx->file;
+    cg->lineno = lineno;
+    cg->entries = NULL;
+    cg->last = NULL;
+    s->cgroups[s->count++] = cg;
+    ctx->cur = cg;
+  }
+
+  state_entry_t *e = arena_alloc(&s->arena, sizeof(*e));
+  if (!e || !(e->key = arena_strdup(&s->arena, key)) ||
+      !(e->value = arena_strdup(&s->arena, value))) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the state");
+    return PLIMIT_ERR_MEM;
+  }
+  e->next = NULL;
+  if (ctx->cur->last) {
+    ctx->cur->last->next = e;
+  } else {
+    ctx->cur->entries = e;
+  }
+  ctx->cur->last = e;
+  return PLIMIT_OK;
+}
+
+// '/' sorts before every other byte, so a cgroup is directly followed by
+// its subtree (pre-order, as snapshot_restore() expects)
+static int cmp_name(const char *x, const char *y) {
+  for (; *x && *x == *y; x++, y++) {
+  }
+  int cx = *x == '/' ? 1 : *x ? (unsigned char)*x + 1 : 0;
+  int cy = *y == '/' ? 1 : *y ? (unsigned char)*y + 1 : 0;
+  return cx - cy;
+}
+
+static int cmp_cgroup(const void *a, const void *b) {
+  return cmp_name((*(state_cgroup_t *const *)a)->name,
+                  (*(state_cgroup_t *const *)b)->name);
+}
+
+static bool is_state_name(const char *name) {
+  size_t len = strlen(name);
+  size_t slen = strlen(RECONCILE_SUFFIX);
+  return name[0] != '.' && len > slen &&
+         strcmp(name + len - slen, RECONCILE_SUFFIX) == 0;
+}
+
+static int is_state_file(const struct dirent *d) {
+  return is_state_name(d->d_name);
+}
+
+static int state_serialize(state_t *s) {
+  FILE *out = open_memstream(&s->text, &s->len);
+  if (!out) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the state");
+    return PLIMIT_ERR_MEM;
+  }
+  for (size_t i = 0; i < s->count; i++) {
+    const state_cgroup_t *cg = s->cgroups[i];
+    fprintf(out, "%s[cgroup %s]\n", i ? "\n" : "", cg->name);
+    for (const state_entry_t *e = cg->entries; e; e = e->next) {
+      fprintf(out, "%s = %s\n", e->key, e->value);
+    }
+  }
+  if (fclose(out) != 0) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the state");
+    return PLIMIT_ERR_MEM;
+  }
+  return PLIMIT_OK;
+}
+
+static int state_load(const char *dir, state_t *s) {
+  memset(s, 0, sizeof(*s));
+  arena_init(&s->arena, NULL, 0);
+  struct dirent **names = NULL;
+  int n = scandir(dir, &names, is_state_file, alphasort);
+  if (n < 0) {
+    log_msg(LOG_ERROR, "failed to read state directory '%s': %s", dir,
+            strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  int rc = PLIMIT_OK;
+  for (int i = 0; i < n; i++) {
+    char *path = rc == PLIMIT_OK
+                     ? arena_sprintf(&s->arena, "%s/%s", dir, names[i]->d_name)
+                     : NULL;
+    if (rc == PLIMIT_OK && !path) {
+      log_msg(LOG_ERROR, "failed to allocate memory for the state");
+      rc = PLIMIT_ERR_MEM;
+    }
+    if (rc == PLIMIT_OK) {
+      load_ctx_t ctx = {.state = s, .file = path};
+      FILE *in = fopen(path, "re");
+      if (!in) {
+        log_msg(LOG_ERROR, "failed to open file '%s': %s", path,
+                strerror(errno));
+        rc = PLIMIT_ERR_IO;
+      } else {
+        rc = ini_parse_stream(in, path, load_handler, &ctx);
+        fclose(in);
+      }
+    }
+    free(names[i]);
+  }
+  free(names);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+
+  if (s->count > 0) {
+    qsort(s->cgroups, s->count, sizeof(*s->cgroups), cmp_cgroup);
+  }
+  for (size_t i = 1; i < s->count; i++) {
+    const state_cgroup_t *a = s->cgroups[i - 1];
+    const state_cgroup_t *b = s->cgroups[i];
+    if (strcmp(a->name, b->name) == 0) {
+      log_msg(LOG_ERROR, "cgroup '%s' declared twice, at %s:%d and %s:%d",
+              a->name, a->file, a->lineno, b->file, b->lineno);
+      return PLIMIT_ERR_PARSE;
+    }
+  }
+  return state_serialize(s);
+}
+
+static bool state_has(const state_t *s, const char *name) {
+  size_t lo = 0;
+  size_t hi = s->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int c = cmp_name(s->cgroups[mid]->name, name);
+    if (c == 0) {
+      return true;
+    }
+    if (c < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return false;
+}
+
+// cgroups of prev missing from next, children first
+static int delete_dropped(const state_t *prev, const state_t *next,
+                          const run_opts_t *opts, size_t *deleted) {
+  int rc = PLIMIT_OK;
+  for (size_t i = prev->count; i-- > 0;) {
+    const char *name = prev->cgroups[i]->name;
+    if (state_has(next, name)) {
+      continue;
+    }
+    char cgname[PATH_MAX];
+    char path[PATH_MAX];
+    // a top-level name needs a leading '/' to stay out of cg_plimit_root()
+    snprintf(cgname, sizeof(cgname), "%s%s", strchr(name, '/') ? "" : "/",
+             name);
+    snprintf(path, sizeof(path), "%s/%s", cg_root(), name);
+    if (access(path, F_OK) != 0) {
+      continue;
+    }
+    int drc = destroy_cgroup(cgname, opts);
+    if (drc == PLIMIT_OK) {
+      (*deleted)++;
+    } else if (rc == PLIMIT_OK) {
+      rc = drc;
+    }
+  }
+  return rc;
+}
+
+static int reconcile_pass(const reconcile_opts_t *ropts, const state_t *prev,
+                          const state_t *next) {
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pass_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+  int rc = PLIMIT_OK;
+  if (next->len > 0) {
+    FILE *in = fmemopen(next->text, next->len, "r");
+    if (!in) {
+      log_msg(LOG_ERROR, "failed to open the merged state: %s",
+              strerror(errno));
+      return PLIMIT_ERR_MEM;
+    }
+    rc = snapshot_restore(in, ropts->dir, &ropts->opts, ropts->jobs,
+                          &stats.restore);
+    fclose(in);
+  }
+  int drc = delete_dropped(prev, next, &ropts->opts, &stats.deleted);
+  if (rc == PLIMIT_OK) {
+    rc = drc;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ms = (double)(end.tv_sec - start.tv_sec) * 1e3 +
+              (double)(end.tv_nsec - start.tv_nsec) / NSEC_PER_MSEC;
+  log_msg(rc == PLIMIT_OK ? LOG_INFO : LOG_ERROR,
+          "reconcile %s: %zu cgroups (%zu created, %zu deleted), %zu writes, "
+          "%zu unchanged, %zu processes moved, %zu missing in %.1fms",
+          rc == PLIMIT_OK ? "complete" : "failed", stats.restore.cgroups,
+          stats.restore.created, stats.deleted, stats.restore.writes,
+          stats.restore.skipped, stats.restore.moved, stats.restore.missing,
+          ms);
+  return rc;
+}
+
+// drains pending events, true if one of them concerns the state
+static bool read_events(int fd, bool *gone) {
+  _Alignas(struct inotify_event) char buf[4096];
+  bool relevant = false;
+  for (;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      return relevant;
+    }
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        *gone = true;
+      }
+      if (ev->len > 0 && is_state_name(ev->name)) {
+        relevant = true;
+      }
+      p += sizeof(*ev) + ev->len;
+    }
+  }
+}
+
+static int watch(const reconcile_opts_t *ropts, state_t *applied,
+                 bool dirty) {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, ropts->dir, WATCH_MASK) < 0) {
+    log_msg(LOG_ERROR, "failed to watch state directory '%s': %s",
+            ropts->dir, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return PLIMIT_ERR_IO;
+  }
+
+  stop_on_signal(on_hup);
+  if (ropts->opts.verbose) {
+    log_msg(LOG_INFO, "watching %s", ropts->dir);
+  }
+
+  int rc = PLIMIT_OK;
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  while (!stop_requested()) {
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+      log_msg(LOG_ERROR, "failed to wait for state changes: %s",
+              strerror(errno));
+      rc = PLIMIT_ERR_IO;
+      break;
+    }
+    bool gone = false;
+    bool changed = read_events(fd, &gone);
+    // editors and config management write several files in a row
+    while (changed && !stop_requested() &&
+           poll(&pfd, 1, RECONCILE_DEBOUNCE_MS) > 0) {
+      read_events(fd, &gone);
+    }
+    if (gone) {
+      log_msg(LOG_ERROR, "state directory '%s' was removed", ropts->dir);
+      rc = PLIMIT_ERR_NOTFOUND;
+      break;
+    }
+    if (stop_requested() || (!changed && !resync)) {
+      continue;
+    }
+
+    state_t next;
+    if (state_load(ropts->dir, &next) != PLIMIT_OK) {
+      log_msg(LOG_WARN, "keeping the previous state");
+      state_free(&next);
+      continue;
+    }
+    bool same = next.len == applied->len &&
+                (next.len == 0 || memcmp(next.text, applied->text,
+                                         next.len) == 0);
+    if (same && !dirty && !resync) {
+      if (ropts->opts.verbose) {
+        log_msg(LOG_INFO, "state unchanged");
+      }
+      state_free(&next);
+      continue;
+    }
+    resync = 0;
+    // a failed pass is retried on the next change even if the state is
+    // the same
+    dirty = reconcile_pass(ropts, applied, &next) != PLIMIT_OK;
+    state_free(applied);
+    *applied = next;
+  }
+  close(fd);
+  return rc;
+}
+
+int reconcile_run(const reconcile_opts_t *ropts) {
+  if (!have_cgroupv2()) {
+    log_msg(LOG_ERROR, "cgroup v2 not detected at %s: %s", cg_root(),
+            strerror(errno));
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  resync = 0;
+  state_t applied;
+  int rc = state_load(ropts->dir, &applied);
+  if (rc != PLIMIT_OK) {
+    state_free(&applied);
+    return rc;
+  }
+  state_t none;
+  memset(&none, 0, sizeof(none));
+  rc = reconcile_pass(ropts, &none, &applied);
+  if (!ropts->once) {
+    rc = watch(ropts, &applied, rc != PLIMIT_OK);
+  }
+  state_free(&applied);
+  return rc;
+}
@@ -0,0 +1,698 @@
+#include "record.h"
+#include "reclaim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = "PLREC\0\0";
+static const uint32_t VERSION = 1;
+static const size_t HEADER_SIZE = 4096;
+// ids beyond this are taken as damage rather than grown into
+static const uint64_t MAX_ID = 1 << 24;
+
+// varint of a 64 bit value, and of an entry without its name
+#define VARINT_MAX 10
+#define SAMPLE_MAX (1 + 2 * VARINT_MAX + RECORD_FIELDS * VARINT_MAX)
+#define NAME_MAX_SIZE (1 + 2 * VARINT_MAX + PATH_MAX)
+
+enum {
+  TAG_TICK = 1, // time of the round, absolute first in a block
+  TAG_NAME,     // id and name of a cgroup, its values restart from 0
+  TAG_SAMPLE,   // id, mask of changed fields, their deltas
+};
+
+// files read per round, bit i of cg_t.files
+enum {
+  F_CPU_STAT,
+  F_MEM_CURRENT,
+  F_MEM_STAT,
+  F_IO_STAT,
+  F_CPU_PRESSURE,
+  F_MEM_PRESSURE,
+  F_IO_PRESSURE,
+  F_PIDS_CURRENT,
+  F_COUNT
+};
+
+static const char *const FILES[F_COUNT] = {
+    "cpu.stat",      "memory.current",  "memory.stat", "io.stat",
+    "cpu.pressure",  "memory.pressure", "io.pressure", "pids.current"};
+
+static const char *const FIELD_NAMES[RECORD_FIELDS] = {
+    "cpu_usage_usec",   "cpu_nr_throttled", "cpu_throttled_usec",
+    "memory_current",   "memory_anon",      "memory_file",
+    "io_rbytes",        "io_wbytes",        "cpu_pressure_usec",
+    "memory_pressure_usec", "io_pressure_usec", "pids_current"};
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;
+  uint32_t fields;
+  uint32_t blocks;
+  uint64_t interval_ms;
+  uint64_t seq; // sequence number of the newest block
+} file_header_t;
+
+// seq and used are published with release stores, replay loads them with
+// acquire and drops a block whose seq changed while it was copied
+typedef struct {
+  uint64_t seq; // 0 for a block never written or being reset
+  uint32_t used;
+  uint32_t reserved;
+} block_header_t;
+
+typedef struct {
+  char *name; // relative to cg_root()
+  char *path;
+  uint64_t id;
+  uint64_t seq; // block holding the name entry, values relative to prev
+  unsigned files;
+  long long prev[RECORD_FIELDS];
+} cg_t;
+
+typedef struct {
+  const record_opts_t *ro;
+  unsigned char *map;
+  size_t map_size;
+  file_header_t *hdr;
+  block_header_t *block;
+  size_t used;
+  long long round_ms;
+  uint64_t tick_seq; // block of the last tick
+  size_t tick_round;
+  long long tick_ms;
+  arena_t arena;
+  cg_t *cgs;
+  size_t count;
+  uint64_t next_id;
+  record_stats_t *stats;
+} writer_t;
+
+const char *record_field_name(record_field_t field) {
+  return field < RECORD_FIELDS ? FIELD_NAMES[field] : "unknown";
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (unsigned char)v;
+  return n;
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end,
+                      uint64_t *v) {
+  *v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (*p == end) {
+      return PLIMIT_ERR_PARSE;
+    }
+    unsigned char b = *(*p)++;
+    *v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return PLIMIT_OK;
+    }
+  }
+  return PLIMIT_ERR_PARSE;
+}
+
+static uint64_t zigzag(long long v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static long long unzigzag(uint64_t v) {
+  return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+// value of "key N" in a flat keyed file, 0 if missing
+static long long keyed(const char *buf, const char *key) {
+  size_t klen = strlen(key);
+  for (const char *line = buf; line;) {
+    if (strncmp(line, key, klen) == 0 && line[klen] == ' ') {
+      return strtoll(line + klen + 1, NULL, 10);
+    }
+    line = strchr(line, '\n');
+    line = line ? line + 1 : NULL;
+  }
+  return 0;
+}
+
+// sum of "key=N" of every device line
+static long long io_sum(const char *buf, const char *key) {
+  long long sum = 0;
+  size_t klen = strlen(key);
+  for (const char *c = strstr(buf, key); c; c = strstr(c + klen, key)) {
+    if (c > buf && c[-1] == ' ' && c[klen] == '=') {
+      sum += strtoll(c + klen + 1, NULL, 10);
+    }
+  }
+  return sum;
+}
+
+static void sample(const cg_t *cg, long long *v) {
+  char path[PATH_MAX];
+  char buf[RECLAIM_STAT_SIZE];
+  memset(v, 0, sizeof(*v) * RECORD_FIELDS);
+  for (unsigned f = 0; f < F_COUNT; f++) {
+    if (!(cg->files & (1u << f))) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", cg->path, FILES[f]);
+    if (read_file(path, buf, sizeof(buf)) != PLIMIT_OK) {
+      continue;
+    }
+    // the first total= of a pressure file is the one of "some"
+    const char *total = strstr(buf, "total=");
+    long long some = total ? strtoll(total + 6, NULL, 10) : 0;
+    switch (f) {
+    case F_CPU_STAT:
+      v[RECORD_CPU_USAGE] = keyed(buf, "usage_usec");
+      v[RECORD_CPU_THROTTLED] = keyed(buf, "nr_throttled");
+      v[RECORD_CPU_THROTTLED_US] = keyed(buf, "throttled_usec");
+      break;
+    case F_MEM_CURRENT:
+      v[RECORD_MEM_CURRENT] = strtoll(buf, NULL, 10);
+      break;
+    case F_MEM_STAT:
+      v[RECORD_MEM_ANON] = keyed(buf, "anon");
+      v[RECORD_MEM_FILE] = keyed(buf, "file");
+      break;
+    case F_IO_STAT:
+      v[RECORD_IO_RBYTES] = io_sum(buf, "rbytes");
+      v[RECORD_IO_WBYTES] = io_sum(buf, "wbytes");
+      break;
+    case F_CPU_PRESSURE:
+      v[RECORD_CPU_PRESSURE] = some;
+      break;
+    case F_MEM_PRESSURE:
+      v[RECORD_MEM_PRESSURE] = some;
+      break;
+    case F_IO_PRESSURE:
+      v[RECORD_IO_PRESSURE] = some;
+      break;
+    case F_PIDS_CURRENT:
+      v[RECORD_PIDS] = strtoll(buf, NULL, 10);
+      break;
+    }
+  }
+}
+
+static int cmp_cg(const void *a, const void *b) {
+  return strcmp(((const cg_t *)a)->name, ((const cg_t *)b)->name);
+}
+
+// match the pattern again, keeping the ids and previous values of the
+// cgroups already known
+static int rescan(writer_t *w) {
+  arena_t a;
+  arena_init(&a, NULL, 0);
+  int rc = PLIMIT_OK;
+  const char *pattern = cg_full_path(&a, w->ro->pattern);
+  glob_t g = {0};
+  cg_t *cgs = NULL;
+  if (!pattern) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  int grc = glob(pattern, GLOB_ONLYDIR | GLOB_NOSORT, NULL, &g);
+  if (grc != 0 && grc != GLOB_NOMATCH) {
+    log_msg(LOG_ERROR, "failed to match '%s'", pattern);
+    rc = PLIMIT_ERR_NOTFOUND;
+    goto exit;
+  }
+  cgs = arena_alloc(&a, (g.gl_pathc + 1) * sizeof(*cgs));
+  if (!cgs) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  size_t rootlen = strlen(cg_root());
+  size_t count = 0;
+  char path[PATH_MAX];
+  for (size_t i = 0; i < g.gl_pathc; i++) {
+    const char *p = g.gl_pathv[i];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", p);
+    if (strncmp(p, cg_root(), rootlen) != 0 || access(path, F_OK) != 0) {
+      continue;
+    }
+    cg_t *cg = &cgs[count++];
+    memset(cg, 0, sizeof(*cg));
+    cg->path = arena_strdup(&a, p);
+    cg->name = arena_strdup(&a, p[rootlen] == '/' ? p + rootlen + 1 : "");
+    if (!cg->path || !cg->name) {
+      rc = PLIMIT_ERR_MEM;
+      goto exit;
+    }
+    // controllers may be enabled later, looked up again on the next scan
+    for (unsigned f = 0; f < F_COUNT; f++) {
+      snprintf(path, sizeof(path), "%s/%s", p, FILES[f]);
+      cg->files |= access(path, R_OK) == 0 ? 1u << f : 0;
+    }
+  }
+  qsort(cgs, count, sizeof(*cgs), cmp_cg);
+
+  // both lists are sorted by name
+  for (size_t i = 0, j = 0; i < count; i++) {
+    int cmp = -1;
+    while (j < w->count && (cmp = strcmp(w->cgs[j].name, cgs[i].name)) < 0) {
+      j++;
+    }
+    if (j < w->count && cmp == 0) {
+      cgs[i].id = w->cgs[j].id;
+      cgs[i].seq = w->cgs[j].seq;
+      memcpy(cgs[i].prev, w->cgs[j].prev, sizeof(cgs[i].prev));
+    } else {
+      cgs[i].id = w->next_id++;
+      if (w->ro->opts.verbose) {
+        log_msg(LOG_INFO, "recording %s", cgs[i].path);
+      }
+    }
+  }
+  if (count == 0 && w->count > 0) {
+    log_msg(LOG_WARN, "no cgroup matches '%s' anymore", w->ro->pattern);
+  }
+  arena_release(&w->arena);
+  w->arena = a;
+  w->cgs = cgs;
+  w->count = count;
+  globfree(&g);
+  return PLIMIT_OK;
+
+exit:
+  globfree(&g);
+  arena_release(&a);
+  return rc;
+}
+
+static unsigned char *block_at(const unsigned char *map, uint32_t block_size,
+                               uint64_t index) {
+  return (unsigned char *)map + HEADER_SIZE + index * block_size;
+}
+
+static void next_block(writer_t *w) {
+  uint64_t seq = w->hdr->seq + 1;
+  block_header_t *b =
+      (block_header_t *)block_at(w->map, RECORD_BLOCK_SIZE,
+                                 (seq - 1) % w->hdr->blocks);
+  if (b->seq != 0) {
+    w->stats->wraps++;
+  }
+  // invalidate before the old entries are overwritten
+  __atomic_store_n(&b->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&b->used, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&b->seq, seq, __ATOMIC_RELEASE);
+  __atomic_store_n(&w->hdr->seq, seq, __ATOMIC_RELEASE);
+  w->block = b;
+  w->used = 0;
+}
+
+// entries of the current block
+static unsigned char *cursor(writer_t *w) {
+  return (unsigned char *)(w->block + 1) + w->used;
+}
+
+static void put_tick(writer_t *w) {
+  // the first tick of a block is absolute, the others relative
+  bool first = w->tick_seq != w->block->seq;
+  unsigned char *p = cursor(w);
+  p[0] = TAG_TICK;
+  size_t n = 1 + put_varint(p + 1, zigzag(first ? w->round_ms
+                                               : w->round_ms - w->tick_ms));
+  w->tick_ms = w->round_ms;
+  w->tick_seq = w->block->seq;
+  w->tick_round = w->stats->rounds;
+  w->used += n;
+  w->stats->bytes += (long long)n;
+}
+
+// start a new block if need bytes do not fit, the tick of the round is
+// repeated at the start of each block
+static void reserve(writer_t *w, size_t need) {
+  size_t cap = RECORD_BLOCK_SIZE - sizeof(block_header_t);
+  if (w->used + need + 1 + VARINT_MAX > cap) {
+    __atomic_store_n(&w->block->used, (uint32_t)w->used, __ATOMIC_RELEASE);
+    next_block(w);
+  }
+  if (w->tick_seq != w->block->seq || w->tick_round != w->stats->rounds) {
+    put_tick(w);
+  }
+}
+
+static void put_sample(writer_t *w, cg_t *cg, const long long *v) {
+  size_t namelen = strlen(cg->name);
+  reserve(w, (cg->seq != w->block->seq ? NAME_MAX_SIZE : 0) + SAMPLE_MAX);
+  unsigned char *p = cursor(w);
+  size_t n = 0;
+  if (cg->seq != w->block->seq) {
+    p[n++] = TAG_NAME;
+    n += put_varint(p + n, cg->id);
+    n += put_varint(p + n, namelen);
+    memcpy(p + n, cg->name, namelen);
+    n += namelen;
+    memset(cg->prev, 0, sizeof(cg->prev));
+    cg->seq = w->block->seq;
+  }
+  p[n++] = TAG_SAMPLE;
+  n += put_varint(p + n, cg->id);
+  unsigned mask = 0;
+  for (size_t f = 0; f < RECORD_FIELDS; f++) {
+    mask |= v[f] != cg->prev[f] ? 1u << f : 0;
+  }
+  n += put_varint(p + n, mask);
+  for (size_t f = 0; f < RECORD_FIELDS; f++) {
+    if (mask & (1u << f)) {
+      n += put_varint(p + n, zigzag(v[f] - cg->prev[f]));
+      cg->prev[f] = v[f];
+    }
+  }
+  w->used += n;
+  w->stats->bytes += (long long)n;
+  w->stats->samples++;
+}
+
+static void round_once(writer_t *w) {
+  long long v[RECORD_FIELDS];
+  w->round_ms = clock_ms(CLOCK_REALTIME);
+  reserve(w, 0);
+  for (size_t i = 0; i < w->count; i++) {
+    sample(&w->cgs[i], v);
+    put_sample(w, &w->cgs[i], v);
+  }
+  // readers see complete rounds only
+  __atomic_store_n(&w->block->used, (uint32_t)w->used, __ATOMIC_RELEASE);
+  w->stats->rounds++;
+}
+
+static int open_ring(const record_opts_t *ro, int fd, writer_t *w) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    log_msg(LOG_ERROR, "failed to stat %s: %s", ro->file, strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  bool fresh = st.st_size == 0;
+  if (fresh) {
+    long long blocks = ro->size / RECORD_BLOCK_SIZE;
+    if (blocks < 2) {
+      log_msg(LOG_ERROR, "--size must hold two blocks of %d bytes at least",
+              RECORD_BLOCK_SIZE);
+      return PLIMIT_ERR_ARG;
+    }
+    // sparse, blocks take disk space once written
+    if (ftruncate(fd, (off_t)(HEADER_SIZE + blocks * RECORD_BLOCK_SIZE)) !=
+        0) {
+      log_msg(LOG_ERROR, "failed to size %s: %s", ro->file, strerror(errno));
+      return PLIMIT_ERR_IO;
+    }
+    st.st_size = (off_t)(HEADER_SIZE + blocks * RECORD_BLOCK_SIZE);
+  }
+  w->map_size = (size_t)st.st_size;
+  w->map = mmap(NULL, w->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (w->map == MAP_FAILED) {
+    w->map = NULL;
+    log_msg(LOG_ERROR, "failed to map %s: %s", ro->file, strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  w->hdr = (file_header_t *)w->map;
+  if (fresh) {
+    memcpy(w->hdr->magic, MAGIC, sizeof(MAGIC));
+    w->hdr->version = VERSION;
+    w->hdr->block_size = RECORD_BLOCK_SIZE;
+    w->hdr->fields = RECORD_FIELDS;
+    w->hdr->blocks = (uint32_t)((w->map_size - HEADER_SIZE) /
+                                RECORD_BLOCK_SIZE);
+  } else if (w->map_size < HEADER_SIZE ||
+             memcmp(w->hdr->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+             w->hdr->version != VERSION ||
+             w->hdr->block_size != RECORD_BLOCK_SIZE ||
+             w->hdr->fields != RECORD_FIELDS ||
+             w->map_size != HEADER_SIZE + (size_t)w->hdr->blocks *
+                                              RECORD_BLOCK_SIZE) {
+    log_msg(LOG_ERROR, "%s is not a plimit record file of this version",
+            ro->file);
+    return PLIMIT_ERR_PARSE;
+  }
+  w->hdr->interval_ms = (uint64_t)ro->interval_ms;
+  // a continued recording starts a block, its ids restart at 0
+  next_block(w);
+  return PLIMIT_OK;
+}
+
+int record_run(const record_opts_t *ro, record_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  writer_t w = {.ro = ro, .stats = stats};
+  arena_init(&w.arena, NULL, 0);
+  int fd = -1;
+  int rc = rescan(&w);
+  if (rc == PLIMIT_OK && w.count == 0) {
+    log_msg(LOG_ERROR, "no cgroup matches '%s'", ro->pattern);
+    rc = PLIMIT_ERR_NOTFOUND;
+  }
+  if (rc != PLIMIT_OK) {
+    goto exit;
+  }
+  fd = open(ro->file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    log_msg(LOG_ERROR, "failed to open %s: %s", ro->file, strerror(errno));
+    rc = PLIMIT_ERR_IO;
+    goto exit;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    log_msg(LOG_ERROR, "%s is being recorded by another process", ro->file);
+    rc = PLIMIT_ERR_EXISTS;
+    goto exit;
+  }
+  rc = open_ring(ro, fd, &w);
+  if (rc != PLIMIT_OK) {
+    goto exit;
+  }
+
+  stop_on_signal(NULL);
+
+  long long next = clock_ms(CLOCK_MONOTONIC);
+  long long scanned = next;
+  while (!stop_requested()) {
+    if (next - scanned >= RECORD_RESCAN_MS) {
+      // a failed scan keeps the previous cgroups
+      rescan(&w);
+      scanned = next;
+    }
+    round_once(&w);
+    next += ro->interval_ms;
+    long long now = clock_ms(CLOCK_MONOTONIC);
+    if (now > next) {
+      // fell behind, skip the missed rounds instead of catching up
+      next = now;
+    }
+    sleep_ms(next - now);
+  }
+
+exit:
+  if (w.map) {
+    msync(w.map, w.map_size, MS_SYNC);
+    munmap(w.map, w.map_size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  arena_release(&w.arena);
+  return rc;
+}
+
+typedef struct {
+  const char *name;
+  size_t len;
+  uint64_t seq; // block of the name entry
+  long long values[RECORD_FIELDS];
+} replay_cg_t;
+
+typedef struct {
+  arena_t arena;
+  replay_cg_t *cgs;
+  size_t cap;
+  char name[PATH_MAX];
+} replay_t;
+
+static replay_cg_t *replay_cg(replay_t *r, uint64_t id) {
+  if (id >= MAX_ID) {
+    return NULL;
+  }
+  if (id >= r->cap) {
+    size_t cap = r->cap ? r->cap : 64;
+    while (cap <= id) {
+      cap *= 2;
+    }
+    replay_cg_t *cgs = arena_realloc(&r->arena, r->cgs,
+                                     r->cap * sizeof(*cgs), cap * sizeof(*cgs));
+    if (!cgs) {
+      return NULL;
+    }
+    memset(cgs + r->cap, 0, (cap - r->cap) * sizeof(*cgs));
+    r->cgs = cgs;
+    r->cap = cap;
+  }
+  return &r->cgs[id];
+}
+
+static int decode_block(replay_t *r, const unsigned char *p, size_t used,
+                        uint64_t seq, record_sample_fn fn, void *ctx) {
+  const unsigned char *end = p + used;
+  bool ticked = false;
+  record_sample_t s = {0};
+  while (p < end) {
+    unsigned char tag = *p++;
+    uint64_t id = 0;
+    uint64_t v = 0;
+    replay_cg_t *cg = NULL;
+    if (tag == TAG_TICK) {
+      if (get_varint(&p, end, &v) != PLIMIT_OK) {
+        return PLIMIT_ERR_PARSE;
+      }
+      s.time_ms = ticked ? s.time_ms + unzigzag(v) : unzigzag(v);
+      ticked = true;
+      continue;
+    }
+    if (get_varint(&p, end, &id) != PLIMIT_OK || !ticked ||
+        !(cg = replay_cg(r, id))) {
+      return PLIMIT_ERR_PARSE;
+    }
+    if (tag == TAG_NAME) {
+      if (get_varint(&p, end, &v) != PLIMIT_OK || v >= PATH_MAX ||
+          v > (uint64_t)(end - p)) {
+        return PLIMIT_ERR_PARSE;
+      }
+      cg->name = (const char *)p;
+      cg->len = (size_t)v;
+      cg->seq = seq;
+      memset(cg->values, 0, sizeof(cg->values));
+      p += v;
+      continue;
+    }
+    if (tag != TAG_SAMPLE || cg->seq != seq ||
+        get_varint(&p, end, &v) != PLIMIT_OK) {
+      return PLIMIT_ERR_PARSE;
+    }
+    for (size_t f = 0; f < RECORD_FIELDS; f++) {
+      uint64_t d = 0;
+      if ((v & (1u << f)) && get_varint(&p, end, &d) != PLIMIT_OK) {
+        return PLIMIT_ERR_PARSE;
+      }
+      cg->values[f] += unzigzag(d);
+    }
+    memcpy(r->name, cg->name, cg->len);
+    r->name[cg->len] = '\0';
+    s.cgname = r->name;
+    memcpy(s.values, cg->values, sizeof(s.values));
+    int rc = fn(&s, ctx);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+  }
+  return PLIMIT_OK;
+}
+
+typedef struct {
+  const block_header_t *b;
+  uint64_t seq;
+} replay_block_t;
+
+static int cmp_seq(const void *a, const void *b) {
+  uint64_t x = ((const replay_block_t *)a)->seq;
+  uint64_t y = ((const replay_block_t *)b)->seq;
+  return (x > y) - (x < y);
+}
+
+// a live writer may reuse the block meanwhile: decode a copy, and only if
+// the block still holds the same seq after copying
+static int replay_block(replay_t *r, const replay_block_t *rb,
+                        uint32_t block_size, unsigned char *copy,
+                        record_sample_fn fn, void *ctx) {
+  size_t used = __atomic_load_n(&rb->b->used, __ATOMIC_ACQUIRE);
+  if (used > block_size - sizeof(block_header_t)) {
+    return PLIMIT_ERR_PARSE;
+  }
+  memcpy(copy, rb->b + 1, used);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&rb->b->seq, __ATOMIC_RELAXED) != rb->seq) {
+    return PLIMIT_ERR_PARSE;
+  }
+  return decode_block(r, copy, used, rb->seq, fn, ctx);
+}
+
+int record_replay(const char *file, record_sample_fn fn, void *ctx) {
+  replay_t r = {0};
+  arena_init(&r.arena, NULL, 0);
+  unsigned char *map = NULL;
+  size_t size = 0;
+  int rc = PLIMIT_OK;
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    log_msg(LOG_ERROR, "failed to open %s: %s", file, strerror(errno));
+    rc = PLIMIT_ERR_IO;
+    goto exit;
+  }
+  size = (size_t)st.st_size;
+  map = size >= HEADER_SIZE
+            ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+  const file_header_t *hdr = (const file_header_t *)map;
+  if (map == MAP_FAILED || memcmp(hdr->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      hdr->version != VERSION || hdr->fields != RECORD_FIELDS ||
+      hdr->block_size <= sizeof(block_header_t) ||
+      size < HEADER_SIZE + (size_t)hdr->blocks * hdr->block_size) {
+    map = map == MAP_FAILED ? NULL : map;
+    log_msg(LOG_ERROR, "%s is not a plimit record file of this version",
+            file);
+    rc = PLIMIT_ERR_PARSE;
+    goto exit;
+  }
+
+  replay_block_t *order =
+      arena_alloc(&r.arena, (hdr->blocks + 1) * sizeof(*order));
+  unsigned char *copy = arena_alloc(&r.arena, hdr->block_size);
+  if (!order || !copy) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+  size_t n = 0;
+  for (uint64_t i = 0; i < hdr->blocks; i++) {
+    const block_header_t *b =
+        (const block_header_t *)block_at(map, hdr->block_size, i);
+    uint64_t seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+    if (seq != 0) {
+      order[n++] = (replay_block_t){.b = b, .seq = seq};
+    }
+  }
+  qsort(order, n, sizeof(*order), cmp_seq);
+  for (size_t i = 0; i < n && rc == PLIMIT_OK; i++) {
+    rc = replay_block(&r, &order[i], hdr->block_size, copy, fn, ctx);
+    if (rc == PLIMIT_ERR_PARSE) {
+      // typically the block the writer is reusing, the others still count
+      log_msg(LOG_WARN, "skipping damaged or overwritten block %llu in %s",
+              (unsigned long long)order[i].seq, file);
+      rc = PLIMIT_OK;
+    }
+  }
+
+exit:
+  if (map) {
+    munmap(map, size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  arena_release(&r.arena);
+  return rc;
+}
@@ -0,0 +1,563 @@
+#include "schedule.h"
+#include "ini.h"
+#include "snapshot.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char CGROUP_SECTION[] = "cgroup ";
+static const char WINDOW_SECTION[] = "window ";
+static const size_t SCHEDULE_INITIAL_CAP = 16;
+static const int MINUTES_PER_HOUR = 60;
+static const int HOURS_PER_DAY = 24;
+static const unsigned ALL_DAYS = 0x7f;
+static const char *const DAY_NAMES[] = {"sun", "mon", "tue", "wed",
+                                        "thu", "fri", "sat"};
+
+typedef struct entry {
+  const char *key;
+  const char *value;
+  struct entry *next;
+} entry_t;
+
+typedef struct {
+  entry_t *head;
+  entry_t *last;
+} entry_list_t;
+
+typedef struct {
+  const char *name;
+  int lineno;
+  entry_list_t limits;
+} sched_cgroup_t;
+
+typedef struct {
+  const char *name;
+  const char *cgroup;
+  unsigned days; // bit per tm_wday
+  int start;     // minutes after midnight, -1 until set
+  int end;
+  int lineno;
+  bool open;
+  entry_list_t limits;
+} sched_window_t;
+
+typedef struct {
+  arena_t arena;
+  sched_cgroup_t **cgroups;
+  size_t ncgroups;
+  size_t cgcap;
+  sched_window_t **windows;
+  size_t nwindows;
+  size_t wcap;
+} schedule_t;
+
+typedef struct {
+  schedule_t *s;
+  const char *file;
+  const char *section;
+  sched_cgroup_t *cg;
+  sched_window_t *win;
+} load_ctx_t;
+
+static volatile sig_atomic_t reload;
+
+static void on_hup(int sig) {
+  (void)sig;
+  reload = 1;
+}
+
+static void schedule_free(schedule_t *s) {
+  arena_release(&s->arena);
+  memset(s, 0, sizeof(*s));
+}
+
+static void **grow(arena_t *a, void **items, size_t count, size_t *cap) {
+  if (count < *cap) {
+    return items;
+  }
+  size_t ncap = *cap ? *cap * 2 : SCHEDULE_INITIAL_CAP;
+  void **tmp = arena_realloc(a, items, *cap * sizeof(*items),
+                             ncap * sizeof(*items));
+  if (tmp) {
+    *cap = ncap;
+  }
+  return tmp;
+}
+
+// limit files only, processes are not part of a schedule
+static bool valid_key(const char *key) {
+  return strcmp(key, "cgroup.subtree_control") == 0 ||
+         (!strchr(key, '/') && strcmp(key, "proc") != 0 &&
+          strncmp(key, "cgroup.", strlen("cgroup.")) != 0);
+}
+
+static int day_index(const char *s, size_t len) {
+  for (int i = 0; i < 7; i++) {
+    if (len == 3 && strncasecmp(s, DAY_NAMES[i], 3) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// "mon-fri,sun", a range may wrap past saturday
+static bool parse_days(const char *v, unsigned *days) {
+  *days = 0;
+  for (const char *c = v; *c;) {
+    c += strspn(c, " ,");
+    size_t len = strcspn(c, " ,");
+    if (len == 0) {
+      break;
+    }
+    const char *dash = memchr(c, '-', len);
+    int from = day_index(c, dash ? (size_t)(dash - c) : len);
+    int to = dash ? day_index(dash + 1, len - (size_t)(dash - c) - 1) : from;
+    if (from < 0 || to < 0) {
+      return false;
+    }
+    for (int d = from;; d = (d + 1) % 7) {
+      *days |= 1u << d;
+      if (d == to) {
+        break;
+      }
+    }
+    c += len;
+  }
+  return *days != 0;
+}
+
+// "HH:MM-HH:MM", 24:00 allowed as the end
+static bool parse_hours(const char *v, int *start, int *end) {
+  int h1, m1, h2, m2, n = 0;
+  if (sscanf(v, "%d:%d-%d:%d%n", &h1, &m1, &h2, &m2, &n) != 4 ||
+      v[n] != '\0' || h1 < 0 || h1 >= HOURS_PER_DAY || h2 < 0 ||
+      h2 > HOURS_PER_DAY || m1 < 0 || m1 >= MINUTES_PER_HOUR || m2 < 0 ||
+      m2 >= MINUTES_PER_HOUR || (h2 == HOURS_PER_DAY && m2 != 0)) {
+    return false;
+  }
+  *start = h1 * MINUTES_PER_HOUR + m1;
+  *end = h2 * MINUTES_PER_HOUR + m2;
+  return true;
+}
+
+static int add_entry(arena_t *a, entry_list_t *list, const char *key,
+                     const char *value) {
+  entry_t *e = arena_alloc(a, sizeof(*e));
+  if (!e || !(e->key = arena_strdup(a, key)) ||
+      !(e->value = arena_strdup(a, value))) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the schedule");
+    return PLIMIT_ERR_MEM;
+  }
+  e->next = NULL;
+  if (list->last) {
+    list->last->next = e;
+  } else {
+    list->head = e;
+  }
+  list->last = e;
+  return PLIMIT_OK;
+}
+
+static const entry_t *find_entry(const entry_list_t *list, const char *key) {
+  for (const entry_t *e = list->head; e; e = e->next) {
+    if (strcmp(e->key, key) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static sched_cgroup_t *find_cgroup(const schedule_t *s, const char *name) {
+  for (size_t i = 0; i < s->ncgroups; i++) {
+    if (strcmp(s->cgroups[i]->name, name) == 0) {
+      return s->cgroups[i];
+    }
+  }
+  return NULL;
+}
+
+static int begin_section(load_ctx_t *ctx, const char *section, int lineno) {
+  schedule_t *s = ctx->s;
+  ctx->cg = NULL;
+  ctx->win = NULL;
+  if (!(ctx->section = arena_strdup(&s->arena, section))) {
+    return PLIMIT_ERR_MEM;
+  }
+  if (strncmp(section, CGROUP_SECTION, strlen(CGROUP_SECTION)) == 0) {
+    const char *name = section + strlen(CGROUP_SECTION);
+    sched_cgroup_t *dup = find_cgroup(s, name);
+    if (dup) {
+      log_msg(LOG_ERROR, "%s:%d: cgroup '%s' already declared on line %d",
+              ctx->file, lineno, name, dup->lineno);
+      return PLIMIT_ERR_PARSE;
+    }
+    void **tmp = grow(&s->arena, (void **)s->cgroups, s->ncgroups, &s->cgcap);
+    sched_cgroup_t *cg = arena_alloc(&s->arena, sizeof(*cg));
+    if (!tmp || !cg || !(cg->name = arena_strdup(&s->arena, name))) {
+      return PLIMIT_ERR_MEM;
+    }
+    cg->lineno = lineno;
+    s->cgroups = (sched_cgroup_t **)tmp;
+    s->cgroups[s->ncgroups++] = cg;
+    ctx->cg = cg;
+    return PLIMIT_OK;
+  }
+  if (strncmp(section, WINDOW_SECTION, strlen(WINDOW_SECTION)) == 0) {
+    const char *name = section + strlen(WINDOW_SECTION);
+    for (size_t i = 0; i < s->nwindows; i++) {
+      if (strcmp(s->windows[i]->name, name) == 0) {
+        log_msg(LOG_ERROR, "%s:%d: window '%s' already declared on line %d",
+                ctx->file, lineno, name, s->windows[i]->lineno);
+        return PLIMIT_ERR_PARSE;
+      }
+    }
+    void **tmp =
+        grow(&s->arena, (void **)s->windows, s->nwindows, &s->wcap);
+    sched_window_t *w = arena_alloc(&s->arena, sizeof(*w));
+    if (!tmp || !w || !(w->name = arena_strdup(&s->arena, name))) {
+      return PLIMIT_ERR_MEM;
+    }
+    w->days = ALL_DAYS;
+    w->start = -1;
+    w->lineno = lineno;
+    s->windows = (sched_window_t **)tmp;
+    s->windows[s->nwindows++] = w;
+    ctx->win = w;
+    return PLIMIT_OK;
+  }
+  log_msg(LOG_ERROR,
+          "%s:%d: key outside of a [cgroup PATH] or [window NAME] section",
+          ctx->file, lineno);
+  return PLIMIT_ERR_PARSE;
+}
+
+static int load_handler(const char *section, const char *key,
+                        const char *value, int lineno, void *ctx_) {
+  load_ctx_t *ctx = (load_ctx_t *)ctx_;
+  schedule_t *s = ctx->s;
+  if (!ctx->section || strcmp(ctx->section, section) != 0) {
+    int rc = begin_section(ctx, section, lineno);
+    if (rc != PLIMIT_OK) {
+      if (rc == PLIMIT_ERR_MEM) {
+        log_msg(LOG_ERROR, "failed to allocate memory for the schedule");
+      }
+      return rc;
+    }
+  }
+  sched_window_t *w = ctx->win;
+  if (w && strcmp(key, "cgroup") == 0) {
+    w->cgroup = arena_strdup(&s->arena, value);
+    return w->cgroup ? PLIMIT_OK : PLIMIT_ERR_MEM;
+  }
+  if (w && strcmp(key, "days") == 0) {
+    if (!parse_days(value, &w->days)) {
+      log_msg(LOG_ERROR, "%s:%d: invalid days '%s'", ctx->file, lineno,
+              value);
+      return PLIMIT_ERR_PARSE;
+    }
+    return PLIMIT_OK;
+  }
+  if (w && strcmp(key, "hours") == 0) {
+    if (!parse_hours(value, &w->start, &w->end)) {
+      log_msg(LOG_ERROR, "%s:%d: invalid hours '%s', expected HH:MM-HH:MM",
+              ctx->file, lineno, value);
+      return PLIMIT_ERR_PARSE;
+    }
+    return PLIMIT_OK;
+  }
+  if (!valid_key(key)) {
+    log_msg(LOG_ERROR, "%s:%d: invalid controller file '%s'", ctx->file,
+            lineno, key);
+    return PLIMIT_ERR_PARSE;
+  }
+  return add_entry(&s->arena, w ? &w->limits : &ctx->cg->limits, key, value);
+}
+
+static int check_windows(const schedule_t *s, const char *file) {
+  for (size_t i = 0; i < s->nwindows; i++) {
+    const sched_window_t *w = s->windows[i];
+    const sched_cgroup_t *cg = w->cgroup ? find_cgroup(s, w->cgroup) : NULL;
+    if (!w->cgroup || w->start < 0) {
+      log_msg(LOG_ERROR, "%s:%d: window '%s' needs cgroup and hours", file,
+              w->lineno, w->name);
+      return PLIMIT_ERR_PARSE;
+    }
+    if (!cg) {
+      log_msg(LOG_ERROR, "%s:%d: window '%s' targets '%s' without a [cgroup "
+                         "%s] section",
+              file, w->lineno, w->name, w->cgroup, w->cgroup);
+      return PLIMIT_ERR_PARSE;
+    }
+    // leaving the window has to restore a known value
+    for (const entry_t *e = w->limits.head; e; e = e->next) {
+      if (!find_entry(&cg->limits, e->key)) {
+        log_msg(LOG_ERROR, "%s:%d: window '%s' sets %s, which [cgroup %s] "
+                           "does not",
+                file, w->lineno, w->name, e->key, w->cgroup);
+        return PLIMIT_ERR_PARSE;
+      }
+    }
+  }
+  return PLIMIT_OK;
+}
+
+static int schedule_load(const char *file, schedule_t *s) {
+  memset(s, 0, sizeof(*s));
+  arena_init(&s->arena, NULL, 0);
+  load_ctx_t ctx = {.s = s, .file = file};
+  int rc = ini_parse_file(file, load_handler, &ctx);
+  if (rc == PLIMIT_OK) {
+    rc = check_windows(s, file);
+  }
+  return rc;
+}
+
+// a window with start >= end wraps past midnight, start == end spans a day
+static bool window_open(const sched_window_t *w, const struct tm *tm) {
+  int minute = tm->tm_hour * MINUTES_PER_HOUR + tm->tm_min;
+  bool today = w->days & (1u << tm->tm_wday);
+  bool yesterday = w->days & (1u << ((tm->tm_wday + 6) % 7));
+  if (w->start < w->end) {
+    return today && minute >= w->start && minute < w->end;
+  }
+  return (today && minute >= w->start) || (yesterday && minute < w->end);
+}
+
+// every start and end time of the next days; waking up at a time that is
+// not a boundary on that day of the week only costs an unchanged pass
+static time_t next_boundary(const schedule_t *s, time_t now) {
+  struct tm base;
+  localtime_r(&now, &base);
+  time_t best = 0;
+  for (size_t i = 0; i < s->nwindows; i++) {
+    const int minutes[] = {s->windows[i]->start, s->windows[i]->end};
+    for (int d = 0; d < SCHEDULE_HORIZON_DAYS; d++) {
+      for (size_t k = 0; k < 2; k++) {
+        struct tm tm = base;
+        tm.tm_mday += d;
+        tm.tm_hour = minutes[k] / MINUTES_PER_HOUR;
+        tm.tm_min = minutes[k] % MINUTES_PER_HOUR;
+        tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        time_t t = mktime(&tm);
+        if (t > now && (best == 0 || t < best)) {
+          best = t;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+// limits of every cgroup at now, in the snapshot format
+static int compose(schedule_t *s, time_t now, char **text, size_t *len) {
+  struct tm tm;
+  localtime_r(&now, &tm);
+  for (size_t i = 0; i < s->nwindows; i++) {
+    sched_window_t *w = s->windows[i];
+    bool open = window_open(w, &tm);
+    if (open != w->open) {
+      log_msg(LOG_INFO, "window '%s' %s for %s", w->name,
+              open ? "opened" : "closed", w->cgroup);
+    }
+    w->open = open;
+  }
+  FILE *out = open_memstream(text, len);
+  if (!out) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the schedule");
+    return PLIMIT_ERR_MEM;
+  }
+  for (size_t i = 0; i < s->ncgroups; i++) {
+    const sched_cgroup_t *cg = s->cgroups[i];
+    fprintf(out, "%s[cgroup %s]\n", i ? "\n" : "", cg->name);
+    for (const entry_t *e = cg->limits.head; e; e = e->next) {
+      const char *value = e->value;
+      for (size_t j = 0; j < s->nwindows; j++) {
+        const sched_window_t *w = s->windows[j];
+        const entry_t *o = w->open && strcmp(w->cgroup, cg->name) == 0
+                               ? find_entry(&w->limits, e->key)
+                               : NULL;
+        value = o ? o->value : value;
+      }
+      fprintf(out, "%s = %s\n", e->key, value);
+    }
+  }
+  if (fclose(out) != 0) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the schedule");
+    return PLIMIT_ERR_MEM;
+  }
+  return PLIMIT_OK;
+}
+
+typedef struct {
+  char *text; // limits of the last successful pass, NULL to force one
+  size_t len;
+} applied_t;
+
+static int schedule_pass(const schedule_opts_t *so, schedule_t *s,
+                         applied_t *applied) {
+  char *text = NULL;
+  size_t len = 0;
+  int rc = compose(s, time(NULL), &text, &len);
+  if (rc != PLIMIT_OK) {
+    free(text);
+    return rc;
+  }
+  if (applied->text && applied->len == len &&
+      memcmp(applied->text, text, len) == 0) {
+    if (so->opts.verbose) {
+      log_msg(LOG_INFO, "limits unchanged");
+    }
+    free(text);
+    return PLIMIT_OK;
+  }
+  restore_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+  if (len > 0) {
+    FILE *in = fmemopen(text, len, "r");
+    if (!in) {
+      log_msg(LOG_ERROR, "failed to open the limits: %s", strerror(errno));
+      free(text);
+      return PLIMIT_ERR_MEM;
+    }
+    rc = snapshot_restore(in, so->file, &so->opts, 1, &stats);
+    fclose(in);
+  }
+  log_msg(rc == PLIMIT_OK ? LOG_INFO : LOG_ERROR,
+          "schedule %s: %zu cgroups (%zu created), %zu writes, %zu unchanged",
+          rc == PLIMIT_OK ? "applied" : "failed", stats.cgroups,
+          stats.created, stats.writes, stats.skipped);
+  free(applied->text);
+  // a failed pass is retried on the next wake-up
+  applied->text = rc == PLIMIT_OK ? text : NULL;
+  applied->len = rc == PLIMIT_OK ? len : 0;
+  if (rc != PLIMIT_OK) {
+    free(text);
+  }
+  return rc;
+}
+
+// retry_ms > 0 wakes up earlier than the next boundary to retry a failed pass
+static int arm(int fd, const schedule_t *s, long long retry_ms, bool verbose) {
+  time_t next = next_boundary(s, time(NULL));
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = next;
+  if (retry_ms > 0) {
+    long long at = clock_ms(CLOCK_REALTIME) + retry_ms;
+    if (next == 0 || at < (long long)next * MSEC_PER_SEC) {
+      its.it_value.tv_sec = (time_t)(at / MSEC_PER_SEC);
+      its.it_value.tv_nsec = (long)(at % MSEC_PER_SEC * NSEC_PER_MSEC);
+      next = 0;
+    }
+  }
+  // a wall clock change cancels the timer, so boundaries are recomputed
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its,
+                      NULL) != 0) {
+    log_msg(LOG_ERROR, "failed to arm the schedule timer: %s",
+            strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  if (verbose && next > 0) {
+    char when[64];
+    struct tm tm;
+    localtime_r(&next, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M %Z", &tm);
+    log_msg(LOG_INFO, "next boundary at %s", when);
+  }
+  return PLIMIT_OK;
+}
+
+static long long backoff(long long retry_ms) {
+  retry_ms = retry_ms > 0 ? retry_ms * 2 : SCHEDULE_RETRY_MS;
+  if (retry_ms > SCHEDULE_RETRY_MAX_MS) {
+    retry_ms = SCHEDULE_RETRY_MAX_MS;
+  }
+  log_msg(LOG_INFO, "retrying in %lldms", retry_ms);
+  return retry_ms;
+}
+
+// failed tells whether the pass before the watch failed
+static int watch(const schedule_opts_t *so, schedule_t *s, applied_t *applied,
+                 bool failed) {
+  int fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd < 0) {
+    log_msg(LOG_ERROR, "failed to create the schedule timer: %s",
+            strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  stop_on_signal(on_hup);
+
+  int rc = PLIMIT_OK;
+  long long retry_ms = failed ? backoff(0) : 0;
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  while (!stop_requested()) {
+    rc = arm(fd, s, retry_ms, so->opts.verbose);
+    if (rc != PLIMIT_OK) {
+      break;
+    }
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+      log_msg(LOG_ERROR, "failed to wait for the next boundary: %s",
+              strerror(errno));
+      rc = PLIMIT_ERR_IO;
+      break;
+    }
+    uint64_t expired;
+    // ECANCELED after a clock change, EAGAIN when woken by a signal
+    if (read(fd, &expired, sizeof(expired)) < 0 && errno == ECANCELED &&
+        so->opts.verbose) {
+      log_msg(LOG_INFO, "wall clock changed");
+    }
+    if (stop_requested()) {
+      break;
+    }
+    if (reload) {
+      reload = 0;
+      schedule_t next;
+      if (schedule_load(so->file, &next) != PLIMIT_OK) {
+        log_msg(LOG_WARN, "keeping the previous schedule");
+        schedule_free(&next);
+        continue;
+      }
+      schedule_free(s);
+      *s = next;
+      free(applied->text);
+      applied->text = NULL;
+    }
+    bool ok = schedule_pass(so, s, applied) == PLIMIT_OK;
+    retry_ms = ok ? 0 : backoff(retry_ms);
+  }
+  close(fd);
+  return rc;
+}
+
+int schedule_run(const schedule_opts_t *so) {
+  if (!have_cgroupv2()) {
+    log_msg(LOG_ERROR, "cgroup v2 not detected at %s: %s", cg_root(),
+            strerror(errno));
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  reload = 0;
+  schedule_t s;
+  int rc = schedule_load(so->file, &s);
+  if (rc == PLIMIT_OK) {
+    applied_t applied = {0};
+    rc = schedule_pass(so, &s, &applied);
+    if (!so->once) {
+      rc = watch(so, &s, &applied, rc != PLIMIT_OK);
+    }
+    free(applied.text);
+  }
+  schedule_free(&s);
+  return rc;
+}
@@ -0,0 +1,588 @@
+#include "snapshot.h"
+#include "batch.h"
+#include "ini.h"
+#include "pool.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char CGROUP_SECTION[] = "cgroup ";
+static const int CGFILE_PERM = 0644;
+
+// writable settings captured for every cgroup, in restore order
+static const char *const SNAPSHOT_FILES[] = {
+    "cpu.max",          "cpu.weight",      "cpu.idle",    "cpu.uclamp.min",
+    "cpu.uclamp.max",   "cpuset.cpus",     "cpuset.mems", "memory.min",
+    "memory.low",       "memory.high",     "memory.max",  "memory.swap.max",
+    "memory.oom.group", "io.max",          "io.weight",   "pids.max",
+    NULL};
+
+static int read_cmdline(pid_t pid, char *buf, size_t size) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  ssize_t n = read(fd, buf, size - 1);
+  close(fd);
+  if (n < 0) {
+    return PLIMIT_ERR_IO;
+  }
+  // arguments are NUL separated; newlines would break the snapshot format
+  while (n > 0 && buf[n - 1] == '\0') {
+    n--;
+  }
+  for (ssize_t i = 0; i < n; i++) {
+    if (buf[i] == '\0' || buf[i] == '\n') {
+      buf[i] = ' ';
+    }
+  }
+  buf[n] = '\0';
+  return PLIMIT_OK;
+}
+
+static void emit_lines(FILE *out, const char *key, char *value) {
+  char *save = NULL;
+  for (char *line = strtok_r(value, "\n", &save); line;
+       line = strtok_r(NULL, "\n", &save)) {
+    fprintf(out, "%s = %s\n", key, line);
+  }
+}
+
+static int is_hugetlb_limit(const struct dirent *de) {
+  size_t len = strlen(de->d_name);
+  return strncmp(de->d_name, "hugetlb.", strlen("hugetlb.")) == 0 &&
+         len > strlen(".max") &&
+         strcmp(de->d_name + len - strlen(".max"), ".max") == 0;
+}
+
+// dot entries also cover the PID index of an emulated hierarchy
+static int is_child_dir(const struct dirent *de) {
+  return de->d_type == DT_DIR && de->d_name[0] != '.';
+}
+
+typedef struct {
+  FILE *out;
+  const snapshot_opts_t *sopts;
+} procs_ctx_t;
+
+static int snapshot_proc(pid_t pid, void *ctx) {
+  const procs_ctx_t *pc = (const procs_ctx_t *)ctx;
+  char cmdline[1024];
+  if (pc->sopts->cmdlines &&
+      read_cmdline(pid, cmdline, sizeof(cmdline)) == PLIMIT_OK && *cmdline) {
+    fprintf(pc->out, "proc = %d %s\n", pid, cmdline);
+  } else {
+    fprintf(pc->out, "proc = %d\n", pid);
+  }
+  return PLIMIT_OK;
+}
+
+static void snapshot_procs(FILE *out, const char *path,
+                           const snapshot_opts_t *sopts) {
+  char buf[PROCS_READ_SIZE];
+  procs_ctx_t pc = {.out = out, .sopts = sopts};
+  cg_for_each_proc(path, buf, sizeof(buf), snapshot_proc, &pc);
+}
+
+static int snapshot_dir(FILE *out, char *path, size_t len,
+                        const snapshot_opts_t *sopts) {
+  char file[PATH_MAX];
+  char value[4096];
+
+  fprintf(out, "\n[%s%s]\n", CGROUP_SECTION, path + strlen(cg_root()) + 1);
+  // always emitted so that every section has at least one key
+  snprintf(file, sizeof(file), "%s/cgroup.subtree_control", path);
+  if (read_file(file, value, sizeof(value)) != PLIMIT_OK) {
+    *value = '\0';
+  }
+  fprintf(out, "cgroup.subtree_control = %s\n", value);
+
+  for (const char *const *f = SNAPSHOT_FILES; *f; ++f) {
+    snprintf(file, sizeof(file), "%s/%s", path, *f);
+    if (read_file(file, value, sizeof(value)) == PLIMIT_OK && *value) {
+      emit_lines(out, *f, value);
+    }
+  }
+
+  struct dirent **hugetlb = NULL;
+  int n = scandir(path, &hugetlb, is_hugetlb_limit, alphasort);
+  for (int i = 0; i < n; i++) {
+    snprintf(file, sizeof(file), "%s/%s", path, hugetlb[i]->d_name);
+    if (read_file(file, value, sizeof(value)) == PLIMIT_OK && *value) {
+      emit_lines(out, hugetlb[i]->d_name, value);
+    }
+    free(hugetlb[i]);
+  }
+  free((void *)hugetlb);
+
+  if (sopts->procs) {
+    snapshot_procs(out, path, sopts);
+  }
+
+  struct dirent **children = NULL;
+  n = scandir(path, &children, is_child_dir, alphasort);
+  if (n < 0) {
+    log_msg(LOG_ERROR, "failed to list cgroup '%s': %s", path,
+            strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  int rc = PLIMIT_OK;
+  for (int i = 0; i < n; i++) {
+    size_t clen = strlen(children[i]->d_name);
+    if (rc == PLIMIT_OK && len + 1 + clen < PATH_MAX) {
+      path[len] = '/';
+      memcpy(path + len + 1, children[i]->d_name, clen + 1);
+      rc = snapshot_dir(out, path, len + 1 + clen, sopts);
+      path[len] = '\0';
+    }
+    free(children[i]);
+  }
+  free((void *)children);
+  return rc;
+}
+
+int snapshot_write(FILE *out, const char *cgname,
+                   const snapshot_opts_t *sopts) {
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  const char *cgpath =
+      cgname ? cg_full_path(&a, cgname) : cg_plimit_root();
+  if (!cgpath) {
+    return PLIMIT_ERR_MEM;
+  }
+  // the walk extends the path in place, so it needs a PATH_MAX buffer
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", cgpath);
+  arena_release(&a);
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    log_msg(LOG_ERROR, "cgroup '%s' not found", path);
+    return PLIMIT_ERR_NOTFOUND;
+  }
+
+  fprintf(out, "# plimit %s snapshot\n", PLIMIT_VERSION);
+  int rc = snapshot_dir(out, path, strlen(path), sopts);
+  if (fflush(out) != 0) {
+    log_msg(LOG_ERROR, "failed to write snapshot: %s", strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  return rc;
+}
+
+// limit writes are queued and submitted together (see write_files()), the
+// strings of queued entries live in the arena until the queue is flushed
+typedef struct {
+  const char *name;
+  const run_opts_t *opts;
+  restore_stats_t *stats;
+  bool enable_parent; // --force: enable controllers above the next cgroup
+  char section[PATH_MAX];
+  char cgpath[PATH_MAX];
+  arena_t arena;
+  file_write_t queue[BATCH_URING_SIZE];
+  size_t queued;
+} restore_ctx_t;
+
+static int restore_flush(restore_ctx_t *ctx) {
+  if (ctx->queued == 0) {
+    return PLIMIT_OK;
+  }
+  int rc = write_files(ctx->opts->dry_run, ctx->queue, ctx->queued,
+                       ctx->opts->verbose);
+  for (size_t i = 0; i < ctx->queued; i++) {
+    const file_write_t *w = &ctx->queue[i];
+    if (w->rc != PLIMIT_OK) {
+      log_msg(LOG_ERROR, "failed to restore %s: %s", w->args.path,
+              strerror(w->err));
+    }
+  }
+  ctx->queued = 0;
+  arena_release(&ctx->arena);
+  return rc;
+}
+
+static int restore_queue(restore_ctx_t *ctx, const char *path,
+                         const char *value) {
+  file_write_t *w = &ctx->queue[ctx->queued];
+  w->args.path = arena_strdup(&ctx->arena, path);
+  w->args.data = arena_strdup(&ctx->arena, value);
+  w->args.mode = CGFILE_PERM;
+  if (!w->args.path || !w->args.data) {
+    log_msg(LOG_ERROR, "failed to allocate memory for restore queue");
+    return PLIMIT_ERR_MEM;
+  }
+  // a dry run only logs, keep its output in stream order
+  if (++ctx->queued == BATCH_URING_SIZE || ctx->opts->dry_run) {
+    return restore_flush(ctx);
+  }
+  return PLIMIT_OK;
+}
+
+static bool valid_cgroup_name(const char *name) {
+  size_t len = strlen(name);
+  if (len == 0 || *name == '/' || strcmp(name, "..") == 0 ||
+      strncmp(name, "../", 3) == 0 || strstr(name, "/../") ||
+      (len >= 3 && strcmp(name + len - 3, "/..") == 0)) {
+    return false;
+  }
+  return true;
+}
+
+static int restore_begin(restore_ctx_t *ctx, const char *section) {
+  const char *name = section + strlen(CGROUP_SECTION);
+  if (!valid_cgroup_name(name)) {
+    log_msg(LOG_ERROR, "%s: invalid cgroup name '%s'", ctx->name, name);
+    return PLIMIT_ERR_PARSE;
+  }
+  snprintf(ctx->section, sizeof(ctx->section), "%s", section);
+  snprintf(ctx->cgpath, sizeof(ctx->cgpath), "%s/%s", cg_root(), name);
+  ctx->stats->cgroups++;
+
+  if (ctx->enable_parent) {
+    ctx->enable_parent = false;
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", ctx->cgpath);
+    *strrchr(parent, '/') = '\0';
+    controllers_t controllers = {.parent = parent,
+                                 .list = "+cpu +memory +io +pids"};
+    int rc = enable_controllers(controllers, ctx->opts);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+  }
+
+  struct stat st;
+  if (stat(ctx->cgpath, &st) == 0) {
+    return PLIMIT_OK;
+  }
+  int rc = cg_mkdir(ctx->cgpath, ctx->opts);
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to create cgroup directory '%s': %s",
+            ctx->cgpath, strerror(errno));
+    return rc;
+  }
+  ctx->stats->created++;
+  return PLIMIT_OK;
+}
+
+static int restore_subtree(restore_ctx_t *ctx, const char *value) {
+  char file[PATH_MAX];
+  char cur[1024];
+  if (snprintf(file, sizeof(file), "%s/cgroup.subtree_control",
+               ctx->cgpath) >= (int)sizeof(file) ||
+      read_file(file, cur, sizeof(cur)) != PLIMIT_OK) {
+    *cur = '\0';
+  }
+  char want[1024];
+  snprintf(want, sizeof(want), "%s", value);
+  char list[1024] = "";
+  size_t used = 0;
+  char *save = NULL;
+  for (char *tok = strtok_r(want, " ", &save); tok;
+       tok = strtok_r(NULL, " ", &save)) {
+    bool enabled = false;
+    size_t len = strlen(tok);
+    for (const char *c = cur; *c;) {
+      size_t clen = strcspn(c, " ");
+      enabled = enabled || (clen == len && strncmp(c, tok, len) == 0);
+      c += clen + (c[clen] == ' ');
+    }
+    if (!enabled && used + len + 2 < sizeof(list)) {
+      used += (size_t)snprintf(list + used, sizeof(list) - used, "%s+%s",
+                               used ? " " : "", tok);
+    }
+  }
+  if (used == 0) {
+    ctx->stats->skipped++;
+    return PLIMIT_OK;
+  }
+  ctx->stats->writes++;
+  controllers_t controllers = {.parent = ctx->cgpath, .list = list};
+  return enable_controllers(controllers, ctx->opts);
+}
+
+static int restore_proc(restore_ctx_t *ctx, const char *value) {
+  char *end = NULL;
+  long pid = strtol(value, &end, 10);
+  if (pid <= 0 || (*end && *end != ' ')) {
+    log_msg(LOG_ERROR, "%s: invalid proc entry '%s'", ctx->name, value);
+    return PLIMIT_ERR_PARSE;
+  }
+  while (*end == ' ') {
+    end++;
+  }
+  char buf[1024];
+  if (read_cmdline((pid_t)pid, buf, sizeof(buf)) != PLIMIT_OK ||
+      (*end && strcmp(buf, end) != 0)) {
+    // the PID is gone or was reused by another program
+    ctx->stats->missing++;
+    if (ctx->opts->verbose) {
+      log_msg(LOG_INFO, "skip PID %ld: process no longer matches snapshot",
+              pid);
+    }
+    return PLIMIT_OK;
+  }
+
+  // the v2 entry is not the first line on hybrid hosts
+  if (cg_proc_cgroup((pid_t)pid, buf, sizeof(buf)) == PLIMIT_OK &&
+      strcmp(buf, ctx->section + strlen(CGROUP_SECTION)) == 0) {
+    ctx->stats->skipped++;
+    return PLIMIT_OK;
+  }
+  // limits first, so the process is not running unlimited in the meantime
+  int rc = restore_flush(ctx);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  rc = add_proc_cgroup(ctx->cgpath, (pid_t)pid, ctx->opts);
+  if (rc == PLIMIT_OK) {
+    ctx->stats->moved++;
+  } else if (rc == PLIMIT_ERR_NOTFOUND) {
+    // exited after the command line check
+    ctx->stats->missing++;
+    rc = PLIMIT_OK;
+  }
+  return rc;
+}
+
+static bool is_cgroup_section(const restore_ctx_t *ctx, const char *section,
+                              int lineno) {
+  if (strncmp(section, CGROUP_SECTION, strlen(CGROUP_SECTION)) != 0) {
+    log_msg(LOG_ERROR, "%s:%d: key outside of a [cgroup NAME] section",
+            ctx->name, lineno);
+    return false;
+  }
+  return true;
+}
+
+// apply one key of the current section
+static int restore_entry(restore_ctx_t *ctx, const char *key,
+                         const char *value, int lineno) {
+  if (strcmp(key, "cgroup.subtree_control") == 0) {
+    return restore_subtree(ctx, value);
+  }
+  if (strcmp(key, "proc") == 0) {
+    return restore_proc(ctx, value);
+  }
+  if (strchr(key, '/') || strncmp(key, "cgroup.", strlen("cgroup.")) == 0) {
+    log_msg(LOG_ERROR, "%s:%d: invalid controller file '%s'", ctx->name,
+            lineno, key);
+    return PLIMIT_ERR_PARSE;
+  }
+
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/%s", ctx->cgpath, key) >=
+      (int)sizeof(path)) {
+    log_msg(LOG_ERROR, "%s:%d: path too long", ctx->name, lineno);
+    return PLIMIT_ERR_ARG;
+  }
+  if (*value && file_has_line(path, value)) {
+    ctx->stats->skipped++;
+    return PLIMIT_OK;
+  }
+  ctx->stats->writes++;
+  return restore_queue(ctx, path, value);
+}
+
+static int restore_handler(const char *section, const char *key,
+                           const char *value, int lineno, void *ctx_) {
+  restore_ctx_t *ctx = (restore_ctx_t *)ctx_;
+  if (!is_cgroup_section(ctx, section, lineno)) {
+    return PLIMIT_ERR_PARSE;
+  }
+  if (strcmp(section, ctx->section) != 0) {
+    int rc = restore_begin(ctx, section);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+  }
+  return restore_entry(ctx, key, value, lineno);
+}
+
+/*
+ * Parallel restore: the stream is loaded into a tree first. Every cgroup
+ * section is one pool task that queues the sections below it once its own
+ * directory, controllers and limits are in place, so sibling subtrees are
+ * restored concurrently while a parent always precedes its children.
+ */
+
+typedef struct restore_entry {
+  const char *key;
+  const char *value;
+  int lineno;
+  struct restore_entry *next;
+} restore_entry_t;
+
+typedef struct restore_node {
+  const char *section;
+  restore_entry_t *entries;
+  restore_entry_t *last_entry;
+  struct restore_node *parent;
+  struct restore_node *children;
+  struct restore_node *last_child;
+  struct restore_node *sibling;
+  struct restore_node *next; // stream order
+  restore_stats_t stats;
+  int rc;
+  bool ran;
+} restore_node_t;
+
+typedef struct {
+  restore_ctx_t base; // name and options only
+  arena_t arena;
+  restore_node_t *first;
+  restore_node_t *last;
+  restore_node_t **roots;
+  size_t nroots;
+} restore_tree_t;
+
+// sections are expected parents first, as snapshot_write() emits them
+static bool is_ancestor(const restore_node_t *n, const char *section) {
+  size_t len = strlen(n->section);
+  return strncmp(n->section, section, len) == 0 && section[len] == '/';
+}
+
+static int tree_handler(const char *section, const char *key,
+                        const char *value, int lineno, void *ctx_) {
+  restore_tree_t *tree = (restore_tree_t *)ctx_;
+  if (!is_cgroup_section(&tree->base, section, lineno)) {
+    return PLIMIT_ERR_PARSE;
+  }
+  restore_node_t *node = tree->last;
+  if (!node || strcmp(node->section, section) != 0) {
+    node = (restore_node_t *)arena_alloc(&tree->arena, sizeof(*node));
+    if (!node || !(node->section = arena_strdup(&tree->arena, section))) {
+      log_msg(LOG_ERROR, "failed to allocate memory for snapshot tree");
+      return PLIMIT_ERR_MEM;
+    }
+    for (restore_node_t *a = tree->last; a; a = a->parent) {
+      if (is_ancestor(a, section)) {
+        node->parent = a;
+        break;
+      }
+    }
+    if (node->parent) {
+      *(node->parent->last_child ? &node->parent->last_child->sibling
+                                 : &node->parent->children) = node;
+      node->parent->last_child = node;
+    } else {
+      restore_node_t **roots = (restore_node_t **)arena_realloc(
+          &tree->arena, tree->roots, tree->nroots * sizeof(*roots),
+          (tree->nroots + 1) * sizeof(*roots));
+      if (!roots) {
+        log_msg(LOG_ERROR, "failed to allocate memory for snapshot tree");
+        return PLIMIT_ERR_MEM;
+      }
+      tree->roots = roots;
+      tree->roots[tree->nroots++] = node;
+    }
+    *(tree->last ? &tree->last->next : &tree->first) = node;
+    tree->last = node;
+  }
+
+  restore_entry_t *e =
+      (restore_entry_t *)arena_alloc(&tree->arena, sizeof(*e));
+  if (!e || !(e->key = arena_strdup(&tree->arena, key)) ||
+      !(e->value = arena_strdup(&tree->arena, value))) {
+    log_msg(LOG_ERROR, "failed to allocate memory for snapshot tree");
+    return PLIMIT_ERR_MEM;
+  }
+  e->lineno = lineno;
+  *(node->last_entry ? &node->last_entry->next : &node->entries) = e;
+  node->last_entry = e;
+  return PLIMIT_OK;
+}
+
+static void restore_node_run(pool_t *pool, void *task, void *ctx_) {
+  restore_node_t *node = (restore_node_t *)task;
+  const restore_tree_t *tree = (const restore_tree_t *)ctx_;
+  node->ran = true;
+  // the write queue is too big for the stacks of pool threads
+  restore_ctx_t *ctx = (restore_ctx_t *)calloc(1, sizeof(*ctx));
+  if (!ctx) {
+    log_msg(LOG_ERROR, "failed to allocate memory for %s", node->section);
+    node->rc = PLIMIT_ERR_MEM;
+    return;
+  }
+  ctx->name = tree->base.name;
+  ctx->opts = tree->base.opts;
+  ctx->stats = &node->stats;
+  ctx->enable_parent = node == tree->first && ctx->opts->force;
+  arena_init(&ctx->arena, NULL, 0);
+  int rc = restore_begin(ctx, node->section);
+  for (const restore_entry_t *e = node->entries; e && rc == PLIMIT_OK;
+       e = e->next) {
+    rc = restore_entry(ctx, e->key, e->value, e->lineno);
+  }
+  int frc = restore_flush(ctx);
+  arena_release(&ctx->arena);
+  free(ctx);
+  node->rc = rc == PLIMIT_OK ? frc : rc;
+  if (node->rc != PLIMIT_OK) {
+    return;
+  }
+  for (restore_node_t *c = node->children; c; c = c->sibling) {
+    pool_push(pool, c);
+  }
+}
+
+static int restore_parallel(FILE *in, const char *name,
+                            const run_opts_t *opts, size_t jobs,
+                            restore_stats_t *stats) {
+  restore_tree_t tree;
+  memset(&tree, 0, sizeof(tree));
+  tree.base.name = name;
+  tree.base.opts = opts;
+  arena_init(&tree.arena, NULL, 0);
+  int rc = ini_parse_stream(in, name, tree_handler, &tree);
+  if (rc == PLIMIT_OK && tree.nroots > 0) {
+    rc = pool_run(jobs, (void *const *)tree.roots, tree.nroots,
+                  restore_node_run, &tree);
+  }
+
+  // aggregate in stream order, the first failed cgroup decides the result
+  size_t blocked = 0;
+  for (const restore_node_t *n = tree.first; n; n = n->next) {
+    stats->cgroups += n->stats.cgroups;
+    stats->created += n->stats.created;
+    stats->writes += n->stats.writes;
+    stats->skipped += n->stats.skipped;
+    stats->moved += n->stats.moved;
+    stats->missing += n->stats.missing;
+    blocked += !n->ran;
+    if (rc == PLIMIT_OK && n->rc != PLIMIT_OK) {
+      rc = n->rc;
+    }
+  }
+  if (blocked > 0) {
+    log_msg(LOG_WARN, "%zu cgroups not restored below failed cgroups",
+            blocked);
+  }
+  arena_release(&tree.arena);
+  return rc;
+}
+
+int snapshot_restore(FILE *in, const char *name, const run_opts_t *opts,
+                     size_t jobs, restore_stats_t *stats) {
+  restore_stats_t local;
+  restore_ctx_t ctx = {.name = name, .opts = opts,
+                       .stats = stats ? stats : &local,
+                       .enable_parent = opts->force};
+  memset(ctx.stats, 0, sizeof(*ctx.stats));
+  if (jobs > 1) {
+    return restore_parallel(in, name, opts, jobs, ctx.stats);
+  }
+  arena_init(&ctx.arena, NULL, 0);
+  int rc = ini_parse_stream(in, name, restore_handler, &ctx);
+  int frc = restore_flush(&ctx);
+  arena_release(&ctx.arena);
+  return rc == PLIMIT_OK ? frc : rc;
+}
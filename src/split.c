@@ -0,0 +1,461 @@
+#include "split.h"
+#include "trace.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const int CGFILE_PERM = 0644;
+static const long long SPLIT_QUOTA_MIN_US = 1000;
+
+typedef enum {
+  UNDO_RMDIR,
+  UNDO_WRITE,
+  UNDO_CONTROLLERS,
+} undo_kind_t;
+
+// a change made by the transaction and how to take it back
+typedef struct undo {
+  undo_kind_t kind;
+  char *path;
+  char *value;
+  struct undo *next;
+} undo_t;
+
+typedef struct {
+  const run_opts_t *opts;
+  arena_t *arena;
+  undo_t *undo; // most recent change first
+  split_stats_t stats;
+} txn_t;
+
+static bool valid_name(const char *name) {
+  return *name && !strchr(name, '/') && strcmp(name, ".") != 0 &&
+         strcmp(name, "..") != 0 && strlen(name) <= NAME_MAX;
+}
+
+int split_parse_children(arena_t *a, const char *spec,
+                         split_child_t **children, size_t *count) {
+  char *list = arena_strdup(a, spec);
+  size_t n = 1;
+  for (const char *c = spec; *c; c++) {
+    n += *c == ',';
+  }
+  split_child_t *out = arena_alloc(a, n * sizeof(*out));
+  if (!list || !out) {
+    log_msg(LOG_ERROR, "failed to allocate memory for %zu children", n);
+    return PLIMIT_ERR_MEM;
+  }
+
+  size_t used = 0;
+  char *save = NULL;
+  for (char *tok = strtok_r(list, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    unsigned long weight = 1;
+    char *colon = strrchr(tok, ':');
+    if (colon) {
+      *colon = '\0';
+      char *endp = NULL;
+      errno = 0;
+      weight = strtoul(colon + 1, &endp, 10);
+      if (errno || endp == colon + 1 || *endp || colon[1] == '-' ||
+          weight < 1 || weight > SPLIT_WEIGHT_MAX) {
+        log_msg(LOG_ERROR,
+                "invalid weight '%s' for child '%s' (expected 1 to %d)",
+                colon + 1, tok, SPLIT_WEIGHT_MAX);
+        return PLIMIT_ERR_ARG;
+      }
+    }
+    if (!valid_name(tok)) {
+      log_msg(LOG_ERROR, "invalid child cgroup name '%s'", tok);
+      return PLIMIT_ERR_ARG;
+    }
+    for (size_t i = 0; i < used; i++) {
+      if (strcmp(out[i].name, tok) == 0) {
+        log_msg(LOG_ERROR, "child '%s' listed more than once", tok);
+        return PLIMIT_ERR_ARG;
+      }
+    }
+    out[used++] = (split_child_t){.name = tok, .weight = (unsigned)weight};
+  }
+  if (used == 0) {
+    log_msg(LOG_ERROR, "no children in '%s'", spec);
+    return PLIMIT_ERR_ARG;
+  }
+  *children = out;
+  *count = used;
+  return PLIMIT_OK;
+}
+
+// largest remainder: floor shares first, then one unit each to the largest
+// fractions, earlier children winning ties
+static int divide(long long total, const split_child_t *c, size_t n,
+                  long long *shares) {
+  unsigned long long wsum = 0;
+  for (size_t i = 0; i < n; i++) {
+    wsum += c[i].weight;
+  }
+  unsigned long long *frac = calloc(n, sizeof(*frac));
+  if (!frac) {
+    log_msg(LOG_ERROR, "failed to allocate memory for %zu shares", n);
+    return PLIMIT_ERR_MEM;
+  }
+  unsigned long long q = (unsigned long long)total / wsum;
+  unsigned long long r = (unsigned long long)total % wsum;
+  long long left = total;
+  for (size_t i = 0; i < n; i++) {
+    // q * w + r * w / wsum is total * w / wsum without the overflow
+    shares[i] = (long long)(q * c[i].weight + r * c[i].weight / wsum);
+    frac[i] = r * c[i].weight % wsum;
+    left -= shares[i];
+  }
+  for (; left > 0; left--) {
+    size_t best = 0;
+    for (size_t i = 1; i < n; i++) {
+      if (frac[i] > frac[best]) {
+        best = i;
+      }
+    }
+    shares[best]++;
+    frac[best] = 0;
+  }
+  free(frac);
+  return PLIMIT_OK;
+}
+
+int split_compute(split_t *s) {
+  if (s->count == 0) {
+    log_msg(LOG_ERROR, "split of '%s' has no children", s->parent);
+    return PLIMIT_ERR_ARG;
+  }
+  long long *shares = calloc(s->count, sizeof(*shares));
+  if (!shares) {
+    log_msg(LOG_ERROR, "failed to allocate memory for %zu shares", s->count);
+    return PLIMIT_ERR_MEM;
+  }
+  int rc = PLIMIT_OK;
+  unsigned wmin = SPLIT_WEIGHT_MAX;
+  unsigned long long wsum = 0;
+  for (size_t i = 0; i < s->count; i++) {
+    wsum += s->children[i].weight;
+    if (s->children[i].weight < wmin) {
+      wmin = s->children[i].weight;
+    }
+    s->children[i].quota = 0;
+    s->children[i].mem = 0;
+  }
+
+  s->quota = 0;
+  s->period = 0;
+  if (s->cpus > 0) {
+    // pick the period for the smallest share so that it stays above the
+    // kernel minimum, every other share is larger
+    long long quota = 0;
+    rc = cpu_max_for(s->cpus * (double)wmin / (double)wsum, s->cpu_latency,
+                     s->cpu_period, &quota, &s->period);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+    s->quota = (long long)((double)s->period * s->cpus + 0.5);
+    rc = divide(s->quota, s->children, s->count, shares);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+    for (size_t i = 0; i < s->count; i++) {
+      s->children[i].quota = shares[i];
+      if (shares[i] < SPLIT_QUOTA_MIN_US) {
+        log_msg(LOG_ERROR,
+                "cpu share of child '%s' is %lldus per %lldus period, below "
+                "the minimum quota of %lldus",
+                s->children[i].name, shares[i], s->period,
+                SPLIT_QUOTA_MIN_US);
+        rc = PLIMIT_ERR_ARG;
+        goto exit;
+      }
+    }
+  }
+
+  if (s->mem_max >= 0) {
+    // the kernel keeps memory.max in pages, an unaligned value would never
+    // read back as written
+    s->mem_max -= s->mem_max % SPLIT_MEM_ALIGN;
+    rc = divide(s->mem_max / SPLIT_MEM_ALIGN, s->children, s->count, shares);
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+    for (size_t i = 0; i < s->count; i++) {
+      s->children[i].mem = shares[i] * SPLIT_MEM_ALIGN;
+      if (shares[i] == 0) {
+        log_msg(LOG_ERROR, "memory share of child '%s' is below %d bytes",
+                s->children[i].name, SPLIT_MEM_ALIGN);
+        rc = PLIMIT_ERR_ARG;
+        goto exit;
+      }
+    }
+  }
+
+exit:
+  free(shares);
+  return rc;
+}
+
+// allocated before the change is made, so that a made change can always be
+// recorded
+static undo_t *undo_new(txn_t *t, undo_kind_t kind, const char *path,
+                        const char *value) {
+  undo_t *u = arena_alloc(t->arena, sizeof(*u));
+  if (u) {
+    u->kind = kind;
+    u->path = arena_strdup(t->arena, path);
+    u->value = value ? arena_strdup(t->arena, value) : NULL;
+  }
+  if (!u || !u->path || (value && !u->value)) {
+    log_msg(LOG_ERROR, "failed to allocate memory for the undo log");
+    return NULL;
+  }
+  return u;
+}
+
+static void undo_push(txn_t *t, undo_t *u) {
+  if (!t->opts->dry_run) {
+    u->next = t->undo;
+    t->undo = u;
+  }
+}
+
+static int txn_mkdir(txn_t *t, const char *path) {
+  if (access(path, F_OK) == 0) {
+    return PLIMIT_OK;
+  }
+  // a dry run only plans the parent, so its children cannot be checked
+  const char *slash = strrchr(path, '/');
+  if (t->opts->dry_run && t->stats.created > 0 && slash) {
+    char *dir = arena_strndup(t->arena, path, (size_t)(slash - path));
+    if (dir && access(dir, F_OK) != 0) {
+      log_action(LOG_ACTION_MKDIR, path, NULL, true, false);
+      t->stats.created++;
+      return PLIMIT_OK;
+    }
+  }
+  undo_t *u = undo_new(t, UNDO_RMDIR, path, NULL);
+  if (!u) {
+    return PLIMIT_ERR_MEM;
+  }
+  if (cg_mkdir(path, t->opts) != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to create cgroup directory '%s': %s", path,
+            strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  undo_push(t, u);
+  t->stats.created++;
+  return PLIMIT_OK;
+}
+
+static int txn_write(txn_t *t, const char *cgpath, const char *file,
+                     const char *value, bool *changed) {
+  char *path = arena_sprintf(t->arena, "%s/%s", cgpath, file);
+  if (!path) {
+    log_msg(LOG_ERROR, "failed to allocate memory for path (cgroup=%s)",
+            cgpath);
+    return PLIMIT_ERR_MEM;
+  }
+  if (file_has_line(path, value)) {
+    t->stats.unchanged++;
+    return PLIMIT_OK;
+  }
+  char old[256] = "";
+  if (read_file(path, old, sizeof(old)) != PLIMIT_OK && !t->opts->dry_run) {
+    log_msg(LOG_ERROR, "failed to read '%s': %s", path, strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  undo_t *u = undo_new(t, UNDO_WRITE, path, old);
+  if (!u) {
+    return PLIMIT_ERR_MEM;
+  }
+  file_write_args_t args = {.path = path, .data = value, .mode = CGFILE_PERM};
+  uint64_t span = trace_begin();
+  int rc = write_file(t->opts->dry_run, &args, t->opts->verbose);
+  trace_end(span, file, path, rc);
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "failed to write '%s' to %s: %s", value, path,
+            strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  undo_push(t, u);
+  t->stats.writes++;
+  *changed = true;
+  return PLIMIT_OK;
+}
+
+// enables the controllers of list that are not enabled yet
+static int txn_controllers(txn_t *t, const char *cgpath, const char *list) {
+  char path[PATH_MAX];
+  char cur[1024] = "";
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgpath);
+  if (read_file(path, cur, sizeof(cur)) != PLIMIT_OK && !t->opts->dry_run) {
+    log_msg(LOG_ERROR, "failed to read '%s': %s", path, strerror(errno));
+    return PLIMIT_ERR_IO;
+  }
+  char add[256] = "";
+  char del[256] = "";
+  size_t alen = 0;
+  size_t dlen = 0;
+  for (const char *c = list; *c;) {
+    c += strspn(c, " ");
+    size_t len = strcspn(c, " ");
+    bool on = false;
+    for (const char *w = cur; *w && len > 0;) {
+      w += strspn(w, " ");
+      size_t wlen = strcspn(w, " ");
+      on = on || (wlen == len && strncmp(w, c, len) == 0);
+      w += wlen;
+    }
+    if (len > 0 && !on) {
+      alen += (size_t)snprintf(add + alen, sizeof(add) - alen, "%s+%.*s",
+                               alen ? " " : "", (int)len, c);
+      dlen += (size_t)snprintf(del + dlen, sizeof(del) - dlen, "%s-%.*s",
+                               dlen ? " " : "", (int)len, c);
+    }
+    c += len;
+  }
+  if (alen == 0) {
+    return PLIMIT_OK;
+  }
+  undo_t *u = undo_new(t, UNDO_CONTROLLERS, cgpath, del);
+  if (!u) {
+    return PLIMIT_ERR_MEM;
+  }
+  controllers_t controllers = {.parent = cgpath, .list = add};
+  int rc = enable_controllers(controllers, t->opts);
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  undo_push(t, u);
+  return PLIMIT_OK;
+}
+
+static void txn_rollback(txn_t *t) {
+  size_t n = 0;
+  for (undo_t *u = t->undo; u; u = u->next) {
+    n++;
+  }
+  if (n == 0) {
+    return;
+  }
+  log_msg(LOG_WARN, "rolling back %zu changes", n);
+  run_opts_t opts = *t->opts;
+  opts.dry_run = false;
+  for (undo_t *u = t->undo; u; u = u->next) {
+    switch (u->kind) {
+    case UNDO_RMDIR:
+      if (cg_rmdir(u->path) != 0) {
+        log_msg(LOG_ERROR, "rollback: failed to remove '%s': %s", u->path,
+                strerror(errno));
+      }
+      break;
+    case UNDO_WRITE: {
+      file_write_args_t args = {
+          .path = u->path, .data = u->value, .mode = CGFILE_PERM};
+      if (write_file(false, &args, opts.verbose) != PLIMIT_OK) {
+        log_msg(LOG_ERROR, "rollback: failed to restore '%s' in %s: %s",
+                u->value, u->path, strerror(errno));
+      }
+      break;
+    }
+    case UNDO_CONTROLLERS: {
+      controllers_t controllers = {.parent = u->path, .list = u->value};
+      enable_controllers(controllers, &opts);
+      break;
+    }
+    }
+  }
+  t->undo = NULL;
+}
+
+static int apply_child(txn_t *t, const split_t *s, const char *parent,
+                       const split_child_t *c) {
+  char *cgpath = arena_sprintf(t->arena, "%s/%s", parent, c->name);
+  if (!cgpath) {
+    log_msg(LOG_ERROR, "failed to allocate memory for path (child=%s)",
+            c->name);
+    return PLIMIT_ERR_MEM;
+  }
+  int rc = txn_mkdir(t, cgpath);
+  bool changed = false;
+  char buf[64];
+  if (rc == PLIMIT_OK && s->cpus > 0) {
+    snprintf(buf, sizeof(buf), "%lld %lld", c->quota, s->period);
+    rc = txn_write(t, cgpath, "cpu.max", buf, &changed);
+  }
+  if (rc == PLIMIT_OK && s->mem_max >= 0) {
+    snprintf(buf, sizeof(buf), "%lld", c->mem);
+    rc = txn_write(t, cgpath, "memory.max", buf, &changed);
+  }
+  if (changed) {
+    t->stats.children++;
+  }
+  return rc;
+}
+
+int split_apply(const split_t *s, split_stats_t *stats) {
+  if (!have_cgroupv2()) {
+    log_msg(LOG_ERROR, "cgroup v2 not detected at %s: %s", cg_root(),
+            strerror(errno));
+    return PLIMIT_ERR_NOTFOUND;
+  }
+
+  uint64_t span = trace_begin();
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  txn_t t = {.opts = &s->opts, .arena = &a};
+  int rc = PLIMIT_OK;
+  const char *list = s->cpus > 0 && s->mem_max >= 0 ? "cpu memory"
+                     : s->cpus > 0                  ? "cpu"
+                                                    : "memory";
+  char *cgpath = cg_full_path(&a, s->parent);
+  char *container = cg_parent(&a, s->parent);
+  if (!cgpath || !container) {
+    rc = PLIMIT_ERR_MEM;
+    goto exit;
+  }
+
+  if (s->opts.force) {
+    rc = txn_mkdir(&t, container);
+    if (rc == PLIMIT_OK) {
+      rc = txn_controllers(&t, container, list);
+    }
+    if (rc != PLIMIT_OK) {
+      goto exit;
+    }
+  }
+  rc = txn_mkdir(&t, cgpath);
+  bool changed = false;
+  char buf[64];
+  if (rc == PLIMIT_OK && s->cpus > 0) {
+    snprintf(buf, sizeof(buf), "%lld %lld", s->quota, s->period);
+    rc = txn_write(&t, cgpath, "cpu.max", buf, &changed);
+  }
+  if (rc == PLIMIT_OK && s->mem_max >= 0) {
+    snprintf(buf, sizeof(buf), "%lld", s->mem_max);
+    rc = txn_write(&t, cgpath, "memory.max", buf, &changed);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = txn_controllers(&t, cgpath, list);
+  }
+  for (size_t i = 0; rc == PLIMIT_OK && i < s->count; i++) {
+    rc = apply_child(&t, s, cgpath, &s->children[i]);
+  }
+
+exit:
+  if (rc != PLIMIT_OK) {
+    txn_rollback(&t);
+  }
+  if (stats) {
+    *stats = t.stats;
+  }
+  trace_end(span, "split", s->parent, rc);
+  arena_release(&a);
+  return rc;
+}
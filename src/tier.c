@@ -0,0 +1,250 @@
+#include "tier.h"
+#include "ini.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TIER_SECTION[] = "tier ";
+static const int WEIGHT_MIN = 1;
+static const int WEIGHT_MAX = 10000;
+static const int IOPRIO_LEVELS = 8;
+
+// I/O priority classes of ioprio_set(2)
+enum { IOPRIO_NONE, IOPRIO_RT, IOPRIO_BE, IOPRIO_IDLE };
+#define IOPRIO(cls, level) ((cls) << 13 | (level))
+
+typedef struct {
+  const char *name;
+  qos_t qos;
+} builtin_tier_t;
+
+// every built-in tier sets these, best-effort has no cpu.weight
+#define QOS_CORE                                                              \
+  (QOS_CPU_IDLE | QOS_IO_WEIGHT | QOS_MEM_LOW | QOS_MEM_HIGH |                 \
+   QOS_SCHED_POLICY | QOS_IOPRIO)
+
+static const builtin_tier_t BUILTIN_TIERS[] = {
+    // memory.low "max" would let it pin all of the parent's memory, it is
+    // left unchanged unless a [tier latency-critical] section sets mem-low
+    {"latency-critical",
+     {.set = (QOS_CORE & ~QOS_MEM_LOW) | QOS_CPU_WEIGHT,
+      .cpu_weight = 1000,
+      .io_weight = 1000,
+      .mem_high = -1,
+      .sched_policy = SCHED_OTHER,
+      .ioprio = IOPRIO(IOPRIO_BE, 0)}},
+    {"standard",
+     {.set = QOS_CORE | QOS_CPU_WEIGHT,
+      .cpu_weight = 100,
+      .io_weight = 100,
+      .mem_high = -1,
+      .sched_policy = SCHED_OTHER,
+      .ioprio = IOPRIO(IOPRIO_NONE, 0)}},
+    {"batch",
+     {.set = QOS_CORE | QOS_CPU_WEIGHT,
+      .cpu_weight = 25,
+      .io_weight = 25,
+      .mem_high = -1,
+      .sched_policy = SCHED_BATCH,
+      .ioprio = IOPRIO(IOPRIO_BE, 7)}},
+    {"best-effort",
+     {.set = QOS_CORE,
+      .cpu_idle = 1,
+      .io_weight = 1,
+      .mem_high = -1,
+      .sched_policy = SCHED_IDLE,
+      .ioprio = IOPRIO(IOPRIO_IDLE, 0)}},
+};
+
+typedef struct {
+  const char *path;
+  const char *name;
+  const char *host;
+  qos_t base;
+  qos_t over;
+  bool found;
+} tier_ctx_t;
+
+static void merge_qos(qos_t *dst, const qos_t *src) {
+  unsigned set = src->set;
+  if (set & QOS_CPU_WEIGHT) {
+    dst->cpu_weight = src->cpu_weight;
+  }
+  if (set & QOS_CPU_IDLE) {
+    dst->cpu_idle = src->cpu_idle;
+  }
+  if (set & QOS_IO_WEIGHT) {
+    dst->io_weight = src->io_weight;
+  }
+  if (set & QOS_MEM_LOW) {
+    dst->mem_low = src->mem_low;
+  }
+  if (set & QOS_MEM_HIGH) {
+    dst->mem_high = src->mem_high;
+  }
+  if (set & QOS_UCLAMP_MIN) {
+    dst->uclamp_min = src->uclamp_min;
+  }
+  if (set & QOS_UCLAMP_MAX) {
+    dst->uclamp_max = src->uclamp_max;
+  }
+  if (set & QOS_SCHED_POLICY) {
+    dst->sched_policy = src->sched_policy;
+  }
+  if (set & QOS_IOPRIO) {
+    dst->ioprio = src->ioprio;
+  }
+  dst->set |= set;
+}
+
+static int parse_int(const char *value, int min, int max, int *out) {
+  char *end = NULL;
+  errno = 0;
+  long v = strtol(value, &end, 10);
+  if (errno || end == value || *end || v < min || v > max) {
+    return PLIMIT_ERR_PARSE;
+  }
+  *out = (int)v;
+  return PLIMIT_OK;
+}
+
+static int parse_percent(const char *value, double *out) {
+  if (strcmp(value, "max") == 0) {
+    *out = 100;
+    return PLIMIT_OK;
+  }
+  char *end = NULL;
+  double v = strtod(value, &end);
+  if (end == value || *end || v < 0 || v > 100) {
+    return PLIMIT_ERR_PARSE;
+  }
+  *out = v;
+  return PLIMIT_OK;
+}
+
+static int parse_policy(const char *value, int *out) {
+  if (strcmp(value, "other") == 0) {
+    *out = SCHED_OTHER;
+  } else if (strcmp(value, "batch") == 0) {
+    *out = SCHED_BATCH;
+  } else if (strcmp(value, "idle") == 0) {
+    *out = SCHED_IDLE;
+  } else {
+    return PLIMIT_ERR_PARSE;
+  }
+  return PLIMIT_OK;
+}
+
+// "none", "idle", "be/N" or "rt/N" with N from 0 (highest) to 7
+static int parse_ioprio(const char *value, int *out) {
+  int cls = IOPRIO_NONE;
+  int level = 0;
+  if (strcmp(value, "idle") == 0) {
+    cls = IOPRIO_IDLE;
+  } else if (strncmp(value, "be/", 3) == 0 || strncmp(value, "rt/", 3) == 0) {
+    cls = value[0] == 'b' ? IOPRIO_BE : IOPRIO_RT;
+    if (parse_int(value + 3, 0, IOPRIO_LEVELS - 1, &level) != PLIMIT_OK) {
+      return PLIMIT_ERR_PARSE;
+    }
+  } else if (strcmp(value, "none") != 0) {
+    return PLIMIT_ERR_PARSE;
+  }
+  *out = IOPRIO(cls, level);
+  return PLIMIT_OK;
+}
+
+static int tier_key(qos_t *q, const char *key, const char *value) {
+  int rc = PLIMIT_ERR_PARSE;
+  unsigned bit = 0;
+  if (strcmp(key, "cpu-weight") == 0) {
+    rc = parse_int(value, WEIGHT_MIN, WEIGHT_MAX, &q->cpu_weight);
+    bit = QOS_CPU_WEIGHT;
+  } else if (strcmp(key, "cpu-idle") == 0) {
+    rc = parse_int(value, 0, 1, &q->cpu_idle);
+    bit = QOS_CPU_IDLE;
+  } else if (strcmp(key, "io-weight") == 0) {
+    rc = parse_int(value, WEIGHT_MIN, WEIGHT_MAX, &q->io_weight);
+    bit = QOS_IO_WEIGHT;
+  } else if (strcmp(key, "mem-low") == 0) {
+    rc = parse_size(value, &q->mem_low);
+    bit = QOS_MEM_LOW;
+  } else if (strcmp(key, "mem-high") == 0) {
+    rc = parse_size(value, &q->mem_high);
+    bit = QOS_MEM_HIGH;
+  } else if (strcmp(key, "uclamp-min") == 0) {
+    rc = parse_percent(value, &q->uclamp_min);
+    bit = QOS_UCLAMP_MIN;
+  } else if (strcmp(key, "uclamp-max") == 0) {
+    rc = parse_percent(value, &q->uclamp_max);
+    bit = QOS_UCLAMP_MAX;
+  } else if (strcmp(key, "sched-policy") == 0) {
+    rc = parse_policy(value, &q->sched_policy);
+    bit = QOS_SCHED_POLICY;
+  } else if (strcmp(key, "ioprio") == 0) {
+    rc = parse_ioprio(value, &q->ioprio);
+    bit = QOS_IOPRIO;
+  } else {
+    log_msg(LOG_ERROR, "unknown tier key '%s'", key);
+    return PLIMIT_ERR_PARSE;
+  }
+  if (rc == PLIMIT_OK) {
+    q->set |= bit;
+  }
+  return rc;
+}
+
+static int tier_handler(const char *section, const char *key,
+                        const char *value, int lineno, void *ctx_) {
+  tier_ctx_t *ctx = (tier_ctx_t *)ctx_;
+  if (strncmp(section, TIER_SECTION, strlen(TIER_SECTION)) != 0) {
+    // other sections belong to other features sharing the file
+    return PLIMIT_OK;
+  }
+  const char *name = section + strlen(TIER_SECTION);
+  const char *at = strchr(name, '@');
+  size_t len = at ? (size_t)(at - name) : strlen(name);
+  if (len != strlen(ctx->name) || strncmp(name, ctx->name, len) != 0 ||
+      (at && !host_matches(at + 1, ctx->host))) {
+    return PLIMIT_OK;
+  }
+  ctx->found = true;
+  int rc = tier_key(at ? &ctx->over : &ctx->base, key, value);
+  if (rc != PLIMIT_OK) {
+    log_msg(LOG_ERROR, "%s:%d: invalid value '%s' for '%s'", ctx->path,
+            lineno, value, key);
+  }
+  return rc;
+}
+
+int tier_resolve(const char *config, const char *name, const char *host,
+                 qos_t *out) {
+  memset(out, 0, sizeof(*out));
+  bool builtin = false;
+  size_t count = sizeof(BUILTIN_TIERS) / sizeof(BUILTIN_TIERS[0]);
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(BUILTIN_TIERS[i].name, name) == 0) {
+      *out = BUILTIN_TIERS[i].qos;
+      builtin = true;
+    }
+  }
+
+  tier_ctx_t ctx = {.path = config, .name = name, .host = host};
+  if (config) {
+    int rc = ini_parse_file(config, tier_handler, &ctx);
+    if (rc != PLIMIT_OK) {
+      return rc;
+    }
+  }
+  if (!builtin && !ctx.found) {
+    log_msg(LOG_ERROR, "tier '%s' not found (latency-critical, standard, "
+                       "batch, best-effort or a [tier NAME] section)",
+            name);
+    return PLIMIT_ERR_NOTFOUND;
+  }
+  // the host section wins wherever it appears in the file
+  merge_qos(out, &ctx.base);
+  merge_qos(out, &ctx.over);
+  return PLIMIT_OK;
+}
@@ -0,0 +1,165 @@
+#include "trace.h"
+#include "utils.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static const size_t TRACE_INITIAL_CAP = 256;
+static const double NS_PER_US = 1e3;
+static const double NS_PER_MS = 1e6;
+
+typedef struct {
+  uint64_t start;
+  uint64_t dur;
+  const char *name;
+  char detail[TRACE_DETAIL_SIZE];
+  int rc;
+  int depth;
+  pid_t tid;
+} trace_span_t;
+
+static atomic_bool enabled;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_span_t *spans;
+static size_t nspans;
+static size_t cap;
+static _Thread_local int depth;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int trace_parse_format(const char *s, trace_format_t *fmt) {
+  if (strcmp(s, "text") == 0) {
+    *fmt = TRACE_TEXT;
+  } else if (strcmp(s, "chrome") == 0 || strcmp(s, "json") == 0) {
+    *fmt = TRACE_CHROME;
+  } else {
+    log_msg(LOG_ERROR, "invalid trace format '%s' (expected text or chrome)",
+            s);
+    return PLIMIT_ERR_ARG;
+  }
+  return PLIMIT_OK;
+}
+
+void trace_enable(void) { atomic_store(&enabled, true); }
+
+uint64_t trace_begin(void) {
+  if (!atomic_load_explicit(&enabled, memory_order_relaxed)) {
+    return 0;
+  }
+  depth++;
+  return now_ns();
+}
+
+void trace_end(uint64_t start, const char *name, const char *detail, int rc) {
+  if (start == 0) {
+    return;
+  }
+  uint64_t end = now_ns();
+  int saved_errno = errno;
+  depth--;
+
+  pthread_mutex_lock(&lock);
+  if (nspans == cap) {
+    size_t ncap = cap ? cap * 2 : TRACE_INITIAL_CAP;
+    trace_span_t *tmp = realloc(spans, ncap * sizeof(*spans));
+    if (!tmp) {
+      // a lost span is not worth failing the operation for
+      pthread_mutex_unlock(&lock);
+      errno = saved_errno;
+      return;
+    }
+    spans = tmp;
+    cap = ncap;
+  }
+  trace_span_t *s = &spans[nspans++];
+  s->start = start;
+  s->dur = end - start;
+  s->name = name;
+  snprintf(s->detail, sizeof(s->detail), "%s", detail ? detail : "");
+  s->rc = rc;
+  s->depth = depth;
+  s->tid = (pid_t)syscall(SYS_gettid);
+  pthread_mutex_unlock(&lock);
+  errno = saved_errno;
+}
+
+// spans are recorded when they end, so parents follow their children
+static int cmp_span(const void *a, const void *b) {
+  const trace_span_t *x = a;
+  const trace_span_t *y = b;
+  if (x->start != y->start) {
+    return x->start < y->start ? -1 : 1;
+  }
+  return x->depth - y->depth;
+}
+
+static void write_text(FILE *out, uint64_t t0) {
+  fprintf(out, "%12s %12s  %s\n", "start(ms)", "dur(ms)", "span");
+  for (size_t i = 0; i < nspans; i++) {
+    const trace_span_t *s = &spans[i];
+    fprintf(out, "%12.3f %12.3f  %*s%s", (double)(s->start - t0) / NS_PER_MS,
+            (double)s->dur / NS_PER_MS, s->depth * 2, "", s->name);
+    if (s->detail[0]) {
+      fprintf(out, " %s", s->detail);
+    }
+    if (s->rc != 0) {
+      fprintf(out, " rc=%d", s->rc);
+    }
+    fputc('\n', out);
+  }
+}
+
+static void write_chrome(FILE *out, uint64_t t0) {
+  pid_t pid = getpid();
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+  for (size_t i = 0; i < nspans; i++) {
+    const trace_span_t *s = &spans[i];
+    fprintf(out, "%s\n{\"name\":", i ? "," : "");
+    json_write_string(out, s->name);
+    fprintf(out,
+            ",\"cat\":\"plimit\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%d,\"args\":{\"detail\":",
+            (double)(s->start - t0) / NS_PER_US, (double)s->dur / NS_PER_US,
+            pid, s->tid);
+    json_write_string(out, s->detail);
+    fprintf(out, ",\"rc\":%d}}", s->rc);
+  }
+  fputs("\n]}\n", out);
+}
+
+int trace_write(FILE *out, trace_format_t fmt) {
+  pthread_mutex_lock(&lock);
+  qsort(spans, nspans, sizeof(*spans), cmp_span);
+  uint64_t t0 = nspans ? spans[0].start : 0;
+  if (fmt == TRACE_CHROME) {
+    write_chrome(out, t0);
+  } else if (fmt == TRACE_TEXT) {
+    write_text(out, t0);
+  }
+  pthread_mutex_unlock(&lock);
+  if (fflush(out) != 0 || ferror(out)) {
+    log_msg(LOG_ERROR, "failed to write trace");
+    return PLIMIT_ERR_IO;
+  }
+  return PLIMIT_OK;
+}
+
+void trace_reset(void) {
+  atomic_store(&enabled, false);
+  pthread_mutex_lock(&lock);
+  free(spans);
+  spans = NULL;
+  nspans = 0;
+  cap = 0;
+  pthread_mutex_unlock(&lock);
+}
@@ -1,12 +1,15 @@
 #include "utils.h"
+#include "trace.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 static long long pow2(int e) {
@@ -17,6 +20,133 @@ static long long pow2(int e) {
   return v;
 }
 
+const char *plimit_strerror(int code) {
+  switch (code) {
+  case PLIMIT_OK:
+    return "success";
+  case PLIMIT_ERR_GENERIC:
+    return "generic error";
+  case PLIMIT_ERR_ARG:
+    return "invalid argument";
+  case PLIMIT_ERR_PERM:
+    return "permission denied";
+  case PLIMIT_ERR_NOTFOUND:
+    return "not found";
+  case PLIMIT_ERR_EXISTS:
+    return "already exists";
+  case PLIMIT_ERR_IO:
+    return "I/O error";
+  case PLIMIT_ERR_MEM:
+    return "out of memory";
+  case PLIMIT_ERR_PARSE:
+    return "parse error";
+  case PLIMIT_ERR_CGROUP:
+    return "cgroup operation failed";
+  case PLIMIT_ERR_SYS:
+    return "system call failed";
+  default:
+    return "unknown error";
+  }
+}
+
+// per thread so that library users can capture messages of concurrent calls
+static _Thread_local log_handler_t log_handler = NULL;
+static _Thread_local void *log_handler_ctx = NULL;
+
+void log_set_handler(log_handler_t handler, void *ctx) {
+  log_handler = handler;
+  log_handler_ctx = ctx;
+}
+
+log_handler_t log_get_handler(void **ctx) {
+  if (ctx) {
+    *ctx = log_handler_ctx;
+  }
+  return log_handler;
+}
+
+// process wide, selected once by the command line front end
+static log_format_t log_format = LOG_FORMAT_TEXT;
+static FILE *log_json_stream = NULL;
+
+int log_parse_format(const char *s, log_format_t *fmt) {
+  if (strcmp(s, "text") == 0) {
+    *fmt = LOG_FORMAT_TEXT;
+  } else if (strcmp(s, "json") == 0) {
+    *fmt = LOG_FORMAT_JSON;
+  } else {
+    log_msg(LOG_ERROR, "invalid output format '%s' (expected text or json)",
+            s);
+    return PLIMIT_ERR_ARG;
+  }
+  return PLIMIT_OK;
+}
+
+void log_set_format(log_format_t fmt, FILE *stream) {
+  log_format = fmt;
+  log_json_stream = stream;
+}
+
+log_format_t log_get_format(void) { return log_format; }
+
+void json_write_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; ++s) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') {
+      fputc('\\', out);
+      fputc(c, out);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static const char *log_type_name(log_type_t type) {
+  switch (type) {
+  case LOG_PREFIX:
+    return "usage";
+  case LOG_DRY_RUN:
+    return "dry-run";
+  case LOG_INFO:
+    return "info";
+  case LOG_DEBUG:
+    return "debug";
+  case LOG_WARN:
+    return "warn";
+  case LOG_ERROR:
+    return "error";
+  default:
+    return "message";
+  }
+}
+
+// JSON records are written under the stream lock so that lines of
+// concurrent threads do not interleave
+static FILE *json_begin(const char *type) {
+  FILE *out = log_json_stream ? log_json_stream : stdout;
+  flockfile(out);
+  fputs("{\"type\":", out);
+  json_write_string(out, type);
+  return out;
+}
+
+static void json_field(FILE *out, const char *key, const char *value) {
+  fputc(',', out);
+  json_write_string(out, key);
+  fputc(':', out);
+  json_write_string(out, value);
+}
+
+static void json_end(FILE *out) {
+  fputs("}\n", out);
+  fflush(out);
+  funlockfile(out);
+}
+
 void log_msg(log_type_t type, const char *fmt, ...) {
   FILE *stream = (type == LOG_ERROR) ? stderr : stdout;
   const char *type_prefix;
@@ -43,17 +173,102 @@ void log_msg(log_type_t type, const char *fmt, ...) {
     type_prefix = "";
     break;
   }
-  char buf[1024];
+  // most messages fit inline, longer ones (paths, io.max lists) go to the
+  // heap instead of being cut off
+  char inline_buf[LOG_INLINE_SIZE];
+  char *buf = inline_buf;
   va_list ap;
+  va_list ap2;
   va_start(ap, fmt);
-  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_copy(ap2, ap);
+  int n = vsnprintf(inline_buf, sizeof(inline_buf), fmt, ap);
   va_end(ap);
+  if (n >= (int)sizeof(inline_buf)) {
+    char *heap = malloc((size_t)n + 1);
+    if (heap) {
+      vsnprintf(heap, (size_t)n + 1, fmt, ap2);
+      buf = heap;
+    }
+  }
+  va_end(ap2);
+
+  if (log_handler) {
+    log_handler(type, buf, log_handler_ctx);
+  } else if (log_format == LOG_FORMAT_JSON) {
+    FILE *out = json_begin(log_type_name(type));
+    json_field(out, "msg", buf);
+    json_end(out);
+  } else {
+    flockfile(stream);
+    fputs(type_prefix, stream);
+    fputs(buf, stream);
+    fputc('\n', stream);
+    fflush(stream);
+    funlockfile(stream);
+  }
+
+  if (buf != inline_buf) {
+    free(buf);
+  }
+}
 
-  fputs(type_prefix, stream);
-  fputs(buf, stream);
-  fputc('\n', stream);
+static const char *const action_names[] = {
+    [LOG_ACTION_WRITE] = "write",
+    [LOG_ACTION_TRUNCATE] = "truncate",
+    [LOG_ACTION_MKDIR] = "mkdir",
+    [LOG_ACTION_RMDIR] = "rmdir",
+};
 
-  fflush(stream);
+void log_action(log_action_t action, const char *path, const char *value,
+                bool dry_run, bool verbose) {
+  if (log_format == LOG_FORMAT_JSON && !log_handler) {
+    FILE *out = json_begin("action");
+    json_field(out, "action", action_names[action]);
+    json_field(out, "path", path);
+    if (value) {
+      json_field(out, "value", value);
+    }
+    fprintf(out, ",\"dry_run\":%s", dry_run ? "true" : "false");
+    json_end(out);
+    return;
+  }
+  if (!dry_run && !verbose) {
+    return;
+  }
+  log_type_t type = dry_run ? LOG_DRY_RUN : LOG_INFO;
+  switch (action) {
+  case LOG_ACTION_WRITE:
+    log_msg(type, "write '%s' to file %s", value, path);
+    break;
+  case LOG_ACTION_TRUNCATE:
+    log_msg(type, "truncate file %s", path);
+    break;
+  case LOG_ACTION_MKDIR:
+    log_msg(type, "create directory %s", path);
+    break;
+  case LOG_ACTION_RMDIR:
+    log_msg(type, dry_run ? "delete cgroup directory %s"
+                          : "deleted cgroup directory %s",
+            path);
+    break;
+  }
+}
+
+void log_result(const char *command, const char *cgname, pid_t pid, int rc) {
+  if (log_format != LOG_FORMAT_JSON || log_handler) {
+    return;
+  }
+  FILE *out = json_begin("result");
+  json_field(out, "command", command);
+  if (cgname) {
+    json_field(out, "cgroup", cgname);
+  }
+  if (pid > 0) {
+    fprintf(out, ",\"pid\":%d", (int)pid);
+  }
+  fprintf(out, ",\"code\":%d", rc);
+  json_field(out, "status", plimit_strerror(rc));
+  json_end(out);
 }
 
 int write_file(bool dry_run, const file_write_args_t *args, bool verbose) {
@@ -65,52 +280,119 @@ int write_file(bool dry_run, const file_write_args_t *args, bool verbose) {
   // yet
   if (dry_run) {
     if (strcmp(args->data, "") == 0) {
-      log_msg(LOG_DRY_RUN, "truncate file %s", args->path);
+      log_action(LOG_ACTION_TRUNCATE, args->path, NULL, true, false);
     } else {
-      log_msg(LOG_DRY_RUN, "write '%s' to file %s", args->data, args->path);
+      log_action(LOG_ACTION_WRITE, args->path, args->data, true, false);
     }
     return PLIMIT_OK;
   }
+  // callers report errno, logging may change it
+  int err;
   if (access(args->path, W_OK) != 0) {
+    err = errno;
     log_msg(LOG_ERROR, "cannot write to file '%s': %s", args->path,
-            strerror(errno));
+            strerror(err));
+    errno = err;
     return PLIMIT_ERR_IO;
   }
   int fd;
   if (strcmp(args->data, "") == 0) {
     // Open with O_WRONLY | O_TRUNC to truncate the file
+    uint64_t t = trace_begin();
     fd = open(args->path, O_WRONLY | O_TRUNC);
+    trace_end(t, "open", args->path, fd < 0 ? -errno : 0);
     if (fd < 0) {
-      log_msg(LOG_ERROR, "cannot truncate file '%s': %s", args->path, strerror(errno));
+      err = errno;
+      log_msg(LOG_ERROR, "cannot truncate file '%s': %s", args->path,
+              strerror(err));
+      errno = err;
       return PLIMIT_ERR_IO;
     }
     close(fd);
-    if (verbose) {
-      log_msg(LOG_INFO, "truncate file %s", args->path);
-    }
+    log_action(LOG_ACTION_TRUNCATE, args->path, NULL, false, verbose);
     return PLIMIT_OK;
   }
   
   // Open with O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC to write data
+  uint64_t t = trace_begin();
   fd = open(args->path, O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC, args->mode);
+  trace_end(t, "open", args->path, fd < 0 ? -errno : 0);
   if (fd < 0) {
     return PLIMIT_ERR_IO;
   }
   size_t len = strlen(args->data);
+  // the write is where the kernel does the work, e.g. a cgroup.procs write
+  // waits here for the threadgroup rwsem
+  t = trace_begin();
   ssize_t n = write(fd, args->data, len);
+  trace_end(t, "write", args->data, n < 0 ? -errno : 0);
   close(fd);
   if (n < 0 || (size_t)n != len) {
+    err = n < 0 ? errno : EIO;
+    if (err == ESRCH) {
+      // a PID that exited before a cgroup.procs write, callers decide
+      errno = err;
+      return PLIMIT_ERR_NOTFOUND;
+    }
     log_msg(LOG_ERROR, "failed to write to file '%s': %s", args->path,
-            strerror(errno));
+            strerror(err));
+    errno = err;
     return PLIMIT_ERR_IO;
   }
-  if (verbose) {
-    if (strcmp(args->data, "") == 0) {
-      log_msg(LOG_INFO, "truncate file %s", args->path);
-    } else {
-      log_msg(LOG_INFO, "write '%s' to file %s", args->data, args->path);
+  log_action(LOG_ACTION_WRITE, args->path, args->data, false, verbose);
+  return PLIMIT_OK;
+}
+
+bool file_has_line(const char *path, const char *line) {
+  char cur[4096];
+  if (read_file(path, cur, sizeof(cur)) != PLIMIT_OK) {
+    return false;
+  }
+  size_t len = strlen(line);
+  char *save = NULL;
+  for (char *l = strtok_r(cur, "\n", &save); l;
+       l = strtok_r(NULL, "\n", &save)) {
+    if (strlen(l) == len && memcmp(l, line, len) == 0) {
+      return true;
     }
   }
+  return false;
+}
+
+int write_file_if_changed(bool dry_run, const file_write_args_t *args,
+                          bool verbose, bool *changed) {
+  if (changed) {
+    *changed = false;
+  }
+  if (!args || !args->path || !args->data) {
+    return PLIMIT_ERR_ARG;
+  }
+  if (*args->data && file_has_line(args->path, args->data)) {
+    return PLIMIT_OK;
+  }
+  if (changed) {
+    *changed = true;
+  }
+  return write_file(dry_run, args, verbose);
+}
+
+int read_file(const char *path, char *buf, size_t size) {
+  if (!path || !buf || size == 0) {
+    return PLIMIT_ERR_ARG;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno == ENOENT ? PLIMIT_ERR_NOTFOUND : PLIMIT_ERR_IO;
+  }
+  ssize_t n = read(fd, buf, size - 1);
+  close(fd);
+  if (n < 0) {
+    return PLIMIT_ERR_IO;
+  }
+  buf[n] = '\0';
+  if (n > 0 && buf[n - 1] == '\n') {
+    buf[n - 1] = '\0';
+  }
   return PLIMIT_OK;
 }
 
@@ -138,13 +420,14 @@ int create_directory(bool dry_run, const char *path, mode_t mode,
     }
   }
   if (dry_run) {
-    log_msg(LOG_DRY_RUN, "create directory %s", path);
+    log_action(LOG_ACTION_MKDIR, path, NULL, true, false);
     return PLIMIT_OK;
   }
-  if (mkdir(path, mode) == 0) {
-    if (verbose) {
-      log_msg(LOG_INFO, "create directory %s", path);
-    }
+  uint64_t t = trace_begin();
+  int ret = mkdir(path, mode);
+  trace_end(t, "mkdir", path, ret < 0 ? -errno : 0);
+  if (ret == 0) {
+    log_action(LOG_ACTION_MKDIR, path, NULL, false, verbose);
     return PLIMIT_OK;
   }
   return PLIMIT_ERR_IO;
@@ -190,6 +473,89 @@ long long parse_bytes(const char *s) {
   return (long long)r;
 }
 
+int parse_size(const char *s, long long *out) {
+  if (strcmp(s, "max") == 0) {
+    *out = -1;
+    return PLIMIT_OK;
+  }
+  // parse_bytes() cannot tell its error codes from small sizes
+  size_t digits = strspn(s, "0123456789.");
+  if (digits == 0 || (s[digits] && (s[digits + 1] ||
+                                    !strchr("KMGTPEkmgtpe", s[digits])))) {
+    return PLIMIT_ERR_PARSE;
+  }
+  *out = parse_bytes(s);
+  return PLIMIT_OK;
+}
+
+long long parse_duration(const char *s) {
+  if (!s || !*s) {
+    return -1;
+  }
+  char *end = NULL;
+  errno = 0;
+  double v = strtod(s, &end);
+  if (errno != 0 || end == s || v < 0) {
+    return -1;
+  }
+  double mul;
+  if (strcmp(end, "ms") == 0) {
+    mul = 1;
+  } else if (*end == '\0' || strcmp(end, "s") == 0) {
+    mul = 1000;
+  } else if (strcmp(end, "m") == 0) {
+    mul = 60 * 1000;
+  } else if (strcmp(end, "h") == 0) {
+    mul = 60 * 60 * 1000;
+  } else {
+    return -1;
+  }
+  double r = v * mul;
+  if (r > (double)LLONG_MAX) {
+    return -1;
+  }
+  return (long long)r;
+}
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+void stop_on_signal(void (*on_hup)(int)) {
+  stop = 0;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigemptyset(&sa.sa_mask);
+  // no SA_RESTART: a signal has to cut sleeps and poll() short
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  if (on_hup) {
+    sa.sa_handler = on_hup;
+    sigaction(SIGHUP, &sa, NULL);
+  }
+}
+
+bool stop_requested(void) { return stop != 0; }
+
+long long clock_ms(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * MSEC_PER_SEC + ts.tv_nsec / NSEC_PER_MSEC;
+}
+
+void sleep_ms(long long ms) {
+  if (ms <= 0 || stop) {
+    return;
+  }
+  struct timespec ts = {.tv_sec = ms / MSEC_PER_SEC,
+                        .tv_nsec = ms % MSEC_PER_SEC * NSEC_PER_MSEC};
+  nanosleep(&ts, NULL);
+}
+
 long long parse_ll(const char *s, const char *name) {
   if (!s) {
     return PLIMIT_ERR_ARG;
@@ -204,3 +570,15 @@ long long parse_ll(const char *s, const char *name) {
 }
 
 int run_as_root(void) { return geteuid() == 0; }
+
+bool host_matches(const char *want, const char *host) {
+  if (!host) {
+    return false;
+  }
+  if (strcmp(want, host) == 0) {
+    return true;
+  }
+  // also match the short host name ("node17" for "node17.example.com")
+  size_t len = strcspn(host, ".");
+  return strlen(want) == len && strncmp(want, host, len) == 0;
+}
@@ -0,0 +1,470 @@
+// Microbenchmarks and bulk placement scenarios for the plimit library.
+//
+// Runs against the cgroup hierarchy selected by cg_set_root(): the real
+// cgroup v2 mount when run as root, or an emulated cgroupfs passed with -r
+// (see `make cgroupfs`). The emulated numbers measure plimit's own overhead
+// plus the VFS cost of the backing filesystem, not the kernel's cgroup work.
+#include "batch.h"
+#include "cgroups.h"
+#include "utils.h"
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PARENT "plimit-bench"
+#define BENCH_PREFIX BENCH_PARENT "/bench-"
+#define EMULATED_PID_BASE 4000000
+
+typedef struct {
+  int cgroups;
+  int pids;
+  int iterations;
+} bench_opts_t;
+
+typedef struct {
+  uint64_t *ns;
+  size_t count;
+  uint64_t total;
+} samples_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void samples_add(samples_t *s, uint64_t start) {
+  uint64_t d = now_ns() - start;
+  s->ns[s->count++] = d;
+  s->total += d;
+}
+
+static void report(const char *name, samples_t *s) {
+  if (s->count == 0) {
+    printf("%-28s %8s\n", name, "skipped");
+    return;
+  }
+  qsort(s->ns, s->count, sizeof(*s->ns), cmp_u64);
+  size_t p99 = s->count * 99 / 100;
+  if (p99 >= s->count) {
+    p99 = s->count - 1;
+  }
+  double secs = (double)s->total / 1e9;
+  printf("%-28s %8zu %12.1f %12.1f %12.0f\n", name, s->count,
+         (double)s->ns[s->count / 2] / 1e3, (double)s->ns[p99] / 1e3,
+         secs > 0 ? (double)s->count / secs : 0);
+  s->count = 0;
+  s->total = 0;
+}
+
+// only errors are interesting while timing, everything else is dropped
+static void quiet_log(log_type_t type, const char *msg, void *ctx) {
+  (void)ctx;
+  if (type == LOG_ERROR) {
+    fprintf(stderr, "bench: error: %s\n", msg);
+  }
+}
+
+static void cg_path(char *buf, size_t len, const char *name) {
+  snprintf(buf, len, "%s/%s", cg_root(), name);
+}
+
+static int prepare_cg(const char *name) {
+  char path[PATH_MAX];
+  run_opts_t opts = {0};
+  cg_path(path, sizeof(path), name);
+  return cg_mkdir(path, &opts);
+}
+
+// real PIDs are needed on cgroupfs, the emulated tree accepts any number
+static pid_t *spawn(size_t count) {
+  pid_t *pids = (pid_t *)calloc(count ? count : 1, sizeof(pid_t));
+  if (!pids) {
+    return NULL;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (cg_emulated()) {
+      pids[i] = (pid_t)(EMULATED_PID_BASE + i);
+      continue;
+    }
+    pids[i] = fork();
+    if (pids[i] == 0) {
+      pause();
+      _exit(0);
+    }
+    if (pids[i] < 0) {
+      fprintf(stderr, "bench: fork failed: %s\n", strerror(errno));
+      pids[i] = 0;
+    }
+  }
+  return pids;
+}
+
+static void reap(pid_t *pids, size_t count) {
+  for (size_t i = 0; !cg_emulated() && i < count; i++) {
+    if (pids[i] > 0) {
+      kill(pids[i], SIGKILL);
+      waitpid(pids[i], NULL, 0);
+    }
+  }
+  free(pids);
+}
+
+// let apply_limits() create the bench parent and enable its controllers
+static int setup_root(void) {
+  limits_t lim = {.cgname = BENCH_PREFIX "setup",
+                  .cpu_percent = -1,
+                  .cpu_quota = -1,
+                  .cpu_period = -1,
+                  .mem_max = -1,
+                  .attach_only = true,
+                  .opts = {.force = true}};
+  int rc = apply_limits(&lim);
+  if (rc == PLIMIT_OK) {
+    rc = delete_cgroup(lim.cgname, &lim.opts);
+  }
+  return rc;
+}
+
+static void teardown_root(void) {
+  char path[PATH_MAX];
+  cg_path(path, sizeof(path), BENCH_PARENT);
+  cg_rmdir(path);
+}
+
+// move PIDs back to the root cgroup and empty the cgroups they were in
+static void park(const pid_t *pids, size_t count, const char *const *names,
+                 size_t nnames) {
+  run_opts_t opts = {0};
+  for (size_t i = 0; i < count; i++) {
+    add_proc_cgroup(cg_root(), pids[i], &opts);
+  }
+  for (size_t i = 0; i < nnames; i++) {
+    remove_procs_cgroup(names[i], &opts);
+  }
+}
+
+static limits_t bench_limits(const char *cgname, pid_t pid) {
+  limits_t lim;
+  memset(&lim, 0, sizeof(lim));
+  lim.cgname = (char *)cgname;
+  lim.pid = pid;
+  lim.cpus = 0.5;
+  lim.cpu_percent = -1;
+  lim.cpu_quota = -1;
+  lim.cpu_period = -1;
+  lim.mem_max = 256LL * 1024 * 1024;
+  return lim;
+}
+
+static int bench_write_file(const bench_opts_t *bo, samples_t *s) {
+  char path[PATH_MAX];
+  int rc = prepare_cg(BENCH_PREFIX "write");
+  if (rc != PLIMIT_OK) {
+    return rc;
+  }
+  cg_path(path, sizeof(path), BENCH_PREFIX "write/memory.max");
+  for (int i = 0; i < bo->iterations && rc == PLIMIT_OK; i++) {
+    file_write_args_t args = {
+        .path = path, .data = i % 2 ? "max" : "268435456", .mode = 0644};
+    uint64_t t = now_ns();
+    rc = write_file(false, &args, false);
+    samples_add(s, t);
+  }
+  report("write_file", s);
+  run_opts_t opts = {0};
+  delete_cgroup(BENCH_PREFIX "write", &opts);
+  return rc;
+}
+
+// the same limit files of N cgroups, one write_file() each versus one
+// write_files() batch
+static int bench_write_batch(const bench_opts_t *bo, samples_t *s) {
+  static const char *const files[] = {"memory.max", "cpu.max"};
+  size_t nfiles = sizeof(files) / sizeof(files[0]);
+  size_t n = (size_t)bo->cgroups;
+  size_t count = n * nfiles;
+  file_write_t *writes = (file_write_t *)calloc(count, sizeof(*writes));
+  char(*paths)[PATH_MAX] = calloc(count, PATH_MAX);
+  if (!writes || !paths) {
+    free(writes);
+    free(paths);
+    return PLIMIT_ERR_MEM;
+  }
+  int rc = PLIMIT_OK;
+  char name[64];
+  size_t created = 0;
+  for (; created < n && rc == PLIMIT_OK; created++) {
+    snprintf(name, sizeof(name), BENCH_PREFIX "batch-%zu", created);
+    rc = prepare_cg(name);
+    for (size_t f = 0; f < nfiles; f++) {
+      size_t i = created * nfiles + f;
+      snprintf(paths[i], PATH_MAX, "%s/%s/%s", cg_root(), name, files[f]);
+      writes[i].args.path = paths[i];
+      writes[i].args.mode = 0644;
+    }
+  }
+
+  int iterations = bo->iterations / 10 > 0 ? bo->iterations / 10 : 1;
+  char title[64];
+  for (int i = 0; i < iterations && rc == PLIMIT_OK; i++) {
+    for (size_t j = 0; j < count; j++) {
+      writes[j].args.data = j % nfiles ? (i % 2 ? "50000 100000" : "max")
+                                       : (i % 2 ? "268435456" : "max");
+    }
+    uint64_t t = now_ns();
+    for (size_t j = 0; j < count && rc == PLIMIT_OK; j++) {
+      rc = write_file(false, &writes[j].args, false);
+    }
+    samples_add(s, t);
+  }
+  snprintf(title, sizeof(title), "write_file x%zu", count);
+  report(title, s);
+  for (int i = 0; i < iterations && rc == PLIMIT_OK; i++) {
+    for (size_t j = 0; j < count; j++) {
+      writes[j].args.data = j % nfiles ? (i % 2 ? "50000 100000" : "max")
+                                       : (i % 2 ? "268435456" : "max");
+    }
+    uint64_t t = now_ns();
+    rc = write_files(false, writes, count, false);
+    samples_add(s, t);
+  }
+  snprintf(title, sizeof(title), "write_files x%zu", count);
+  report(title, s);
+
+  run_opts_t opts = {0};
+  for (size_t i = 0; i < created; i++) {
+    snprintf(name, sizeof(name), BENCH_PREFIX "batch-%zu", i);
+    delete_cgroup(name, &opts);
+  }
+  free(paths);
+  free(writes);
+  return rc;
+}
+
+static int bench_apply_delete(const bench_opts_t *bo, samples_t *s) {
+  pid_t *pids = spawn(1);
+  if (!pids) {
+    return PLIMIT_ERR_MEM;
+  }
+  int rc = PLIMIT_OK;
+  char name[64];
+  int done = 0;
+  for (; done < bo->iterations && rc == PLIMIT_OK; done++) {
+    snprintf(name, sizeof(name), BENCH_PREFIX "apply-%d", done);
+    limits_t lim = bench_limits(name, pids[0]);
+    uint64_t t = now_ns();
+    rc = apply_limits(&lim);
+    samples_add(s, t);
+  }
+  report("apply_limits", s);
+
+  // the PID sits in the last cgroup, park it before deleting
+  const char *last = name;
+  park(pids, 1, &last, 1);
+  run_opts_t opts = {0};
+  for (int i = 0; i < done; i++) {
+    snprintf(name, sizeof(name), BENCH_PREFIX "apply-%d", i);
+    uint64_t t = now_ns();
+    int drc = delete_cgroup(name, &opts);
+    samples_add(s, t);
+    rc = rc == PLIMIT_OK ? drc : rc;
+  }
+  report("delete_cgroup", s);
+  reap(pids, 1);
+  return rc;
+}
+
+static int bench_attach_list(const bench_opts_t *bo, samples_t *s) {
+  static const char *const names[] = {BENCH_PREFIX "attach-a",
+                                      BENCH_PREFIX "attach-b"};
+  size_t npids = (size_t)bo->pids;
+  pid_t *pids = spawn(npids);
+  if (!pids) {
+    return PLIMIT_ERR_MEM;
+  }
+  char paths[2][PATH_MAX];
+  int rc = PLIMIT_OK;
+  for (int i = 0; i < 2 && rc == PLIMIT_OK; i++) {
+    rc = prepare_cg(names[i]);
+    cg_path(paths[i], sizeof(paths[i]), names[i]);
+  }
+  run_opts_t opts = {0};
+  for (int i = 0; i < bo->iterations && rc == PLIMIT_OK; i++) {
+    uint64_t t = now_ns();
+    rc = add_proc_cgroup(paths[i % 2], pids[(size_t)i % npids], &opts);
+    samples_add(s, t);
+  }
+  report("add_proc_cgroup", s);
+
+  // place every PID in the first cgroup and list it
+  for (size_t i = 0; i < npids && rc == PLIMIT_OK; i++) {
+    rc = add_proc_cgroup(paths[0], pids[i], &opts);
+  }
+  char mem[ARENA_STACK_SIZE];
+  arena_t a;
+  arena_init(&a, mem, sizeof(mem));
+  for (int i = 0; i < bo->iterations && rc == PLIMIT_OK; i++) {
+    size_t count = 0;
+    uint64_t t = now_ns();
+    get_procs_cgroup(&a, &rc, names[0], &count);
+    samples_add(s, t);
+    arena_release(&a);
+  }
+  report("get_procs_cgroup", s);
+
+  park(pids, npids, names, 2);
+  for (int i = 0; i < 2; i++) {
+    delete_cgroup(names[i], &opts);
+  }
+  reap(pids, npids);
+  return rc;
+}
+
+// N cgroups x M PIDs: create and limit every cgroup, attach its PIDs, then
+// tear everything down again
+static int bench_bulk(const bench_opts_t *bo, samples_t *s) {
+  size_t n = (size_t)bo->cgroups;
+  size_t m = (size_t)bo->pids;
+  pid_t *pids = spawn(n * m);
+  if (!pids) {
+    return PLIMIT_ERR_MEM;
+  }
+  char title[64];
+  char name[64];
+  run_opts_t opts = {0};
+  int rc = PLIMIT_OK;
+  size_t created = 0;
+  uint64_t start = now_ns();
+  for (; created < n && rc == PLIMIT_OK; created++) {
+    snprintf(name, sizeof(name), BENCH_PREFIX "bulk-%zu", created);
+    char path[PATH_MAX];
+    cg_path(path, sizeof(path), name);
+    const pid_t *own = pids + created * m;
+    limits_t lim = bench_limits(name, own[0]);
+    uint64_t t = now_ns();
+    rc = apply_limits(&lim);
+    for (size_t j = 1; j < m && rc == PLIMIT_OK; j++) {
+      rc = add_proc_cgroup(path, own[j], &opts);
+    }
+    samples_add(s, t);
+  }
+  uint64_t placed = now_ns() - start;
+  snprintf(title, sizeof(title), "bulk place %zux%zu", n, m);
+  report(title, s);
+
+  start = now_ns();
+  for (size_t i = 0; i < created; i++) {
+    snprintf(name, sizeof(name), BENCH_PREFIX "bulk-%zu", i);
+    uint64_t t = now_ns();
+    int drc = destroy_cgroup(name, &opts);
+    samples_add(s, t);
+    rc = rc == PLIMIT_OK ? drc : rc;
+  }
+  uint64_t torn = now_ns() - start;
+  snprintf(title, sizeof(title), "bulk teardown %zux%zu", n, m);
+  report(title, s);
+  printf("%-28s %8s %12.1f ms total place, %.1f ms total teardown\n", "", "",
+         (double)placed / 1e6, (double)torn / 1e6);
+  reap(pids, n * m);
+  return rc;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-r ROOT] [-n CGROUPS] [-m PIDS] [-i ITERATIONS]\n"
+          "  -r  cgroup root, e.g. an emulated cgroupfs (default: autodetect)\n"
+          "  -n  cgroups in the bulk scenario (default 64)\n"
+          "  -m  PIDs per cgroup (default 8)\n"
+          "  -i  iterations of each microbenchmark (default 1000)\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  bench_opts_t bo = {.cgroups = 64, .pids = 8, .iterations = 1000};
+  const char *root = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "r:n:m:i:h")) != -1) {
+    switch (c) {
+    case 'r':
+      root = optarg;
+      break;
+    case 'n':
+      bo.cgroups = atoi(optarg);
+      break;
+    case 'm':
+      bo.pids = atoi(optarg);
+      break;
+    case 'i':
+      bo.iterations = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return c == 'h' ? PLIMIT_OK : PLIMIT_ERR_ARG;
+    }
+  }
+  if (bo.cgroups <= 0 || bo.pids <= 0 || bo.iterations <= 0) {
+    usage(argv[0]);
+    return PLIMIT_ERR_ARG;
+  }
+  if (cg_set_root(root) != PLIMIT_OK) {
+    return PLIMIT_ERR_ARG;
+  }
+  if (!cg_emulated() && !run_as_root()) {
+    fprintf(stderr, "bench: %s is cgroupfs, must be run as root\n",
+            cg_root());
+    return PLIMIT_ERR_PERM;
+  }
+
+  log_set_handler(quiet_log, NULL);
+  size_t cap = (size_t)bo.iterations;
+  if ((size_t)bo.cgroups > cap) {
+    cap = (size_t)bo.cgroups;
+  }
+  samples_t s = {.ns = (uint64_t *)calloc(cap, sizeof(uint64_t))};
+  if (!s.ns) {
+    return PLIMIT_ERR_MEM;
+  }
+
+  printf("plimit %s benchmarks on %s (%s)\n\n", PLIMIT_VERSION, cg_root(),
+         cg_emulated() ? "emulated" : "cgroupfs");
+  printf("%-28s %8s %12s %12s %12s\n", "benchmark", "ops", "p50 (us)",
+         "p99 (us)", "ops/s");
+
+  int rc = setup_root();
+  if (rc == PLIMIT_OK) {
+    rc = bench_write_file(&bo, &s);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = bench_write_batch(&bo, &s);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = bench_apply_delete(&bo, &s);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = bench_attach_list(&bo, &s);
+  }
+  if (rc == PLIMIT_OK) {
+    rc = bench_bulk(&bo, &s);
+  }
+  teardown_root();
+  free(s.ns);
+  if (rc != PLIMIT_OK) {
+    fprintf(stderr, "bench: failed: %s\n", plimit_strerror(rc));
+  }
+  return rc;
+}